@@ -16,22 +16,32 @@ from esphome.const import (
 AUTO_LOAD = ["binary_sensor", "nfc"]
 CODEOWNERS = ["@kbx81", "@jesserockz"]
 
+CONF_BUFFER_SIZE = "buffer_size"
+CONF_CORE = "core"
 CONF_DWL_REQ_PIN = "dwl_req_pin"
 CONF_EMULATION_MESSAGE = "emulation_message"
 CONF_EMULATION_OFF = "emulation_off"
 CONF_EMULATION_ON = "emulation_on"
 CONF_INCLUDE_ANDROID_APP_RECORD = "include_android_app_record"
+CONF_LOOP_BUDGET = "loop_budget"
 CONF_ON_EMULATED_TAG_SCAN = "on_emulated_tag_scan"
 CONF_PN7160_ID = "pn7160_id"
+CONF_PRESENCE_CHECK_INTERVAL = "presence_check_interval"
 CONF_POLLING_OFF = "polling_off"
 CONF_POLLING_ON = "polling_on"
+CONF_PRIORITY = "priority"
 CONF_SET_CLEAN_MODE = "set_clean_mode"
 CONF_SET_EMULATION_MESSAGE = "set_emulation_message"
 CONF_SET_FORMAT_MODE = "set_format_mode"
 CONF_SET_READ_MODE = "set_read_mode"
 CONF_SET_WRITE_MESSAGE = "set_write_message"
 CONF_SET_WRITE_MODE = "set_write_mode"
+CONF_STACK_SIZE = "stack_size"
+CONF_STOP_WHEN_FULL = "stop_when_full"
+CONF_STATS = "stats"
 CONF_TAG_TTL = "tag_ttl"
+CONF_TASK = "task"
+CONF_TRACE = "trace"
 CONF_VEN_PIN = "ven_pin"
 CONF_WKUP_REQ_PIN = "wkup_req_pin"
 
@@ -56,6 +66,8 @@ SetFormatModeAction = pn7160_ns.class_("SetFormatModeAction", automation.Action)
 SetReadModeAction = pn7160_ns.class_("SetReadModeAction", automation.Action)
 SetWriteMessageAction = pn7160_ns.class_("SetWriteMessageAction", automation.Action)
 SetWriteModeAction = pn7160_ns.class_("SetWriteModeAction", automation.Action)
+DumpTraceAction = pn7160_ns.class_("DumpTraceAction", automation.Action)
+ClearTraceAction = pn7160_ns.class_("ClearTraceAction", automation.Action)
 
 PN7160OnEmulatedTagScanTrigger = pn7160_ns.class_(
     "PN7160OnEmulatedTagScanTrigger", automation.Trigger.template()
@@ -85,7 +97,8 @@ SET_MESSAGE_ACTION_SCHEMA = cv.Schema(
     }
 )
 
-PN7160_SCHEMA = cv.Schema(
+# shared by every transport; PN7160_SCHEMA adds the pins a physical NFCC needs
+PN7160_BASE_SCHEMA = cv.Schema(
     {
         cv.Optional(CONF_ON_EMULATED_TAG_SCAN): automation.validate_automation(
             {
@@ -111,12 +124,23 @@ PN7160_SCHEMA = cv.Schema(
                 cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(nfc.NfcOnTagTrigger),
             }
         ),
-        cv.Optional(CONF_DWL_REQ_PIN): pins.gpio_output_pin_schema,
-        cv.Required(CONF_IRQ_PIN): pins.gpio_input_pin_schema,
-        cv.Required(CONF_VEN_PIN): pins.gpio_output_pin_schema,
-        cv.Optional(CONF_WKUP_REQ_PIN): pins.gpio_output_pin_schema,
         cv.Optional(CONF_EMULATION_MESSAGE): cv.string,
         cv.Optional(CONF_TAG_TTL): cv.positive_time_period_milliseconds,
+        # keep a lone tag activated once read and check on it this often, instead of rediscovering it
+        cv.Optional(CONF_PRESENCE_CHECK_INTERVAL): cv.positive_time_period_milliseconds,
+        # tag operations and NFCC init spread over as many loop() calls as this needs
+        cv.Optional(CONF_LOOP_BUDGET, default="20ms"): cv.positive_time_period_milliseconds,
+        # latency histograms and retry/timeout counters in dump_config(); a pn7160 sensor turns this on too
+        cv.Optional(CONF_STATS, default=False): cv.boolean,
+        # raw NCI frames in a RAM ring buffer, dumped by pn7160.dump_trace
+        cv.Optional(CONF_TRACE): cv.Schema(
+            {
+                cv.Optional(CONF_BUFFER_SIZE, default=4096): cv.int_range(
+                    min=256, max=65536
+                ),
+                cv.Optional(CONF_STOP_WHEN_FULL, default=False): cv.boolean,
+            }
+        ),
         # Health check options
         cv.Optional(CONF_HEALTH_CHECK_ENABLED, default=True): cv.boolean,
         cv.Optional(CONF_HEALTH_CHECK_INTERVAL, default="60s"): cv.positive_time_period_milliseconds,
@@ -125,6 +149,30 @@ PN7160_SCHEMA = cv.Schema(
     }
 ).extend(cv.COMPONENT_SCHEMA)
 
+PN7160_SCHEMA = PN7160_BASE_SCHEMA.extend(
+    {
+        cv.Optional(CONF_DWL_REQ_PIN): pins.gpio_output_pin_schema,
+        cv.Required(CONF_IRQ_PIN): pins.gpio_input_pin_schema,
+        cv.Required(CONF_VEN_PIN): pins.gpio_output_pin_schema,
+        cv.Optional(CONF_WKUP_REQ_PIN): pins.gpio_output_pin_schema,
+        # NCI state machine in its own FreeRTOS task; triggers still fire from the main loop
+        cv.Optional(CONF_TASK): cv.All(
+            cv.Schema(
+                {
+                    cv.Optional(CONF_CORE, default=0): cv.int_range(min=0, max=1),
+                    cv.Optional(CONF_PRIORITY, default=5): cv.int_range(
+                        min=1, max=24
+                    ),
+                    cv.Optional(CONF_STACK_SIZE, default=4096): cv.int_range(
+                        min=2048, max=32768
+                    ),
+                }
+            ),
+            cv.only_on_esp32,
+        ),
+    }
+)
+
 
 @automation.register_action(
     "tag.set_emulation_message",
@@ -172,6 +220,18 @@ async def pn7160_simple_action_to_code(config, action_id, template_arg, args):
     return var
 
 
+@automation.register_action("pn7160.dump_trace", DumpTraceAction, SIMPLE_ACTION_SCHEMA)
+@automation.register_action(
+    "pn7160.clear_trace", ClearTraceAction, SIMPLE_ACTION_SCHEMA
+)
+async def pn7160_trace_action_to_code(config, action_id, template_arg, args):
+    # the actions need the trace built in; without a `trace:` block it gets the default size
+    cg.add_define("USE_PN7160_TRACE")
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    return var
+
+
 async def setup_pn7160(var, config):
     await cg.register_component(var, config)
 
@@ -179,11 +239,13 @@ async def setup_pn7160(var, config):
         pin = await cg.gpio_pin_expression(dwl_req_pin_config)
         cg.add(var.set_dwl_req_pin(pin))
 
-    pin = await cg.gpio_pin_expression(config[CONF_IRQ_PIN])
-    cg.add(var.set_irq_pin(pin))
+    if irq_pin_config := config.get(CONF_IRQ_PIN):
+        pin = await cg.gpio_pin_expression(irq_pin_config)
+        cg.add(var.set_irq_pin(pin))
 
-    pin = await cg.gpio_pin_expression(config[CONF_VEN_PIN])
-    cg.add(var.set_ven_pin(pin))
+    if ven_pin_config := config.get(CONF_VEN_PIN):
+        pin = await cg.gpio_pin_expression(ven_pin_config)
+        cg.add(var.set_ven_pin(pin))
 
     if wakeup_req_pin_config := config.get(CONF_WKUP_REQ_PIN):
         pin = await cg.gpio_pin_expression(wakeup_req_pin_config)
@@ -196,6 +258,29 @@ async def setup_pn7160(var, config):
     if CONF_TAG_TTL in config:
         cg.add(var.set_tag_ttl(config[CONF_TAG_TTL]))
 
+    if CONF_PRESENCE_CHECK_INTERVAL in config:
+        cg.add(var.set_presence_check_interval(config[CONF_PRESENCE_CHECK_INTERVAL]))
+
+    cg.add(var.set_loop_budget(config[CONF_LOOP_BUDGET]))
+
+    if config[CONF_STATS]:
+        cg.add_define("USE_PN7160_STATS")
+
+    if trace_config := config.get(CONF_TRACE):
+        cg.add_define("USE_PN7160_TRACE")
+        cg.add(var.set_trace_buffer_size(trace_config[CONF_BUFFER_SIZE]))
+        cg.add(var.set_trace_stop_when_full(trace_config[CONF_STOP_WHEN_FULL]))
+
+    if task_config := config.get(CONF_TASK):
+        cg.add_define("USE_PN7160_TASK")
+        cg.add(
+            var.set_task(
+                task_config[CONF_CORE],
+                task_config[CONF_PRIORITY],
+                task_config[CONF_STACK_SIZE],
+            )
+        )
+
     # Health check settings
     cg.add(var.set_health_check_enabled(config[CONF_HEALTH_CHECK_ENABLED]))
     cg.add(var.set_health_check_interval(config[CONF_HEALTH_CHECK_INTERVAL]))
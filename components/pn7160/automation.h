@@ -78,5 +78,15 @@ template<typename... Ts> class SetWriteModeAction : public Action<Ts...>, public
   void play(const Ts &...x) override { this->parent_->write_mode(); }
 };
 
+#ifdef USE_PN7160_TRACE
+template<typename... Ts> class DumpTraceAction : public Action<Ts...>, public Parented<PN7160> {
+  void play(const Ts &...x) override { this->parent_->dump_trace(); }
+};
+
+template<typename... Ts> class ClearTraceAction : public Action<Ts...>, public Parented<PN7160> {
+  void play(const Ts &...x) override { this->parent_->clear_trace(); }
+};
+#endif
+
 }  // namespace pn7160
 }  // namespace esphome
@@ -0,0 +1,66 @@
+#include "nci_frame.h"
+
+#include <cstdio>
+
+namespace esphome {
+namespace pn7160 {
+
+NciFrame::NciFrame(const uint8_t message_type, std::initializer_list<uint8_t> payload) {
+  this->data()[nfc::NCI_PKT_MT_GID_INDEX] = message_type & nfc::NCI_PKT_MT_MASK;
+  this->set_payload(payload);
+}
+
+NciFrame::NciFrame(const uint8_t message_type, const uint8_t gid, const uint8_t oid,
+                   std::initializer_list<uint8_t> payload) {
+  this->set_header(message_type, gid, oid);
+  this->set_payload(payload);
+}
+
+NciFrame::NciFrame(const uint8_t message_type, const uint8_t gid, const uint8_t oid, const uint8_t *payload,
+                   const size_t length) {
+  this->set_message(message_type, gid, oid, payload, length);
+}
+
+void NciFrame::set_header(const uint8_t message_type, const uint8_t gid, const uint8_t oid) {
+  this->data()[nfc::NCI_PKT_MT_GID_INDEX] = (message_type & nfc::NCI_PKT_MT_MASK) | (gid & nfc::NCI_PKT_GID_MASK);
+  this->data()[nfc::NCI_PKT_OID_INDEX] = oid & nfc::NCI_PKT_OID_MASK;
+}
+
+void NciFrame::set_message(const uint8_t message_type, const uint8_t gid, const uint8_t oid, const uint8_t *payload,
+                           const size_t length) {
+  this->set_header(message_type, gid, oid);
+  this->set_payload(payload, length);
+}
+
+void NciFrame::set_payload(std::initializer_list<uint8_t> payload) { this->set_payload(payload.begin(), payload.size()); }
+
+void NciFrame::set_payload(const uint8_t *payload, const size_t length) {
+  this->set_payload_size(0);
+  this->append(payload, length);
+}
+
+bool NciFrame::append(const uint8_t *bytes, const size_t length) {
+  const size_t current = this->get_payload_size();
+  if (current + length > NCI_MAX_PAYLOAD_SIZE) {
+    return false;
+  }
+  if (length) {
+    std::memcpy(this->payload() + current, bytes, length);
+  }
+  this->set_payload_size(current + length);
+  return true;
+}
+
+char *format_frame_to(char *buffer, const uint8_t *bytes, const size_t length) {
+  // two hex digits and a separator per byte, leaving room for the terminator
+  const size_t max_bytes = (nfc::FORMAT_BYTES_BUFFER_SIZE - 1) / 3;
+  size_t pos = 0;
+  for (size_t i = 0; i < length && i < max_bytes; i++) {
+    pos += snprintf(buffer + pos, nfc::FORMAT_BYTES_BUFFER_SIZE - pos, i ? " %02X" : "%02X", bytes[i]);
+  }
+  buffer[pos] = '\0';
+  return buffer;
+}
+
+}  // namespace pn7160
+}  // namespace esphome
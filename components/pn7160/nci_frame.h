@@ -0,0 +1,88 @@
+#pragma once
+
+#include "esphome/components/nfc/nci_core.h"
+#include "esphome/components/nfc/nfc.h"
+
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+namespace esphome {
+namespace pn7160 {
+
+static const uint16_t NCI_MAX_PAYLOAD_SIZE = 255;
+static const uint16_t NCI_MAX_FRAME_SIZE = nfc::NCI_PKT_HEADER_SIZE + NCI_MAX_PAYLOAD_SIZE;
+
+/// A single NCI packet with inline storage sized for the largest possible frame, so building, sending and parsing
+/// one never touches the heap. Accessors mirror nfc::NciMessage.
+class NciFrame {
+ public:
+  NciFrame() = default;
+  /// data packet
+  NciFrame(uint8_t message_type, std::initializer_list<uint8_t> payload);
+  /// control packet
+  NciFrame(uint8_t message_type, uint8_t gid, uint8_t oid, std::initializer_list<uint8_t> payload = {});
+  NciFrame(uint8_t message_type, uint8_t gid, uint8_t oid, const uint8_t *payload, size_t length);
+
+  uint8_t *data() { return this->buffer_ + PREFIX_SIZE; }
+  const uint8_t *data() const { return this->buffer_ + PREFIX_SIZE; }
+  size_t size() const { return nfc::NCI_PKT_HEADER_SIZE + this->get_payload_size(); }
+
+  /// the frame with `prefix` written into the byte just ahead of it, for transports that send one first (SPI TDD)
+  uint8_t *data_with_prefix(uint8_t prefix) {
+    this->buffer_[0] = prefix;
+    return this->buffer_;
+  }
+
+  uint8_t *payload() { return this->data() + nfc::NCI_PKT_PAYLOAD_OFFSET; }
+  const uint8_t *payload() const { return this->data() + nfc::NCI_PKT_PAYLOAD_OFFSET; }
+
+  uint8_t get_message_type() const { return this->data()[nfc::NCI_PKT_MT_GID_INDEX] & nfc::NCI_PKT_MT_MASK; }
+  uint8_t get_gid() const { return this->data()[nfc::NCI_PKT_MT_GID_INDEX] & nfc::NCI_PKT_GID_MASK; }
+  uint8_t get_oid() const { return this->data()[nfc::NCI_PKT_OID_INDEX] & nfc::NCI_PKT_OID_MASK; }
+  uint8_t get_payload_size() const { return this->data()[nfc::NCI_PKT_LENGTH_INDEX]; }
+  /// Packet Boundary Flag: more segments of the same message follow this one
+  bool get_pbf() const { return this->data()[nfc::NCI_PKT_MT_GID_INDEX] & nfc::NCI_PKT_PBF_MASK; }
+  void set_pbf(bool more) {
+    this->data()[nfc::NCI_PKT_MT_GID_INDEX] =
+        (this->data()[nfc::NCI_PKT_MT_GID_INDEX] & ~nfc::NCI_PKT_PBF_MASK) | (more ? nfc::NCI_PKT_PBF_MASK : 0);
+  }
+  /// byte at `offset` from the start of the frame (header included); 0 if past the end
+  uint8_t get_message_byte(size_t offset) const { return offset < this->size() ? this->data()[offset] : 0; }
+  uint8_t get_simple_status_response() const {
+    return this->get_message_byte(nfc::NCI_PKT_PAYLOAD_OFFSET);
+  }
+
+  bool message_type_is(uint8_t message_type) const { return this->get_message_type() == message_type; }
+  bool gid_is(uint8_t gid) const { return this->get_gid() == gid; }
+  bool oid_is(uint8_t oid) const { return this->get_oid() == oid; }
+  bool message_length_is(uint8_t length) const { return this->get_payload_size() == length; }
+  bool simple_status_response_is(uint8_t response) const {
+    return this->get_payload_size() > 0 && this->get_simple_status_response() == response;
+  }
+
+  void set_header(uint8_t message_type, uint8_t gid, uint8_t oid);
+  void set_message(uint8_t message_type, uint8_t gid, uint8_t oid, const uint8_t *payload, size_t length);
+  void set_payload(std::initializer_list<uint8_t> payload);
+  void set_payload(const uint8_t *payload, size_t length);
+  /// sets the length byte directly; used by transports after reading the payload into payload()
+  void set_payload_size(uint8_t length) { this->data()[nfc::NCI_PKT_LENGTH_INDEX] = length; }
+  /// appends to the payload; returns false (and appends nothing) if it would not fit
+  bool append(const uint8_t *bytes, size_t length);
+  bool append(uint8_t byte) { return this->append(&byte, 1); }
+
+ protected:
+  static const uint8_t PREFIX_SIZE = 1;
+
+  uint8_t buffer_[PREFIX_SIZE + NCI_MAX_FRAME_SIZE]{};
+};
+
+/// like nfc::format_bytes_to(), without needing the bytes in a vector; `buffer` is nfc::FORMAT_BYTES_BUFFER_SIZE
+char *format_frame_to(char *buffer, const uint8_t *bytes, size_t length);
+inline char *format_frame_to(char *buffer, const NciFrame &frame) {
+  return format_frame_to(buffer, frame.data(), frame.size());
+}
+
+}  // namespace pn7160
+}  // namespace esphome
@@ -1,4 +1,9 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+#include <iterator>
 #include <utility>
+#include <vector>
 
 #include "automation.h"
 #include "pn7160.h"
@@ -12,16 +17,135 @@ namespace pn7160 {
 
 static const char *const TAG = "pn7160";
 
+// SEL_RES (SAK) bits that say what an NFC-A tag is
+static const uint8_t SEL_RES_MIFARE_MINI = 0x01;
+static const uint8_t SEL_RES_MIFARE_CLASSIC = 0x08;
+static const uint8_t SEL_RES_MIFARE_4K = 0x10;
+static const uint8_t SEL_RES_ISO_DEP = 0x20;
+
+// NFC-A technology parameters: SENS_RES, NFCID1 length, NFCID1, SEL_RES length, then SEL_RES
+static const uint8_t NFCA_SENS_RES_AT = 0;
+static const uint8_t NFCA_UID_LENGTH_AT = 2;
+static const uint8_t NFCA_UID_AT = 3;
+// a Type 1 tag skips SEL_REQ, so has no SEL_RES; its SENS_RES says what it is in the second byte's platform bits
+static const uint8_t SENS_RES_PLATFORM_MASK = 0x0F;
+static const uint8_t SENS_RES_PLATFORM_T1T = 0x0C;
+
+static const char *const NFC_FORUM_TYPE_1 = "NFC Forum Type 1";
+static const char *const NFC_FORUM_TYPE_3 = "NFC Forum Type 3";
+static const char *const NFC_FORUM_TYPE_4 = "NFC Forum Type 4";
+static const char *const NFC_FORUM_TYPE_5 = "NFC Forum Type 5";
+
+// NFC-F technology parameters: bit rate, SENSF_RES length, then SENSF_RES from its NFCID2 (the IDm) on
+static const uint8_t NFCF_SENSF_RES_AT = 2;
+static const uint8_t NFCF_IDM_LENGTH = 8;
+static const uint8_t NFCF_PMM_LENGTH = 8;
+static const uint8_t NFCF_PMM_MRTI_CHECK = 5;
+
+// NFC-V technology parameters: RES_FLAG, DSFID, then the UID, least significant byte first as it goes on air
+static const uint8_t NFCV_UID_AT = 2;
+static const uint8_t NFCV_UID_LENGTH = 8;
+
+/// nfc::TAG_TYPE_* of an NFC-A tag: by the protocol the NFCC found, else by its SEL_RES or, for a Type 1 tag, its
+/// SENS_RES; its UID length is the last resort
+static uint8_t nfca_tag_type(const uint8_t protocol, const uint16_t sens_res, const uint8_t sel_res,
+                             const uint8_t uid_length) {
+  switch (protocol) {
+    case nfc::PROT_T1T:
+      return nfc::TAG_TYPE_1;
+    case nfc::PROT_T2T:
+      return nfc::TAG_TYPE_2;
+    case nfc::PROT_ISODEP:
+      return nfc::TAG_TYPE_4;  // the NFCC activates ISO-DEP ahead of any MIFARE Classic emulation alongside it
+    case nfc::PROT_MIFARE:
+      return nfc::TAG_TYPE_MIFARE_CLASSIC;
+    default:
+      break;
+  }
+  if (sel_res == SEL_RES_NONE) {
+    if (((sens_res >> 8) & SENS_RES_PLATFORM_MASK) == SENS_RES_PLATFORM_T1T) {
+      return nfc::TAG_TYPE_1;
+    }
+    return nfc::guess_tag_type(uid_length);
+  }
+  if (sel_res & SEL_RES_ISO_DEP) {
+    return nfc::TAG_TYPE_4;
+  }
+  return (sel_res & SEL_RES_MIFARE_CLASSIC) ? nfc::TAG_TYPE_MIFARE_CLASSIC : nfc::TAG_TYPE_2;
+}
+
+static const char *tag_type_name(const uint8_t tag_type) {
+  switch (tag_type) {
+    case nfc::TAG_TYPE_MIFARE_CLASSIC:
+      return nfc::MIFARE_CLASSIC;
+    case nfc::TAG_TYPE_1:
+      return NFC_FORUM_TYPE_1;
+    case nfc::TAG_TYPE_3:
+      return NFC_FORUM_TYPE_3;
+    case nfc::TAG_TYPE_4:
+      return NFC_FORUM_TYPE_4;
+    case TAG_TYPE_5:
+      return NFC_FORUM_TYPE_5;
+    default:
+      return nfc::NFC_FORUM_TYPE_2;
+  }
+}
+
+/// blocks on a MIFARE Classic card with this SEL_RES: Mini, 4K, or 1K when it doesn't say
+static uint16_t mifare_classic_card_blocks(const uint8_t sel_res) {
+  if (sel_res == SEL_RES_NONE) {
+    return 64;
+  }
+  if (sel_res & SEL_RES_MIFARE_4K) {
+    return 256;
+  }
+  return (sel_res & SEL_RES_MIFARE_MINI) ? 20 : 64;
+}
+
+static const char *tag_chip_name(const TagChip chip) {
+  switch (chip) {
+    case TagChip::NTAG215:
+      return "NTAG215";
+    case TagChip::NTAG216:
+      return "NTAG216";
+    case TagChip::UNKNOWN:
+    default:
+      return "Type 2 tag";
+  }
+}
+
 void PN7160::setup() {
-  this->irq_pin_->setup();
-  this->ven_pin_->setup();
+  // transports without a physical NFCC (pn7160_sim) leave these unset
+  if (this->irq_pin_ != nullptr) {
+    this->irq_pin_->setup();
+    if (this->irq_pin_->is_internal()) {
+      static_cast<InternalGPIOPin *>(this->irq_pin_)->attach_interrupt(PN7160::gpio_intr, this,
+                                                                       gpio::INTERRUPT_RISING_EDGE);
+      this->irq_interrupt_ = true;
+    }
+  }
+  if (this->ven_pin_ != nullptr) {
+    this->ven_pin_->setup();
+  }
   if (this->dwl_req_pin_ != nullptr) {
     this->dwl_req_pin_->setup();
   }
   if (this->wkup_req_pin_ != nullptr) {
     this->wkup_req_pin_->setup();
   }
+#ifdef USE_PN7160_TRACE
+  if (!this->trace_.init(this->trace_buffer_size_)) {
+    ESP_LOGE(TAG, "Unable to allocate %zu bytes for the NCI trace", this->trace_buffer_size_);
+  }
+#endif
 
+  this->loop_started_ = this->millis_();
+#ifdef USE_PN7160_TASK
+  if (this->task_enabled_) {
+    this->start_task_();  // the task kicks off reset & init processes
+    return;
+  }
+#endif
   this->nci_fsm_transition_();  // kick off reset & init processes
 }
 
@@ -35,16 +159,80 @@ void PN7160::dump_config() {
   if (this->wkup_req_pin_ != nullptr) {
     LOG_PIN("  WKUP_REQ pin: ", this->wkup_req_pin_);
   }
+  if (this->irq_interrupt_) {
+    ESP_LOGCONFIG(TAG, "  IRQ edges: %" PRIu32 " spurious, %" PRIu32 " missed", this->irq_spurious_edges_,
+                  this->irq_missed_edges_);
+  } else if (this->irq_pin_ != nullptr) {
+    ESP_LOGCONFIG(TAG, "  IRQ pin is polled (no interrupt off the MCU)");
+  }
+  if (this->presence_check_interval_) {
+    ESP_LOGCONFIG(TAG, "  Presence check interval: %" PRIu32 " ms", this->presence_check_interval_);
+  }
+#ifdef USE_PN7160_STATS
+  this->dump_stats_();
+#endif
+#ifdef USE_PN7160_TRACE
+  ESP_LOGCONFIG(TAG, "  NCI trace: %zu of %zu bytes, %" PRIu32 " frames, %" PRIu32 " dropped", this->trace_.size(),
+                this->trace_.capacity(), this->trace_.records(), this->trace_.dropped());
+#endif
+#ifdef USE_PN7160_TASK
+  if (this->task_enabled_) {
+    ESP_LOGCONFIG(TAG, "  NFC task: core %u, priority %u, %" PRIu32 " byte stack, %" PRIu32 " events dropped",
+                  this->task_core_, this->task_priority_, this->task_stack_size_, this->events_dropped_);
+  }
+#endif
+}
+
+#ifdef USE_PN7160_STATS
+void PN7160::dump_stats_() {
+  ESP_LOGCONFIG(TAG,
+                "  Statistics:\n"
+                "    Read retries: %" PRIu32 "\n"
+                "    IRQ timeouts: %" PRIu32 "\n"
+                "    Misreads avoided: %" PRIu32,
+                this->stats_.read_retries(), this->stats_.irq_timeouts(), this->stats_.misreads_avoided());
+  ESP_LOGCONFIG(TAG, "    Time in state (count, mean/p50/p95/max us):");
+  for (uint8_t slot = 0; slot < PN7160Stats::STATE_SLOTS; slot++) {
+    const uint8_t state = PN7160Stats::slot_state(slot);
+    const auto &latency = this->stats_.state_latency(state);
+    if (latency.count()) {
+      ESP_LOGCONFIG(TAG, "      %3u: %" PRIu32 ", %" PRIu32 "/%" PRIu32 "/%" PRIu32 "/%" PRIu32, state, latency.count(),
+                    latency.mean(), latency.percentile(50), latency.percentile(95), latency.max());
+    }
+  }
+  ESP_LOGCONFIG(TAG, "    Transceive round trip (count, mean/p50/p95/max us, read retries, failures):");
+  for (size_t i = 0; i < this->stats_.opcode_count(); i++) {
+    const auto &opcode = this->stats_.opcodes()[i];
+    ESP_LOGCONFIG(TAG, "      %02X %02X: %" PRIu32 ", %" PRIu32 "/%" PRIu32 "/%" PRIu32 "/%" PRIu32 ", %" PRIu32 ", %" PRIu32,
+                  opcode.header, opcode.oid, opcode.latency.count(), opcode.latency.mean(),
+                  opcode.latency.percentile(50), opcode.latency.percentile(95), opcode.latency.max(),
+                  opcode.read_retries, opcode.failures);
+  }
+  if (this->stats_.untracked_opcodes()) {
+    ESP_LOGCONFIG(TAG, "      (%" PRIu32 " more on untracked opcodes)", this->stats_.untracked_opcodes());
+  }
 }
+#endif
 
 void PN7160::loop() {
+#ifdef USE_PN7160_TASK
+  if (this->task_enabled_) {
+    this->dispatch_events_();
+    return;
+  }
+#endif
+  this->nci_loop_();
+}
+
+void PN7160::nci_loop_() {
+  this->loop_started_ = this->millis_();
   // Fast recovery for stuck EP states -- should never last more than 2 seconds
   if ((this->nci_state_ == NCIState::EP_DEACTIVATING ||
        this->nci_state_ == NCIState::EP_SELECTING) &&
-      (millis() - this->last_nci_state_change_ > 2000)) {
+      (this->millis_() - this->last_nci_state_change_ > 2000)) {
     ESP_LOGW(TAG, "Stuck in EP state %u for %ums -- forcing NFCC reset",
              (uint8_t) this->nci_state_,
-             millis() - this->last_nci_state_change_);
+             this->millis_() - this->last_nci_state_change_);
     this->nci_fsm_set_state_(NCIState::NFCC_RESET);
     return;
   }
@@ -54,7 +242,11 @@ void PN7160::loop() {
 }
 
 void PN7160::set_tag_emulation_message(std::shared_ptr<nfc::NdefMessage> message) {
+#ifdef USE_PN7160_TASK
+  LockGuard guard(this->nci_lock_);
+#endif
   this->card_emulation_message_ = std::move(message);
+  this->card_emulation_ndef_ = this->card_emulation_message_->encode();
   ESP_LOGD(TAG, "Tag emulation message set");
 }
 
@@ -76,8 +268,7 @@ void PN7160::set_tag_emulation_message(const optional<std::string> &message,
     ndef_message->add_record(std::move(ext_record));
   }
 
-  this->card_emulation_message_ = std::move(ndef_message);
-  ESP_LOGD(TAG, "Tag emulation message set");
+  this->set_tag_emulation_message(std::shared_ptr<nfc::NdefMessage>(std::move(ndef_message)));
 }
 
 void PN7160::set_tag_emulation_message(const char *message, const bool include_android_app_record) {
@@ -85,6 +276,9 @@ void PN7160::set_tag_emulation_message(const char *message, const bool include_a
 }
 
 void PN7160::set_tag_emulation_off() {
+#ifdef USE_PN7160_TASK
+  LockGuard guard(this->nci_lock_);
+#endif
   if (this->listening_enabled_) {
     this->listening_enabled_ = false;
     this->config_refresh_pending_ = true;
@@ -93,6 +287,9 @@ void PN7160::set_tag_emulation_off() {
 }
 
 void PN7160::set_tag_emulation_on() {
+#ifdef USE_PN7160_TASK
+  LockGuard guard(this->nci_lock_);
+#endif
   if (this->card_emulation_message_ == nullptr) {
     ESP_LOGE(TAG, "No NDEF message is set; tag emulation cannot be enabled");
     return;
@@ -105,6 +302,9 @@ void PN7160::set_tag_emulation_on() {
 }
 
 void PN7160::set_polling_off() {
+#ifdef USE_PN7160_TASK
+  LockGuard guard(this->nci_lock_);
+#endif
   if (this->polling_enabled_) {
     this->polling_enabled_ = false;
     this->config_refresh_pending_ = true;
@@ -113,6 +313,9 @@ void PN7160::set_polling_off() {
 }
 
 void PN7160::set_polling_on() {
+#ifdef USE_PN7160_TASK
+  LockGuard guard(this->nci_lock_);
+#endif
   if (!this->polling_enabled_) {
     this->polling_enabled_ = true;
     this->config_refresh_pending_ = true;
@@ -121,21 +324,33 @@ void PN7160::set_polling_on() {
 }
 
 void PN7160::read_mode() {
+#ifdef USE_PN7160_TASK
+  LockGuard guard(this->nci_lock_);
+#endif
   this->next_task_ = EP_READ;
   ESP_LOGD(TAG, "Waiting to read next tag");
 }
 
 void PN7160::clean_mode() {
+#ifdef USE_PN7160_TASK
+  LockGuard guard(this->nci_lock_);
+#endif
   this->next_task_ = EP_CLEAN;
   ESP_LOGD(TAG, "Waiting to clean next tag");
 }
 
 void PN7160::format_mode() {
+#ifdef USE_PN7160_TASK
+  LockGuard guard(this->nci_lock_);
+#endif
   this->next_task_ = EP_FORMAT;
   ESP_LOGD(TAG, "Waiting to format next tag");
 }
 
 void PN7160::write_mode() {
+#ifdef USE_PN7160_TASK
+  LockGuard guard(this->nci_lock_);
+#endif
   if (this->next_task_message_to_write_ == nullptr) {
     ESP_LOGW(TAG, "Message to write must be set before setting write mode");
     return;
@@ -146,6 +361,9 @@ void PN7160::write_mode() {
 }
 
 void PN7160::set_tag_write_message(std::shared_ptr<nfc::NdefMessage> message) {
+#ifdef USE_PN7160_TASK
+  LockGuard guard(this->nci_lock_);
+#endif
   this->next_task_message_to_write_ = std::move(message);
   ESP_LOGD(TAG, "Message to write has been set");
 }
@@ -167,12 +385,14 @@ void PN7160::set_tag_write_message(optional<std::string> message, optional<bool>
     ndef_message->add_record(std::move(ext_record));
   }
 
-  this->next_task_message_to_write_ = std::move(ndef_message);
-  ESP_LOGD(TAG, "Message to write has been set");
+  this->set_tag_write_message(std::shared_ptr<nfc::NdefMessage>(std::move(ndef_message)));
 }
 
 uint8_t PN7160::set_test_mode(const TestMode test_mode, const std::vector<uint8_t> &data,
                               std::vector<uint8_t> &result) {
+#ifdef USE_PN7160_TASK
+  LockGuard guard(this->nci_lock_);  // this does its exchanges from the caller, not the NFC task
+#endif
   auto test_oid = TEST_PRBS_OID;
 
   switch (test_mode) {
@@ -212,8 +432,8 @@ uint8_t PN7160::set_test_mode(const TestMode test_mode, const std::vector<uint8_
     this->nci_fsm_set_state_(NCIState::TEST);
   }
 
-  nfc::NciMessage rx;
-  nfc::NciMessage tx(nfc::NCI_PKT_MT_CTRL_COMMAND, nfc::NCI_PROPRIETARY_GID, test_oid, data);
+  NciFrame rx;
+  NciFrame tx(nfc::NCI_PKT_MT_CTRL_COMMAND, nfc::NCI_PROPRIETARY_GID, test_oid, data.data(), data.size());
 
   ESP_LOGW(TAG, "Starting test mode, OID 0x%02X", test_oid);
   auto status = this->transceive_(tx, rx, NFCC_INIT_TIMEOUT);
@@ -223,8 +443,10 @@ uint8_t PN7160::set_test_mode(const TestMode test_mode, const std::vector<uint8_
     this->nci_fsm_set_state_(NCIState::NFCC_RESET);
     result.clear();
   } else {
-    result = rx.get_message();
-    result.erase(result.begin(), result.begin() + 4);  // remove NCI header
+    result.clear();
+    if (rx.size() > 4) {  // skip NCI header and status
+      result.assign(rx.data() + 4, rx.data() + rx.size());
+    }
     if (!result.empty()) {
       char buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
       ESP_LOGW(TAG, "Test results: %s", nfc::format_bytes_to(buf, result));
@@ -234,23 +456,16 @@ uint8_t PN7160::set_test_mode(const TestMode test_mode, const std::vector<uint8_
 }
 
 uint8_t PN7160::reset_core_(const bool reset_config, const bool power) {
-  if (this->dwl_req_pin_ != nullptr) {
-    this->dwl_req_pin_->digital_write(false);
-    delay(NFCC_DEFAULT_TIMEOUT);
-  }
-
   if (power) {
-    this->ven_pin_->digital_write(true);
-    delay(NFCC_DEFAULT_TIMEOUT);
-    this->ven_pin_->digital_write(false);
-    delay(NFCC_DEFAULT_TIMEOUT);
-    this->ven_pin_->digital_write(true);
-    delay(NFCC_INIT_TIMEOUT);
+    // only test mode gets here; the FSM runs the power cycle across loop() calls instead
+    this->power_cycle_stage_ = 0;
+    while (!this->power_cycle_step_()) {
+      delay(1);
+    }
   }
 
-  nfc::NciMessage rx;
-  nfc::NciMessage tx(nfc::NCI_PKT_MT_CTRL_COMMAND, nfc::NCI_CORE_GID, nfc::NCI_CORE_RESET_OID,
-                     {(uint8_t) reset_config});
+  NciFrame rx;
+  NciFrame tx(nfc::NCI_PKT_MT_CTRL_COMMAND, nfc::NCI_CORE_GID, nfc::NCI_CORE_RESET_OID, {(uint8_t) reset_config});
 
   if (this->transceive_(tx, rx, NFCC_INIT_TIMEOUT) != nfc::STATUS_OK) {
     ESP_LOGE(TAG, "Error sending reset command");
@@ -259,20 +474,20 @@ uint8_t PN7160::reset_core_(const bool reset_config, const bool power) {
 
   if (!rx.simple_status_response_is(nfc::STATUS_OK)) {
     char buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
-    ESP_LOGE(TAG, "Invalid reset response: %s", nfc::format_bytes_to(buf, rx.get_message()));
+    ESP_LOGE(TAG, "Invalid reset response: %s", format_frame_to(buf, rx));
     return rx.get_simple_status_response();
   }
   // read reset notification
-  if (this->read_nfcc(rx, NFCC_INIT_TIMEOUT) != nfc::STATUS_OK) {
+  if (this->read_frame_(rx, NFCC_INIT_TIMEOUT) != nfc::STATUS_OK) {
     ESP_LOGE(TAG, "Reset notification was not received");
     return nfc::STATUS_FAILED;
   }
   // verify reset notification
   if ((!rx.message_type_is(nfc::NCI_PKT_MT_CTRL_NOTIFICATION)) || (!rx.message_length_is(9)) ||
-      (rx.get_message()[nfc::NCI_PKT_PAYLOAD_OFFSET] != 0x02) ||
-      (rx.get_message()[nfc::NCI_PKT_PAYLOAD_OFFSET + 1] != (uint8_t) reset_config)) {
+      (rx.get_message_byte(nfc::NCI_PKT_PAYLOAD_OFFSET) != 0x02) ||
+      (rx.get_message_byte(nfc::NCI_PKT_PAYLOAD_OFFSET + 1) != (uint8_t) reset_config)) {
     char buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
-    ESP_LOGE(TAG, "Reset notification was malformed: %s", nfc::format_bytes_to(buf, rx.get_message()));
+    ESP_LOGE(TAG, "Reset notification was malformed: %s", format_frame_to(buf, rx));
     return nfc::STATUS_FAILED;
   }
 
@@ -280,18 +495,45 @@ uint8_t PN7160::reset_core_(const bool reset_config, const bool power) {
            "Configuration %s\n"
            "NCI version: %s\n"
            "Manufacturer ID: 0x%02X",
-           rx.get_message()[4] ? "reset" : "retained", rx.get_message()[5] == 0x20 ? "2.0" : "1.0",
-           rx.get_message()[6]);
-  rx.get_message().erase(rx.get_message().begin(), rx.get_message().begin() + 8);
+           rx.get_message_byte(4) ? "reset" : "retained", rx.get_message_byte(5) == 0x20 ? "2.0" : "1.0",
+           rx.get_message_byte(6));
   char mfr_buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
-  ESP_LOGD(TAG, "Manufacturer info: %s", nfc::format_bytes_to(mfr_buf, rx.get_message()));
+  ESP_LOGD(TAG, "Manufacturer info: %s", format_frame_to(mfr_buf, rx.data() + 8, rx.size() - 8));
 
   return nfc::STATUS_OK;
 }
 
+// DWL_REQ low keeps the NFCC out of firmware download mode, then VEN high-low-high power cycles it
+static const struct {
+  bool ven;  // otherwise DWL_REQ
+  bool level;
+  uint16_t hold;
+} POWER_CYCLE[] = {
+    {false, false, NFCC_DEFAULT_TIMEOUT},
+    {true, true, NFCC_DEFAULT_TIMEOUT},
+    {true, false, NFCC_DEFAULT_TIMEOUT},
+    {true, true, NFCC_INIT_TIMEOUT},
+};
+
+bool PN7160::power_cycle_step_() {
+  while (this->millis_() - this->power_cycle_since_ >= this->power_cycle_hold_) {
+    if (this->power_cycle_stage_ == sizeof(POWER_CYCLE) / sizeof(POWER_CYCLE[0])) {
+      return true;
+    }
+    const auto &step = POWER_CYCLE[this->power_cycle_stage_++];
+    GPIOPin *pin = step.ven ? this->ven_pin_ : this->dwl_req_pin_;
+    if (pin != nullptr) {
+      pin->digital_write(step.level);
+      this->power_cycle_since_ = this->millis_();
+      this->power_cycle_hold_ = step.hold;
+    }
+  }
+  return false;
+}
+
 uint8_t PN7160::init_core_() {
-  nfc::NciMessage rx;
-  nfc::NciMessage tx(nfc::NCI_PKT_MT_CTRL_COMMAND, nfc::NCI_CORE_GID, nfc::NCI_CORE_INIT_OID);
+  NciFrame rx;
+  NciFrame tx(nfc::NCI_PKT_MT_CTRL_COMMAND, nfc::NCI_CORE_GID, nfc::NCI_CORE_INIT_OID);
 
   if (this->transceive_(tx, rx) != nfc::STATUS_OK) {
     ESP_LOGE(TAG, "Error sending initialise command");
@@ -300,15 +542,17 @@ uint8_t PN7160::init_core_() {
 
   if (!rx.simple_status_response_is(nfc::STATUS_OK)) {
     char buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
-    ESP_LOGE(TAG, "Invalid initialise response: %s", nfc::format_bytes_to(buf, rx.get_message()));
+    ESP_LOGE(TAG, "Invalid initialise response: %s", format_frame_to(buf, rx));
     return nfc::STATUS_FAILED;
   }
 
-  uint8_t hw_version = rx.get_message()[17 + rx.get_message()[8]];
-  uint8_t rom_code_version = rx.get_message()[18 + rx.get_message()[8]];
-  uint8_t flash_major_version = rx.get_message()[19 + rx.get_message()[8]];
-  uint8_t flash_minor_version = rx.get_message()[20 + rx.get_message()[8]];
-  std::vector<uint8_t> features(rx.get_message().begin() + 4, rx.get_message().begin() + 8);
+  const uint8_t num_interfaces = rx.get_message_byte(8);
+  const uint8_t max_ctrl_payload = rx.get_message_byte(12 + num_interfaces);
+  this->max_ctrl_payload_ = max_ctrl_payload ? max_ctrl_payload : NCI_MAX_PAYLOAD_SIZE;
+  uint8_t hw_version = rx.get_message_byte(17 + num_interfaces);
+  uint8_t rom_code_version = rx.get_message_byte(18 + num_interfaces);
+  uint8_t flash_major_version = rx.get_message_byte(19 + num_interfaces);
+  uint8_t flash_minor_version = rx.get_message_byte(20 + num_interfaces);
 
   char feat_buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
   ESP_LOGD(TAG,
@@ -316,24 +560,25 @@ uint8_t PN7160::init_core_() {
            "ROM code version: %u\n"
            "FLASH major version: %u\n"
            "FLASH minor version: %u\n"
+           "Max control payload: %u\n"
            "Features: %s",
-           hw_version, rom_code_version, flash_major_version, flash_minor_version,
-           nfc::format_bytes_to(feat_buf, features));
+           hw_version, rom_code_version, flash_major_version, flash_minor_version, this->max_ctrl_payload_,
+           format_frame_to(feat_buf, rx.data() + 4, 4));
 
   return rx.get_simple_status_response();
 }
 
 uint8_t PN7160::send_init_config_() {
-  nfc::NciMessage rx;
-  nfc::NciMessage tx(nfc::NCI_PKT_MT_CTRL_COMMAND, nfc::NCI_PROPRIETARY_GID, nfc::NCI_CORE_SET_CONFIG_OID);
+  NciFrame rx;
+  NciFrame tx(nfc::NCI_PKT_MT_CTRL_COMMAND, nfc::NCI_PROPRIETARY_GID, nfc::NCI_CORE_SET_CONFIG_OID);
 
   if (this->transceive_(tx, rx) != nfc::STATUS_OK) {
     ESP_LOGE(TAG, "Error enabling proprietary extensions");
     return nfc::STATUS_FAILED;
   }
 
-  tx.set_message(nfc::NCI_PKT_MT_CTRL_COMMAND, nfc::NCI_CORE_GID, nfc::NCI_CORE_SET_CONFIG_OID,
-                 std::vector<uint8_t>(std::begin(PMU_CFG), std::end(PMU_CFG)));
+  tx.set_message(nfc::NCI_PKT_MT_CTRL_COMMAND, nfc::NCI_CORE_GID, nfc::NCI_CORE_SET_CONFIG_OID, PMU_CFG,
+                 sizeof(PMU_CFG));
 
   if (this->transceive_(tx, rx) != nfc::STATUS_OK) {
     ESP_LOGE(TAG, "Error sending PMU config");
@@ -344,19 +589,19 @@ uint8_t PN7160::send_init_config_() {
 }
 
 uint8_t PN7160::send_core_config_() {
-  const auto *core_config_begin = std::begin(CORE_CONFIG_SOLO);
-  const auto *core_config_end = std::end(CORE_CONFIG_SOLO);
+  const uint8_t *core_config = CORE_CONFIG_SOLO;
+  size_t core_config_length = sizeof(CORE_CONFIG_SOLO);
   this->core_config_is_solo_ = true;
 
   if (this->listening_enabled_ && this->polling_enabled_) {
-    core_config_begin = std::begin(CORE_CONFIG_RW_CE);
-    core_config_end = std::end(CORE_CONFIG_RW_CE);
+    core_config = CORE_CONFIG_RW_CE;
+    core_config_length = sizeof(CORE_CONFIG_RW_CE);
     this->core_config_is_solo_ = false;
   }
 
-  nfc::NciMessage rx;
-  nfc::NciMessage tx(nfc::NCI_PKT_MT_CTRL_COMMAND, nfc::NCI_CORE_GID, nfc::NCI_CORE_SET_CONFIG_OID,
-                     std::vector<uint8_t>(core_config_begin, core_config_end));
+  NciFrame rx;
+  NciFrame tx(nfc::NCI_PKT_MT_CTRL_COMMAND, nfc::NCI_CORE_GID, nfc::NCI_CORE_SET_CONFIG_OID, core_config,
+              core_config_length);
 
   if (this->transceive_(tx, rx) != nfc::STATUS_OK) {
     ESP_LOGW(TAG, "Error sending core config");
@@ -388,11 +633,10 @@ uint8_t PN7160::refresh_core_config_() {
 }
 
 uint8_t PN7160::set_discover_map_() {
-  std::vector<uint8_t> discover_map = {sizeof(RF_DISCOVER_MAP_CONFIG) / 3};
-  discover_map.insert(discover_map.end(), std::begin(RF_DISCOVER_MAP_CONFIG), std::end(RF_DISCOVER_MAP_CONFIG));
-
-  nfc::NciMessage rx;
-  nfc::NciMessage tx(nfc::NCI_PKT_MT_CTRL_COMMAND, nfc::RF_GID, nfc::RF_DISCOVER_MAP_OID, discover_map);
+  NciFrame rx;
+  NciFrame tx(nfc::NCI_PKT_MT_CTRL_COMMAND, nfc::RF_GID, nfc::RF_DISCOVER_MAP_OID,
+              {sizeof(RF_DISCOVER_MAP_CONFIG) / 3});
+  tx.append(RF_DISCOVER_MAP_CONFIG, sizeof(RF_DISCOVER_MAP_CONFIG));
 
   if (this->transceive_(tx, rx) != nfc::STATUS_OK) {
     ESP_LOGE(TAG, "Error sending discover map poll config");
@@ -402,10 +646,9 @@ uint8_t PN7160::set_discover_map_() {
 }
 
 uint8_t PN7160::set_listen_mode_routing_() {
-  nfc::NciMessage rx;
-  nfc::NciMessage tx(
-      nfc::NCI_PKT_MT_CTRL_COMMAND, nfc::RF_GID, nfc::RF_SET_LISTEN_MODE_ROUTING_OID,
-      std::vector<uint8_t>(std::begin(RF_LISTEN_MODE_ROUTING_CONFIG), std::end(RF_LISTEN_MODE_ROUTING_CONFIG)));
+  NciFrame rx;
+  NciFrame tx(nfc::NCI_PKT_MT_CTRL_COMMAND, nfc::RF_GID, nfc::RF_SET_LISTEN_MODE_ROUTING_OID,
+              RF_LISTEN_MODE_ROUTING_CONFIG, sizeof(RF_LISTEN_MODE_ROUTING_CONFIG));
 
   if (this->transceive_(tx, rx) != nfc::STATUS_OK) {
     ESP_LOGE(TAG, "Error setting listen mode routing config");
@@ -426,17 +669,13 @@ uint8_t PN7160::start_discovery_() {
     rf_discovery_config = RF_DISCOVERY_LISTEN_CONFIG;
   }
 
-  std::vector<uint8_t> discover_config = std::vector<uint8_t>((length * 2) + 1);
-
-  discover_config[0] = length;
+  NciFrame rx;
+  NciFrame tx(nfc::NCI_PKT_MT_CTRL_COMMAND, nfc::RF_GID, nfc::RF_DISCOVER_OID, {length});
   for (uint8_t i = 0; i < length; i++) {
-    discover_config[(i * 2) + 1] = rf_discovery_config[i];
-    discover_config[(i * 2) + 2] = 0x01;  // RF Technology and Mode will be executed in every discovery period
+    tx.append(rf_discovery_config[i]);
+    tx.append(0x01);  // RF Technology and Mode will be executed in every discovery period
   }
 
-  nfc::NciMessage rx;
-  nfc::NciMessage tx(nfc::NCI_PKT_MT_CTRL_COMMAND, nfc::RF_GID, nfc::RF_DISCOVER_OID, discover_config);
-
   if (this->transceive_(tx, rx) != nfc::STATUS_OK) {
     switch (rx.get_simple_status_response()) {
       // in any of these cases, we are either already in or will remain in discovery, which satisfies the function call
@@ -458,8 +697,8 @@ uint8_t PN7160::start_discovery_() {
 uint8_t PN7160::stop_discovery_() { return this->deactivate_(nfc::DEACTIVATION_TYPE_IDLE, NFCC_TAG_WRITE_TIMEOUT); }
 
 uint8_t PN7160::deactivate_(const uint8_t type, const uint16_t timeout) {
-  nfc::NciMessage rx;
-  nfc::NciMessage tx(nfc::NCI_PKT_MT_CTRL_COMMAND, nfc::RF_GID, nfc::RF_DEACTIVATE_OID, {type});
+  NciFrame rx;
+  NciFrame tx(nfc::NCI_PKT_MT_CTRL_COMMAND, nfc::RF_GID, nfc::RF_DEACTIVATE_OID, {type});
 
   auto status = this->transceive_(tx, rx, timeout);
   // if (status != nfc::STATUS_OK) {
@@ -476,19 +715,25 @@ void PN7160::select_endpoint_() {
     this->nci_fsm_set_state_(NCIState::RFST_IDLE);
     return;
   }
-  std::vector<uint8_t> endpoint_data = {this->discovered_endpoint_[0].id, this->discovered_endpoint_[0].protocol,
-                                        0x01};  // that last byte is the interface ID
-  for (size_t i = 0; i < this->discovered_endpoint_.size(); i++) {
+  size_t endpoint = ENDPOINT_TABLE_SIZE;
+  for (size_t i = 0; i < ENDPOINT_TABLE_SIZE; i++) {
+    if (!this->discovered_endpoint_.in_use(i)) {
+      continue;
+    }
+    if (endpoint == ENDPOINT_TABLE_SIZE) {
+      endpoint = i;  // the first one, if they have all been read
+    }
     if (!this->discovered_endpoint_[i].trig_called) {
-      endpoint_data = {this->discovered_endpoint_[i].id, this->discovered_endpoint_[i].protocol,
-                       0x01};  // that last byte is the interface ID
-      this->selecting_endpoint_ = i;
+      endpoint = i;
       break;
     }
   }
+  this->selecting_endpoint_ = endpoint;
 
-  nfc::NciMessage rx;
-  nfc::NciMessage tx(nfc::NCI_PKT_MT_CTRL_COMMAND, nfc::RF_GID, nfc::RF_DISCOVER_SELECT_OID, endpoint_data);
+  NciFrame rx;
+  NciFrame tx(nfc::NCI_PKT_MT_CTRL_COMMAND, nfc::RF_GID, nfc::RF_DISCOVER_SELECT_OID,
+              {this->discovered_endpoint_[endpoint].id, this->discovered_endpoint_[endpoint].protocol,
+               0x01});  // that last byte is the interface ID
 
   if (this->transceive_(tx, rx) != nfc::STATUS_OK) {
     ESP_LOGE(TAG, "Error selecting endpoint");
@@ -497,142 +742,677 @@ void PN7160::select_endpoint_() {
   }
 }
 
-uint8_t PN7160::read_endpoint_data_(nfc::NfcTag &tag) {
-  uint8_t type = nfc::guess_tag_type(tag.get_uid().size());
+void PN7160::start_tag_operation_(const size_t endpoint) {
+  auto &working_endpoint = this->discovered_endpoint_[endpoint];
+  this->tag_op_ = TagOperation{};
+  this->tag_op_.endpoint = endpoint;
+  this->tag_op_.task = this->next_task_;
+  this->tag_op_.step = this->next_task_;
+  this->tag_op_.status = nfc::STATUS_OK;
+  this->tag_op_.tag_type = working_endpoint.tech.tag_type;
+  this->tag_op_.card_blocks = mifare_classic_card_blocks(working_endpoint.tech.sel_res);
+  this->tag_data_.clear();
+  if (this->tag_op_.tag_type == nfc::TAG_TYPE_2 || this->tag_op_.tag_type == TAG_TYPE_5) {
+    const auto *identity = this->find_identity_(working_endpoint.uid, working_endpoint.uid_length);
+    if (identity != nullptr) {
+      this->tag_op_.identity = *identity;
+      this->tag_op_.identified = true;
+      this->tag_op_.fast_read = identity->fast_read;
+    }
+  } else {
+    this->tag_op_.identified = true;
+  }
 
-  switch (type) {
+  switch (this->next_task_) {
+    case EP_CLEAN:
+      ESP_LOGD(TAG, "  Tag cleaning");
+      break;
+
+    case EP_FORMAT:
+      ESP_LOGD(TAG, "  Tag formatting");
+      break;
+
+    case EP_WRITE:
+      if (this->next_task_message_to_write_ == nullptr) {
+        this->release_endpoint_(&working_endpoint);
+        return;
+      }
+      ESP_LOGD(TAG, "  Tag writing\n"
+                    "  Tag formatting");
+      this->tag_op_.step = EP_FORMAT;
+      break;
+
+    case EP_READ:
+    default:
+      if (working_endpoint.trig_called) {
+        if (!this->hold_for_presence_check_(working_endpoint)) {
+          this->release_endpoint_(&working_endpoint);
+        }
+        return;
+      }
+      // the read fills in its NDEF message, and the triggers get it after
+      auto &tag = this->endpoint_tag_(working_endpoint);
+      char uid_buf[nfc::FORMAT_UID_BUFFER_SIZE];
+      ESP_LOGI(TAG, "Read tag type %s with UID %s", tag.get_tag_type().c_str(),
+               nfc::format_uid_to(uid_buf, tag.get_uid()));
+      break;
+  }
+#ifdef USE_PN7160_STATS
+  // going by the UID length alone, this would have started with the wrong commands and had to fail first
+  if (working_endpoint.tech.mode_tech == (nfc::MODE_POLL | nfc::TECH_PASSIVE_NFCA) &&
+      nfc::guess_tag_type(working_endpoint.uid_length) != this->tag_op_.tag_type) {
+    this->stats_.record_misread_avoided();
+  }
+#endif
+  this->tag_op_.active = true;
+  this->request_high_frequency_loop_(true);
+  this->run_tag_operation_();
+}
+
+void PN7160::run_tag_operation_() {
+  auto &working_endpoint = this->discovered_endpoint_[this->tag_op_.endpoint];
+  TagOpStatus status;
+
+  do {
+    if (!this->tag_op_.identified) {
+      status = this->identify_endpoint_();
+      continue;
+    }
+    switch (this->tag_op_.step) {
+      case EP_CLEAN:
+        status = this->clean_endpoint_();
+        break;
+
+      case EP_FORMAT:
+        status = this->format_endpoint_();
+        break;
+
+      case EP_WRITE:
+        status = this->write_endpoint_();
+        break;
+
+      case EP_READ:
+      default:
+        status = this->read_endpoint_data_(this->endpoint_tag_(working_endpoint));
+        break;
+    }
+
+    if (status == TagOpStatus::DONE && this->tag_op_.task == EP_WRITE && this->tag_op_.step == EP_FORMAT) {
+      ESP_LOGD(TAG, "  Writing NDEF data");
+      this->tag_op_.step = EP_WRITE;
+      this->tag_op_.block = 0;
+      this->tag_op_.authenticated = false;
+      this->tag_op_.index = 0;
+      this->tag_op_.length = 0;
+      status = TagOpStatus::PENDING;
+    }
+  } while (status == TagOpStatus::PENDING && !this->loop_budget_spent_());
+
+  if (status != TagOpStatus::PENDING) {
+    this->complete_tag_operation_(status);
+  }
+}
+
+void PN7160::request_high_frequency_loop_(const bool enable) {
+#ifdef USE_PN7160_TASK
+  if (this->task_enabled_) {
+    return;  // the requester isn't thread-safe, and the NFC task sets its own pace
+  }
+#endif
+  if (enable) {
+    this->high_freq_.start();
+  } else {
+    this->high_freq_.stop();
+  }
+}
+
+void PN7160::complete_tag_operation_(const TagOpStatus status) {
+  this->tag_op_.active = false;
+  this->request_high_frequency_loop_(false);
+  auto &working_endpoint = this->discovered_endpoint_[this->tag_op_.endpoint];
+  // it answered all the way through, however many loop() calls that took
+  working_endpoint.last_seen = this->millis_();
+
+  switch (this->tag_op_.task) {
+    case EP_CLEAN:
+      if (status != TagOpStatus::DONE) {
+        ESP_LOGE(TAG, "  Tag cleaning incomplete");
+      }
+      ESP_LOGD(TAG, "  Tag cleaned!");
+      break;
+
+    case EP_FORMAT:
+      if (status != TagOpStatus::DONE) {
+        ESP_LOGE(TAG, "Error formatting tag as NDEF");
+      }
+      ESP_LOGD(TAG, "  Tag formatted!");
+      break;
+
+    case EP_WRITE:
+      if (this->tag_op_.step == EP_FORMAT) {
+        ESP_LOGE(TAG, "  Tag could not be formatted for writing");
+        break;
+      }
+      if (status != TagOpStatus::DONE) {
+        ESP_LOGE(TAG, "  Failed to write message to tag");
+      }
+      ESP_LOGD(TAG, "  Finished writing NDEF data");
+      this->next_task_message_to_write_ = nullptr;
+      this->notify_(NfcEventType::FINISHED_WRITE);
+      break;
+
+    case EP_READ:
+    default:
+      if (status != TagOpStatus::DONE) {
+        ESP_LOGW(TAG, "  Unable to read NDEF record(s)");
+      } else if (this->endpoint_tag_(working_endpoint).has_ndef_message()) {
+        const auto message = working_endpoint.tag->get_ndef_message();
+        const auto records = message->get_records();
+        ESP_LOGD(TAG, "  NDEF record(s):");
+        for (const auto &record : records) {
+          ESP_LOGD(TAG, "    %s - %s", record->get_type().c_str(), record->get_payload().c_str());
+        }
+      } else {
+        ESP_LOGW(TAG, "  No NDEF records found");
+      }
+      this->notify_(NfcEventType::TAG_ON, working_endpoint.tag);
+      working_endpoint.trig_called = true;
+      break;
+  }
+  if (status == TagOpStatus::DONE && this->hold_for_presence_check_(working_endpoint)) {
+    return;
+  }
+  this->release_endpoint_(&working_endpoint);
+}
+
+bool PN7160::hold_for_presence_check_(const DiscoveredEndpoint &endpoint) {
+  if (!this->presence_check_interval_ || this->tag_op_.task != EP_READ || this->next_task_ != EP_READ) {
+    return false;
+  }
+  // nothing else is discovered while a tag is held, so with others in the field they all go by the TTL as before
+  if (this->discovered_endpoint_.size() != 1) {
+    return false;
+  }
+  switch (endpoint.tech.tag_type) {
+    case nfc::TAG_TYPE_2:
+    case nfc::TAG_TYPE_3:
+    case nfc::TAG_TYPE_4:
+    case TAG_TYPE_5:
+      break;
+
+    default:
+      return false;  // a MIFARE Classic READ needs its sector authenticated again each time
+  }
+  this->discard_data_in_flight_();
+  this->presence_held_ = true;
+  this->presence_checked_ = this->millis_();
+  ESP_LOGV(TAG, "  Holding tag for presence checks");
+  return true;
+}
+
+void PN7160::run_presence_check_() {
+  auto &endpoint = this->discovered_endpoint_[this->tag_op_.endpoint];
+  if (this->next_task_ != EP_READ) {
+    // a clean, format or write was asked for; the tag is still activated, so it runs now
+    this->presence_held_ = false;
+    this->start_tag_operation_(this->tag_op_.endpoint);
+    return;
+  }
+  const uint32_t now = this->millis_();
+  if (now - this->presence_checked_ < this->presence_check_interval_) {
+    return;
+  }
+  this->presence_checked_ = now;
+  for (uint8_t attempt = 0; attempt < PRESENCE_CHECK_ATTEMPTS; attempt++) {
+    if (this->check_presence_() == nfc::STATUS_OK) {
+      endpoint.last_seen = this->millis_();
+      return;
+    }
+    this->discard_data_in_flight_();
+  }
+  ESP_LOGV(TAG, "  Presence check failed");
+  this->presence_held_ = false;
+  // reported now, not a TTL later; with the endpoint gone there is nothing left to halt
+  this->erase_tag_(this->tag_op_.endpoint);
+  this->release_endpoint_(nullptr);
+}
+
+uint8_t PN7160::check_presence_() {
+  switch (this->tag_op_.tag_type) {
+    case nfc::TAG_TYPE_2:
+      return this->check_mifare_ultralight_presence_();
+
+    case nfc::TAG_TYPE_3:
+      return this->check_t3t_presence_();
+
+    case nfc::TAG_TYPE_4:
+      return this->check_t4t_presence_();
+
+    case TAG_TYPE_5:
+      return this->check_t5t_presence_();
+
+    default:
+      return nfc::STATUS_FAILED;
+  }
+}
+
+void PN7160::release_endpoint_(const DiscoveredEndpoint *endpoint) {
+  this->discard_data_in_flight_();  // a step that failed part way through a batch may have left one behind
+  if (endpoint != nullptr && endpoint->tech.tag_type == nfc::TAG_TYPE_MIFARE_CLASSIC) {
+    this->halt_mifare_classic_tag_();
+  }
+  if (this->next_task_ != EP_READ) {
+    // read_mode() would take nci_lock_, which the NFC task already holds here
+    this->next_task_ = EP_READ;
+    ESP_LOGD(TAG, "Waiting to read next tag");
+  }
+
+  if (this->stop_discovery_() != nfc::STATUS_OK) {
+    ESP_LOGW(TAG, "Failed to deactivate -- forcing NFCC reset");
+    this->nci_fsm_set_state_(NCIState::NFCC_RESET);
+  } else {
+    this->nci_fsm_set_state_(NCIState::EP_DEACTIVATING);
+  }
+}
+
+TagOpStatus PN7160::identify_endpoint_() {
+  auto &op = this->tag_op_;
+  const auto &endpoint = this->discovered_endpoint_[op.endpoint];
+
+  const uint8_t status = op.tag_type == TAG_TYPE_5 ? this->identify_t5t_(op.identity)
+                                                   : this->identify_mifare_ultralight_(op.identity);
+  if (status != nfc::STATUS_OK) {
+    ESP_LOGW(TAG, "  Unable to identify tag");
+    return TagOpStatus::FAILED;
+  }
+  op.identity.uid_length = endpoint.uid_length;
+  std::copy(endpoint.uid, endpoint.uid + endpoint.uid_length, op.identity.uid);
+  op.identified = true;
+  op.fast_read = op.identity.fast_read;
+  this->remember_identity_(op.identity);
+  if (op.tag_type == TAG_TYPE_5) {
+    ESP_LOGD(TAG, "  Type 5 tag with a %u-byte data area in %u-byte blocks%s", op.identity.capacity,
+             op.identity.block_size, op.identity.fast_read ? ", reading with Read Multiple Blocks" : "");
+  } else {
+    ESP_LOGD(TAG, "  %s with a %u-byte data area%s", tag_chip_name(op.identity.chip), op.identity.capacity,
+             op.identity.fast_read ? ", reading with FAST_READ" : "");
+  }
+  return TagOpStatus::PENDING;
+}
+
+TagOpStatus PN7160::read_endpoint_data_(nfc::NfcTag &tag) {
+  switch (this->tag_op_.tag_type) {
     case nfc::TAG_TYPE_MIFARE_CLASSIC:
-      ESP_LOGV(TAG, "Reading Mifare classic");
       return this->read_mifare_classic_tag_(tag);
 
     case nfc::TAG_TYPE_2:
-      ESP_LOGV(TAG, "Reading Mifare ultralight");
       return this->read_mifare_ultralight_tag_(tag);
 
+    case nfc::TAG_TYPE_3:
+      return this->read_t3t_tag_(tag);
+
+    case nfc::TAG_TYPE_4:
+      return this->read_t4t_tag_(tag);
+
+    case TAG_TYPE_5:
+      return this->read_t5t_tag_(tag);
+
     case nfc::TAG_TYPE_UNKNOWN:
     default:
       ESP_LOGV(TAG, "Cannot determine tag type");
       break;
   }
-  return nfc::STATUS_FAILED;
+  return TagOpStatus::FAILED;
 }
 
-uint8_t PN7160::clean_endpoint_(nfc::NfcTagUid &uid) {
-  uint8_t type = nfc::guess_tag_type(uid.size());
-  switch (type) {
+TagOpStatus PN7160::clean_endpoint_() {
+  switch (this->tag_op_.tag_type) {
     case nfc::TAG_TYPE_MIFARE_CLASSIC:
       return this->format_mifare_classic_mifare_();
 
     case nfc::TAG_TYPE_2:
       return this->clean_mifare_ultralight_();
 
+    case TAG_TYPE_5:
+      return this->clean_t5t_();
+
     default:
       ESP_LOGE(TAG, "Unsupported tag for cleaning");
       break;
   }
-  return nfc::STATUS_FAILED;
+  return TagOpStatus::FAILED;
 }
 
-uint8_t PN7160::format_endpoint_(nfc::NfcTagUid &uid) {
-  uint8_t type = nfc::guess_tag_type(uid.size());
-  switch (type) {
+TagOpStatus PN7160::format_endpoint_() {
+  switch (this->tag_op_.tag_type) {
     case nfc::TAG_TYPE_MIFARE_CLASSIC:
       return this->format_mifare_classic_ndef_();
 
     case nfc::TAG_TYPE_2:
       return this->clean_mifare_ultralight_();
 
+    case TAG_TYPE_5:
+      return this->format_t5t_();
+
     default:
       ESP_LOGE(TAG, "Unsupported tag for formatting");
       break;
   }
-  return nfc::STATUS_FAILED;
+  return TagOpStatus::FAILED;
 }
 
-uint8_t PN7160::write_endpoint_(nfc::NfcTagUid &uid, std::shared_ptr<nfc::NdefMessage> &message) {
-  uint8_t type = nfc::guess_tag_type(uid.size());
-  switch (type) {
+TagOpStatus PN7160::write_endpoint_() {
+  switch (this->tag_op_.tag_type) {
     case nfc::TAG_TYPE_MIFARE_CLASSIC:
-      return this->write_mifare_classic_tag_(message);
+      return this->write_mifare_classic_tag_(this->next_task_message_to_write_);
 
     case nfc::TAG_TYPE_2:
-      return this->write_mifare_ultralight_tag_(uid, message);
+      return this->write_mifare_ultralight_tag_(this->next_task_message_to_write_);
+
+    case TAG_TYPE_5:
+      return this->write_t5t_tag_(this->next_task_message_to_write_);
 
     default:
       ESP_LOGE(TAG, "Unsupported tag for writing");
       break;
   }
-  return nfc::STATUS_FAILED;
+  return TagOpStatus::FAILED;
+}
+
+uint32_t PN7160::encode_ndef_tlv_(const std::shared_ptr<nfc::NdefMessage> &message) {
+  const auto encoded = message->encode();
+  const uint32_t message_length = encoded.size();
+  auto &buffer = this->tag_data_;
+
+  buffer.clear();
+  buffer.push_back(0x03);
+  if (message_length < 255) {
+    buffer.push_back(message_length);
+  } else {
+    buffer.push_back(0xFF);
+    buffer.push_back((message_length >> 8) & 0xFF);
+    buffer.push_back(message_length & 0xFF);
+  }
+  buffer.insert(buffer.end(), encoded.begin(), encoded.end());
+  buffer.push_back(0xFE);
+  return message_length;
 }
 
-std::unique_ptr<nfc::NfcTag> PN7160::build_tag_(const uint8_t mode_tech, const std::vector<uint8_t> &data) {
+uint8_t PN7160::parse_tech_params_(const uint8_t mode_tech, const uint8_t protocol, const uint8_t *params,
+                                  const size_t length, DiscoveredEndpoint &endpoint) {
+  auto &tech = endpoint.tech;
+  tech = TechParams{mode_tech, nfc::TAG_TYPE_UNKNOWN, 0, SEL_RES_NONE, 0};
   switch (mode_tech) {
     case (nfc::MODE_POLL | nfc::TECH_PASSIVE_NFCA): {
-      uint8_t uid_length = data[2];
+      uint8_t uid_length = length > NFCA_UID_LENGTH_AT ? params[NFCA_UID_LENGTH_AT] : 0;
       if (!uid_length) {
         ESP_LOGE(TAG, "UID length cannot be zero");
-        return nullptr;
+        return nfc::STATUS_FAILED;
+      }
+      if (uid_length > NFCA_MAX_UID_LENGTH) {
+        ESP_LOGE(TAG, "UID is too long");
+        return nfc::STATUS_FAILED;
+      }
+      if (static_cast<size_t>(NFCA_UID_AT + uid_length) > length) {
+        ESP_LOGE(TAG, "UID is truncated");
+        return nfc::STATUS_FAILED;
+      }
+      tech.sens_res = params[NFCA_SENS_RES_AT] | (params[NFCA_SENS_RES_AT + 1] << 8);
+      std::memcpy(endpoint.uid, params + NFCA_UID_AT, uid_length);
+      endpoint.uid_length = uid_length;
+      // then SEL_RES_LEN and, when it's one, the SEL_RES itself
+      const size_t sel_res_at = NFCA_UID_AT + uid_length;
+      if (sel_res_at + 1 < length && params[sel_res_at] == 1) {
+        tech.sel_res = params[sel_res_at + 1];
+      }
+      tech.tag_type = nfca_tag_type(protocol, tech.sens_res, tech.sel_res, uid_length);
+      ESP_LOGVV(TAG, "NFC-A tag: SENS_RES %02X %02X, SEL_RES %02X, protocol %02X", params[NFCA_SENS_RES_AT],
+                params[NFCA_SENS_RES_AT + 1], tech.sel_res, protocol);
+      return nfc::STATUS_OK;
+    }
+
+    case (nfc::MODE_POLL | nfc::TECH_PASSIVE_NFCF): {
+      // SENSF_RES is 16 bytes, or 18 with the request data a system code poll asks for
+      if (length < NFCF_SENSF_RES_AT + NFCF_IDM_LENGTH + NFCF_PMM_LENGTH ||
+          params[1] < NFCF_IDM_LENGTH + NFCF_PMM_LENGTH) {
+        ESP_LOGE(TAG, "SENSF_RES is truncated");
+        return nfc::STATUS_FAILED;
       }
-      nfc::NfcTagUid uid(data.begin() + 3, data.begin() + 3 + uid_length);
-      const auto *tag_type_str =
-          nfc::guess_tag_type(uid_length) == nfc::TAG_TYPE_MIFARE_CLASSIC ? nfc::MIFARE_CLASSIC : nfc::NFC_FORUM_TYPE_2;
-      return make_unique<nfc::NfcTag>(uid, tag_type_str);
+      const uint8_t *idm = params + NFCF_SENSF_RES_AT;
+      std::memcpy(endpoint.uid, idm, NFCF_IDM_LENGTH);
+      endpoint.uid_length = NFCF_IDM_LENGTH;
+      tech.tag_type = nfc::TAG_TYPE_3;
+      tech.mrti_check = idm[NFCF_IDM_LENGTH + NFCF_PMM_MRTI_CHECK];
+      return nfc::STATUS_OK;
+    }
+
+    case (nfc::MODE_POLL | nfc::TECH_PASSIVE_15693): {
+      if (length < NFCV_UID_AT + NFCV_UID_LENGTH) {
+        ESP_LOGE(TAG, "UID is truncated");
+        return nfc::STATUS_FAILED;
+      }
+      // kept most significant byte first, as printed on the label; build_t5t_request_() turns it back round
+      const uint8_t *uid = params + NFCV_UID_AT;
+      std::reverse_copy(uid, uid + NFCV_UID_LENGTH, endpoint.uid);
+      endpoint.uid_length = NFCV_UID_LENGTH;
+      tech.tag_type = TAG_TYPE_5;
+      return nfc::STATUS_OK;
     }
   }
-  return nullptr;
+  return nfc::STATUS_FAILED;
+}
+
+optional<size_t> PN7160::cache_endpoint_(const DiscoveredEndpoint &found) {
+  auto slot = this->discovered_endpoint_.find(found.uid, found.uid_length);
+  if (slot.has_value()) {
+    ESP_LOGVV(TAG, "Tag cache updated");
+  } else {
+    slot = this->discovered_endpoint_.insert(found.uid, found.uid_length);
+    if (!slot.has_value()) {
+      ESP_LOGW(TAG, "Endpoint table full; ignoring tag");
+      return nullopt;
+    }
+    ESP_LOGVV(TAG, "Tag added to cache");
+  }
+  auto &endpoint = this->discovered_endpoint_[slot.value()];
+  endpoint.id = found.id;
+  endpoint.protocol = found.protocol;
+  endpoint.last_seen = this->millis_();
+  endpoint.tech = found.tech;
+  // later sightings only move last_seen; purge_old_tags_() finds that out when this comes due
+  this->endpoint_expiry_.schedule(slot.value(), endpoint.last_seen + this->tag_ttl_);
+  return slot;
 }
 
-optional<size_t> PN7160::find_tag_uid_(const nfc::NfcTagUid &uid) {
-  if (!this->discovered_endpoint_.empty()) {
-    for (size_t i = 0; i < this->discovered_endpoint_.size(); i++) {
-      auto existing_tag_uid = this->discovered_endpoint_[i].tag->get_uid();
-      bool uid_match = (uid.size() == existing_tag_uid.size());
+nfc::NfcTag &PN7160::endpoint_tag_(DiscoveredEndpoint &endpoint) {
+  if (endpoint.tag == nullptr) {
+    endpoint.tag = make_unique<nfc::NfcTag>(nfc::NfcTagUid(endpoint.uid, endpoint.uid + endpoint.uid_length),
+                                            tag_type_name(endpoint.tech.tag_type));
+  }
+  return *endpoint.tag;
+}
 
-      if (uid_match) {
-        for (size_t i = 0; i < uid.size(); i++) {
-          uid_match &= (uid[i] == existing_tag_uid[i]);
-        }
-        if (uid_match) {
-          return i;
-        }
-      }
+// FNV-1a
+size_t EndpointTable::hash(const uint8_t *uid, const uint8_t uid_length) {
+  uint32_t hash = 2166136261UL;
+  for (uint8_t i = 0; i < uid_length; i++) {
+    hash = (hash ^ uid[i]) * 16777619UL;
+  }
+  return hash & (ENDPOINT_TABLE_SIZE - 1);
+}
+
+optional<size_t> EndpointTable::find(const uint8_t *uid, const uint8_t uid_length) const {
+  size_t slot = hash(uid, uid_length);
+  for (size_t probe = 0; probe < ENDPOINT_TABLE_SIZE; probe++, slot = (slot + 1) & (ENDPOINT_TABLE_SIZE - 1)) {
+    if (this->state_[slot] == SLOT_EMPTY) {
+      break;
+    }
+    const auto &endpoint = this->slots_[slot];
+    if (this->state_[slot] == SLOT_USED && endpoint.uid_length == uid_length &&
+        std::equal(uid, uid + uid_length, endpoint.uid)) {
+      return slot;
     }
   }
   return nullopt;
 }
 
-void PN7160::purge_old_tags_() {
-  for (size_t i = 0; i < this->discovered_endpoint_.size(); i++) {
-    if (millis() - this->discovered_endpoint_[i].last_seen > this->tag_ttl_) {
-      this->erase_tag_(i);
+optional<size_t> EndpointTable::insert(const uint8_t *uid, const uint8_t uid_length) {
+  size_t slot = hash(uid, uid_length);
+  for (size_t probe = 0; probe < ENDPOINT_TABLE_SIZE; probe++, slot = (slot + 1) & (ENDPOINT_TABLE_SIZE - 1)) {
+    if (this->state_[slot] != SLOT_USED) {
+      auto &endpoint = this->slots_[slot];
+      endpoint = DiscoveredEndpoint{};
+      std::copy(uid, uid + uid_length, endpoint.uid);
+      endpoint.uid_length = uid_length;
+      this->state_[slot] = SLOT_USED;
+      this->size_++;
+      return slot;
     }
   }
+  return nullopt;
 }
 
-void PN7160::erase_tag_(const uint8_t tag_index) {
-  if (tag_index < this->discovered_endpoint_.size()) {
-    for (auto *trigger : this->triggers_ontagremoved_) {
-      trigger->process(this->discovered_endpoint_[tag_index].tag);
+void EndpointTable::erase(const size_t slot) {
+  if (this->state_[slot] != SLOT_USED) {
+    return;
+  }
+  this->slots_[slot].tag.reset();
+  this->state_[slot] = SLOT_ERASED;
+  if (--this->size_ == 0) {
+    // nothing left for a probe to run past
+    std::fill(std::begin(this->state_), std::end(this->state_), SLOT_EMPTY);
+  }
+}
+
+const TagIdentity *PN7160::find_identity_(const uint8_t *uid, const uint8_t uid_length) const {
+  for (const auto &identity : this->identities_) {
+    if (identity.uid_length != 0 && identity.uid_length == uid_length &&
+        std::equal(uid, uid + uid_length, identity.uid)) {
+      return &identity;
+    }
+  }
+  return nullptr;
+}
+
+void PN7160::remember_identity_(const TagIdentity &identity) {
+  // a tag seen again after a format takes over its old entry rather than sitting beside it
+  for (auto &cached : this->identities_) {
+    if (cached.uid_length == identity.uid_length &&
+        std::equal(identity.uid, identity.uid + identity.uid_length, cached.uid)) {
+      cached = identity;
+      return;
+    }
+  }
+  this->identities_[this->identity_next_] = identity;
+  this->identity_next_ = (this->identity_next_ + 1) % IDENTITY_CACHE_SIZE;
+}
+
+void PN7160::purge_old_tags_() {
+  if (this->tag_op_.active) {
+    return;  // the tag being worked on is in the field; entries must not shift under tag_op_.endpoint either
+  }
+  const uint32_t now = this->millis_();
+  if (!this->endpoint_expiry_.due(now)) {
+    return;
+  }
+  uint8_t expired[ENDPOINT_TABLE_SIZE];
+  size_t expired_count = 0;
+  uint8_t slot;
+  while (this->endpoint_expiry_.pop_due(now, slot)) {
+    if (!this->discovered_endpoint_.in_use(slot)) {
+      continue;  // erased some other way since
+    }
+    if (this->presence_held_ && slot == this->tag_op_.endpoint) {
+      this->endpoint_expiry_.schedule(slot, now + this->tag_ttl_);  // its presence checks say when it leaves
+      continue;
     }
-    for (auto *listener : this->tag_listeners_) {
-      listener->tag_off(*this->discovered_endpoint_[tag_index].tag);
+    const uint32_t deadline = this->discovered_endpoint_[slot].last_seen + this->tag_ttl_;
+    if (static_cast<int32_t>(now - deadline) <= 0) {
+      this->endpoint_expiry_.schedule(slot, deadline);  // seen again since it was queued
+      continue;
     }
+    expired[expired_count++] = slot;
+  }
+  // the triggers run once the queue is settled, and every tag that left is reported in this pass
+  for (size_t i = 0; i < expired_count; i++) {
+    this->erase_tag_(expired[i]);
+  }
+}
+
+void PN7160::erase_tag_(const uint8_t tag_index) {
+  if (tag_index < ENDPOINT_TABLE_SIZE && this->discovered_endpoint_.in_use(tag_index)) {
+    auto &endpoint = this->discovered_endpoint_[tag_index];
+    auto &tag = this->endpoint_tag_(endpoint);  // the removal triggers want one even if it was never read
+    this->notify_(NfcEventType::TAG_OFF, endpoint.tag);
     char uid_buf[nfc::FORMAT_UID_BUFFER_SIZE];
-    ESP_LOGI(TAG, "Tag %s removed", nfc::format_uid_to(uid_buf, this->discovered_endpoint_[tag_index].tag->get_uid()));
-    this->discovered_endpoint_.erase(this->discovered_endpoint_.begin() + tag_index);
+    ESP_LOGI(TAG, "Tag %s removed", nfc::format_uid_to(uid_buf, tag.get_uid()));
+    this->discovered_endpoint_.erase(tag_index);
+  }
+}
+
+void PN7160::notify_(const NfcEventType type, const std::unique_ptr<nfc::NfcTag> &tag) {
+#ifdef USE_PN7160_TASK
+  if (this->task_enabled_) {
+    // the endpoint's tag may be gone by the time loop() gets to this, so the event carries its own copy
+    NfcEvent event{type, tag != nullptr ? make_unique<nfc::NfcTag>(*tag) : nullptr};
+    if (!this->events_.push(std::move(event))) {
+      this->events_dropped_++;
+      ESP_LOGW(TAG, "Event queue full; dropped event %u", (uint8_t) type);
+    }
+    return;
+  }
+#endif
+  this->fire_event_(type, tag);
+}
+
+void PN7160::fire_event_(const NfcEventType type, const std::unique_ptr<nfc::NfcTag> &tag) {
+  switch (type) {
+    case NfcEventType::TAG_ON:
+      for (auto *trigger : this->triggers_ontag_) {
+        trigger->process(tag);
+      }
+      for (auto *listener : this->tag_listeners_) {
+        listener->tag_on(*tag);
+      }
+      break;
+
+    case NfcEventType::TAG_OFF:
+      for (auto *trigger : this->triggers_ontagremoved_) {
+        trigger->process(tag);
+      }
+      for (auto *listener : this->tag_listeners_) {
+        listener->tag_off(*tag);
+      }
+      break;
+
+    case NfcEventType::FINISHED_WRITE:
+      this->on_finished_write_callback_.call();
+      break;
+
+    case NfcEventType::EMULATED_TAG_SCAN:
+      this->on_emulated_tag_scan_callback_.call();
+      break;
   }
 }
 
 void PN7160::nci_fsm_transition_() {
   switch (this->nci_state_) {
+    // each init stage is one NCI exchange; they run back to back until the loop budget is spent
     case NCIState::NFCC_RESET:
-      if (this->reset_core_(true, true) != nfc::STATUS_OK) {
+      if (!this->power_cycle_step_()) {
+        return;  // VEN has not settled yet
+      }
+      if (this->reset_core_(true, false) != nfc::STATUS_OK) {
         ESP_LOGE(TAG, "Failed to reset NCI core");
+        this->power_cycle_stage_ = 0;  // power cycle again before retrying
         this->nci_fsm_set_error_state_(NCIState::NFCC_RESET);
         return;
       } else {
         this->nci_fsm_set_state_(NCIState::NFCC_INIT);
       }
+      if (this->loop_budget_spent_()) {
+        return;
+      }
       [[fallthrough]];
 
     case NCIState::NFCC_INIT:
@@ -643,6 +1423,9 @@ void PN7160::nci_fsm_transition_() {
       } else {
         this->nci_fsm_set_state_(NCIState::NFCC_CONFIG);
       }
+      if (this->loop_budget_spent_()) {
+        return;
+      }
       [[fallthrough]];
 
     case NCIState::NFCC_CONFIG:
@@ -654,6 +1437,9 @@ void PN7160::nci_fsm_transition_() {
         this->config_refresh_pending_ = false;
         this->nci_fsm_set_state_(NCIState::NFCC_SET_DISCOVER_MAP);
       }
+      if (this->loop_budget_spent_()) {
+        return;
+      }
       [[fallthrough]];
 
     case NCIState::NFCC_SET_DISCOVER_MAP:
@@ -664,6 +1450,9 @@ void PN7160::nci_fsm_transition_() {
       } else {
         this->nci_fsm_set_state_(NCIState::NFCC_SET_LISTEN_MODE_ROUTING);
       }
+      if (this->loop_budget_spent_()) {
+        return;
+      }
       [[fallthrough]];
 
     case NCIState::NFCC_SET_LISTEN_MODE_ROUTING:
@@ -674,6 +1463,9 @@ void PN7160::nci_fsm_transition_() {
       } else {
         this->nci_fsm_set_state_(NCIState::RFST_IDLE);
       }
+      if (this->loop_budget_spent_()) {
+        return;
+      }
       [[fallthrough]];
 
     case NCIState::RFST_IDLE:
@@ -710,11 +1502,20 @@ void PN7160::nci_fsm_transition_() {
 
     case NCIState::RFST_LISTEN_ACTIVE:
     case NCIState::RFST_LISTEN_SLEEP:
-    case NCIState::RFST_POLL_ACTIVE:
     case NCIState::EP_SELECTING:
     case NCIState::EP_DEACTIVATING:
-      if (this->irq_pin_->digital_read()) {
+      if (this->irq_asserted_()) {
+        this->process_message_();
+      }
+      break;
+
+    case NCIState::RFST_POLL_ACTIVE:
+      if (this->tag_op_.active) {
+        this->run_tag_operation_();
+      } else if (this->irq_asserted_()) {
         this->process_message_();
+      } else if (this->presence_held_) {
+        this->run_presence_check_();
       }
       break;
 
@@ -727,10 +1528,23 @@ void PN7160::nci_fsm_transition_() {
 
 void PN7160::nci_fsm_set_state_(NCIState new_state) {
   ESP_LOGVV(TAG, "nci_fsm_set_state_(%u)", (uint8_t) new_state);
+#ifdef USE_PN7160_STATS
+  const uint32_t now_us = this->micros_();
+  this->stats_.record_state((uint8_t) this->nci_state_, now_us - this->nci_state_entered_us_);
+  this->nci_state_entered_us_ = now_us;
+#endif
+  if (new_state != NCIState::RFST_POLL_ACTIVE) {
+    this->tag_op_.active = false;  // an operation cannot outlive the activation it was started in
+    this->presence_held_ = false;
+    this->request_high_frequency_loop_(false);
+  }
+  if (new_state == NCIState::NFCC_RESET) {
+    this->power_cycle_stage_ = 0;
+  }
   this->nci_state_ = new_state;
   this->nci_state_error_ = NCIState::NONE;
   this->error_count_ = 0;
-  this->last_nci_state_change_ = millis();
+  this->last_nci_state_change_ = this->millis_();
 }
 
 bool PN7160::nci_fsm_set_error_state_(NCIState new_state) {
@@ -751,8 +1565,8 @@ bool PN7160::nci_fsm_set_error_state_(NCIState new_state) {
 }
 
 void PN7160::process_message_() {
-  nfc::NciMessage rx;
-  if (this->read_nfcc(rx, NFCC_DEFAULT_TIMEOUT) != nfc::STATUS_OK) {
+  NciFrame rx;
+  if (this->read_frame_(rx, NFCC_DEFAULT_TIMEOUT) != nfc::STATUS_OK) {
     return;  // No data
   }
 
@@ -771,7 +1585,7 @@ void PN7160::process_message_() {
             return;
 
           case nfc::RF_DEACTIVATE_OID:
-            ESP_LOGVV(TAG, "RF_DEACTIVATE_OID: type: 0x%02X, reason: 0x%02X", rx.get_message()[3], rx.get_message()[4]);
+            ESP_LOGVV(TAG, "RF_DEACTIVATE_OID: type: 0x%02X, reason: 0x%02X", rx.get_message_byte(3), rx.get_message_byte(4));
             this->process_rf_deactivate_oid_(rx);
             return;
 
@@ -792,9 +1606,7 @@ void PN7160::process_message_() {
                 ESP_LOGV(TAG, "  DISCOVERY_TARGET_ACTIVATION_FAILED");
                 if (this->nci_state_ == NCIState::EP_SELECTING) {
                   this->nci_fsm_set_state_(NCIState::RFST_W4_HOST_SELECT);
-                  if (!this->discovered_endpoint_.empty()) {
-                    this->erase_tag_(this->selecting_endpoint_);
-                  }
+                  this->erase_tag_(this->selecting_endpoint_);
                 } else {
                   this->stop_discovery_();
                   this->nci_fsm_set_state_(NCIState::RFST_IDLE);
@@ -811,25 +1623,29 @@ void PN7160::process_message_() {
             }
             break;
 
+          case nfc::NCI_CORE_CONN_CREDITS_OID:
+            this->process_conn_credits_(rx);  // after a card emulation reply
+            break;
+
           default:
             ESP_LOGV(TAG, "Unimplemented NCI Core OID received: 0x%02X", rx.get_oid());
         }
       } else {
         char buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
-        ESP_LOGV(TAG, "Unimplemented notification: %s", nfc::format_bytes_to(buf, rx.get_message()));
+        ESP_LOGV(TAG, "Unimplemented notification: %s", format_frame_to(buf, rx));
       }
       break;
 
     case nfc::NCI_PKT_MT_CTRL_RESPONSE: {
       char buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
       ESP_LOGV(TAG, "Unimplemented GID: 0x%02X  OID: 0x%02X  Full response: %s", rx.get_gid(), rx.get_oid(),
-               nfc::format_bytes_to(buf, rx.get_message()));
+               format_frame_to(buf, rx));
       break;
     }
 
     case nfc::NCI_PKT_MT_CTRL_COMMAND: {
       char buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
-      ESP_LOGV(TAG, "Unimplemented command: %s", nfc::format_bytes_to(buf, rx.get_message()));
+      ESP_LOGV(TAG, "Unimplemented command: %s", format_frame_to(buf, rx));
       break;
     }
 
@@ -839,13 +1655,13 @@ void PN7160::process_message_() {
 
     default: {
       char buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
-      ESP_LOGV(TAG, "Unimplemented message type: %s", nfc::format_bytes_to(buf, rx.get_message()));
+      ESP_LOGV(TAG, "Unimplemented message type: %s", format_frame_to(buf, rx));
       break;
     }
   }
 }
 
-void PN7160::process_rf_intf_activated_oid_(nfc::NciMessage &rx) {  // an endpoint was activated
+void PN7160::process_rf_intf_activated_oid_(NciFrame &rx) {  // an endpoint was activated
   uint8_t discovery_id = rx.get_message_byte(nfc::RF_INTF_ACTIVATED_NTF_DISCOVERY_ID);
   uint8_t interface = rx.get_message_byte(nfc::RF_INTF_ACTIVATED_NTF_INTERFACE);
   uint8_t protocol = rx.get_message_byte(nfc::RF_INTF_ACTIVATED_NTF_PROTOCOL);
@@ -855,6 +1671,12 @@ void PN7160::process_rf_intf_activated_oid_(nfc::NciMessage &rx) {  // an endpoi
   ESP_LOGVV(TAG, "Endpoint activated -- interface: 0x%02X, protocol: 0x%02X, mode&tech: 0x%02X, max payload: %u",
             interface, protocol, mode_tech, max_size);
 
+  // a new static RF connection: nothing of the last one's is still in flight
+  this->conn_credits_[NCI_STATIC_RF_CONN_ID] = rx.get_message_byte(nfc::RF_INTF_ACTIVATED_NTF_INIT_CRED);
+  this->conn_max_payload_[NCI_STATIC_RF_CONN_ID] = max_size ? max_size : NCI_MAX_PAYLOAD_SIZE;
+  this->data_in_flight_ = 0;
+  this->early_data_pending_ = false;
+
   if (mode_tech & nfc::MODE_LISTEN_MASK) {
     ESP_LOGVV(TAG, "Tag activated in listen mode");
     this->nci_fsm_set_state_(NCIState::RFST_LISTEN_ACTIVE);
@@ -862,135 +1684,47 @@ void PN7160::process_rf_intf_activated_oid_(nfc::NciMessage &rx) {  // an endpoi
   }
 
   this->nci_fsm_set_state_(NCIState::RFST_POLL_ACTIVE);
-  auto incoming_tag =
-      this->build_tag_(mode_tech, std::vector<uint8_t>(rx.get_message().begin() + 10, rx.get_message().end()));
-
-  if (incoming_tag == nullptr) {
+  DiscoveredEndpoint found{};
+  found.id = discovery_id;
+  found.protocol = protocol;
+  optional<size_t> slot;
+  if (this->parse_tech_params_(mode_tech, protocol, rx.data() + nfc::RF_INTF_ACTIVATED_NTF_RF_TECH_PARAMS,
+                               rx.size() > nfc::RF_INTF_ACTIVATED_NTF_RF_TECH_PARAMS
+                                   ? rx.size() - nfc::RF_INTF_ACTIVATED_NTF_RF_TECH_PARAMS
+                                   : 0,
+                               found) == nfc::STATUS_OK) {
+    slot = this->cache_endpoint_(found);
+  }
+
+  if (!slot.has_value()) {
     ESP_LOGE(TAG, "Could not build tag");
+    this->release_endpoint_(nullptr);
   } else {
-    auto tag_loc = this->find_tag_uid_(incoming_tag->get_uid());
-    if (tag_loc.has_value()) {
-      this->discovered_endpoint_[tag_loc.value()].id = discovery_id;
-      this->discovered_endpoint_[tag_loc.value()].protocol = protocol;
-      this->discovered_endpoint_[tag_loc.value()].last_seen = millis();
-      ESP_LOGVV(TAG, "Tag cache updated");
-    } else {
-      this->discovered_endpoint_.emplace_back(
-          DiscoveredEndpoint{discovery_id, protocol, millis(), std::move(incoming_tag), false});
-      tag_loc = this->discovered_endpoint_.size() - 1;
-      ESP_LOGVV(TAG, "Tag added to cache");
-    }
-
-    auto &working_endpoint = this->discovered_endpoint_[tag_loc.value()];
-
-    switch (this->next_task_) {
-      case EP_CLEAN:
-        ESP_LOGD(TAG, "  Tag cleaning");
-        if (this->clean_endpoint_(working_endpoint.tag->get_uid()) != nfc::STATUS_OK) {
-          ESP_LOGE(TAG, "  Tag cleaning incomplete");
-        }
-        ESP_LOGD(TAG, "  Tag cleaned!");
-        break;
-
-      case EP_FORMAT:
-        ESP_LOGD(TAG, "  Tag formatting");
-        if (this->format_endpoint_(working_endpoint.tag->get_uid()) != nfc::STATUS_OK) {
-          ESP_LOGE(TAG, "Error formatting tag as NDEF");
-        }
-        ESP_LOGD(TAG, "  Tag formatted!");
-        break;
-
-      case EP_WRITE:
-        if (this->next_task_message_to_write_ != nullptr) {
-          ESP_LOGD(TAG, "  Tag writing\n"
-                        "  Tag formatting");
-          if (this->format_endpoint_(working_endpoint.tag->get_uid()) != nfc::STATUS_OK) {
-            ESP_LOGE(TAG, "  Tag could not be formatted for writing");
-          } else {
-            ESP_LOGD(TAG, "  Writing NDEF data");
-            if (this->write_endpoint_(working_endpoint.tag->get_uid(), this->next_task_message_to_write_) !=
-                nfc::STATUS_OK) {
-              ESP_LOGE(TAG, "  Failed to write message to tag");
-            }
-            ESP_LOGD(TAG, "  Finished writing NDEF data");
-            this->next_task_message_to_write_ = nullptr;
-            this->on_finished_write_callback_.call();
-          }
-        }
-        break;
-
-      case EP_READ:
-      default:
-        if (!working_endpoint.trig_called) {
-          char uid_buf[nfc::FORMAT_UID_BUFFER_SIZE];
-          ESP_LOGI(TAG, "Read tag type %s with UID %s", working_endpoint.tag->get_tag_type().c_str(),
-                   nfc::format_uid_to(uid_buf, working_endpoint.tag->get_uid()));
-          if (this->read_endpoint_data_(*working_endpoint.tag) != nfc::STATUS_OK) {
-            ESP_LOGW(TAG, "  Unable to read NDEF record(s)");
-          } else if (working_endpoint.tag->has_ndef_message()) {
-            const auto message = working_endpoint.tag->get_ndef_message();
-            const auto records = message->get_records();
-            ESP_LOGD(TAG, "  NDEF record(s):");
-            for (const auto &record : records) {
-              ESP_LOGD(TAG, "    %s - %s", record->get_type().c_str(), record->get_payload().c_str());
-            }
-          } else {
-            ESP_LOGW(TAG, "  No NDEF records found");
-          }
-          for (auto *trigger : this->triggers_ontag_) {
-            trigger->process(working_endpoint.tag);
-          }
-          for (auto *listener : this->tag_listeners_) {
-            listener->tag_on(*working_endpoint.tag);
-          }
-          working_endpoint.trig_called = true;
-          break;
-        }
-    }
-    if (working_endpoint.tag->get_tag_type() == nfc::MIFARE_CLASSIC) {
-      this->halt_mifare_classic_tag_();
-    }
-  }
-  if (this->next_task_ != EP_READ) {
-    this->read_mode();
-  }
-
-  if (this->stop_discovery_() != nfc::STATUS_OK) {
-    ESP_LOGW(TAG, "Failed to deactivate -- forcing NFCC reset");
-    this->nci_fsm_set_state_(NCIState::NFCC_RESET);
-  } else {
-    this->nci_fsm_set_state_(NCIState::EP_DEACTIVATING);
+    this->start_tag_operation_(slot.value());
   }
 }
 
-void PN7160::process_rf_discover_oid_(nfc::NciMessage &rx) {
-  auto incoming_tag = this->build_tag_(rx.get_message_byte(nfc::RF_DISCOVER_NTF_MODE_TECH),
-                                       std::vector<uint8_t>(rx.get_message().begin() + 7, rx.get_message().end()));
-
-  if (incoming_tag == nullptr) {
+void PN7160::process_rf_discover_oid_(NciFrame &rx) {
+  DiscoveredEndpoint found{};
+  found.id = rx.get_message_byte(nfc::RF_DISCOVER_NTF_DISCOVERY_ID);
+  found.protocol = rx.get_message_byte(nfc::RF_DISCOVER_NTF_PROTOCOL);
+  if (this->parse_tech_params_(rx.get_message_byte(nfc::RF_DISCOVER_NTF_MODE_TECH), found.protocol,
+                               rx.data() + nfc::RF_DISCOVER_NTF_RF_TECH_PARAMS,
+                               rx.size() > nfc::RF_DISCOVER_NTF_RF_TECH_PARAMS
+                                   ? rx.size() - nfc::RF_DISCOVER_NTF_RF_TECH_PARAMS
+                                   : 0,
+                               found) != nfc::STATUS_OK ||
+      !this->cache_endpoint_(found).has_value()) {
     ESP_LOGE(TAG, "Could not build tag!");
-  } else {
-    auto tag_loc = this->find_tag_uid_(incoming_tag->get_uid());
-    if (tag_loc.has_value()) {
-      this->discovered_endpoint_[tag_loc.value()].id = rx.get_message_byte(nfc::RF_DISCOVER_NTF_DISCOVERY_ID);
-      this->discovered_endpoint_[tag_loc.value()].protocol = rx.get_message_byte(nfc::RF_DISCOVER_NTF_PROTOCOL);
-      this->discovered_endpoint_[tag_loc.value()].last_seen = millis();
-      ESP_LOGVV(TAG, "Tag found & updated");
-    } else {
-      this->discovered_endpoint_.emplace_back(DiscoveredEndpoint{rx.get_message_byte(nfc::RF_DISCOVER_NTF_DISCOVERY_ID),
-                                                                 rx.get_message_byte(nfc::RF_DISCOVER_NTF_PROTOCOL),
-                                                                 millis(), std::move(incoming_tag), false});
-      ESP_LOGVV(TAG, "Tag saved");
-    }
   }
 
-  if (rx.get_message().back() != nfc::RF_DISCOVER_NTF_NT_MORE) {
+  if (rx.get_message_byte(rx.size() - 1) != nfc::RF_DISCOVER_NTF_NT_MORE) {
     this->nci_fsm_set_state_(NCIState::RFST_W4_HOST_SELECT);
     ESP_LOGVV(TAG, "Discovered %u endpoints", this->discovered_endpoint_.size());
   }
 }
 
-void PN7160::process_rf_deactivate_oid_(nfc::NciMessage &rx) {
+void PN7160::process_rf_deactivate_oid_(NciFrame &rx) {
   this->ce_state_ = CardEmulationState::CARD_EMU_IDLE;
 
   switch (rx.get_simple_status_response()) {
@@ -1018,200 +1752,546 @@ void PN7160::process_rf_deactivate_oid_(nfc::NciMessage &rx) {
   }
 }
 
-void PN7160::process_data_message_(nfc::NciMessage &rx) {
-  char buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
-  ESP_LOGVV(TAG, "Received data message: %s", nfc::format_bytes_to(buf, rx.get_message()));
+void PN7160::process_data_message_(NciFrame &rx) {
+  // a C-APDU longer than the connection's max payload (an UPDATE BINARY near MLc) arrives in segments
+  auto &capdu = this->card_emulation_capdu_;
+  capdu.assign(rx.payload(), rx.payload() + rx.get_payload_size());
+  uint8_t read_retries = 0;
+  while (rx.get_pbf()) {
+    if (this->read_data_packet_(rx, NFCC_DEFAULT_TIMEOUT, read_retries) != nfc::STATUS_OK) {
+      ESP_LOGE(TAG, "Incomplete C-APDU for card emulation");
+      return;
+    }
+    capdu.insert(capdu.end(), rx.payload(), rx.payload() + rx.get_payload_size());
+  }
 
-  std::vector<uint8_t> ndef_response;
-  this->card_emu_t4t_get_response_(rx.get_message(), ndef_response);
+  auto &rapdu = this->card_emulation_rapdu_;
+  rapdu.clear();
+  this->card_emu_t4t_get_response_(capdu.data(), capdu.size(), rapdu);
 
-  uint16_t ndef_response_size = ndef_response.size();
-  if (!ndef_response_size) {
+  if (rapdu.empty()) {
     return;  // no message returned, we cannot respond
   }
 
-  std::vector<uint8_t> tx_msg = {nfc::NCI_PKT_MT_DATA, uint8_t((ndef_response_size & 0xFF00) >> 8),
-                                 uint8_t(ndef_response_size & 0x00FF)};
-  tx_msg.insert(tx_msg.end(), ndef_response.begin(), ndef_response.end());
-  nfc::NciMessage tx(tx_msg);
-  ESP_LOGVV(TAG, "Sending data message: %s", nfc::format_bytes_to(buf, tx.get_message()));
-  if (this->transceive_(tx, rx, NFCC_DEFAULT_TIMEOUT, false) != nfc::STATUS_OK) {
+  // without a response to wait for, the credit comes back through process_message_()
+  if (this->send_data_message_(rx.get_gid(), rapdu.data(), rapdu.size(), NFCC_DEFAULT_TIMEOUT, false) !=
+      nfc::STATUS_OK) {
     ESP_LOGE(TAG, "Sending reply for card emulation failed");
   }
 }
 
-void PN7160::card_emu_t4t_get_response_(std::vector<uint8_t> &response, std::vector<uint8_t> &ndef_response) {
+static bool capdu_is(const uint8_t *capdu, size_t capdu_length, const uint8_t *command, size_t length) {
+  return (capdu_length == length) && (std::memcmp(capdu, command, length) == 0);
+}
+
+/// true if READ BINARY of `length` bytes at `offset` is inside a file of `file_size` bytes; if not, puts the error
+/// status word in `rapdu`: 6B00 for an offset past the end, or 6Cxx with the bytes left from it
+static bool card_emu_read_fits(const uint16_t offset, const uint16_t length, const uint32_t file_size,
+                               std::vector<uint8_t> &rapdu) {
+  if (offset >= file_size) {
+    rapdu.insert(rapdu.end(), std::begin(CARD_EMU_T4T_WRONG_OFFSET), std::end(CARD_EMU_T4T_WRONG_OFFSET));
+    return false;
+  }
+  if (offset + length > file_size) {
+    rapdu.push_back(CARD_EMU_T4T_WRONG_LE);
+    rapdu.push_back((file_size - offset) & 0xFF);
+    return false;
+  }
+  return true;
+}
+
+static bool capdu_starts_with(const uint8_t *capdu, size_t capdu_length, const uint8_t *command, size_t length) {
+  return (capdu_length >= length) && (std::memcmp(capdu, command, length) == 0);
+}
+
+void PN7160::card_emu_t4t_get_response_(const uint8_t *capdu, const size_t capdu_length,
+                                        std::vector<uint8_t> &rapdu) {
   if (this->card_emulation_message_ == nullptr) {
     ESP_LOGE(TAG, "No NDEF message is set; tag emulation not possible");
-    ndef_response.clear();
     return;
   }
 
-  if (equal(response.begin() + nfc::NCI_PKT_HEADER_SIZE, response.end(), std::begin(CARD_EMU_T4T_APP_SELECT))) {
+  if (capdu_is(capdu, capdu_length, CARD_EMU_T4T_APP_SELECT, sizeof(CARD_EMU_T4T_APP_SELECT))) {
     // CARD_EMU_T4T_APP_SELECT
     ESP_LOGVV(TAG, "CARD_EMU_NDEF_APP_SELECTED");
     this->ce_state_ = CardEmulationState::CARD_EMU_NDEF_APP_SELECTED;
-    ndef_response.insert(ndef_response.begin(), std::begin(CARD_EMU_T4T_OK), std::end(CARD_EMU_T4T_OK));
-  } else if (equal(response.begin() + nfc::NCI_PKT_HEADER_SIZE, response.end(), std::begin(CARD_EMU_T4T_CC_SELECT))) {
+    rapdu.insert(rapdu.end(), std::begin(CARD_EMU_T4T_OK), std::end(CARD_EMU_T4T_OK));
+  } else if (capdu_is(capdu, capdu_length, CARD_EMU_T4T_CC_SELECT, sizeof(CARD_EMU_T4T_CC_SELECT))) {
     // CARD_EMU_T4T_CC_SELECT
     if (this->ce_state_ == CardEmulationState::CARD_EMU_NDEF_APP_SELECTED) {
       ESP_LOGVV(TAG, "CARD_EMU_CC_SELECTED");
       this->ce_state_ = CardEmulationState::CARD_EMU_CC_SELECTED;
-      ndef_response.insert(ndef_response.begin(), std::begin(CARD_EMU_T4T_OK), std::end(CARD_EMU_T4T_OK));
+      rapdu.insert(rapdu.end(), std::begin(CARD_EMU_T4T_OK), std::end(CARD_EMU_T4T_OK));
     }
-  } else if (equal(response.begin() + nfc::NCI_PKT_HEADER_SIZE, response.end(), std::begin(CARD_EMU_T4T_NDEF_SELECT))) {
+  } else if (capdu_is(capdu, capdu_length, CARD_EMU_T4T_NDEF_SELECT, sizeof(CARD_EMU_T4T_NDEF_SELECT))) {
     // CARD_EMU_T4T_NDEF_SELECT
     ESP_LOGVV(TAG, "CARD_EMU_NDEF_SELECTED");
     this->ce_state_ = CardEmulationState::CARD_EMU_NDEF_SELECTED;
-    ndef_response.insert(ndef_response.begin(), std::begin(CARD_EMU_T4T_OK), std::end(CARD_EMU_T4T_OK));
-  } else if (equal(response.begin() + nfc::NCI_PKT_HEADER_SIZE,
-                   response.begin() + nfc::NCI_PKT_HEADER_SIZE + sizeof(CARD_EMU_T4T_READ),
-                   std::begin(CARD_EMU_T4T_READ))) {
+    rapdu.insert(rapdu.end(), std::begin(CARD_EMU_T4T_OK), std::end(CARD_EMU_T4T_OK));
+  } else if (capdu_starts_with(capdu, capdu_length, CARD_EMU_T4T_READ, sizeof(CARD_EMU_T4T_READ)) &&
+             capdu_length >= 5) {
     // CARD_EMU_T4T_READ
+    uint16_t offset = (capdu[2] << 8) + capdu[3];
+    // a short Le of zero asks for 256 bytes; the reply then goes out in more than one segment
+    uint16_t length = capdu[4] ? capdu[4] : 256;
+
     if (this->ce_state_ == CardEmulationState::CARD_EMU_CC_SELECTED) {
       // CARD_EMU_T4T_READ with CARD_EMU_CC_SELECTED
       ESP_LOGVV(TAG, "CARD_EMU_T4T_READ with CARD_EMU_CC_SELECTED");
-      uint16_t offset = (response[nfc::NCI_PKT_HEADER_SIZE + 2] << 8) + response[nfc::NCI_PKT_HEADER_SIZE + 3];
-      uint8_t length = response[nfc::NCI_PKT_HEADER_SIZE + 4];
-
-      if (length <= (sizeof(CARD_EMU_T4T_CC) + offset + 2)) {
-        ndef_response.insert(ndef_response.begin(), std::begin(CARD_EMU_T4T_CC) + offset,
-                             std::begin(CARD_EMU_T4T_CC) + offset + length);
-        ndef_response.insert(ndef_response.end(), std::begin(CARD_EMU_T4T_OK), std::end(CARD_EMU_T4T_OK));
+      if (card_emu_read_fits(offset, length, sizeof(CARD_EMU_T4T_CC), rapdu)) {
+        uint8_t cc[sizeof(CARD_EMU_T4T_CC)];
+        std::memcpy(cc, CARD_EMU_T4T_CC, sizeof(cc));
+        // the NDEF file holds NLEN and the message; a reader can have all of it in one READ BINARY if it fits one
+        const uint16_t file_size =
+            std::min<size_t>(this->card_emulation_ndef_.size() + 2, CARD_EMU_T4T_MAX_FILE_SIZE);
+        const uint16_t mle = std::max<uint16_t>(std::min(file_size, CARD_EMU_T4T_MAX_LE), sizeof(cc));
+        cc[CARD_EMU_T4T_CC_MLE] = mle >> 8;
+        cc[CARD_EMU_T4T_CC_MLE + 1] = mle & 0xFF;
+        cc[CARD_EMU_T4T_CC_FILE_SIZE] = file_size >> 8;
+        cc[CARD_EMU_T4T_CC_FILE_SIZE + 1] = file_size & 0xFF;
+        rapdu.insert(rapdu.end(), cc + offset, cc + offset + length);
+        rapdu.insert(rapdu.end(), std::begin(CARD_EMU_T4T_OK), std::end(CARD_EMU_T4T_OK));
       }
     } else if (this->ce_state_ == CardEmulationState::CARD_EMU_NDEF_SELECTED) {
       // CARD_EMU_T4T_READ with CARD_EMU_NDEF_SELECTED
       ESP_LOGVV(TAG, "CARD_EMU_T4T_READ with CARD_EMU_NDEF_SELECTED");
-      auto ndef_message = this->card_emulation_message_->encode();
-      uint16_t ndef_msg_size = ndef_message.size();
-      uint16_t offset = (response[nfc::NCI_PKT_HEADER_SIZE + 2] << 8) + response[nfc::NCI_PKT_HEADER_SIZE + 3];
-      uint8_t length = response[nfc::NCI_PKT_HEADER_SIZE + 4];
+      // the NDEF file is the two-byte NLEN followed by the encoded message
+      const auto &ndef_message = this->card_emulation_ndef_;
+      const uint16_t ndef_msg_size = ndef_message.size();
+      const uint32_t file_size = ndef_msg_size + 2;
 
       char ndef_buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
-      ESP_LOGVV(TAG, "Encoded NDEF message: %s", nfc::format_bytes_to(ndef_buf, ndef_message));
-
-      if (length <= (ndef_msg_size + offset + 2)) {
-        if (offset == 0) {
-          ndef_response.resize(2);
-          ndef_response[0] = (ndef_msg_size & 0xFF00) >> 8;
-          ndef_response[1] = (ndef_msg_size & 0x00FF);
-          if (length > 2) {
-            ndef_response.insert(ndef_response.end(), ndef_message.begin(), ndef_message.begin() + length - 2);
-          }
-        } else if (offset == 1) {
-          ndef_response.resize(1);
-          ndef_response[0] = (ndef_msg_size & 0x00FF);
-          if (length > 1) {
-            ndef_response.insert(ndef_response.end(), ndef_message.begin(), ndef_message.begin() + length - 1);
-          }
-        } else {
-          ndef_response.insert(ndef_response.end(), ndef_message.begin(), ndef_message.begin() + length);
-        }
+      ESP_LOGVV(TAG, "Encoded NDEF message: %s", format_frame_to(ndef_buf, ndef_message.data(), ndef_msg_size));
 
-        ndef_response.insert(ndef_response.end(), std::begin(CARD_EMU_T4T_OK), std::end(CARD_EMU_T4T_OK));
-
-        if ((offset + length) >= (ndef_msg_size + 2)) {
+      if (card_emu_read_fits(offset, length, file_size, rapdu)) {
+        for (uint32_t i = offset; i < offset + length; i++) {
+          uint8_t byte = i == 0 ? (ndef_msg_size & 0xFF00) >> 8 : i == 1 ? (ndef_msg_size & 0x00FF) : ndef_message[i - 2];
+          rapdu.push_back(byte);
+        }
+        rapdu.insert(rapdu.end(), std::begin(CARD_EMU_T4T_OK), std::end(CARD_EMU_T4T_OK));
+        if ((offset + length) >= file_size) {
           ESP_LOGD(TAG, "NDEF message sent");
-          this->on_emulated_tag_scan_callback_.call();
+          this->notify_(NfcEventType::EMULATED_TAG_SCAN);
         }
       }
     }
-  } else if (equal(response.begin() + nfc::NCI_PKT_HEADER_SIZE,
-                   response.begin() + nfc::NCI_PKT_HEADER_SIZE + sizeof(CARD_EMU_T4T_WRITE),
-                   std::begin(CARD_EMU_T4T_WRITE))) {
+  } else if (capdu_starts_with(capdu, capdu_length, CARD_EMU_T4T_WRITE, sizeof(CARD_EMU_T4T_WRITE)) &&
+             capdu_length >= 5) {
     // CARD_EMU_T4T_WRITE
     if (this->ce_state_ == CardEmulationState::CARD_EMU_NDEF_SELECTED) {
       ESP_LOGVV(TAG, "CARD_EMU_T4T_WRITE");
-      uint8_t length = response[nfc::NCI_PKT_HEADER_SIZE + 4];
-      std::vector<uint8_t> ndef_msg_written;
-
-      ndef_msg_written.insert(ndef_msg_written.end(), response.begin() + nfc::NCI_PKT_HEADER_SIZE + 5,
-                              response.begin() + nfc::NCI_PKT_HEADER_SIZE + 5 + length);
-      char write_buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
-      ESP_LOGD(TAG, "Received %u-byte NDEF message: %s", length, nfc::format_bytes_to(write_buf, ndef_msg_written));
-      ndef_response.insert(ndef_response.end(), std::begin(CARD_EMU_T4T_OK), std::end(CARD_EMU_T4T_OK));
+      uint8_t length = capdu[4];
+      if (5u + length <= capdu_length) {
+        char write_buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
+        ESP_LOGD(TAG, "Received %u-byte NDEF message: %s", length, format_frame_to(write_buf, capdu + 5, length));
+        rapdu.insert(rapdu.end(), std::begin(CARD_EMU_T4T_OK), std::end(CARD_EMU_T4T_OK));
+      }
+    }
+  }
+}
+
+uint8_t PN7160::read_frame_(NciFrame &rx, const uint16_t timeout) {
+  const uint8_t status = this->read_nfcc(rx, timeout);
+  if (status == nfc::STATUS_OK) {
+#ifdef USE_PN7160_TRACE
+    this->trace_.record(NciTrace::TRACE_RX, this->micros_(), rx.data(), rx.size());
+#else
+    char buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
+    ESP_LOGVV(TAG, "Read: %s", format_frame_to(buf, rx));
+#endif
+  }
+  return status;
+}
+
+uint8_t PN7160::write_frame_(NciFrame &tx) {
+  // recorded before it goes out, so a write that fails still shows up
+#ifdef USE_PN7160_TRACE
+  this->trace_.record(NciTrace::TRACE_TX, this->micros_(), tx.data(), tx.size());
+#else
+  char buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
+  ESP_LOGVV(TAG, "Wrote: %s", format_frame_to(buf, tx));
+#endif
+  return this->write_nfcc(tx);
+}
+
+#ifdef USE_PN7160_TRACE
+void PN7160::dump_trace() {
+  static const size_t BYTES_PER_LINE = 32;
+  std::vector<uint8_t> trace;
+  uint32_t records;
+  uint32_t dropped;
+  {
+#ifdef USE_PN7160_TASK
+    LockGuard guard(this->nci_lock_);
+#endif
+    this->trace_.copy_to(trace);
+    records = this->trace_.records();
+    dropped = this->trace_.dropped();
+  }
+  ESP_LOGI(TAG, "NCI trace: %" PRIu32 " frames, %" PRIu32 " dropped, timestamps in us", records, dropped);
+  char line[BYTES_PER_LINE * 2 + 1];
+  for (size_t offset = 0; offset < trace.size(); offset += BYTES_PER_LINE) {
+    const size_t length = std::min(BYTES_PER_LINE, trace.size() - offset);
+    for (size_t i = 0; i < length; i++) {
+      line[i * 2] = format_hex_char(trace[offset + i] >> 4);
+      line[i * 2 + 1] = format_hex_char(trace[offset + i] & 0x0F);
+    }
+    line[length * 2] = '\0';
+    ESP_LOGI(TAG, "TRACE %s", line);
+  }
+  ESP_LOGI(TAG, "TRACE END");
+}
+
+void PN7160::clear_trace() {
+#ifdef USE_PN7160_TASK
+  LockGuard guard(this->nci_lock_);
+#endif
+  this->trace_.clear();
+}
+#endif
+
+uint8_t PN7160::transceive_(NciFrame &tx, NciFrame &rx, const uint16_t timeout, const bool expect_notification) {
+  if (tx.message_type_is(nfc::NCI_PKT_MT_DATA)) {
+    // without a response to wait for (a card emulation reply), the credit comes back through process_message_()
+    if (this->send_data_(tx, timeout, expect_notification) != nfc::STATUS_OK) {
+      return nfc::STATUS_FAILED;
     }
+    return expect_notification ? this->receive_data_(rx, timeout) : nfc::STATUS_OK;
   }
+
+  uint8_t read_retries = 0;
+#ifdef USE_PN7160_STATS
+  const uint32_t start_us = this->micros_();
+  const uint8_t header[] = {tx.data()[0], tx.data()[1]};
+  const uint8_t status = this->transceive_frame_(tx, rx, timeout, read_retries);
+  this->stats_.record_transceive(header, this->micros_() - start_us, read_retries, status == nfc::STATUS_OK);
+  return status;
+#else
+  return this->transceive_frame_(tx, rx, timeout, read_retries);
+#endif
 }
 
-uint8_t PN7160::transceive_(nfc::NciMessage &tx, nfc::NciMessage &rx, const uint16_t timeout,
-                            const bool expect_notification) {
+uint8_t PN7160::transceive_frame_(NciFrame &tx, NciFrame &rx, const uint16_t timeout, uint8_t &read_retries) {
   char buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
 
+  // none of the driver's commands come near it, so they are never segmented
+  if (tx.get_payload_size() > this->max_ctrl_payload_) {
+    ESP_LOGE(TAG, "Command of %u bytes exceeds the NFCC's %u-byte control payload", tx.get_payload_size(),
+             this->max_ctrl_payload_);
+    return nfc::STATUS_FAILED;
+  }
+
   // Send command ONCE only -- resending on read timeout confuses the NCI state machine
-  if (this->write_nfcc(tx) != nfc::STATUS_OK) {
+  if (this->write_frame_(tx) != nfc::STATUS_OK) {
     ESP_LOGE(TAG, "Error sending message");
     return nfc::STATUS_FAILED;
   }
-  ESP_LOGVV(TAG, "Wrote: %s", nfc::format_bytes_to(buf, tx.get_message()));
 
   // Retry reads only -- chip has already received the command
+  if (this->read_frame_retrying_(rx, timeout, read_retries) != nfc::STATUS_OK) {
+    return nfc::STATUS_FAILED;
+  }
+
+  if ((rx.get_gid() != tx.get_gid()) || (rx.get_oid() != tx.get_oid())) {
+    ESP_LOGE(TAG, "Incorrect response to command: %s", format_frame_to(buf, rx));
+    return nfc::STATUS_FAILED;
+  }
+  if (!rx.simple_status_response_is(nfc::STATUS_OK)) {
+    ESP_LOGE(TAG, "Error in response to command: %s", format_frame_to(buf, rx));
+  }
+  return rx.get_simple_status_response();
+}
+
+uint8_t PN7160::read_frame_retrying_(NciFrame &rx, const uint16_t timeout, uint8_t &read_retries) {
   uint8_t retries = NFCC_MAX_COMM_FAILS;
-  while (true) {
-    if (this->read_nfcc(rx, timeout) == nfc::STATUS_OK) {
-      break;
-    }
+  while (this->read_frame_(rx, timeout) != nfc::STATUS_OK) {
     if (!retries--) {
       ESP_LOGE(TAG, "Error receiving message -- giving up");
       return nfc::STATUS_FAILED;
     }
+    read_retries++;
     ESP_LOGW(TAG, "Error receiving message -- retrying read");
   }
+  return nfc::STATUS_OK;
+}
+
+static bool is_conn_credits_ntf(const NciFrame &rx) {
+  return rx.message_type_is(nfc::NCI_PKT_MT_CTRL_NOTIFICATION) && rx.gid_is(nfc::NCI_CORE_GID) &&
+         rx.oid_is(nfc::NCI_CORE_CONN_CREDITS_OID);
+}
+
+static bool is_interface_error_ntf(const NciFrame &rx) {
+  return rx.message_type_is(nfc::NCI_PKT_MT_CTRL_NOTIFICATION) && rx.gid_is(nfc::NCI_CORE_GID) &&
+         rx.oid_is(nfc::NCI_CORE_INTERFACE_ERROR_OID);
+}
+
+uint8_t PN7160::send_data_(NciFrame &tx, const uint16_t timeout, const bool expect_response) {
+  if (expect_response && this->data_in_flight_ == NCI_MAX_DATA_IN_FLIGHT) {
+    ESP_LOGE(TAG, "Too many data packets in flight");
+    return nfc::STATUS_FAILED;
+  }
+  const uint8_t conn = tx.get_gid();
+  if (tx.get_payload_size() > this->conn_max_payload_[conn]) {
+    ESP_LOGE(TAG, "Data packet of %u bytes exceeds connection %u's %u-byte payload", tx.get_payload_size(), conn,
+             this->conn_max_payload_[conn]);
+    return nfc::STATUS_FAILED;
+  }
+  if (this->wait_for_credit_(conn, timeout) != nfc::STATUS_OK) {
+    return nfc::STATUS_FAILED;
+  }
+  if (this->write_frame_(tx) != nfc::STATUS_OK) {
+    ESP_LOGE(TAG, "Error sending data");
+    return nfc::STATUS_FAILED;
+  }
+  this->conn_credits_[conn]--;
+  if (expect_response) {
+#ifdef USE_PN7160_STATS
+    this->data_sent_us_[this->data_in_flight_] = this->micros_();
+#endif
+    this->data_in_flight_++;
+  }
+  return nfc::STATUS_OK;
+}
+
+uint8_t PN7160::receive_data_(NciFrame &rx, const uint16_t timeout) {
+  if (!this->data_in_flight_) {
+    ESP_LOGE(TAG, "No data packet is awaiting a response");
+    return nfc::STATUS_FAILED;
+  }
+
+  uint8_t read_retries = 0;
+  uint8_t status = this->read_data_packet_(rx, timeout, read_retries);
+  if (status == nfc::STATUS_OK && rx.get_pbf()) {
+    // only receive_data_message_() can hold more than one packet; drop the rest so the next response lines up
+    ESP_LOGE(TAG, "Segmented response where one packet was expected");
+    NciFrame segment;
+    do {
+      if (this->read_data_packet_(segment, timeout, read_retries) != nfc::STATUS_OK) {
+        break;
+      }
+    } while (segment.get_pbf());
+    status = nfc::STATUS_FAILED;
+  }
+  this->data_response_received_(read_retries, status == nfc::STATUS_OK);
+  return status;
+}
+
+uint8_t PN7160::receive_data_message_(std::vector<uint8_t> &message, const uint16_t timeout) {
+  if (!this->data_in_flight_) {
+    ESP_LOGE(TAG, "No data packet is awaiting a response");
+    return nfc::STATUS_FAILED;
+  }
 
-  ESP_LOGVV(TAG, "Read: %s", nfc::format_bytes_to(buf, rx.get_message()));
+  message.clear();
+  uint8_t read_retries = 0;
+  uint8_t status;
+  NciFrame rx;
+  do {
+    status = this->read_data_packet_(rx, timeout, read_retries);
+    if (status != nfc::STATUS_OK) {
+      break;
+    }
+    message.insert(message.end(), rx.payload(), rx.payload() + rx.get_payload_size());
+  } while (rx.get_pbf());
+  this->data_response_received_(read_retries, status == nfc::STATUS_OK);
+  return status;
+}
+
+uint8_t PN7160::send_data_message_(const uint8_t conn, const uint8_t *payload, const size_t length,
+                                   const uint16_t timeout, const bool expect_response) {
+  const uint8_t max_payload = this->conn_max_payload_[conn];
+  NciFrame tx;
+  size_t offset = 0;
+  do {
+    const size_t segment = std::min<size_t>(length - offset, max_payload);
+    tx.set_message(nfc::NCI_PKT_MT_DATA, conn, 0, payload + offset, segment);
+    offset += segment;
+    const bool last = offset == length;
+    tx.set_pbf(!last);
+    if (this->send_data_(tx, timeout, last && expect_response) != nfc::STATUS_OK) {
+      return nfc::STATUS_FAILED;
+    }
+  } while (offset < length);
+  return nfc::STATUS_OK;
+}
 
-  if (!tx.message_type_is(nfc::NCI_PKT_MT_DATA)) {
-    if ((rx.get_gid() != tx.get_gid()) || (rx.get_oid() != tx.get_oid())) {
-      ESP_LOGE(TAG, "Incorrect response to command: %s", nfc::format_bytes_to(buf, rx.get_message()));
+uint8_t PN7160::read_data_packet_(NciFrame &rx, const uint16_t timeout, uint8_t &read_retries) {
+  if (this->early_data_pending_) {
+    rx = this->early_data_;
+    this->early_data_pending_ = false;
+    return nfc::STATUS_OK;
+  }
+  while (true) {
+    if (this->read_frame_retrying_(rx, timeout, read_retries) != nfc::STATUS_OK) {
+      ESP_LOGE(TAG, "Error receiving data from endpoint");
       return nfc::STATUS_FAILED;
     }
-    if (!rx.simple_status_response_is(nfc::STATUS_OK)) {
-      ESP_LOGE(TAG, "Error in response to command: %s", nfc::format_bytes_to(buf, rx.get_message()));
+    if (rx.message_type_is(nfc::NCI_PKT_MT_DATA)) {
+      return nfc::STATUS_OK;
     }
-    return rx.get_simple_status_response();
-  } else {
-    if ((!rx.message_type_is(nfc::NCI_PKT_MT_CTRL_NOTIFICATION)) || (!rx.gid_is(nfc::NCI_CORE_GID)) ||
-        (!rx.oid_is(nfc::NCI_CORE_CONN_CREDITS_OID)) || (!rx.message_length_is(3))) {
-      ESP_LOGE(TAG, "Incorrect response to data message: %s", nfc::format_bytes_to(buf, rx.get_message()));
+    if (is_conn_credits_ntf(rx)) {
+      this->process_conn_credits_(rx);
+      continue;
+    }
+    if (is_interface_error_ntf(rx)) {
+      // the tag didn't answer, as when it has left the field; whether that is an error is up to the caller
+      ESP_LOGV(TAG, "RF interface error %02X", rx.get_simple_status_response());
       return nfc::STATUS_FAILED;
     }
-    if (expect_notification) {
-      if (this->read_nfcc(rx, timeout) != nfc::STATUS_OK) {
-        ESP_LOGE(TAG, "Error receiving data from endpoint");
-        return nfc::STATUS_FAILED;
-      }
-      ESP_LOGVV(TAG, "Read: %s", nfc::format_bytes_to(buf, rx.get_message()));
+    char buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
+    ESP_LOGE(TAG, "Incorrect response to data message: %s", format_frame_to(buf, rx));
+    return nfc::STATUS_FAILED;
+  }
+}
+
+void PN7160::data_response_received_(const uint8_t read_retries, const bool ok) {
+  this->data_in_flight_--;
+#ifdef USE_PN7160_STATS
+  const uint8_t header[] = {static_cast<uint8_t>(nfc::NCI_PKT_MT_DATA | NCI_STATIC_RF_CONN_ID), 0};
+  this->stats_.record_transceive(header, this->micros_() - this->data_sent_us_[0], read_retries, ok);
+  for (uint8_t i = 0; i < this->data_in_flight_; i++) {
+    this->data_sent_us_[i] = this->data_sent_us_[i + 1];
+  }
+#endif
+}
+
+uint8_t PN7160::wait_for_credit_(const uint8_t conn, const uint16_t timeout) {
+  uint8_t read_retries = 0;
+  while (!this->conn_credits_[conn]) {
+    NciFrame rx;
+    if (this->read_frame_retrying_(rx, timeout, read_retries) != nfc::STATUS_OK) {
+      ESP_LOGE(TAG, "No credit returned for connection %u", conn);
+      return nfc::STATUS_FAILED;
+    }
+    if (is_conn_credits_ntf(rx)) {
+      this->process_conn_credits_(rx);
+    } else if (rx.message_type_is(nfc::NCI_PKT_MT_DATA) && this->data_in_flight_ && !this->early_data_pending_) {
+      this->early_data_ = rx;
+      this->early_data_pending_ = true;
+    } else {
+      char buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
+      ESP_LOGE(TAG, "Unexpected frame while waiting for a credit: %s", format_frame_to(buf, rx));
+      return nfc::STATUS_FAILED;
+    }
+  }
+  return nfc::STATUS_OK;
+}
+
+void PN7160::discard_data_in_flight_() {
+  NciFrame rx;
+  while (this->data_in_flight_) {
+    if (this->receive_data_(rx) != nfc::STATUS_OK) {
+      break;
     }
-    return nfc::STATUS_OK;
   }
+  this->data_in_flight_ = 0;
+  this->early_data_pending_ = false;
+}
+
+void PN7160::process_conn_credits_(const NciFrame &rx) {
+  // a count, then a connection ID and the credits it gets back for each entry
+  const uint8_t entries = rx.get_message_byte(nfc::NCI_PKT_PAYLOAD_OFFSET);
+  for (uint8_t i = 0; i < entries; i++) {
+    const size_t offset = nfc::NCI_PKT_PAYLOAD_OFFSET + 1 + i * 2;
+    const uint8_t conn = rx.get_message_byte(offset) & nfc::NCI_PKT_GID_MASK;
+    const uint16_t credits = this->conn_credits_[conn] + rx.get_message_byte(offset + 1);
+    this->conn_credits_[conn] = std::min<uint16_t>(credits, UINT8_MAX);
+  }
+}
+
+void IRAM_ATTR PN7160::gpio_intr(PN7160 *arg) {
+  arg->irq_edge_pending_ = true;
+#ifdef USE_ESP32
+  TaskHandle_t waiting_task = arg->irq_waiting_task_;
+  if (waiting_task != nullptr) {
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    vTaskNotifyGiveFromISR(waiting_task, &higher_priority_task_woken);
+    portYIELD_FROM_ISR(higher_priority_task_woken);
+  }
+#endif
 }
 
 uint8_t PN7160::wait_for_irq_(uint16_t timeout, bool pin_state) {
   auto start_time = millis();
 
-  while (millis() - start_time < timeout) {
-    if (this->irq_pin_->digital_read() == pin_state) {
-      return nfc::STATUS_OK;
+  if (!pin_state) {
+    // the NFCC drops IRQ within microseconds of the frame being read out, so there is no edge worth waiting for
+    while (millis() - start_time < timeout) {
+      if (!this->irq_asserted_()) {
+        return nfc::STATUS_OK;
+      }
+      yield();
     }
+    ESP_LOGW(TAG, "Timed out waiting for IRQ to clear");
+    return nfc::STATUS_FAILED;
   }
-  ESP_LOGW(TAG, "Timed out waiting for IRQ state");
-  return nfc::STATUS_FAILED;
+
+#ifdef USE_ESP32
+  if (this->irq_interrupt_) {
+    this->irq_waiting_task_ = xTaskGetCurrentTaskHandle();
+    ulTaskNotifyTake(pdTRUE, 0);  // drop any notification left over from an earlier frame
+  }
+#endif
+
+  auto status = nfc::STATUS_FAILED;
+  while (true) {
+    // only clear the latch if it was set; an edge arriving between the read and the clear is merged, not lost
+    bool edge = this->irq_edge_pending_;
+    if (edge) {
+      this->irq_edge_pending_ = false;
+    }
+    if (this->irq_asserted_()) {
+      if (!edge && this->irq_interrupt_) {
+        this->irq_missed_edges_++;
+      }
+#ifdef USE_PN7160_TRACE
+      this->trace_.record(NciTrace::TRACE_IRQ, this->micros_(), nullptr, 0);
+#endif
+      status = nfc::STATUS_OK;
+      break;
+    }
+    if (edge) {
+      this->irq_spurious_edges_++;
+    }
+
+    uint32_t elapsed = millis() - start_time;
+    if (elapsed >= timeout) {
+      break;
+    }
+#ifdef USE_ESP32
+    if (this->irq_interrupt_) {
+      // sleep until the ISR wakes us; the level is re-checked every tick in case an edge was missed
+      ulTaskNotifyTake(pdTRUE, 1);
+      continue;
+    }
+#endif
+    yield();
+  }
+
+#ifdef USE_ESP32
+  this->irq_waiting_task_ = nullptr;
+#endif
+  if (status != nfc::STATUS_OK) {
+    ESP_LOGW(TAG, "Timed out waiting for IRQ state");
+#ifdef USE_PN7160_STATS
+    this->stats_.record_irq_timeout();
+#endif
+  }
+  return status;
 }
 
 void PN7160::reset_via_ven_() {
-  ESP_LOGW(TAG, "Performing hardware reset via VEN pin");
-  this->ven_pin_->digital_write(false);
-  delay(NFCC_DEFAULT_TIMEOUT);
-  this->ven_pin_->digital_write(true);
-  delay(NFCC_INIT_TIMEOUT);
-  this->nci_fsm_set_state_(NCIState::NFCC_RESET);
+  if (this->ven_pin_ != nullptr) {
+    ESP_LOGW(TAG, "Performing hardware reset via VEN pin");
+  }
+  this->nci_fsm_set_state_(NCIState::NFCC_RESET);  // NFCC_RESET power cycles it from loop()
 }
 
 void PN7160::perform_health_check_() {
   if (!this->health_check_enabled_)
     return;
 
-  uint32_t now = millis();
+  uint32_t now = this->millis_();
   if (now - this->last_health_check_ < this->health_check_interval_)
     return;
   this->last_health_check_ = now;
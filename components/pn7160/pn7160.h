@@ -6,22 +6,51 @@
 #include "esphome/components/nfc/nfc.h"
 #include "esphome/components/nfc/nfc_helpers.h"
 #include "esphome/core/component.h"
+#include "esphome/core/defines.h"
 #include "esphome/core/gpio.h"
+#include "esphome/core/hal.h"
 #include "esphome/core/helpers.h"
 
+#include "nci_frame.h"
+#include "pn7160_event_queue.h"
+#include "pn7160_expiry_queue.h"
+#include "pn7160_stats.h"
+#include "pn7160_trace.h"
+
 #include <functional>
 
+#ifdef USE_ESP32
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+
 namespace esphome {
 namespace pn7160 {
 
 static const uint16_t NFCC_DEFAULT_TIMEOUT = 10;
 static const uint16_t NFCC_INIT_TIMEOUT = 50;
 static const uint16_t NFCC_TAG_WRITE_TIMEOUT = 50;
+static const uint16_t NFCC_TAG_FAST_READ_TIMEOUT = 50;  // a packet's worth of FAST_READ is over 20 ms on air
+static const uint16_t NFCC_ISO_DEP_TIMEOUT = 100;       // a long R-APDU, plus any waiting time the card asks for
+static const uint16_t NFCC_DEFAULT_LOOP_BUDGET = 20;
 
 static const uint8_t NFCC_MAX_COMM_FAILS = 3;
 static const uint8_t NFCC_MAX_ERROR_COUNT = 10;
 
+static const uint8_t NCI_MAX_CONNECTIONS = 16;  // the connection ID in a data packet header is four bits
+static const uint8_t NCI_STATIC_RF_CONN_ID = 0;
+// data packets awaiting a response: one on air and the next queued in the NFCC behind it
+static const uint8_t NCI_MAX_DATA_IN_FLIGHT = 2;
+
+static const uint8_t NFCA_MAX_UID_LENGTH = 10;  // triple size; ISO 15693 UIDs are 8 bytes
+static const uint8_t IDENTITY_CACHE_SIZE = 8;   // Type 2 and 5 tags whose identification is kept for their next tap
+static const uint8_t ENDPOINT_TABLE_SIZE = 16;  // tags in the field at once; a power of two, for the hash
+static const uint8_t PRESENCE_CHECK_ATTEMPTS = 2;  // back to back, before a held tag is taken to have left
+static const uint8_t T4T_MAX_CAPDU_LENGTH = 13;    // SELECT of the NDEF application by name is the longest one sent
+
 static const uint8_t XCHG_DATA_OID = 0x10;
+// NCI 2.0: the NFCC sends an ISO-DEP NAK and reports in a notification whether the card answered
+static const uint8_t RF_ISO_DEP_NAK_PRESENCE_OID = 0x10;
 static const uint8_t MF_SECTORSEL_OID = 0x32;
 static const uint8_t MFC_AUTHENTICATE_OID = 0x40;
 static const uint8_t TEST_PRBS_OID = 0x30;
@@ -34,14 +63,21 @@ static const uint8_t MFC_AUTHENTICATE_PARAM_EMBED_KEY = 0x10;
 
 static const uint8_t CARD_EMU_T4T_APP_SELECT[] = {0x00, 0xA4, 0x04, 0x00, 0x07, 0xD2, 0x76,
                                                   0x00, 0x00, 0x85, 0x01, 0x01, 0x00};
-static const uint8_t CARD_EMU_T4T_CC[] = {0x00, 0x0F, 0x20, 0x00, 0xFF, 0x00, 0xFF, 0x04,
-                                          0x06, 0xE1, 0x04, 0x00, 0xFF, 0x00, 0x00};
+// MLe and the maximum NDEF file size are filled in from the message when the CC is read
+static const uint8_t CARD_EMU_T4T_CC[] = {0x00, 0x0F, 0x20, 0x00, 0x00, 0x00, 0xFF, 0x04,
+                                          0x06, 0xE1, 0x04, 0x00, 0x00, 0x00, 0x00};
+static const uint8_t CARD_EMU_T4T_CC_MLE = 3;
+static const uint8_t CARD_EMU_T4T_CC_FILE_SIZE = 11;
+static const uint16_t CARD_EMU_T4T_MAX_LE = 256;            // short Le; what a READ BINARY is answered with at most
+static const uint16_t CARD_EMU_T4T_MAX_FILE_SIZE = 0x7FFF;  // READ BINARY offsets are 15 bits
 static const uint8_t CARD_EMU_T4T_CC_SELECT[] = {0x00, 0xA4, 0x00, 0x0C, 0x02, 0xE1, 0x03};
 static const uint8_t CARD_EMU_T4T_NDEF_SELECT[] = {0x00, 0xA4, 0x00, 0x0C, 0x02, 0xE1, 0x04};
 static const uint8_t CARD_EMU_T4T_READ[] = {0x00, 0xB0};
 static const uint8_t CARD_EMU_T4T_WRITE[] = {0x00, 0xD6};
 static const uint8_t CARD_EMU_T4T_OK[] = {0x90, 0x00};
 static const uint8_t CARD_EMU_T4T_NOK[] = {0x6A, 0x82};
+static const uint8_t CARD_EMU_T4T_WRONG_OFFSET[] = {0x6B, 0x00};
+static const uint8_t CARD_EMU_T4T_WRONG_LE = 0x6C;  // followed by the number of bytes there are
 
 static const uint8_t CORE_CONFIG_SOLO[] = {0x01,   // Number of parameter fields
                                            0x00,   // config param identifier (TOTAL_DURATION)
@@ -81,6 +117,8 @@ static const uint8_t RF_DISCOVER_MAP_CONFIG[] = {  // poll modes
     nfc::INTF_FRAME,  // poll mode
     nfc::PROT_T3T,    nfc::RF_DISCOVER_MAP_MODE_POLL,
     nfc::INTF_FRAME,  // poll mode
+    nfc::PROT_T5T,    nfc::RF_DISCOVER_MAP_MODE_POLL,
+    nfc::INTF_FRAME,  // poll mode
     nfc::PROT_ISODEP, nfc::RF_DISCOVER_MAP_MODE_POLL | nfc::RF_DISCOVER_MAP_MODE_LISTEN,
     nfc::INTF_ISODEP,  // poll & listen mode
     nfc::PROT_MIFARE, nfc::RF_DISCOVER_MAP_MODE_POLL,
@@ -90,13 +128,15 @@ static const uint8_t RF_DISCOVERY_LISTEN_CONFIG[] = {nfc::MODE_LISTEN_MASK | nfc
                                                      nfc::MODE_LISTEN_MASK | nfc::TECH_PASSIVE_NFCB,   // listen mode
                                                      nfc::MODE_LISTEN_MASK | nfc::TECH_PASSIVE_NFCF};  // listen mode
 
-static const uint8_t RF_DISCOVERY_POLL_CONFIG[] = {nfc::MODE_POLL | nfc::TECH_PASSIVE_NFCA,   // poll mode
-                                                   nfc::MODE_POLL | nfc::TECH_PASSIVE_NFCB,   // poll mode
-                                                   nfc::MODE_POLL | nfc::TECH_PASSIVE_NFCF};  // poll mode
+static const uint8_t RF_DISCOVERY_POLL_CONFIG[] = {nfc::MODE_POLL | nfc::TECH_PASSIVE_NFCA,    // poll mode
+                                                   nfc::MODE_POLL | nfc::TECH_PASSIVE_NFCB,    // poll mode
+                                                   nfc::MODE_POLL | nfc::TECH_PASSIVE_NFCF,    // poll mode
+                                                   nfc::MODE_POLL | nfc::TECH_PASSIVE_15693};  // poll mode
 
 static const uint8_t RF_DISCOVERY_CONFIG[] = {nfc::MODE_POLL | nfc::TECH_PASSIVE_NFCA,          // poll mode
                                               nfc::MODE_POLL | nfc::TECH_PASSIVE_NFCB,          // poll mode
                                               nfc::MODE_POLL | nfc::TECH_PASSIVE_NFCF,          // poll mode
+                                              nfc::MODE_POLL | nfc::TECH_PASSIVE_15693,         // poll mode
                                               nfc::MODE_LISTEN_MASK | nfc::TECH_PASSIVE_NFCA,   // listen mode
                                               nfc::MODE_LISTEN_MASK | nfc::TECH_PASSIVE_NFCB,   // listen mode
                                               nfc::MODE_LISTEN_MASK | nfc::TECH_PASSIVE_NFCF};  // listen mode
@@ -149,12 +189,98 @@ enum class TestMode : uint8_t {
   TEST_GET_REGISTER,
 };
 
+/// result of advancing a resumable tag operation by one NCI exchange
+enum class TagOpStatus : uint8_t {
+  PENDING,  // more exchanges to go
+  DONE,
+  FAILED,
+};
+
+/// something the automations hear about; with the NFC task these are queued for the main loop rather than fired
+/// from the task
+enum class NfcEventType : uint8_t {
+  TAG_ON,
+  TAG_OFF,
+  FINISHED_WRITE,
+  EMULATED_TAG_SCAN,
+};
+
+static const uint8_t SEL_RES_NONE = 0xFF;  // not a valid SAK: bit 2 is "UID not complete"
+static const uint8_t TAG_TYPE_5 = 5;       // nfc::TAG_TYPE_* stops at Type 4
+
+/// Type 2 tag silicon, as far as GET_VERSION says; only tags with a data area past 144 bytes are asked
+enum class TagChip : uint8_t {
+  UNKNOWN,  // no GET_VERSION asked for or answered
+  NTAG215,
+  NTAG216,
+};
+
+/// what a Type 2 or 5 tag is and what it can do, worked out on its first tap and looked up by UID on the ones after
+struct TagIdentity {
+  uint8_t uid[NFCA_MAX_UID_LENGTH];
+  uint8_t uid_length;  // zero for an unused cache slot
+  TagChip chip;
+  uint16_t capacity;    // bytes in the data area, from the capability container
+  bool ndef_formatted;  // the capability container has the NDEF magic number
+  bool fast_read;       // the tag has FAST_READ (Type 2) or Read Multiple Blocks (Type 5)
+  uint8_t block_size;   // Type 5: bytes per block
+  uint8_t cc_length;    // Type 5: 4 bytes of capability container, or 8 for a data area past 2040 bytes
+};
+
+/// what an RF_DISCOVER_NTF or RF_INTF_ACTIVATED_NTF says about a tag besides its UID
+struct TechParams {
+  uint8_t mode_tech;
+  uint8_t tag_type;    // nfc::TAG_TYPE_* or TAG_TYPE_5, from the protocol and then SEL_RES and SENS_RES
+  uint16_t sens_res;   // NFC-A: SENS_RES (ATQA), its first byte in the low half
+  uint8_t sel_res;     // NFC-A: SEL_RES (SAK), or SEL_RES_NONE
+  uint8_t mrti_check;  // NFC-F: the PMm's maximum response time for Check
+};
+
+/// a C-APDU for a Type 4 tag, built on the stack
+struct T4tCapdu {
+  uint8_t data[T4T_MAX_CAPDU_LENGTH];
+  uint8_t length;
+};
+
 struct DiscoveredEndpoint {
+  uint8_t uid[NFCA_MAX_UID_LENGTH];
+  uint8_t uid_length;
   uint8_t id;
   uint8_t protocol;
   uint32_t last_seen;
-  std::unique_ptr<nfc::NfcTag> tag;
   bool trig_called;
+  TechParams tech;
+  std::unique_ptr<nfc::NfcTag> tag;  // made only once a read or a trigger needs it; see PN7160::endpoint_tag_()
+};
+
+/// the tags in the field, by UID: open addressing with linear probing over a fixed array, so a busy field costs no
+/// allocation per notification. A removed entry leaves a tombstone until the table empties, so slot indices stay put
+/// while the driver holds them
+class EndpointTable {
+ public:
+  /// the slot holding this UID, if any
+  optional<size_t> find(const uint8_t *uid, uint8_t uid_length) const;
+  /// the slot for a new UID, cleared but for the UID; nullopt when the table is full
+  optional<size_t> insert(const uint8_t *uid, uint8_t uid_length);
+  void erase(size_t slot);
+
+  /// whether `slot` holds an endpoint; the ones that do are visited by index from 0 to ENDPOINT_TABLE_SIZE
+  bool in_use(size_t slot) const { return this->state_[slot] == SLOT_USED; }
+  DiscoveredEndpoint &operator[](size_t slot) { return this->slots_[slot]; }
+  const DiscoveredEndpoint &operator[](size_t slot) const { return this->slots_[slot]; }
+  size_t size() const { return this->size_; }
+  bool empty() const { return this->size_ == 0; }
+
+ protected:
+  static const uint8_t SLOT_EMPTY = 0;
+  static const uint8_t SLOT_USED = 1;
+  static const uint8_t SLOT_ERASED = 2;  // ends no probe, but can be reused
+
+  static size_t hash(const uint8_t *uid, uint8_t uid_length);
+
+  DiscoveredEndpoint slots_[ENDPOINT_TABLE_SIZE]{};
+  uint8_t state_[ENDPOINT_TABLE_SIZE]{};
+  size_t size_{0};
 };
 
 class PN7160 : public nfc::Nfcc, public Component {
@@ -175,6 +301,11 @@ class PN7160 : public nfc::Nfcc, public Component {
   void set_wkup_req_pin(GPIOPin *wkup_req_pin) { this->wkup_req_pin_ = wkup_req_pin; }
 
   void set_tag_ttl(uint32_t ttl) { this->tag_ttl_ = ttl; }
+  /// keep a tag that was read activated and check it is still there this often, rather than letting it age out; 0 is
+  /// off
+  void set_presence_check_interval(uint32_t interval) { this->presence_check_interval_ = interval; }
+  /// how long one loop() may spend on NCI exchanges before yielding; long operations resume on the next loop()
+  void set_loop_budget(uint32_t budget) { this->loop_budget_ = budget; }
   void set_tag_emulation_message(std::shared_ptr<nfc::NdefMessage> message);
   void set_tag_emulation_message(const optional<std::string> &message, optional<bool> include_android_app_record);
   void set_tag_emulation_message(const char *message, bool include_android_app_record = true);
@@ -208,8 +339,42 @@ class PN7160 : public nfc::Nfcc, public Component {
 
   uint8_t set_test_mode(TestMode test_mode, const std::vector<uint8_t> &data, std::vector<uint8_t> &result);
 
+  /// IRQ edges that fired while the line was already low again by the time we looked
+  uint32_t get_irq_spurious_edges() const { return this->irq_spurious_edges_; }
+  /// IRQ assertions found by reading the line level with no edge latched by the ISR
+  uint32_t get_irq_missed_edges() const { return this->irq_missed_edges_; }
+
+#ifdef USE_PN7160_STATS
+  PN7160Stats &get_stats() { return this->stats_; }
+#endif
+
+#ifdef USE_PN7160_TRACE
+  void set_trace_buffer_size(size_t size) { this->trace_buffer_size_ = size; }
+  void set_trace_stop_when_full(bool stop_when_full) { this->trace_.set_stop_when_full(stop_when_full); }
+  NciTrace &get_trace() { return this->trace_; }
+  /// logs the trace buffer as hex for scripts/pn7160_trace_decode.py
+  void dump_trace();
+  void clear_trace();
+#endif
+
+#ifdef USE_PN7160_TASK
+  /// runs the NCI state machine in its own task instead of loop(); loop() then only fires the triggers
+  void set_task(uint8_t core, uint8_t priority, uint32_t stack_size) {
+    this->task_enabled_ = true;
+    this->task_core_ = core;
+    this->task_priority_ = priority;
+    this->task_stack_size_ = stack_size;
+  }
+  /// held by the NFC task while it runs the state machine; take it before touching driver state from elsewhere
+  Mutex &get_nci_lock() { return this->nci_lock_; }
+#endif
+
  protected:
+  static void gpio_intr(PN7160 *arg);
+
   uint8_t reset_core_(bool reset_config, bool power);
+  /// advances the DWL_REQ/VEN power cycle that precedes CORE_RESET; true once it is complete and has settled
+  bool power_cycle_step_();
   uint8_t init_core_();
   uint8_t send_init_config_();
   uint8_t send_core_config_();
@@ -225,16 +390,65 @@ class PN7160 : public nfc::Nfcc, public Component {
 
   void select_endpoint_();
 
-  uint8_t read_endpoint_data_(nfc::NfcTag &tag);
-  uint8_t clean_endpoint_(nfc::NfcTagUid &uid);
-  uint8_t format_endpoint_(nfc::NfcTagUid &uid);
-  uint8_t write_endpoint_(nfc::NfcTagUid &uid, std::shared_ptr<nfc::NdefMessage> &message);
+  /// starts next_task_ on the endpoint that was just activated; it runs from loop() within loop_budget_
+  void start_tag_operation_(size_t endpoint);
+  /// advances the tag operation until it completes or the loop budget is spent
+  void run_tag_operation_();
+  /// reports the outcome of the tag operation, then releases the endpoint
+  void complete_tag_operation_(TagOpStatus status);
+  /// halts `endpoint`'s tag if it needs it, returns to read mode and deactivates; `endpoint` may be null
+  void release_endpoint_(const DiscoveredEndpoint *endpoint);
+  /// keeps `endpoint` activated for presence checks instead of releasing it, if that is on and works for its tag
+  bool hold_for_presence_check_(const DiscoveredEndpoint &endpoint);
+  /// checks the held tag once its interval is up; releases it and reports it removed if it doesn't answer
+  void run_presence_check_();
+  /// one cheap exchange with the held tag, by its type
+  uint8_t check_presence_();
+  /// keeps loop() from sleeping between the exchanges of a tag operation
+  void request_high_frequency_loop_(bool enable);
+  bool loop_budget_spent_() { return this->millis_() - this->loop_started_ >= this->loop_budget_; }
+
+  // each of these does one NCI exchange of the tag operation per call
+  /// fills in tag_op_.identity, for tags that weren't found in the identity cache
+  TagOpStatus identify_endpoint_();
+  TagOpStatus read_endpoint_data_(nfc::NfcTag &tag);
+  TagOpStatus clean_endpoint_();
+  TagOpStatus format_endpoint_();
+  TagOpStatus write_endpoint_();
+  TagOpStatus tag_op_result_() const {
+    return this->tag_op_.status == nfc::STATUS_OK ? TagOpStatus::DONE : TagOpStatus::FAILED;
+  }
 
-  std::unique_ptr<nfc::NfcTag> build_tag_(uint8_t mode_tech, const std::vector<uint8_t> &data);
-  optional<size_t> find_tag_uid_(const nfc::NfcTagUid &uid);
+  /// fills in `endpoint`'s UID and `tech` from NFC-A, NFC-F or NFC-V technology parameters, typed by the protocol the
+  /// NFCC found for it
+  uint8_t parse_tech_params_(uint8_t mode_tech, uint8_t protocol, const uint8_t *params, size_t length,
+                             DiscoveredEndpoint &endpoint);
+  /// `found`'s slot in the endpoint table, added if it's new and brought up to date if not
+  optional<size_t> cache_endpoint_(const DiscoveredEndpoint &found);
+  /// the endpoint's NfcTag, made on first use
+  nfc::NfcTag &endpoint_tag_(DiscoveredEndpoint &endpoint);
+  /// the cached identity of the tag with this UID, or nullptr
+  const TagIdentity *find_identity_(const uint8_t *uid, uint8_t uid_length) const;
+  /// caches `identity`, in place of the one with its UID or else of the one least recently added once the cache is
+  /// full
+  void remember_identity_(const TagIdentity &identity);
+  /// removes the tags not seen for tag_ttl_, all of them in this call, once the triggers can safely run
   void purge_old_tags_();
   void erase_tag_(uint8_t tag_index);
 
+  /// one pass of the state machine and message handling, from loop() or the NFC task
+  void nci_loop_();
+  /// fires `type`'s triggers now, or queues it for loop() when the NFC task is running; `tag` is copied if queued
+  void notify_(NfcEventType type, const std::unique_ptr<nfc::NfcTag> &tag = nullptr);
+  void fire_event_(NfcEventType type, const std::unique_ptr<nfc::NfcTag> &tag);
+#ifdef USE_PN7160_TASK
+  static void task_main_(void *arg);
+  void start_task_();
+  /// blocks the NFC task until the IRQ line asserts or the state machine's timers need it
+  void task_wait_();
+  void dispatch_events_();
+#endif
+
   /// advance controller state as required
   void nci_fsm_transition_();
   /// set new controller state
@@ -243,41 +457,128 @@ class PN7160 : public nfc::Nfcc, public Component {
   bool nci_fsm_set_error_state_(NCIState new_state);
   /// parse & process incoming messages from the NFCC
   void process_message_();
-  void process_rf_intf_activated_oid_(nfc::NciMessage &rx);
-  void process_rf_discover_oid_(nfc::NciMessage &rx);
-  void process_rf_deactivate_oid_(nfc::NciMessage &rx);
-  void process_data_message_(nfc::NciMessage &rx);
+  void process_rf_intf_activated_oid_(NciFrame &rx);
+  void process_rf_discover_oid_(NciFrame &rx);
+  void process_rf_deactivate_oid_(NciFrame &rx);
+  void process_data_message_(NciFrame &rx);
 
-  void card_emu_t4t_get_response_(std::vector<uint8_t> &response, std::vector<uint8_t> &ndef_response);
+  /// builds the reply to `capdu` into `rapdu`; leaves it empty if there is nothing to send
+  void card_emu_t4t_get_response_(const uint8_t *capdu, size_t capdu_length, std::vector<uint8_t> &rapdu);
 
-  uint8_t transceive_(nfc::NciMessage &tx, nfc::NciMessage &rx, uint16_t timeout = NFCC_DEFAULT_TIMEOUT,
+  uint8_t transceive_(NciFrame &tx, NciFrame &rx, uint16_t timeout = NFCC_DEFAULT_TIMEOUT,
                       bool expect_notification = true);
-  virtual uint8_t read_nfcc(nfc::NciMessage &rx, uint16_t timeout) = 0;
-  virtual uint8_t write_nfcc(nfc::NciMessage &tx) = 0;
-
-  uint8_t wait_for_irq_(uint16_t timeout = NFCC_DEFAULT_TIMEOUT, bool pin_state = true);
+  /// transceive_() proper for commands; `read_retries` counts the reads that had to be repeated
+  uint8_t transceive_frame_(NciFrame &tx, NciFrame &rx, uint16_t timeout, uint8_t &read_retries);
+  /// read_frame_(), repeated up to NFCC_MAX_COMM_FAILS times
+  uint8_t read_frame_retrying_(NciFrame &rx, uint16_t timeout, uint8_t &read_retries);
+
+  /// sends a data packet as soon as its connection has a credit; with `expect_response`, collect the answer with
+  /// receive_data_(), which allows a second packet to be sent first so the NFCC has it queued while the first is on air
+  uint8_t send_data_(NciFrame &tx, uint16_t timeout = NFCC_DEFAULT_TIMEOUT, bool expect_response = true);
+  /// the response to the oldest data packet still in flight
+  uint8_t receive_data_(NciFrame &rx, uint16_t timeout = NFCC_DEFAULT_TIMEOUT);
+  /// send_data_() for a message of any length: split into packets of at most the connection's max payload, with PBF
+  /// set on all but the last; only the last one expects the response
+  uint8_t send_data_message_(uint8_t conn, const uint8_t *payload, size_t length,
+                             uint16_t timeout = NFCC_DEFAULT_TIMEOUT, bool expect_response = true);
+  /// receive_data_() for a response that may come in segments; they are reassembled into `message`
+  uint8_t receive_data_message_(std::vector<uint8_t> &message, uint16_t timeout = NFCC_DEFAULT_TIMEOUT);
+  /// the next data packet (or segment), absorbing credit notifications on the way
+  uint8_t read_data_packet_(NciFrame &rx, uint16_t timeout, uint8_t &read_retries);
+  /// bookkeeping once the response to the oldest data packet in flight is in
+  void data_response_received_(uint8_t read_retries, bool ok);
+  /// reads frames until `conn` has a credit; a data packet that overtakes the credit is kept for receive_data_()
+  uint8_t wait_for_credit_(uint8_t conn, uint16_t timeout);
+  /// reads and drops the responses to anything still in flight, so the next command's response comes next
+  void discard_data_in_flight_();
+  void process_conn_credits_(const NciFrame &rx);
+  /// every frame to or from the NFCC goes through these two, so it can be traced
+  uint8_t read_frame_(NciFrame &rx, uint16_t timeout);
+  uint8_t write_frame_(NciFrame &tx);
+  virtual uint8_t read_nfcc(NciFrame &rx, uint16_t timeout) = 0;
+  virtual uint8_t write_nfcc(NciFrame &tx) = 0;
+
+  virtual uint8_t wait_for_irq_(uint16_t timeout = NFCC_DEFAULT_TIMEOUT, bool pin_state = true);
+  /// level of the NFCC's IRQ line
+  virtual bool irq_asserted_() { return this->irq_pin_->digital_read(); }
+  /// time base for timeouts and tag aging; a simulated NFCC substitutes its virtual clock
+  virtual uint32_t millis_() { return millis(); }
+  /// finer time base for latency statistics
+  virtual uint32_t micros_() { return micros(); }
   void perform_health_check_();
+#ifdef USE_PN7160_STATS
+  void dump_stats_();
+#endif
   void reset_via_ven_();
 
-  uint8_t read_mifare_classic_tag_(nfc::NfcTag &tag);
-  uint8_t read_mifare_classic_block_(uint8_t block_num, std::vector<uint8_t> &data);
-  uint8_t write_mifare_classic_block_(uint8_t block_num, std::vector<uint8_t> &data);
+  /// NDEF TLV holding `message`, terminator included, into tag_data_; returns the message length
+  uint32_t encode_ndef_tlv_(const std::shared_ptr<nfc::NdefMessage> &message);
+
+  TagOpStatus read_mifare_classic_tag_(nfc::NfcTag &tag);
+  /// reads `count` blocks of one sector, pipelined; with a `key`, authenticates the sector with it (`key_num`) first
+  uint8_t read_mifare_classic_blocks_(uint8_t block_num, uint8_t count, uint8_t *data, const uint8_t *key = nullptr,
+                                      uint8_t key_num = nfc::MIFARE_CMD_AUTH_A);
+  uint8_t write_mifare_classic_block_(uint8_t block_num, const uint8_t *data);
   uint8_t auth_mifare_classic_block_(uint8_t block_num, uint8_t key_num, const uint8_t *key);
+  /// MFC_AUTHENTICATE_REQ for the sector holding `block_num` into the data frame `tx`
+  void build_mifare_classic_auth_(NciFrame &tx, uint8_t block_num, uint8_t key_num, const uint8_t *key);
   uint8_t sect_to_auth_(uint8_t block_num);
-  uint8_t format_mifare_classic_mifare_();
-  uint8_t format_mifare_classic_ndef_();
-  uint8_t write_mifare_classic_tag_(const std::shared_ptr<nfc::NdefMessage> &message);
+  TagOpStatus format_mifare_classic_mifare_();
+  TagOpStatus format_mifare_classic_ndef_();
+  /// EP_WRITE: DONE, leaving the format alone, if the MAD already gives NDEF `needed` bytes or more
+  TagOpStatus check_mifare_classic_ndef_format_(uint32_t needed);
+  TagOpStatus write_mifare_classic_tag_(const std::shared_ptr<nfc::NdefMessage> &message);
   uint8_t halt_mifare_classic_tag_();
 
-  uint8_t read_mifare_ultralight_tag_(nfc::NfcTag &tag);
-  uint8_t read_mifare_ultralight_bytes_(uint8_t start_page, uint16_t num_bytes, std::vector<uint8_t> &data);
+  TagOpStatus read_mifare_ultralight_tag_(nfc::NfcTag &tag);
+  uint8_t read_mifare_ultralight_bytes_(uint8_t start_page, uint16_t num_bytes, uint8_t *data);
+  /// NTAG21x and Ultralight EV1: `num_bytes` from `start_page` on in one FAST_READ, at most a data packet's worth
+  uint8_t fast_read_mifare_ultralight_bytes_(uint8_t start_page, uint16_t num_bytes, uint8_t *data);
+  /// reads the capability container, leaving pages 3 to 6 in tag_data_, and asks GET_VERSION of tags large enough
+  uint8_t identify_mifare_ultralight_(TagIdentity &identity);
   bool is_mifare_ultralight_formatted_(const std::vector<uint8_t> &page_3_to_6);
-  uint16_t read_mifare_ultralight_capacity_();
-  uint8_t find_mifare_ultralight_ndef_(const std::vector<uint8_t> &page_3_to_6, uint8_t &message_length,
+  uint8_t find_mifare_ultralight_ndef_(const std::vector<uint8_t> &page_3_to_6, uint16_t &message_length,
                                        uint8_t &message_start_index);
-  uint8_t write_mifare_ultralight_page_(uint8_t page_num, std::vector<uint8_t> &write_data);
-  uint8_t write_mifare_ultralight_tag_(nfc::NfcTagUid &uid, const std::shared_ptr<nfc::NdefMessage> &message);
-  uint8_t clean_mifare_ultralight_();
+  /// writes `count` consecutive pages from `write_data`
+  uint8_t write_mifare_ultralight_pages_(uint8_t page_num, const uint8_t *write_data, uint8_t count);
+  TagOpStatus write_mifare_ultralight_tag_(const std::shared_ptr<nfc::NdefMessage> &message);
+  TagOpStatus clean_mifare_ultralight_();
+  /// READ of page 0
+  uint8_t check_mifare_ultralight_presence_();
+
+  TagOpStatus read_t3t_tag_(nfc::NfcTag &tag);
+  /// reads `count` blocks of the NDEF service from `block` on, `per_check` blocks to a Check command, pipelined
+  uint8_t check_t3t_blocks_(uint16_t block, uint16_t count, uint8_t per_check, uint8_t *data);
+  /// Check of block 0
+  uint8_t check_t3t_presence_();
+
+  TagOpStatus read_t4t_tag_(nfc::NfcTag &tag);
+  /// sends `count` C-APDUs, pipelined; OK if every one of them was answered 90 00, with the last R-APDU, status word
+  /// stripped, in t4t_rapdu_
+  uint8_t transceive_t4t_apdus_(const T4tCapdu *capdus, size_t count);
+  /// the NFCC's ISO-DEP NAK presence check, which leaves the card's application state alone
+  uint8_t check_t4t_presence_();
+
+  /// Get System Information and the capability container: block size, data area size and Read Multiple Blocks
+  uint8_t identify_t5t_(TagIdentity &identity);
+  TagOpStatus read_t5t_tag_(nfc::NfcTag &tag);
+  /// reads `count` blocks from `block` on, in one Read Multiple Blocks if the tag has it, else pipelined single reads;
+  /// if Read Multiple Blocks fails, `count` is cut to the single reads one step allows
+  uint8_t read_t5t_blocks_(uint8_t block, uint8_t &count, uint8_t *data);
+  /// writes `count` consecutive blocks from `write_data`, pipelined
+  uint8_t write_t5t_blocks_(uint8_t block, const uint8_t *write_data, uint8_t count);
+  /// Read Single Block of block 0
+  uint8_t check_t5t_presence_();
+  /// turns the data area bytes in tag_data_ into whole blocks -- the capability container's share of the first one
+  /// read from the tag -- and sets tag_op_ up to write them
+  uint8_t prepare_t5t_image_();
+  /// writes tag_data_ from tag_op_.block on; only the blocks that differ if tag_op_.differential
+  TagOpStatus write_t5t_image_();
+  TagOpStatus write_t5t_tag_(const std::shared_ptr<nfc::NdefMessage> &message);
+  TagOpStatus clean_t5t_();
+  TagOpStatus format_t5t_();
+  /// addressed ISO 15693 request for `command` into the data frame `tx`
+  void build_t5t_request_(NciFrame &tx, uint8_t command);
 
   enum NfcTask : uint8_t {
     EP_READ = 0,
@@ -286,6 +587,38 @@ class PN7160 : public nfc::Nfcc, public Component {
     EP_WRITE,
   } next_task_{EP_READ};
 
+  /// a read, clean, format or write spread over as many loop() calls as it needs; the routines that run it keep
+  /// their place here between calls
+  struct TagOperation {
+    bool active;
+    NfcTask task;           // what was asked for
+    NfcTask step;           // what is running: EP_WRITE formats first
+    size_t endpoint;        // slot in discovered_endpoint_
+    uint8_t tag_type;       // nfc::TAG_TYPE_*
+    uint16_t card_blocks;   // MIFARE Classic: 20 (Mini), 64 (1K) or 256 (4K)
+    uint16_t block;         // next MIFARE Classic block, Type 2 page or Type 3 or 5 block; the step of a Type 4 read
+    bool authenticated;     // the sector holding `block` has been authenticated
+    uint8_t status;         // nfc::STATUS_FAILED once a block has failed, for routines that carry on past one
+    uint8_t message_start;
+    uint64_t ndef_sectors;  // MIFARE Classic sectors given to NDEF, bit n for sector n; zero until known
+    uint32_t index;         // bytes of tag_data_ transferred
+    uint32_t length;        // bytes of tag_data_ to transfer; zero until the routine has set itself up
+    bool differential;      // EP_WRITE onto a tag already formatted for it: read back first, write only what differs
+    uint8_t compared;       // blocks or pages from `block` on whose fate is decided
+    uint16_t dirty;         // of those, bit n if block + n is to be written
+    uint16_t skipped;       // blocks or pages left alone because they already held the right data
+    bool identified;        // `identity` is filled in; MIFARE Classic needs only its SEL_RES and always is
+    TagIdentity identity;   // Type 2 and 5
+    bool fast_read;         // Type 2 reads go by FAST_READ, Type 5 ones by Read Multiple Blocks
+    uint8_t retries;        // of the exchange at `block`, after it failed
+    uint16_t file_id;       // Type 4: the NDEF file, from the capability container
+    uint16_t file_size;     // Type 4: its size, NLEN included
+    uint16_t chunk;         // Type 4: bytes per READ BINARY, from the capability container's MLe; Type 3: blocks
+                            // per Check, from the attribute information block's Nbr
+  } tag_op_{};
+  // no sleeping between loop() calls while tag_op_ is running
+  HighFrequencyLoopRequester high_freq_;
+
   bool config_refresh_pending_{false};
   bool core_config_is_solo_{false};
   bool listening_enabled_{false};
@@ -296,6 +629,14 @@ class PN7160 : public nfc::Nfcc, public Component {
   uint32_t last_nci_state_change_{0};
   uint8_t selecting_endpoint_{0};
   uint32_t tag_ttl_{250};
+  uint32_t presence_check_interval_{0};
+  bool presence_held_{false};  // tag_op_.endpoint is still activated, for presence checks
+  uint32_t presence_checked_{0};
+  uint32_t loop_budget_{NFCC_DEFAULT_LOOP_BUDGET};
+  uint32_t loop_started_{0};
+  uint8_t power_cycle_stage_{0};
+  uint32_t power_cycle_since_{0};
+  uint32_t power_cycle_hold_{0};
   bool health_check_enabled_{true};
   uint32_t health_check_interval_{60000};
   uint8_t max_failed_checks_{3};
@@ -303,6 +644,38 @@ class PN7160 : public nfc::Nfcc, public Component {
   uint8_t health_fail_count_{0};
   uint32_t last_health_check_{0};
 
+  // the IRQ pin is on the MCU and has the ISR attached; a pin behind an I/O expander is only polled
+  bool irq_interrupt_{false};
+  // set from the IRQ pin ISR, consumed by wait_for_irq_()
+  volatile bool irq_edge_pending_{false};
+  uint32_t irq_spurious_edges_{0};
+  uint32_t irq_missed_edges_{0};
+#ifdef USE_PN7160_STATS
+  PN7160Stats stats_;
+  uint32_t nci_state_entered_us_{0};
+#endif
+#ifdef USE_PN7160_TRACE
+  NciTrace trace_;
+  size_t trace_buffer_size_{4096};
+#endif
+#ifdef USE_ESP32
+  // task blocked in wait_for_irq_(), if any; the ISR notifies it directly
+  volatile TaskHandle_t irq_waiting_task_{nullptr};
+#endif
+#ifdef USE_PN7160_TASK
+  // room for every tag in the table leaving in one purge, with some to spare; one slot always stays empty
+  static const size_t EVENT_QUEUE_SIZE = ENDPOINT_TABLE_SIZE + 8;
+
+  bool task_enabled_{false};
+  uint8_t task_core_{0};
+  uint8_t task_priority_{5};
+  uint32_t task_stack_size_{4096};
+  TaskHandle_t task_handle_{nullptr};
+  Mutex nci_lock_;
+  SpscQueue<NfcEvent, EVENT_QUEUE_SIZE> events_;
+  uint32_t events_dropped_{0};  // queue was full; written by the NFC task only
+#endif
+
   GPIOPin *dwl_req_pin_{nullptr};
   GPIOPin *irq_pin_{nullptr};
   GPIOPin *ven_pin_{nullptr};
@@ -311,13 +684,38 @@ class PN7160 : public nfc::Nfcc, public Component {
   CallbackManager<void()> on_emulated_tag_scan_callback_;
   CallbackManager<void()> on_finished_write_callback_;
 
-  std::vector<DiscoveredEndpoint> discovered_endpoint_;
+  EndpointTable discovered_endpoint_;
+  // when each endpoint goes stale, as of the last_seen it had when queued; purge_old_tags_() checks it again
+  ExpiryQueue<ENDPOINT_TABLE_SIZE> endpoint_expiry_;
+  // outlives the endpoints, so a tag that comes back is read without identifying it again
+  TagIdentity identities_[IDENTITY_CACHE_SIZE]{};
+  uint8_t identity_next_{0};  // slot the next new identity goes in
+
+  // NCI flow control: data packets each connection may still send, from the activation and CORE_CONN_CREDITS_NTF
+  uint8_t conn_credits_[NCI_MAX_CONNECTIONS]{};
+  // largest data packet payload each connection takes, from the activation; longer messages are segmented
+  uint8_t conn_max_payload_[NCI_MAX_CONNECTIONS]{};
+  uint8_t max_ctrl_payload_{NCI_MAX_PAYLOAD_SIZE};  // from CORE_INIT_RSP
+  uint8_t data_in_flight_{0};
+  NciFrame early_data_;  // a response read while waiting for a credit
+  bool early_data_pending_{false};
+#ifdef USE_PN7160_STATS
+  uint32_t data_sent_us_[NCI_MAX_DATA_IN_FLIGHT]{};  // oldest first
+#endif
+
+  // raw tag contents for the tag being read or written; reused so its capacity carries over from one tap to the next
+  std::vector<uint8_t> tag_data_;
+  std::vector<uint8_t> t4t_rapdu_;  // the last R-APDU from a Type 4 tag; reserved for a whole READ BINARY on first use
 
   CardEmulationState ce_state_{CardEmulationState::CARD_EMU_IDLE};
   NCIState nci_state_{NCIState::NFCC_RESET};
   NCIState nci_state_error_{NCIState::NONE};
 
   std::shared_ptr<nfc::NdefMessage> card_emulation_message_;
+  std::vector<uint8_t> card_emulation_ndef_;  // card_emulation_message_, encoded once when it is set
+  // the C-APDU being answered (reassembled if it came in segments) and the R-APDU going back; reused across taps
+  std::vector<uint8_t> card_emulation_capdu_;
+  std::vector<uint8_t> card_emulation_rapdu_;
   std::shared_ptr<nfc::NdefMessage> next_task_message_to_write_;
 
   std::vector<nfc::NfcOnTagTrigger *> triggers_ontag_;
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+
+#ifdef USE_PN7160_TASK
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+#include "esphome/components/nfc/nfc_tag.h"
+
+namespace esphome {
+namespace pn7160 {
+
+enum class NfcEventType : uint8_t;
+
+/// What the NFC task hands to the main loop: something for the triggers to fire on, with its own copy of the tag
+struct NfcEvent {
+  NfcEventType type;
+  std::unique_ptr<nfc::NfcTag> tag;
+};
+
+/// Bounded single-producer, single-consumer ring. push() is only ever called from one task and pop() from one other,
+/// so the two indices are all the synchronisation there is: no locks, nothing that can block either side. One slot
+/// stays empty to tell full from empty.
+template<typename T, size_t N> class SpscQueue {
+ public:
+  /// false, leaving `item` alone, if the consumer has fallen N - 1 items behind
+  bool push(T &&item) {
+    const size_t head = this->head_.load(std::memory_order_relaxed);
+    const size_t next = (head + 1) % N;
+    if (next == this->tail_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    this->slots_[head] = std::move(item);
+    this->head_.store(next, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T &item) {
+    const size_t tail = this->tail_.load(std::memory_order_relaxed);
+    if (tail == this->head_.load(std::memory_order_acquire)) {
+      return false;
+    }
+    item = std::move(this->slots_[tail]);
+    this->tail_.store((tail + 1) % N, std::memory_order_release);
+    return true;
+  }
+
+ protected:
+  T slots_[N]{};
+  std::atomic<size_t> head_{0};  // next slot to fill; written by the producer only
+  std::atomic<size_t> tail_{0};  // next slot to drain; written by the consumer only
+};
+
+}  // namespace pn7160
+}  // namespace esphome
+
+#endif  // USE_PN7160_TASK
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace pn7160 {
+
+/// Deadlines for up to N slots, soonest first: a binary min-heap over a fixed array, so asking whether anything is due
+/// is one comparison. A slot has at most one deadline queued; one that has moved on since is put back by whoever pops
+/// it, rather than the heap being searched for it. Times are millis() values and compare correctly across wraparound.
+template<size_t N> class ExpiryQueue {
+ public:
+  /// queues `slot` to fall due at `deadline`, unless it already has a deadline queued
+  void schedule(uint8_t slot, uint32_t deadline) {
+    if (this->queued_[slot]) {
+      return;
+    }
+    this->queued_[slot] = true;
+    this->heap_[this->size_++] = Entry{deadline, slot};
+    std::push_heap(this->heap_, this->heap_ + this->size_, later);
+  }
+
+  /// whether the soonest deadline has passed at `now`
+  bool due(uint32_t now) const { return this->size_ != 0 && static_cast<int32_t>(now - this->heap_[0].deadline) > 0; }
+
+  /// takes the soonest slot off the queue if its deadline has passed at `now`
+  bool pop_due(uint32_t now, uint8_t &slot) {
+    if (!this->due(now)) {
+      return false;
+    }
+    std::pop_heap(this->heap_, this->heap_ + this->size_, later);
+    slot = this->heap_[--this->size_].slot;
+    this->queued_[slot] = false;
+    return true;
+  }
+
+ protected:
+  struct Entry {
+    uint32_t deadline;
+    uint8_t slot;
+  };
+
+  /// heap order: `a` falls due after `b`, so the soonest ends up on top
+  static bool later(const Entry &a, const Entry &b) { return static_cast<int32_t>(a.deadline - b.deadline) > 0; }
+
+  Entry heap_[N]{};
+  bool queued_[N]{};
+  size_t size_{0};
+};
+
+}  // namespace pn7160
+}  // namespace esphome
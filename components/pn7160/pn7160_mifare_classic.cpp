@@ -1,3 +1,6 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
 #include <memory>
 
 #include "pn7160.h"
@@ -8,99 +11,281 @@ namespace pn7160 {
 
 static const char *const TAG = "pn7160.mifare_classic";
 
-uint8_t PN7160::read_mifare_classic_tag_(nfc::NfcTag &tag) {
-  uint8_t current_block = 4;
-  uint8_t message_start_index = 0;
-  uint32_t message_length = 0;
+static const uint8_t MAX_SECTORS = 40;  // 4K: 32 sectors of 4 blocks, then 8 of 16
+static const uint8_t MAX_READS_PER_STEP = 4;  // a 16-block sector is read over several steps, to keep each one short
+// MAD1: sector 0, blocks 1 and 2, for sectors 1-15; MAD2 (4K only): sector 16, blocks 64-66, for sectors 17-39. Each
+// is a CRC, an info byte, then a two-byte AID for each sector it covers.
+static const uint8_t MAD1_SECTOR = 0;
+static const uint8_t MAD2_SECTOR = 16;
+static const uint8_t MAD1_BLOCKS = 2;
+static const uint8_t MAD2_BLOCKS = 3;
+static const uint8_t MAD1_INFO = 0x01;
+static const uint8_t MAD2_INFO = 0x00;
+static const uint8_t MAD_NDEF_AID[] = {0x03, 0xE1};  // stored low byte first
+// general purpose byte in the MAD sector trailers: MAD in use, multi-application card, MAD version
+static const uint8_t TRAILER_GPB_OFFSET = 9;
+static const uint8_t MAD_GPB_VERSION_MASK = 0x03;
+static const uint8_t MAD_GPB_V1 = 0xC1;
+static const uint8_t MAD_GPB_V2 = 0xC2;
+
+static uint16_t sector_first_block(const uint8_t sector) {
+  if (sector >= nfc::MIFARE_CLASSIC_16BLOCK_SECT_START) {
+    return nfc::MIFARE_CLASSIC_BLOCKS_PER_SECT_LOW * nfc::MIFARE_CLASSIC_16BLOCK_SECT_START +
+           (sector - nfc::MIFARE_CLASSIC_16BLOCK_SECT_START) * nfc::MIFARE_CLASSIC_BLOCKS_PER_SECT_HIGH;
+  }
+  return sector * nfc::MIFARE_CLASSIC_BLOCKS_PER_SECT_LOW;
+}
 
-  if (this->auth_mifare_classic_block_(current_block, nfc::MIFARE_CMD_AUTH_A, nfc::NDEF_KEY) != nfc::STATUS_OK) {
-    ESP_LOGE(TAG, "Tag auth failed while attempting to read tag data");
-    return nfc::STATUS_FAILED;
+static uint8_t sector_blocks(const uint8_t sector) {
+  return sector >= nfc::MIFARE_CLASSIC_16BLOCK_SECT_START ? nfc::MIFARE_CLASSIC_BLOCKS_PER_SECT_HIGH
+                                                          : nfc::MIFARE_CLASSIC_BLOCKS_PER_SECT_LOW;
+}
+
+static uint8_t card_sectors(const uint16_t card_blocks) {
+  const uint16_t low_blocks = nfc::MIFARE_CLASSIC_BLOCKS_PER_SECT_LOW * nfc::MIFARE_CLASSIC_16BLOCK_SECT_START;
+  if (card_blocks > low_blocks) {
+    return nfc::MIFARE_CLASSIC_16BLOCK_SECT_START +
+           (card_blocks - low_blocks) / nfc::MIFARE_CLASSIC_BLOCKS_PER_SECT_HIGH;
   }
-  std::vector<uint8_t> data;
+  return card_blocks / nfc::MIFARE_CLASSIC_BLOCKS_PER_SECT_LOW;
+}
 
-  if (this->read_mifare_classic_block_(current_block, data) == nfc::STATUS_OK) {
-    if (!nfc::decode_mifare_classic_tlv(data, message_length, message_start_index)) {
-      return nfc::STATUS_FAILED;
+/// MAD sectors a card needs to give `ndef_sectors` to NDEF: sector 0, and sector 16 once anything past it is used
+static uint64_t mad_sectors_for(const uint64_t ndef_sectors) {
+  return (1ULL << MAD1_SECTOR) | ((ndef_sectors >> (MAD2_SECTOR + 1)) ? 1ULL << MAD2_SECTOR : 0);
+}
+
+static uint8_t mad_size(const uint8_t mad_sector) {
+  return (mad_sector == MAD1_SECTOR ? MAD1_BLOCKS : MAD2_BLOCKS) * nfc::MIFARE_CLASSIC_BLOCK_SIZE;
+}
+
+/// CRC-8 over the MAD after its CRC byte: polynomial 0x1D, preset 0xC7
+static uint8_t mad_crc(const uint8_t *data, size_t length) {
+  uint8_t crc = 0xC7;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x80) ? (crc << 1) ^ 0x1D : crc << 1;
     }
-  } else {
-    ESP_LOGE(TAG, "Failed to read block %u", current_block);
-    return nfc::STATUS_FAILED;
   }
+  return crc;
+}
 
-  uint32_t index = 0;
-  uint32_t buffer_size = nfc::get_mifare_classic_buffer_size(message_length);
-  std::vector<uint8_t> buffer;
+/// sectors the MAD in `mad_sector` assigns to NDEF, bit n for sector n; zero if `mad` doesn't check out
+static uint64_t mad_ndef_sectors(const uint8_t *mad, const uint8_t mad_sector) {
+  const uint8_t size = mad_size(mad_sector);
+  if (mad_crc(mad + 1, size - 1) != mad[0]) {
+    return 0;
+  }
+  uint64_t sectors = 0;
+  for (uint8_t i = 1; i < size / 2; i++) {
+    if (std::memcmp(mad + i * 2, MAD_NDEF_AID, sizeof(MAD_NDEF_AID)) == 0) {
+      sectors |= 1ULL << (mad_sector + i);
+    }
+  }
+  return sectors;
+}
 
-  while (index < buffer_size) {
-    if (nfc::mifare_classic_is_first_block(current_block)) {
-      if (this->auth_mifare_classic_block_(current_block, nfc::MIFARE_CMD_AUTH_A, nfc::NDEF_KEY) != nfc::STATUS_OK) {
-        ESP_LOGE(TAG, "Block authentication failed for %u", current_block);
-        return nfc::STATUS_FAILED;
-      }
+/// the MAD for `mad_sector`, giving `ndef_sectors` to NDEF and leaving the rest free
+static void build_mad(uint8_t *mad, const uint8_t mad_sector, const uint64_t ndef_sectors) {
+  const uint8_t size = mad_size(mad_sector);
+  std::memset(mad, 0, size);
+  mad[1] = mad_sector == MAD1_SECTOR ? MAD1_INFO : MAD2_INFO;
+  for (uint8_t i = 1; i < size / 2; i++) {
+    if (ndef_sectors & (1ULL << (mad_sector + i))) {
+      std::memcpy(mad + i * 2, MAD_NDEF_AID, sizeof(MAD_NDEF_AID));
     }
-    std::vector<uint8_t> block_data;
-    if (this->read_mifare_classic_block_(current_block, block_data) != nfc::STATUS_OK) {
-      ESP_LOGE(TAG, "Error reading block %u", current_block);
-      return nfc::STATUS_FAILED;
+  }
+  mad[0] = mad_crc(mad + 1, size - 1);
+}
+
+/// first block of the next sector after `sector` in `sectors`, or zero if there isn't one
+static uint16_t next_sector_block(const uint64_t sectors, const uint8_t sector) {
+  for (uint8_t next = sector + 1; next < MAX_SECTORS; next++) {
+    if (sectors & (1ULL << next)) {
+      return sector_first_block(next);
+    }
+  }
+  return 0;
+}
+
+/// NDEF data bytes in `sectors`
+static uint32_t ndef_sectors_capacity(const uint64_t sectors) {
+  uint32_t capacity = 0;
+  for (uint8_t sector = 1; sector < MAX_SECTORS; sector++) {
+    if (sectors & (1ULL << sector)) {
+      capacity += (sector_blocks(sector) - 1) * nfc::MIFARE_CLASSIC_BLOCK_SIZE;
+    }
+  }
+  return capacity;
+}
+
+static bool mifare_classic_auth_succeeded(const NciFrame &rx) {
+  return rx.message_type_is(nfc::NCI_PKT_MT_DATA) && rx.simple_status_response_is(MFC_AUTHENTICATE_OID) &&
+         rx.get_message_byte(4) == nfc::STATUS_OK;
+}
+
+/// either part of a WRITE: the tag's 4-bit ACK, rather than a NAK
+static bool mifare_classic_write_acked(const NciFrame &rx) {
+  return rx.message_type_is(nfc::NCI_PKT_MT_DATA) && rx.simple_status_response_is(XCHG_DATA_OID) &&
+         rx.get_message_byte(4) == nfc::MIFARE_CMD_ACK;
+}
+
+TagOpStatus PN7160::read_mifare_classic_tag_(nfc::NfcTag &tag) {
+  auto &op = this->tag_op_;
+  auto &buffer = this->tag_data_;
+
+  // neither MAD sector ever holds NDEF data, so while op.block is on one, the MAD is what's being read
+  const uint8_t sector = this->sect_to_auth_(op.block);
+  if (sector == MAD1_SECTOR || sector == MAD2_SECTOR) {
+    // the MAD says which sectors hold NDEF, so every other one is skipped without spending an authentication on it
+    uint8_t mad[(MAD2_BLOCKS + 1) * nfc::MIFARE_CLASSIC_BLOCK_SIZE];
+    const uint8_t mad_blocks = sector == MAD1_SECTOR ? MAD1_BLOCKS : MAD2_BLOCKS;
+    // on a 4K card, sector 0's trailer comes too: its GPB says whether there's a MAD2
+    const bool with_trailer = sector == MAD1_SECTOR && op.card_blocks > sector_first_block(MAD2_SECTOR);
+    if (this->read_mifare_classic_blocks_(sector_first_block(sector) + (sector == MAD1_SECTOR ? 1 : 0),
+                                          mad_blocks + (with_trailer ? 1 : 0), mad, nfc::MAD_KEY) != nfc::STATUS_OK) {
+      ESP_LOGE(TAG, "Unable to read the MAD in sector %u", sector);
+      return TagOpStatus::FAILED;
+    }
+    op.ndef_sectors |= mad_ndef_sectors(mad, sector);
+    if (with_trailer && (mad[mad_size(sector) + TRAILER_GPB_OFFSET] & MAD_GPB_VERSION_MASK) == 2) {
+      op.block = sector_first_block(MAD2_SECTOR);
+      return TagOpStatus::PENDING;
+    }
+    op.block = next_sector_block(op.ndef_sectors, MAD1_SECTOR);
+    if (op.block == 0) {
+      // no MAD, or one that gives NDEF nothing: not NDEF formatted
+      ESP_LOGE(TAG, "No NDEF sectors in the MAD");
+      return TagOpStatus::FAILED;
+    }
+    return TagOpStatus::PENDING;
+  }
+
+  // a sector, or as much of one as a step allows, per step; its authentication goes out pipelined ahead of the reads
+  const uint16_t trailer = sector_first_block(sector) + sector_blocks(sector) - 1;
+  uint8_t blocks = std::min<uint16_t>(trailer - op.block, MAX_READS_PER_STEP);
+  if (op.length == 0) {
+    // the TLV is at the start of the first NDEF sector; size the rest of the read from it
+    buffer.resize(blocks * nfc::MIFARE_CLASSIC_BLOCK_SIZE);
+  } else {
+    blocks = std::min<uint32_t>(blocks, (op.length - op.index + nfc::MIFARE_CLASSIC_BLOCK_SIZE - 1) /
+                                            nfc::MIFARE_CLASSIC_BLOCK_SIZE);
+  }
+  const uint8_t *key = nfc::mifare_classic_is_first_block(op.block) ? nfc::NDEF_KEY : nullptr;
+  if (this->read_mifare_classic_blocks_(op.block, blocks, buffer.data() + op.index, key) != nfc::STATUS_OK) {
+    if (op.length == 0) {
+      ESP_LOGE(TAG, "Tag auth failed while attempting to read tag data");
     } else {
-      buffer.insert(buffer.end(), block_data.begin(), block_data.end());
+      ESP_LOGE(TAG, "Error reading blocks %u-%u", op.block, op.block + blocks - 1);
     }
+    return TagOpStatus::FAILED;
+  }
+  op.index += blocks * nfc::MIFARE_CLASSIC_BLOCK_SIZE;
+  op.block += blocks;
 
-    index += nfc::MIFARE_CLASSIC_BLOCK_SIZE;
-    current_block++;
+  if (op.length == 0) {
+    uint32_t message_length = 0;
+    if (!nfc::decode_mifare_classic_tlv(buffer, message_length, op.message_start)) {
+      return TagOpStatus::FAILED;
+    }
+    // the TLV's length is all that's needed: no reading on to find the terminator
+    op.length = op.message_start + message_length;
+    const uint32_t blocks_needed = (op.length + nfc::MIFARE_CLASSIC_BLOCK_SIZE - 1) / nfc::MIFARE_CLASSIC_BLOCK_SIZE;
+    buffer.resize(std::max<uint32_t>(blocks_needed * nfc::MIFARE_CLASSIC_BLOCK_SIZE, buffer.size()));
+  }
 
-    if (nfc::mifare_classic_is_trailer_block(current_block)) {
-      current_block++;
+  if (op.index < op.length) {
+    if (op.block == trailer) {
+      op.block = next_sector_block(op.ndef_sectors, sector);
+      if (op.block == 0) {
+        ESP_LOGE(TAG, "NDEF message runs past the last NDEF sector");
+        return TagOpStatus::FAILED;
+      }
     }
+    return TagOpStatus::PENDING;
   }
 
-  if (buffer.begin() + message_start_index < buffer.end()) {
-    buffer.erase(buffer.begin(), buffer.begin() + message_start_index);
+  buffer.resize(op.length);
+  if (buffer.begin() + op.message_start < buffer.end()) {
+    buffer.erase(buffer.begin(), buffer.begin() + op.message_start);
   } else {
-    return nfc::STATUS_FAILED;
+    return TagOpStatus::FAILED;
   }
 
   tag.set_ndef_message(make_unique<nfc::NdefMessage>(buffer));
 
-  return nfc::STATUS_OK;
+  return TagOpStatus::DONE;
 }
 
-uint8_t PN7160::read_mifare_classic_block_(uint8_t block_num, std::vector<uint8_t> &data) {
-  nfc::NciMessage rx;
-  nfc::NciMessage tx(nfc::NCI_PKT_MT_DATA, {XCHG_DATA_OID, nfc::MIFARE_CMD_READ, block_num});
+uint8_t PN7160::read_mifare_classic_blocks_(uint8_t block_num, uint8_t count, uint8_t *data, const uint8_t *key,
+                                           uint8_t key_num) {
+  NciFrame rx;
+  NciFrame tx(nfc::NCI_PKT_MT_DATA, {});
   char buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
 
-  ESP_LOGVV(TAG, "Read XCHG_DATA_REQ: %s", nfc::format_bytes_to(buf, tx.get_message()));
-  if (this->transceive_(tx, rx) != nfc::STATUS_OK) {
-    ESP_LOGE(TAG, "Timeout reading tag data");
-    return nfc::STATUS_FAILED;
-  }
+  // with a key, the sector's authentication leads; either way the next packet is queued in the NFCC while the one
+  // before it is on air
+  const uint8_t lead = key != nullptr ? 1 : 0;
+  const uint8_t packets = lead + count;
+  uint8_t sent = 0;
+  for (uint8_t received = 0; received < packets; received++) {
+    while (sent < packets && sent - received < NCI_MAX_DATA_IN_FLIGHT) {
+      if (sent < lead) {
+        this->build_mifare_classic_auth_(tx, block_num, key_num, key);
+      } else {
+        tx.set_payload({XCHG_DATA_OID, nfc::MIFARE_CMD_READ, static_cast<uint8_t>(block_num + sent - lead)});
+      }
+      if (this->send_data_(tx) != nfc::STATUS_OK) {
+        ESP_LOGE(TAG, "Timeout reading tag data");
+        this->discard_data_in_flight_();
+        return nfc::STATUS_FAILED;
+      }
+      sent++;
+    }
+    if (this->receive_data_(rx) != nfc::STATUS_OK) {
+      ESP_LOGE(TAG, "Timeout reading tag data");
+      this->discard_data_in_flight_();
+      return nfc::STATUS_FAILED;
+    }
 
-  if ((!rx.message_type_is(nfc::NCI_PKT_MT_DATA)) || (!rx.simple_status_response_is(XCHG_DATA_OID)) ||
-      (!rx.message_length_is(18))) {
-    ESP_LOGE(TAG, "MFC read block failed - block 0x%02x", block_num);
-    ESP_LOGV(TAG, "Read response: %s", nfc::format_bytes_to(buf, rx.get_message()));
-    return nfc::STATUS_FAILED;
-  }
+    if (received < lead) {
+      if (!mifare_classic_auth_succeeded(rx)) {
+        ESP_LOGE(TAG, "MFC authentication failed - block 0x%02x", block_num);
+        this->discard_data_in_flight_();  // the reads queued behind it, so the next step starts clean
+        return nfc::STATUS_FAILED;
+      }
+      continue;
+    }
 
-  data.insert(data.begin(), rx.get_message().begin() + 4, rx.get_message().end() - 1);
+    const uint8_t i = received - lead;
+    const uint8_t block = block_num + i;
+    if ((!rx.message_type_is(nfc::NCI_PKT_MT_DATA)) || (!rx.simple_status_response_is(XCHG_DATA_OID)) ||
+        (!rx.message_length_is(18))) {
+      ESP_LOGE(TAG, "MFC read block failed - block 0x%02x", block);
+      ESP_LOGV(TAG, "Read response: %s", format_frame_to(buf, rx));
+      this->discard_data_in_flight_();
+      return nfc::STATUS_FAILED;
+    }
 
-  ESP_LOGVV(TAG, " Block %u: %s", block_num, nfc::format_bytes_to(buf, data));
+    // payload is the XCHG_DATA_OID echo, 16 data bytes and a trailing status byte
+    uint8_t *block_data = data + i * nfc::MIFARE_CLASSIC_BLOCK_SIZE;
+    std::memcpy(block_data, rx.payload() + 1, nfc::MIFARE_CLASSIC_BLOCK_SIZE);
+    ESP_LOGVV(TAG, " Block %u: %s", block, format_frame_to(buf, block_data, nfc::MIFARE_CLASSIC_BLOCK_SIZE));
+  }
   return nfc::STATUS_OK;
 }
 
-uint8_t PN7160::auth_mifare_classic_block_(uint8_t block_num, uint8_t key_num, const uint8_t *key) {
-  nfc::NciMessage rx;
-  nfc::NciMessage tx(nfc::NCI_PKT_MT_DATA, {MFC_AUTHENTICATE_OID, this->sect_to_auth_(block_num), key_num});
+void PN7160::build_mifare_classic_auth_(NciFrame &tx, uint8_t block_num, uint8_t key_num, const uint8_t *key) {
+  uint8_t auth_param = key_num;
 
   switch (key_num) {
     case nfc::MIFARE_CMD_AUTH_A:
-      tx.get_message().back() = MFC_AUTHENTICATE_PARAM_KS_A;
+      auth_param = MFC_AUTHENTICATE_PARAM_KS_A;
       break;
 
     case nfc::MIFARE_CMD_AUTH_B:
-      tx.get_message().back() = MFC_AUTHENTICATE_PARAM_KS_B;
+      auth_param = MFC_AUTHENTICATE_PARAM_KS_B;
       break;
 
     default:
@@ -108,20 +293,28 @@ uint8_t PN7160::auth_mifare_classic_block_(uint8_t block_num, uint8_t key_num, c
   }
 
   if (key != nullptr) {
-    tx.get_message().back() |= MFC_AUTHENTICATE_PARAM_EMBED_KEY;
-    tx.get_message().insert(tx.get_message().end(), key, key + 6);
+    auth_param |= MFC_AUTHENTICATE_PARAM_EMBED_KEY;
   }
 
-  char buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
-  ESP_LOGVV(TAG, "MFC_AUTHENTICATE_REQ: %s", nfc::format_bytes_to(buf, tx.get_message()));
+  tx.set_payload({MFC_AUTHENTICATE_OID, this->sect_to_auth_(block_num), auth_param});
+  if (key != nullptr) {
+    tx.append(key, 6);
+  }
+}
+
+uint8_t PN7160::auth_mifare_classic_block_(uint8_t block_num, uint8_t key_num, const uint8_t *key) {
+  NciFrame rx;
+  NciFrame tx(nfc::NCI_PKT_MT_DATA, {});
+  this->build_mifare_classic_auth_(tx, block_num, key_num, key);
+
   if (this->transceive_(tx, rx) != nfc::STATUS_OK) {
     ESP_LOGE(TAG, "Sending MFC_AUTHENTICATE_REQ failed");
     return nfc::STATUS_FAILED;
   }
-  if ((!rx.message_type_is(nfc::NCI_PKT_MT_DATA)) || (!rx.simple_status_response_is(MFC_AUTHENTICATE_OID)) ||
-      (rx.get_message()[4] != nfc::STATUS_OK)) {
+  if (!mifare_classic_auth_succeeded(rx)) {
     ESP_LOGE(TAG, "MFC authentication failed - block 0x%02x", block_num);
-    ESP_LOGVV(TAG, "MFC_AUTHENTICATE_RSP: %s", nfc::format_bytes_to(buf, rx.get_message()));
+    char buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
+    ESP_LOGVV(TAG, "MFC_AUTHENTICATE_RSP: %s", format_frame_to(buf, rx));
     return nfc::STATUS_FAILED;
   }
 
@@ -138,183 +331,291 @@ uint8_t PN7160::sect_to_auth_(const uint8_t block_num) {
   return block_num / nfc::MIFARE_CLASSIC_BLOCKS_PER_SECT_LOW;
 }
 
-uint8_t PN7160::format_mifare_classic_mifare_() {
-  std::vector<uint8_t> blank_buffer(
-      {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00});
-  std::vector<uint8_t> trailer_buffer(
-      {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x07, 0x80, 0x69, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF});
-
-  auto status = nfc::STATUS_OK;
-
-  for (int block = 0; block < 64; block += 4) {
-    if (this->auth_mifare_classic_block_(block + 3, nfc::MIFARE_CMD_AUTH_B, nfc::DEFAULT_KEY) != nfc::STATUS_OK) {
-      continue;
-    }
-    if (block != 0) {
-      if (this->write_mifare_classic_block_(block, blank_buffer) != nfc::STATUS_OK) {
-        ESP_LOGE(TAG, "Unable to write block %u", block);
-        status = nfc::STATUS_FAILED;
-      }
-    }
-    if (this->write_mifare_classic_block_(block + 1, blank_buffer) != nfc::STATUS_OK) {
-      ESP_LOGE(TAG, "Unable to write block %u", block + 1);
-      status = nfc::STATUS_FAILED;
+TagOpStatus PN7160::format_mifare_classic_mifare_() {
+  static const uint8_t blank_buffer[] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                                         0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+  static const uint8_t trailer_buffer[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x07,
+                                           0x80, 0x69, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+  auto &op = this->tag_op_;
+
+  if (!op.authenticated) {
+    if (this->auth_mifare_classic_block_(op.block, nfc::MIFARE_CMD_AUTH_B, nfc::DEFAULT_KEY) != nfc::STATUS_OK) {
+      op.block = sector_first_block(this->sect_to_auth_(op.block) + 1);  // not ours to clean; skip the sector
+      return op.block < op.card_blocks ? TagOpStatus::PENDING : this->tag_op_result_();
     }
-    if (this->write_mifare_classic_block_(block + 2, blank_buffer) != nfc::STATUS_OK) {
-      ESP_LOGE(TAG, "Unable to write block %u", block + 2);
-      status = nfc::STATUS_FAILED;
-    }
-    if (this->write_mifare_classic_block_(block + 3, trailer_buffer) != nfc::STATUS_OK) {
-      ESP_LOGE(TAG, "Unable to write block %u", block + 3);
-      status = nfc::STATUS_FAILED;
+    op.authenticated = true;
+    if (op.block == 0) {
+      op.block++;  // leave the manufacturer block alone
     }
+    return TagOpStatus::PENDING;
   }
 
-  return status;
+  const bool trailer = nfc::mifare_classic_is_trailer_block(op.block);
+  if (this->write_mifare_classic_block_(op.block, trailer ? trailer_buffer : blank_buffer) != nfc::STATUS_OK) {
+    ESP_LOGE(TAG, "Unable to write block %u", op.block);
+    op.status = nfc::STATUS_FAILED;
+  }
+  op.block++;
+  op.authenticated = !trailer;
+  return op.block < op.card_blocks ? TagOpStatus::PENDING : this->tag_op_result_();
 }
 
-uint8_t PN7160::format_mifare_classic_ndef_() {
-  std::vector<uint8_t> empty_ndef_message(
-      {0x03, 0x03, 0xD0, 0x00, 0x00, 0xFE, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00});
-  std::vector<uint8_t> blank_block(
-      {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00});
-  std::vector<uint8_t> block_1_data(
-      {0x14, 0x01, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1});
-  std::vector<uint8_t> block_2_data(
-      {0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1});
-  std::vector<uint8_t> block_3_trailer(
-      {0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0x78, 0x77, 0x88, 0xC1, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF});
-  std::vector<uint8_t> ndef_trailer(
-      {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7, 0x7F, 0x07, 0x88, 0x40, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF});
-
-  if (this->auth_mifare_classic_block_(0, nfc::MIFARE_CMD_AUTH_B, nfc::DEFAULT_KEY) != nfc::STATUS_OK) {
+TagOpStatus PN7160::check_mifare_classic_ndef_format_(const uint32_t needed) {
+  auto &op = this->tag_op_;
+  const uint64_t card_mask = (1ULL << card_sectors(op.card_blocks)) - 1;
+  uint8_t mad[(MAD2_BLOCKS + 1) * nfc::MIFARE_CLASSIC_BLOCK_SIZE];
+
+  // with the key B formatting authenticates with anyway, so a blank tag costs no failed authentication
+  if (this->read_mifare_classic_blocks_(sector_first_block(MAD1_SECTOR) + 1, MAD1_BLOCKS + 1, mad, nfc::DEFAULT_KEY,
+                                        nfc::MIFARE_CMD_AUTH_B) != nfc::STATUS_OK) {
     ESP_LOGE(TAG, "Unable to authenticate block 0 for formatting");
-    return nfc::STATUS_FAILED;
-  }
-  if (this->write_mifare_classic_block_(1, block_1_data) != nfc::STATUS_OK) {
-    return nfc::STATUS_FAILED;
+    return TagOpStatus::FAILED;
   }
-  if (this->write_mifare_classic_block_(2, block_2_data) != nfc::STATUS_OK) {
-    return nfc::STATUS_FAILED;
-  }
-  if (this->write_mifare_classic_block_(3, block_3_trailer) != nfc::STATUS_OK) {
-    return nfc::STATUS_FAILED;
+  uint64_t sectors = mad_ndef_sectors(mad, MAD1_SECTOR) & card_mask;
+  bool mad2_read = false;
+  if (ndef_sectors_capacity(sectors) < needed && op.card_blocks > sector_first_block(MAD2_SECTOR) &&
+      (mad[mad_size(MAD1_SECTOR) + TRAILER_GPB_OFFSET] & MAD_GPB_VERSION_MASK) == 2 && sectors != 0) {
+    mad2_read = true;
+    if (this->read_mifare_classic_blocks_(sector_first_block(MAD2_SECTOR), MAD2_BLOCKS, mad, nfc::DEFAULT_KEY,
+                                          nfc::MIFARE_CMD_AUTH_B) != nfc::STATUS_OK) {
+      return TagOpStatus::FAILED;
+    }
+    sectors |= mad_ndef_sectors(mad, MAD2_SECTOR) & card_mask;
   }
 
-  ESP_LOGD(TAG, "Sector 0 formatted with NDEF");
-
-  auto status = nfc::STATUS_OK;
+  if (sectors != 0 && ndef_sectors_capacity(sectors) >= needed) {
+    // already NDEF formatted with room for the message: leave the format be, and write only what has changed
+    ESP_LOGD(TAG, "Already NDEF formatted; writing only blocks that differ");
+    op.ndef_sectors = sectors;
+    op.differential = true;
+    return TagOpStatus::DONE;
+  }
+  // sector 0 is still authenticated unless the MAD2 was looked at too
+  op.block = mad2_read ? 0 : 1;
+  op.authenticated = !mad2_read;
+  return TagOpStatus::PENDING;
+}
 
-  for (int block = 4; block < 64; block += 4) {
-    if (this->auth_mifare_classic_block_(block + 3, nfc::MIFARE_CMD_AUTH_B, nfc::DEFAULT_KEY) != nfc::STATUS_OK) {
-      return nfc::STATUS_FAILED;
+TagOpStatus PN7160::format_mifare_classic_ndef_() {
+  static const uint8_t empty_ndef_message[] = {0x03, 0x03, 0xD0, 0x00, 0x00, 0xFE, 0x00, 0x00,
+                                               0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+  static const uint8_t blank_block[] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                                        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+  static const uint8_t mad_trailer[] = {0xA0, 0xA1, 0xA2, 0xA3, 0xA4, 0xA5, 0x78, 0x77,
+                                        0x88, MAD_GPB_V1, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+  static const uint8_t ndef_trailer[] = {0xD3, 0xF7, 0xD3, 0xF7, 0xD3, 0xF7, 0x7F, 0x07,
+                                         0x88, 0x40, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+  auto &op = this->tag_op_;
+
+  if (op.ndef_sectors == 0) {
+    // formatting for a write only takes the sectors the message needs; otherwise every sector but the MAD's
+    const bool whole_card = op.task != EP_WRITE;
+    const uint8_t sectors = card_sectors(op.card_blocks);
+    const uint32_t message_bytes =
+        whole_card ? 0 : nfc::get_mifare_classic_buffer_size(this->encode_ndef_tlv_(this->next_task_message_to_write_));
+    uint32_t needed = message_bytes;
+    for (uint8_t sector = 1; sector < sectors && (whole_card || needed > 0); sector++) {
+      if (sector == MAD2_SECTOR) {
+        continue;
+      }
+      op.ndef_sectors |= 1ULL << sector;
+      const uint32_t sector_bytes = (sector_blocks(sector) - 1) * nfc::MIFARE_CLASSIC_BLOCK_SIZE;
+      needed -= std::min(needed, sector_bytes);
+    }
+    if (needed > 0) {
+      ESP_LOGE(TAG, "NDEF message is too large for this tag");
+      return TagOpStatus::FAILED;
     }
-    if (block == 4) {
-      if (this->write_mifare_classic_block_(block, empty_ndef_message) != nfc::STATUS_OK) {
-        ESP_LOGE(TAG, "Unable to write block %u", block);
-        status = nfc::STATUS_FAILED;
+    if (!whole_card) {
+      return this->check_mifare_classic_ndef_format_(message_bytes);
+    }
+  }
+
+  const uint8_t sector = this->sect_to_auth_(op.block);
+  const bool mad_sector = sector == MAD1_SECTOR || sector == MAD2_SECTOR;
+  if (!op.authenticated) {
+    if (this->auth_mifare_classic_block_(op.block, nfc::MIFARE_CMD_AUTH_B, nfc::DEFAULT_KEY) != nfc::STATUS_OK) {
+      if (op.block == 0) {
+        ESP_LOGE(TAG, "Unable to authenticate block 0 for formatting");
       }
+      return TagOpStatus::FAILED;
+    }
+    op.authenticated = true;
+    if (op.block == 0) {
+      op.block++;  // leave the manufacturer block alone
+    } else if (!mad_sector && op.task == EP_WRITE) {
+      op.block = sector_first_block(sector) + sector_blocks(sector) - 1;  // the write that follows fills the data
+    }
+    return TagOpStatus::PENDING;
+  }
+
+  const uint64_t mad_sectors = mad_sectors_for(op.ndef_sectors);
+  const bool trailer = nfc::mifare_classic_is_trailer_block(op.block);
+  if (mad_sector) {
+    uint8_t data[nfc::MIFARE_CLASSIC_BLOCK_SIZE];
+    // the MAD points the sectors being formatted at the NDEF application
+    if (trailer) {
+      std::memcpy(data, mad_trailer, sizeof(mad_trailer));
+      data[TRAILER_GPB_OFFSET] = (mad_sectors >> MAD2_SECTOR) & 1 ? MAD_GPB_V2 : MAD_GPB_V1;
     } else {
-      if (this->write_mifare_classic_block_(block, blank_block) != nfc::STATUS_OK) {
-        ESP_LOGE(TAG, "Unable to write block %u", block);
-        status = nfc::STATUS_FAILED;
-      }
+      uint8_t mad[MAD2_BLOCKS * nfc::MIFARE_CLASSIC_BLOCK_SIZE];
+      build_mad(mad, sector, op.ndef_sectors);
+      const uint8_t offset = (op.block - sector_first_block(sector) - (sector == MAD1_SECTOR ? 1 : 0)) *
+                             nfc::MIFARE_CLASSIC_BLOCK_SIZE;
+      std::memcpy(data, mad + offset, nfc::MIFARE_CLASSIC_BLOCK_SIZE);
     }
-    if (this->write_mifare_classic_block_(block + 1, blank_block) != nfc::STATUS_OK) {
-      ESP_LOGE(TAG, "Unable to write block %u", block + 1);
-      status = nfc::STATUS_FAILED;
+    if (this->write_mifare_classic_block_(op.block, data) != nfc::STATUS_OK) {
+      return TagOpStatus::FAILED;
     }
-    if (this->write_mifare_classic_block_(block + 2, blank_block) != nfc::STATUS_OK) {
-      ESP_LOGE(TAG, "Unable to write block %u", block + 2);
-      status = nfc::STATUS_FAILED;
+    if (trailer) {
+      ESP_LOGD(TAG, "Sector %u formatted with the MAD", sector);
     }
-    if (this->write_mifare_classic_block_(block + 3, ndef_trailer) != nfc::STATUS_OK) {
-      ESP_LOGE(TAG, "Unable to write trailer block %u", block + 3);
-      status = nfc::STATUS_FAILED;
+  } else {
+    const uint16_t first_ndef_block = next_sector_block(op.ndef_sectors, MAD1_SECTOR);
+    const uint8_t *data = trailer ? ndef_trailer : op.block == first_ndef_block ? empty_ndef_message : blank_block;
+    if (this->write_mifare_classic_block_(op.block, data) != nfc::STATUS_OK) {
+      ESP_LOGE(TAG, "Unable to write %sblock %u", trailer ? "trailer " : "", op.block);
+      op.status = nfc::STATUS_FAILED;
     }
   }
-  return status;
+  op.authenticated = !trailer;
+  if (!trailer) {
+    op.block++;
+    return TagOpStatus::PENDING;
+  }
+  op.block = next_sector_block(op.ndef_sectors | mad_sectors, sector);
+  return op.block != 0 ? TagOpStatus::PENDING : this->tag_op_result_();
 }
 
-uint8_t PN7160::write_mifare_classic_block_(uint8_t block_num, std::vector<uint8_t> &write_data) {
-  nfc::NciMessage rx;
-  nfc::NciMessage tx(nfc::NCI_PKT_MT_DATA, {XCHG_DATA_OID, nfc::MIFARE_CMD_WRITE, block_num});
+uint8_t PN7160::write_mifare_classic_block_(uint8_t block_num, const uint8_t *write_data) {
+  NciFrame rx;
+  NciFrame tx(nfc::NCI_PKT_MT_DATA, {XCHG_DATA_OID, nfc::MIFARE_CMD_WRITE, block_num});
   char buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
 
-  ESP_LOGVV(TAG, "Write XCHG_DATA_REQ 1: %s", nfc::format_bytes_to(buf, tx.get_message()));
-  if (this->transceive_(tx, rx) != nfc::STATUS_OK) {
+  if (this->send_data_(tx) != nfc::STATUS_OK) {
     ESP_LOGE(TAG, "Sending XCHG_DATA_REQ failed");
     return nfc::STATUS_FAILED;
   }
-  // write command part two
+  // write command part two, queued in the NFCC behind part one rather than after its ACK has come back to us
   tx.set_payload({XCHG_DATA_OID});
-  tx.get_message().insert(tx.get_message().end(), write_data.begin(), write_data.end());
+  tx.append(write_data, nfc::MIFARE_CLASSIC_BLOCK_SIZE);
 
-  ESP_LOGVV(TAG, "Write XCHG_DATA_REQ 2: %s", nfc::format_bytes_to(buf, tx.get_message()));
-  if (this->transceive_(tx, rx, NFCC_TAG_WRITE_TIMEOUT) != nfc::STATUS_OK) {
+  if (this->send_data_(tx, NFCC_TAG_WRITE_TIMEOUT) != nfc::STATUS_OK || this->receive_data_(rx) != nfc::STATUS_OK) {
+    ESP_LOGE(TAG, "Sending XCHG_DATA_REQ failed");
+    this->discard_data_in_flight_();
+    return nfc::STATUS_FAILED;
+  }
+  if (!mifare_classic_write_acked(rx)) {
+    // refused (a write-protected block or trailer); part two is already queued, and its answer is dropped
+    ESP_LOGE(TAG, "MFC write block refused - block 0x%02x", block_num);
+    ESP_LOGV(TAG, "Write response: %s", format_frame_to(buf, rx));
+    this->discard_data_in_flight_();
+    return nfc::STATUS_FAILED;
+  }
+  if (this->receive_data_(rx, NFCC_TAG_WRITE_TIMEOUT) != nfc::STATUS_OK) {
     ESP_LOGE(TAG, "MFC XCHG_DATA timed out waiting for XCHG_DATA_RSP during block write");
     return nfc::STATUS_FAILED;
   }
 
-  if ((!rx.message_type_is(nfc::NCI_PKT_MT_DATA)) || (!rx.simple_status_response_is(XCHG_DATA_OID)) ||
-      (rx.get_message()[4] != nfc::MIFARE_CMD_ACK)) {
+  if (!mifare_classic_write_acked(rx)) {
     ESP_LOGE(TAG, "MFC write block failed - block 0x%02x", block_num);
-    ESP_LOGV(TAG, "Write response: %s", nfc::format_bytes_to(buf, rx.get_message()));
+    ESP_LOGV(TAG, "Write response: %s", format_frame_to(buf, rx));
     return nfc::STATUS_FAILED;
   }
 
   return nfc::STATUS_OK;
 }
 
-uint8_t PN7160::write_mifare_classic_tag_(const std::shared_ptr<nfc::NdefMessage> &message) {
-  auto encoded = message->encode();
-
-  uint32_t message_length = encoded.size();
-  uint32_t buffer_length = nfc::get_mifare_classic_buffer_size(message_length);
+TagOpStatus PN7160::write_mifare_classic_tag_(const std::shared_ptr<nfc::NdefMessage> &message) {
+  auto &op = this->tag_op_;
 
-  encoded.insert(encoded.begin(), 0x03);
-  if (message_length < 255) {
-    encoded.insert(encoded.begin() + 1, message_length);
-  } else {
-    encoded.insert(encoded.begin() + 1, 0xFF);
-    encoded.insert(encoded.begin() + 2, (message_length >> 8) & 0xFF);
-    encoded.insert(encoded.begin() + 3, message_length & 0xFF);
+  if (op.length == 0) {
+    op.length = nfc::get_mifare_classic_buffer_size(this->encode_ndef_tlv_(message));
+    this->tag_data_.resize(op.length, 0);
+    // formatting chose the sectors, and made sure they'd hold the message
+    op.block = next_sector_block(op.ndef_sectors, MAD1_SECTOR);
   }
-  encoded.push_back(0xFE);
-
-  encoded.resize(buffer_length, 0);
 
-  uint32_t index = 0;
-  uint8_t current_block = 4;
-
-  while (index < buffer_length) {
-    if (nfc::mifare_classic_is_first_block(current_block)) {
-      if (this->auth_mifare_classic_block_(current_block, nfc::MIFARE_CMD_AUTH_A, nfc::NDEF_KEY) != nfc::STATUS_OK) {
-        return nfc::STATUS_FAILED;
+  bool read_back = false;
+  if (op.compared == 0) {
+    // the rest of this sector, or as much of it as a step reads back
+    const uint8_t sector = this->sect_to_auth_(op.block);
+    const uint16_t trailer = sector_first_block(sector) + sector_blocks(sector) - 1;
+    const uint8_t count = std::min<uint32_t>(std::min<uint32_t>(trailer - op.block, MAX_READS_PER_STEP),
+                                             (op.length - op.index) / nfc::MIFARE_CLASSIC_BLOCK_SIZE);
+    if (op.differential) {
+      uint8_t current[MAX_READS_PER_STEP * nfc::MIFARE_CLASSIC_BLOCK_SIZE];
+      if (this->read_mifare_classic_blocks_(op.block, count, current, op.authenticated ? nullptr : nfc::NDEF_KEY) !=
+          nfc::STATUS_OK) {
+        return TagOpStatus::FAILED;
       }
+      op.authenticated = true;
+      read_back = true;
+      op.dirty = 0;
+      for (uint8_t i = 0; i < count; i++) {
+        if (std::memcmp(current + i * nfc::MIFARE_CLASSIC_BLOCK_SIZE,
+                        this->tag_data_.data() + op.index + i * nfc::MIFARE_CLASSIC_BLOCK_SIZE,
+                        nfc::MIFARE_CLASSIC_BLOCK_SIZE) != 0) {
+          op.dirty |= 1 << i;
+        }
+      }
+    } else {
+      if (!op.authenticated) {
+        if (this->auth_mifare_classic_block_(op.block, nfc::MIFARE_CMD_AUTH_A, nfc::NDEF_KEY) != nfc::STATUS_OK) {
+          return TagOpStatus::FAILED;
+        }
+        op.authenticated = true;
+        return TagOpStatus::PENDING;
+      }
+      op.dirty = (1 << count) - 1;
     }
+    op.compared = count;
+  }
 
-    std::vector<uint8_t> data(encoded.begin() + index, encoded.begin() + index + nfc::MIFARE_CLASSIC_BLOCK_SIZE);
-    if (this->write_mifare_classic_block_(current_block, data) != nfc::STATUS_OK) {
-      return nfc::STATUS_FAILED;
+  // blocks that already hold their data are passed over without a step of their own
+  while (op.compared > 0 && !(op.dirty & 1)) {
+    op.index += nfc::MIFARE_CLASSIC_BLOCK_SIZE;
+    op.block++;
+    op.compared--;
+    op.dirty >>= 1;
+    op.skipped++;
+  }
+  // a step that read back leaves the write to the next one
+  if (op.compared > 0 && !read_back) {
+    if (this->write_mifare_classic_block_(op.block, this->tag_data_.data() + op.index) != nfc::STATUS_OK) {
+      return TagOpStatus::FAILED;
     }
-    index += nfc::MIFARE_CLASSIC_BLOCK_SIZE;
-    current_block++;
+    op.index += nfc::MIFARE_CLASSIC_BLOCK_SIZE;
+    op.block++;
+    op.compared--;
+    op.dirty >>= 1;
+  }
+  if (op.compared > 0) {
+    return TagOpStatus::PENDING;
+  }
 
-    if (nfc::mifare_classic_is_trailer_block(current_block)) {
-      // Skipping as cannot write to trailer
-      current_block++;
+  if (op.index >= op.length) {
+    if (op.differential) {
+      ESP_LOGD(TAG, "  %u of %" PRIu32 " blocks already up to date", op.skipped,
+               op.length / nfc::MIFARE_CLASSIC_BLOCK_SIZE);
     }
+    return TagOpStatus::DONE;
   }
-  return nfc::STATUS_OK;
+  if (nfc::mifare_classic_is_trailer_block(op.block)) {
+    // Skipping as cannot write to trailer
+    op.block = next_sector_block(op.ndef_sectors, this->sect_to_auth_(op.block));
+    op.authenticated = false;
+    if (op.block == 0) {
+      return TagOpStatus::FAILED;
+    }
+  }
+  return TagOpStatus::PENDING;
 }
 
 uint8_t PN7160::halt_mifare_classic_tag_() {
-  nfc::NciMessage rx;
-  nfc::NciMessage tx(nfc::NCI_PKT_MT_DATA, {XCHG_DATA_OID, nfc::MIFARE_CMD_HALT, 0});
+  NciFrame rx;
+  NciFrame tx(nfc::NCI_PKT_MT_DATA, {XCHG_DATA_OID, nfc::MIFARE_CMD_HALT, 0});
 
-  char buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
-  ESP_LOGVV(TAG, "Halt XCHG_DATA_REQ: %s", nfc::format_bytes_to(buf, tx.get_message()));
   if (this->transceive_(tx, rx, NFCC_TAG_WRITE_TIMEOUT) != nfc::STATUS_OK) {
     ESP_LOGE(TAG, "Sending halt XCHG_DATA_REQ failed");
     return nfc::STATUS_FAILED;
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <cinttypes>
+#include <cstring>
 #include <memory>
 
 #include "pn7160.h"
@@ -9,177 +11,386 @@ namespace pn7160 {
 
 static const char *const TAG = "pn7160.mifare_ultralight";
 
-uint8_t PN7160::read_mifare_ultralight_tag_(nfc::NfcTag &tag) {
-  std::vector<uint8_t> data;
-  // pages 3 to 6 contain various info we are interested in -- do one read to grab it all
-  if (this->read_mifare_ultralight_bytes_(3, nfc::MIFARE_ULTRALIGHT_PAGE_SIZE * nfc::MIFARE_ULTRALIGHT_READ_SIZE,
-                                          data) != nfc::STATUS_OK) {
-    return nfc::STATUS_FAILED;
-  }
+// pipelined back to back within one step of a tag operation
+static const uint8_t READS_PER_STEP = 4;
+static const uint8_t PAGES_PER_STEP = 4;
+
+static const uint8_t CC_PAGE = 3;
+static const uint8_t CC_NDEF_MAGIC = 0xE1;  // first capability container byte on an NDEF formatted tag
+static const uint8_t CC_SIZE = 2;           // capability container byte with the data area size, in 8-byte units
+
+static const uint8_t NTAG_CMD_GET_VERSION = 0x60;
+static const uint8_t NTAG_CMD_FAST_READ = 0x3A;
+static const uint8_t VERSION_LENGTH = 8;
+static const uint8_t VERSION_VENDOR = 1;
+static const uint8_t VERSION_PRODUCT_TYPE = 2;
+static const uint8_t VENDOR_NXP = 0x04;
+static const uint8_t PRODUCT_NTAG = 0x04;
+static const uint8_t VERSION_STORAGE_SIZE = 6;
+static const uint8_t STORAGE_NTAG215 = 0x11;
+static const uint8_t STORAGE_NTAG216 = 0x13;
+// the largest data area of a MIFARE Ultralight (C, 144 bytes, as on an NTAG213); those without GET_VERSION need
+// reactivating once sent one, so only tags with more than this are asked -- smaller ones are read in a few steps of
+// READs anyway, and stay TagChip::UNKNOWN
+static const uint8_t ULTRALIGHT_MAX_CC_SIZE = 0x12;
+static const uint8_t FAST_READ_ATTEMPTS = 2;  // per exchange, before the rest of the tag is read with READ
+
+/// the tag's 4-bit ACK to a WRITE, rather than a NAK, with the NFCC's status byte after it OK
+static bool ultralight_write_acked(const NciFrame &rx) {
+  return rx.get_payload_size() == 2 && rx.payload()[0] == nfc::MIFARE_CMD_ACK && rx.payload()[1] == nfc::STATUS_OK;
+}
 
-  if (!this->is_mifare_ultralight_formatted_(data)) {
-    ESP_LOGW(TAG, "Not NDEF formatted");
-    return nfc::STATUS_FAILED;
-  }
+TagOpStatus PN7160::read_mifare_ultralight_tag_(nfc::NfcTag &tag) {
+  const uint8_t header_bytes = nfc::MIFARE_ULTRALIGHT_PAGE_SIZE * nfc::MIFARE_ULTRALIGHT_READ_SIZE;
+  auto &op = this->tag_op_;
+  auto &data = this->tag_data_;
+
+  if (op.length == 0) {
+    // pages 3 to 6 contain various info we are interested in -- do one read to grab it all, unless the tag was
+    // identified on this tap and the read that did it left them behind
+    if (data.size() != header_bytes) {
+      data.resize(header_bytes);
+      if (this->read_mifare_ultralight_bytes_(CC_PAGE, header_bytes, data.data()) != nfc::STATUS_OK) {
+        return TagOpStatus::FAILED;
+      }
+    }
 
-  uint8_t message_length;
-  uint8_t message_start_index;
-  if (this->find_mifare_ultralight_ndef_(data, message_length, message_start_index) != nfc::STATUS_OK) {
-    ESP_LOGW(TAG, "Couldn't find NDEF message");
-    return nfc::STATUS_FAILED;
-  }
-  ESP_LOGVV(TAG, "NDEF message length: %u, start: %u", message_length, message_start_index);
+    if (!this->is_mifare_ultralight_formatted_(data)) {
+      ESP_LOGW(TAG, "Not NDEF formatted");
+      return TagOpStatus::FAILED;
+    }
 
-  if (message_length == 0) {
-    return nfc::STATUS_FAILED;
-  }
-  // we already read pages 3-6 earlier -- pick up where we left off so we're not re-reading pages
-  const uint8_t read_length = message_length + message_start_index > 12 ? message_length + message_start_index - 12 : 0;
-  if (read_length) {
-    if (read_mifare_ultralight_bytes_(nfc::MIFARE_ULTRALIGHT_DATA_START_PAGE + 3, read_length, data) !=
-        nfc::STATUS_OK) {
+    uint16_t message_length;
+    if (this->find_mifare_ultralight_ndef_(data, message_length, op.message_start) != nfc::STATUS_OK) {
+      ESP_LOGW(TAG, "Couldn't find NDEF message");
+      return TagOpStatus::FAILED;
+    }
+    ESP_LOGVV(TAG, "NDEF message length: %u, start: %u", message_length, op.message_start);
+
+    if (message_length == 0) {
+      return TagOpStatus::FAILED;
+    }
+    // we already read pages 3-6 -- pick up where we left off so we're not re-reading pages
+    const uint16_t read_length = message_length + op.message_start > 12 ? message_length + op.message_start - 12 : 0;
+    op.index = header_bytes;
+    op.length = header_bytes + read_length;
+    op.block = nfc::MIFARE_ULTRALIGHT_DATA_START_PAGE + 3;
+    data.resize(op.length);
+  } else if (op.fast_read) {
+    // as many pages as fit in one data packet, so a full NTAG216 takes four exchanges instead of 56 READs
+    const uint16_t max_bytes = (this->conn_max_payload_[NCI_STATIC_RF_CONN_ID] - 1) / nfc::MIFARE_ULTRALIGHT_PAGE_SIZE *
+                               nfc::MIFARE_ULTRALIGHT_PAGE_SIZE;
+    const uint16_t read_length = std::min<uint32_t>(op.length - op.index, max_bytes);
+    if (this->fast_read_mifare_ultralight_bytes_(op.block, read_length, data.data() + op.index) != nfc::STATUS_OK) {
+      if (++op.retries >= FAST_READ_ATTEMPTS) {
+        ESP_LOGW(TAG, "FAST_READ failed at page %u; reading the rest with READ", op.block);
+        op.fast_read = false;
+      }
+      return TagOpStatus::PENDING;
+    }
+    op.retries = 0;
+    op.index += read_length;
+    op.block += read_length / nfc::MIFARE_ULTRALIGHT_PAGE_SIZE;
+  } else {
+    const uint16_t read_length = std::min<uint32_t>(op.length - op.index, header_bytes * READS_PER_STEP);
+    if (this->read_mifare_ultralight_bytes_(op.block, read_length, data.data() + op.index) != nfc::STATUS_OK) {
       ESP_LOGE(TAG, "Error reading tag data");
-      return nfc::STATUS_FAILED;
+      return TagOpStatus::FAILED;
     }
+    op.index += read_length;
+    op.block += nfc::MIFARE_ULTRALIGHT_READ_SIZE * READS_PER_STEP;
+  }
+  if (op.index < op.length) {
+    return TagOpStatus::PENDING;
   }
-  // we need to trim off page 3 as well as any bytes ahead of message_start_index
-  data.erase(data.begin(), data.begin() + message_start_index + nfc::MIFARE_ULTRALIGHT_PAGE_SIZE);
+
+  // we need to trim off page 3 as well as any bytes ahead of the message start
+  data.erase(data.begin(), data.begin() + op.message_start + nfc::MIFARE_ULTRALIGHT_PAGE_SIZE);
 
   tag.set_ndef_message(make_unique<nfc::NdefMessage>(data));
 
-  return nfc::STATUS_OK;
+  return TagOpStatus::DONE;
 }
 
-uint8_t PN7160::read_mifare_ultralight_bytes_(uint8_t start_page, uint16_t num_bytes, std::vector<uint8_t> &data) {
+uint8_t PN7160::read_mifare_ultralight_bytes_(uint8_t start_page, uint16_t num_bytes, uint8_t *data) {
   const uint8_t read_increment = nfc::MIFARE_ULTRALIGHT_READ_SIZE * nfc::MIFARE_ULTRALIGHT_PAGE_SIZE;
-  nfc::NciMessage rx;
-  nfc::NciMessage tx(nfc::NCI_PKT_MT_DATA, {nfc::MIFARE_CMD_READ, start_page});
+  const size_t reads = (num_bytes + read_increment - 1) / read_increment;
+  NciFrame rx;
+  NciFrame tx(nfc::NCI_PKT_MT_DATA, {nfc::MIFARE_CMD_READ, start_page});
 
-  for (size_t i = 0; i * read_increment < num_bytes; i++) {
-    tx.get_message().back() = i * nfc::MIFARE_ULTRALIGHT_READ_SIZE + start_page;
-    do {  // loop because sometimes we struggle here...???...
-      if (this->transceive_(tx, rx) != nfc::STATUS_OK) {
+  // each READ is sent while the one before it is on air, so the tag doesn't sit idle waiting on the host
+  if (this->send_data_(tx) != nfc::STATUS_OK) {
+    ESP_LOGE(TAG, "Error reading tag data");
+    return nfc::STATUS_FAILED;
+  }
+  for (size_t i = 0; i < reads; i++) {
+    if (i + 1 < reads) {
+      tx.payload()[1] = (i + 1) * nfc::MIFARE_ULTRALIGHT_READ_SIZE + start_page;
+      if (this->send_data_(tx) != nfc::STATUS_OK) {
         ESP_LOGE(TAG, "Error reading tag data");
         return nfc::STATUS_FAILED;
       }
-    } while (rx.get_payload_size() < read_increment);
-    uint16_t bytes_offset = (i + 1) * read_increment;
-    auto pages_in_end_itr = bytes_offset <= num_bytes ? rx.get_message().end() - 1
-                                                      : rx.get_message().end() - (bytes_offset - num_bytes + 1);
-
-    if ((pages_in_end_itr > rx.get_message().begin()) && (pages_in_end_itr < rx.get_message().end())) {
-      data.insert(data.end(), rx.get_message().begin() + nfc::NCI_PKT_HEADER_SIZE, pages_in_end_itr);
     }
+    if (this->receive_data_(rx) != nfc::STATUS_OK) {
+      ESP_LOGE(TAG, "Error reading tag data");
+      return nfc::STATUS_FAILED;
+    }
+    if (rx.get_payload_size() < read_increment) {
+      // a NAK, e.g. for a page past the end of the tag; asking again would get the same answer
+      ESP_LOGE(TAG, "Short read at page %u", static_cast<uint8_t>(i * nfc::MIFARE_ULTRALIGHT_READ_SIZE + start_page));
+      return nfc::STATUS_FAILED;
+    }
+    // the payload is 16 bytes of page data followed by a status byte; keep only what the caller asked for
+    const uint16_t bytes_offset = i * read_increment;
+    const uint16_t bytes_wanted = num_bytes - bytes_offset < read_increment ? num_bytes - bytes_offset : read_increment;
+    std::memcpy(data + bytes_offset, rx.payload(), bytes_wanted);
   }
 
   char buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
-  ESP_LOGVV(TAG, "Data read: %s", nfc::format_bytes_to(buf, data));
+  ESP_LOGVV(TAG, "Data read: %s", format_frame_to(buf, data, num_bytes));
 
   return nfc::STATUS_OK;
 }
 
-bool PN7160::is_mifare_ultralight_formatted_(const std::vector<uint8_t> &page_3_to_6) {
-  const uint8_t p4_offset = nfc::MIFARE_ULTRALIGHT_PAGE_SIZE;  // page 4 will begin 4 bytes into the vector
+uint8_t PN7160::fast_read_mifare_ultralight_bytes_(uint8_t start_page, uint16_t num_bytes, uint8_t *data) {
+  const uint8_t pages = (num_bytes + nfc::MIFARE_ULTRALIGHT_PAGE_SIZE - 1) / nfc::MIFARE_ULTRALIGHT_PAGE_SIZE;
+  NciFrame rx;
+  NciFrame tx(nfc::NCI_PKT_MT_DATA, {NTAG_CMD_FAST_READ, start_page, static_cast<uint8_t>(start_page + pages - 1)});
 
-  return (page_3_to_6.size() > p4_offset + 3) &&
-         ((page_3_to_6[p4_offset + 0] != 0xFF) || (page_3_to_6[p4_offset + 1] != 0xFF) ||
-          (page_3_to_6[p4_offset + 2] != 0xFF) || (page_3_to_6[p4_offset + 3] != 0xFF));
-}
-
-uint16_t PN7160::read_mifare_ultralight_capacity_() {
-  std::vector<uint8_t> data;
-  if (this->read_mifare_ultralight_bytes_(3, nfc::MIFARE_ULTRALIGHT_PAGE_SIZE, data) == nfc::STATUS_OK) {
-    ESP_LOGV(TAG, "Tag capacity is %u bytes", data[2] * 8U);
-    return data[2] * 8U;
+  if (this->transceive_(tx, rx, NFCC_TAG_FAST_READ_TIMEOUT) != nfc::STATUS_OK) {
+    ESP_LOGE(TAG, "Error reading tag data");
+    return nfc::STATUS_FAILED;
+  }
+  // the payload is the pages followed by a status byte
+  if (rx.get_payload_size() < pages * nfc::MIFARE_ULTRALIGHT_PAGE_SIZE + 1) {
+    ESP_LOGW(TAG, "Short FAST_READ at page %u", start_page);
+    return nfc::STATUS_FAILED;
   }
-  return 0;
+  std::memcpy(data, rx.payload(), num_bytes);
+
+  char buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
+  ESP_LOGVV(TAG, "Data read: %s", format_frame_to(buf, data, num_bytes));
+
+  return nfc::STATUS_OK;
 }
 
-uint8_t PN7160::find_mifare_ultralight_ndef_(const std::vector<uint8_t> &page_3_to_6, uint8_t &message_length,
-                                             uint8_t &message_start_index) {
-  const uint8_t p4_offset = nfc::MIFARE_ULTRALIGHT_PAGE_SIZE;  // page 4 will begin 4 bytes into the vector
+uint8_t PN7160::identify_mifare_ultralight_(TagIdentity &identity) {
+  const uint8_t header_bytes = nfc::MIFARE_ULTRALIGHT_PAGE_SIZE * nfc::MIFARE_ULTRALIGHT_READ_SIZE;
+  auto &data = this->tag_data_;
 
-  if (!(page_3_to_6.size() > p4_offset + 5)) {
+  data.resize(header_bytes);
+  if (this->read_mifare_ultralight_bytes_(CC_PAGE, header_bytes, data.data()) != nfc::STATUS_OK) {
     return nfc::STATUS_FAILED;
   }
+  identity.ndef_formatted = data[0] == CC_NDEF_MAGIC;
+  identity.capacity = data[CC_SIZE] * 8U;
+  identity.chip = TagChip::UNKNOWN;
+  identity.fast_read = false;
+  if (data[CC_SIZE] <= ULTRALIGHT_MAX_CC_SIZE) {
+    return nfc::STATUS_OK;
+  }
 
-  if (page_3_to_6[p4_offset + 0] == 0x03) {
-    message_length = page_3_to_6[p4_offset + 1];
-    message_start_index = 2;
+  NciFrame rx;
+  NciFrame tx(nfc::NCI_PKT_MT_DATA, {NTAG_CMD_GET_VERSION});
+  if (this->transceive_(tx, rx) != nfc::STATUS_OK || rx.get_payload_size() < VERSION_LENGTH) {
+    ESP_LOGV(TAG, "No answer to GET_VERSION");
     return nfc::STATUS_OK;
-  } else if (page_3_to_6[p4_offset + 5] == 0x03) {
-    message_length = page_3_to_6[p4_offset + 6];
-    message_start_index = 7;
+  }
+  const uint8_t *version = rx.payload();
+  if (version[VERSION_VENDOR] != VENDOR_NXP || version[VERSION_PRODUCT_TYPE] != PRODUCT_NTAG) {
     return nfc::STATUS_OK;
   }
-  return nfc::STATUS_FAILED;
+  switch (version[VERSION_STORAGE_SIZE]) {
+    case STORAGE_NTAG215:
+      identity.chip = TagChip::NTAG215;
+      break;
+    case STORAGE_NTAG216:
+      identity.chip = TagChip::NTAG216;
+      break;
+    default:
+      break;
+  }
+  identity.fast_read = true;  // every NTAG21x has it
+  return nfc::STATUS_OK;
 }
 
-uint8_t PN7160::write_mifare_ultralight_tag_(nfc::NfcTagUid &uid, const std::shared_ptr<nfc::NdefMessage> &message) {
-  uint32_t capacity = this->read_mifare_ultralight_capacity_();
+bool PN7160::is_mifare_ultralight_formatted_(const std::vector<uint8_t> &page_3_to_6) {
+  const uint8_t p4_offset = nfc::MIFARE_ULTRALIGHT_PAGE_SIZE;  // page 4 will begin 4 bytes into the vector
 
-  auto encoded = message->encode();
+  return (page_3_to_6.size() > p4_offset + 3) &&
+         ((page_3_to_6[p4_offset + 0] != 0xFF) || (page_3_to_6[p4_offset + 1] != 0xFF) ||
+          (page_3_to_6[p4_offset + 2] != 0xFF) || (page_3_to_6[p4_offset + 3] != 0xFF));
+}
 
-  uint32_t message_length = encoded.size();
-  uint32_t buffer_length = nfc::get_mifare_ultralight_buffer_size(message_length);
+uint8_t PN7160::find_mifare_ultralight_ndef_(const std::vector<uint8_t> &page_3_to_6, uint16_t &message_length,
+                                             uint8_t &message_start_index) {
+  const uint8_t p4_offset = nfc::MIFARE_ULTRALIGHT_PAGE_SIZE;  // page 4 will begin 4 bytes into the vector
 
-  if (buffer_length > capacity) {
-    ESP_LOGE(TAG, "Message length exceeds tag capacity %" PRIu32 " > %" PRIu32, buffer_length, capacity);
+  if (!(page_3_to_6.size() > p4_offset + 8)) {
     return nfc::STATUS_FAILED;
   }
 
-  encoded.insert(encoded.begin(), 0x03);
-  if (message_length < 255) {
-    encoded.insert(encoded.begin() + 1, message_length);
+  uint8_t tlv_index;
+  if (page_3_to_6[p4_offset + 0] == 0x03) {
+    tlv_index = p4_offset;
+  } else if (page_3_to_6[p4_offset + 5] == 0x03) {
+    tlv_index = p4_offset + 5;
+  } else {
+    return nfc::STATUS_FAILED;
+  }
+  // 0xFF in the length byte means the next two bytes hold the length (messages of 255 bytes or more)
+  if (page_3_to_6[tlv_index + 1] == 0xFF) {
+    message_length = (page_3_to_6[tlv_index + 2] << 8) | page_3_to_6[tlv_index + 3];
+    message_start_index = tlv_index - p4_offset + 4;
   } else {
-    encoded.insert(encoded.begin() + 1, 0xFF);
-    encoded.insert(encoded.begin() + 2, (message_length >> 8) & 0xFF);
-    encoded.insert(encoded.begin() + 2, message_length & 0xFF);
+    message_length = page_3_to_6[tlv_index + 1];
+    message_start_index = tlv_index - p4_offset + 2;
   }
-  encoded.push_back(0xFE);
+  return nfc::STATUS_OK;
+}
 
-  encoded.resize(buffer_length, 0);
+TagOpStatus PN7160::write_mifare_ultralight_tag_(const std::shared_ptr<nfc::NdefMessage> &message) {
+  auto &op = this->tag_op_;
+
+  if (op.length == 0) {
+    this->encode_ndef_tlv_(message);
+    const uint32_t capacity = op.identity.capacity;
+    // the TLV as built, its header two or four bytes, padded out to a whole page
+    const uint32_t buffer_length = (this->tag_data_.size() + nfc::MIFARE_ULTRALIGHT_PAGE_SIZE - 1) /
+                                   nfc::MIFARE_ULTRALIGHT_PAGE_SIZE * nfc::MIFARE_ULTRALIGHT_PAGE_SIZE;
+    if (buffer_length > capacity) {
+      ESP_LOGE(TAG, "Message length exceeds tag capacity %" PRIu32 " > %" PRIu32, buffer_length, capacity);
+      return TagOpStatus::FAILED;
+    }
+    this->tag_data_.resize(buffer_length, 0);
+    op.length = buffer_length;
+    op.block = nfc::MIFARE_ULTRALIGHT_DATA_START_PAGE;
+    return TagOpStatus::PENDING;
+  }
 
-  uint32_t index = 0;
-  uint8_t current_page = nfc::MIFARE_ULTRALIGHT_DATA_START_PAGE;
+  bool read_back = false;
+  if (op.compared == 0) {
+    // read back with one READ: as many pages as a step writes
+    const uint8_t count = std::min<uint32_t>((op.length - op.index) / nfc::MIFARE_ULTRALIGHT_PAGE_SIZE, PAGES_PER_STEP);
+    if (op.differential) {
+      uint8_t current[PAGES_PER_STEP * nfc::MIFARE_ULTRALIGHT_PAGE_SIZE];
+      if (this->read_mifare_ultralight_bytes_(op.block, count * nfc::MIFARE_ULTRALIGHT_PAGE_SIZE, current) !=
+          nfc::STATUS_OK) {
+        return TagOpStatus::FAILED;
+      }
+      read_back = true;
+      op.dirty = 0;
+      for (uint8_t i = 0; i < count; i++) {
+        if (std::memcmp(current + i * nfc::MIFARE_ULTRALIGHT_PAGE_SIZE,
+                        this->tag_data_.data() + op.index + i * nfc::MIFARE_ULTRALIGHT_PAGE_SIZE,
+                        nfc::MIFARE_ULTRALIGHT_PAGE_SIZE) != 0) {
+          op.dirty |= 1 << i;
+        }
+      }
+    } else {
+      op.dirty = (1 << count) - 1;
+    }
+    op.compared = count;
+  }
 
-  while (index < buffer_length) {
-    std::vector<uint8_t> data(encoded.begin() + index, encoded.begin() + index + nfc::MIFARE_ULTRALIGHT_PAGE_SIZE);
-    if (this->write_mifare_ultralight_page_(current_page, data) != nfc::STATUS_OK) {
-      return nfc::STATUS_FAILED;
+  // pages that already hold their data are passed over without a step of their own
+  while (op.compared > 0 && !(op.dirty & 1)) {
+    op.index += nfc::MIFARE_ULTRALIGHT_PAGE_SIZE;
+    op.block++;
+    op.compared--;
+    op.dirty >>= 1;
+    op.skipped++;
+  }
+  // then the run of them that don't, unless this step read back
+  uint8_t pages = 0;
+  while (!read_back && pages < op.compared && (op.dirty >> pages) & 1) {
+    pages++;
+  }
+  if (pages > 0) {
+    if (this->write_mifare_ultralight_pages_(op.block, this->tag_data_.data() + op.index, pages) != nfc::STATUS_OK) {
+      return TagOpStatus::FAILED;
     }
-    index += nfc::MIFARE_ULTRALIGHT_PAGE_SIZE;
-    current_page++;
+    op.index += pages * nfc::MIFARE_ULTRALIGHT_PAGE_SIZE;
+    op.block += pages;
+    op.compared -= pages;
+    op.dirty >>= pages;
   }
-  return nfc::STATUS_OK;
+  if (op.index < op.length) {
+    return TagOpStatus::PENDING;
+  }
+  if (op.differential) {
+    ESP_LOGD(TAG, "  %u of %" PRIu32 " pages already up to date", op.skipped,
+             op.length / nfc::MIFARE_ULTRALIGHT_PAGE_SIZE);
+  }
+  return TagOpStatus::DONE;
 }
 
-uint8_t PN7160::clean_mifare_ultralight_() {
-  uint32_t capacity = this->read_mifare_ultralight_capacity_();
-  uint8_t pages = (capacity / nfc::MIFARE_ULTRALIGHT_PAGE_SIZE) + nfc::MIFARE_ULTRALIGHT_DATA_START_PAGE;
+TagOpStatus PN7160::clean_mifare_ultralight_() {
+  static const uint8_t blank_data[nfc::MIFARE_ULTRALIGHT_PAGE_SIZE * PAGES_PER_STEP] = {};
+  auto &op = this->tag_op_;
 
-  std::vector<uint8_t> blank_data = {0x00, 0x00, 0x00, 0x00};
+  if (op.length == 0) {
+    if (op.task == EP_WRITE && op.identity.ndef_formatted) {
+      // formatting for a write would only clear the data area; leave it, and write only the pages that change
+      ESP_LOGD(TAG, "Already NDEF formatted; writing only pages that differ");
+      op.differential = true;
+      return TagOpStatus::DONE;
+    }
+    // in pages here: the first one past the data area
+    op.length = op.identity.capacity / nfc::MIFARE_ULTRALIGHT_PAGE_SIZE + nfc::MIFARE_ULTRALIGHT_DATA_START_PAGE;
+    op.block = nfc::MIFARE_ULTRALIGHT_DATA_START_PAGE;
+  } else {
+    const uint8_t pages = std::min<uint32_t>(op.length - op.block, PAGES_PER_STEP);
+    if (this->write_mifare_ultralight_pages_(op.block, blank_data, pages) != nfc::STATUS_OK) {
+      return TagOpStatus::FAILED;
+    }
+    op.block += pages;
+  }
+  return op.block < op.length ? TagOpStatus::PENDING : TagOpStatus::DONE;
+}
 
-  for (int i = nfc::MIFARE_ULTRALIGHT_DATA_START_PAGE; i < pages; i++) {
-    if (this->write_mifare_ultralight_page_(i, blank_data) != nfc::STATUS_OK) {
+uint8_t PN7160::write_mifare_ultralight_pages_(uint8_t page_num, const uint8_t *write_data, uint8_t count) {
+  NciFrame rx;
+  NciFrame tx(nfc::NCI_PKT_MT_DATA, {});
+
+  // as with reads, the next WRITE is queued in the NFCC before the previous one's ACK is collected
+  for (uint8_t i = 0; i <= count; i++) {
+    if (i < count) {
+      tx.set_payload({nfc::MIFARE_CMD_WRITE_ULTRALIGHT, static_cast<uint8_t>(page_num + i)});
+      tx.append(write_data + i * nfc::MIFARE_ULTRALIGHT_PAGE_SIZE, nfc::MIFARE_ULTRALIGHT_PAGE_SIZE);
+      if (this->send_data_(tx, NFCC_TAG_WRITE_TIMEOUT) != nfc::STATUS_OK) {
+        ESP_LOGE(TAG, "Error writing page %u", page_num + i);
+        return nfc::STATUS_FAILED;
+      }
+    }
+    if (i == 0) {
+      continue;
+    }
+    if (this->receive_data_(rx, NFCC_TAG_WRITE_TIMEOUT) != nfc::STATUS_OK) {
+      ESP_LOGE(TAG, "Error writing page %u", page_num + i - 1);
+      this->discard_data_in_flight_();
+      return nfc::STATUS_FAILED;
+    }
+    if (!ultralight_write_acked(rx)) {
+      // refused (a locked page, or one past the end); the answer to the WRITE queued behind it is dropped
+      ESP_LOGE(TAG, "Write of page %u refused", page_num + i - 1);
+      this->discard_data_in_flight_();
       return nfc::STATUS_FAILED;
     }
   }
   return nfc::STATUS_OK;
 }
 
-uint8_t PN7160::write_mifare_ultralight_page_(uint8_t page_num, std::vector<uint8_t> &write_data) {
-  std::vector<uint8_t> payload = {nfc::MIFARE_CMD_WRITE_ULTRALIGHT, page_num};
-  payload.insert(payload.end(), write_data.begin(), write_data.end());
-
-  nfc::NciMessage rx;
-  nfc::NciMessage tx(nfc::NCI_PKT_MT_DATA, payload);
-
-  if (this->transceive_(tx, rx, NFCC_TAG_WRITE_TIMEOUT) != nfc::STATUS_OK) {
-    ESP_LOGE(TAG, "Error writing page %u", page_num);
+uint8_t PN7160::check_mifare_ultralight_presence_() {
+  NciFrame rx;
+  NciFrame tx(nfc::NCI_PKT_MT_DATA, {nfc::MIFARE_CMD_READ, 0});
+  if (this->transceive_(tx, rx) != nfc::STATUS_OK) {
     return nfc::STATUS_FAILED;
   }
-  return nfc::STATUS_OK;
+  // every Type 2 tag lets page 0 be read, so anything short of the 16 bytes is not a tag answering
+  return rx.get_payload_size() >= nfc::MIFARE_ULTRALIGHT_PAGE_SIZE * nfc::MIFARE_ULTRALIGHT_READ_SIZE
+             ? nfc::STATUS_OK
+             : nfc::STATUS_FAILED;
 }
 
 }  // namespace pn7160
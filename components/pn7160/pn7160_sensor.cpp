@@ -0,0 +1,56 @@
+#include "pn7160_sensor.h"
+
+#if defined(USE_SENSOR) && defined(USE_PN7160_STATS)
+
+#include <cmath>
+
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace pn7160 {
+
+static const char *const TAG = "pn7160.sensor";
+
+void PN7160StatsSensor::update() {
+  auto &stats = this->parent_->get_stats();
+  LatencyHistogram window;
+  uint32_t read_retries;
+  uint32_t irq_timeouts;
+  uint32_t misreads_avoided;
+  {
+#ifdef USE_PN7160_TASK
+    LockGuard guard(this->parent_->get_nci_lock());  // the NFC task records into these as it goes
+#endif
+    // always drain the window, so a sensor added later doesn't start with everything since boot
+    window = stats.take_transceive_window();
+    read_retries = stats.read_retries();
+    irq_timeouts = stats.irq_timeouts();
+    misreads_avoided = stats.misreads_avoided();
+  }
+  if (this->transceive_latency_sensor_ != nullptr) {
+    this->transceive_latency_sensor_->publish_state(window.count() ? window.percentile(95) / 1000.0f : NAN);
+  }
+  if (this->read_retries_sensor_ != nullptr) {
+    this->read_retries_sensor_->publish_state(read_retries);
+  }
+  if (this->irq_timeouts_sensor_ != nullptr) {
+    this->irq_timeouts_sensor_->publish_state(irq_timeouts);
+  }
+  if (this->misreads_avoided_sensor_ != nullptr) {
+    this->misreads_avoided_sensor_->publish_state(misreads_avoided);
+  }
+}
+
+void PN7160StatsSensor::dump_config() {
+  ESP_LOGCONFIG(TAG, "PN7160 Statistics Sensor:");
+  LOG_UPDATE_INTERVAL(this);
+  LOG_SENSOR("  ", "Transceive latency", this->transceive_latency_sensor_);
+  LOG_SENSOR("  ", "Read retries", this->read_retries_sensor_);
+  LOG_SENSOR("  ", "IRQ timeouts", this->irq_timeouts_sensor_);
+  LOG_SENSOR("  ", "Misreads avoided", this->misreads_avoided_sensor_);
+}
+
+}  // namespace pn7160
+}  // namespace esphome
+
+#endif  // USE_SENSOR && USE_PN7160_STATS
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+
+#if defined(USE_SENSOR) && defined(USE_PN7160_STATS)
+
+#include "esphome/components/pn7160/pn7160.h"
+#include "esphome/components/sensor/sensor.h"
+#include "esphome/core/component.h"
+#include "esphome/core/helpers.h"
+
+namespace esphome {
+namespace pn7160 {
+
+/// publishes the driver's statistics (see PN7160Stats) once per update interval
+class PN7160StatsSensor : public PollingComponent, public Parented<PN7160> {
+ public:
+  void update() override;
+  void dump_config() override;
+
+  /// 95th percentile transceive_() round trip over the last update interval, in ms
+  void set_transceive_latency_sensor(sensor::Sensor *sensor) { this->transceive_latency_sensor_ = sensor; }
+  void set_read_retries_sensor(sensor::Sensor *sensor) { this->read_retries_sensor_ = sensor; }
+  void set_irq_timeouts_sensor(sensor::Sensor *sensor) { this->irq_timeouts_sensor_ = sensor; }
+  void set_misreads_avoided_sensor(sensor::Sensor *sensor) { this->misreads_avoided_sensor_ = sensor; }
+
+ protected:
+  sensor::Sensor *transceive_latency_sensor_{nullptr};
+  sensor::Sensor *read_retries_sensor_{nullptr};
+  sensor::Sensor *irq_timeouts_sensor_{nullptr};
+  sensor::Sensor *misreads_avoided_sensor_{nullptr};
+};
+
+}  // namespace pn7160
+}  // namespace esphome
+
+#endif  // USE_SENSOR && USE_PN7160_STATS
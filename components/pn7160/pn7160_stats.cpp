@@ -0,0 +1,87 @@
+#include "pn7160_stats.h"
+
+#ifdef USE_PN7160_STATS
+
+#include <algorithm>
+
+namespace esphome {
+namespace pn7160 {
+
+void LatencyHistogram::add(const uint32_t us) {
+  uint8_t bucket = 0;
+  for (uint32_t v = us; v > 1 && bucket < BUCKETS - 1; v >>= 1) {
+    bucket++;
+  }
+  this->buckets_[bucket]++;
+  this->count_++;
+  this->sum_ += us;
+  this->max_ = std::max(this->max_, us);
+}
+
+void LatencyHistogram::reset() { *this = LatencyHistogram(); }
+
+uint32_t LatencyHistogram::percentile(const uint8_t pct) const {
+  if (!this->count_) {
+    return 0;
+  }
+  const uint32_t rank = std::max<uint32_t>((static_cast<uint64_t>(this->count_) * pct + 99) / 100, 1);
+  uint32_t seen = 0;
+  for (uint8_t bucket = 0; bucket < BUCKETS - 1; bucket++) {
+    seen += this->buckets_[bucket];
+    if (seen >= rank) {
+      return std::min<uint32_t>((2UL << bucket) - 1, this->max_);
+    }
+  }
+  return this->max_;
+}
+
+uint8_t PN7160Stats::state_slot(const uint8_t state) {
+  if (state >= 0xFE) {
+    return STATE_SLOTS - 2 + (state - 0xFE);  // TEST, FAILED
+  }
+  return state < STATE_SLOTS - 2 ? state : 0;
+}
+
+void PN7160Stats::record_state(const uint8_t state, const uint32_t us) { this->states_[state_slot(state)].add(us); }
+
+void PN7160Stats::record_transceive(const uint8_t *header, const uint32_t us, const uint8_t read_retries,
+                                    const bool ok) {
+  const uint8_t key = header[0] & 0xEF;  // PBF doesn't make it a different opcode
+  const uint8_t oid = (header[0] & 0xE0) == 0 ? 0 : header[1] & 0x3F;
+
+  this->read_retries_ += read_retries;
+  this->transceive_window_.add(us);
+
+  OpcodeStats *entry = nullptr;
+  for (size_t i = 0; i < this->opcode_count_; i++) {
+    if (this->opcodes_[i].header == key && this->opcodes_[i].oid == oid) {
+      entry = &this->opcodes_[i];
+      break;
+    }
+  }
+  if (entry == nullptr) {
+    if (this->opcode_count_ == MAX_OPCODES) {
+      this->untracked_opcodes_++;
+      return;
+    }
+    entry = &this->opcodes_[this->opcode_count_++];
+    entry->header = key;
+    entry->oid = oid;
+  }
+  entry->latency.add(us);
+  entry->read_retries += read_retries;
+  if (!ok) {
+    entry->failures++;
+  }
+}
+
+LatencyHistogram PN7160Stats::take_transceive_window() {
+  LatencyHistogram window = this->transceive_window_;
+  this->transceive_window_.reset();
+  return window;
+}
+
+}  // namespace pn7160
+}  // namespace esphome
+
+#endif  // USE_PN7160_STATS
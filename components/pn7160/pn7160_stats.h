@@ -0,0 +1,86 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+
+#ifdef USE_PN7160_STATS
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace pn7160 {
+
+/// Latency histogram with power-of-two buckets: bucket n counts samples in [2^n, 2^(n+1)) microseconds and the last
+/// bucket is open-ended. Fixed size, no allocation, cheap enough to update on every transaction.
+class LatencyHistogram {
+ public:
+  static const uint8_t BUCKETS = 24;  // the last one starts at ~8.4 s
+
+  void add(uint32_t us);
+  void reset();
+
+  uint32_t count() const { return this->count_; }
+  uint32_t max() const { return this->max_; }
+  uint32_t mean() const { return this->count_ ? this->sum_ / this->count_ : 0; }
+  /// upper bound of the bucket holding the `pct`th percentile sample, capped at the largest sample seen
+  uint32_t percentile(uint8_t pct) const;
+
+ protected:
+  uint32_t buckets_[BUCKETS]{};
+  uint32_t count_{0};
+  uint32_t max_{0};
+  uint64_t sum_{0};
+};
+
+struct OpcodeStats {
+  uint8_t header;  // first header byte with PBF cleared: MT and GID, or MT and connection ID for data
+  uint8_t oid;     // zero for data packets
+  LatencyHistogram latency;
+  uint32_t read_retries;
+  uint32_t failures;
+};
+
+/// Where the driver spends its time: per-state dwell, per-opcode transceive_() round trips, read retries and IRQ
+/// timeouts. Only built with USE_PN7160_STATS (`stats: true` or a `pn7160` sensor).
+class PN7160Stats {
+ public:
+  static const uint8_t MAX_OPCODES = 24;  // the driver uses about 15; later ones share the overflow counter
+  static const uint8_t STATE_SLOTS = 17;  // NCIState NONE..EP_SELECTING, then TEST and FAILED
+
+  /// time spent in `state` (an NCIState) before leaving it
+  void record_state(uint8_t state, uint32_t us);
+  /// one transceive_() of the frame starting with `header`: its round trip, read retries and outcome
+  void record_transceive(const uint8_t *header, uint32_t us, uint8_t read_retries, bool ok);
+  void record_irq_timeout() { this->irq_timeouts_++; }
+  /// an NFC-A tag whose UID length alone would have had it read as the wrong type
+  void record_misread_avoided() { this->misreads_avoided_++; }
+
+  const LatencyHistogram &state_latency(uint8_t state) const { return this->states_[state_slot(state)]; }
+  const OpcodeStats *opcodes() const { return this->opcodes_; }
+  size_t opcode_count() const { return this->opcode_count_; }
+  uint32_t untracked_opcodes() const { return this->untracked_opcodes_; }
+  uint32_t read_retries() const { return this->read_retries_; }
+  uint32_t irq_timeouts() const { return this->irq_timeouts_; }
+  uint32_t misreads_avoided() const { return this->misreads_avoided_; }
+
+  /// transceive_() latencies since the last call, for sensors that report per update interval
+  LatencyHistogram take_transceive_window();
+
+  static uint8_t state_slot(uint8_t state);
+  static uint8_t slot_state(uint8_t slot) { return slot < STATE_SLOTS - 2 ? slot : 0xFE + (slot - (STATE_SLOTS - 2)); }
+
+ protected:
+  LatencyHistogram states_[STATE_SLOTS];
+  OpcodeStats opcodes_[MAX_OPCODES]{};
+  size_t opcode_count_{0};
+  LatencyHistogram transceive_window_;
+  uint32_t untracked_opcodes_{0};
+  uint32_t read_retries_{0};
+  uint32_t irq_timeouts_{0};
+  uint32_t misreads_avoided_{0};
+};
+
+}  // namespace pn7160
+}  // namespace esphome
+
+#endif  // USE_PN7160_STATS
@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "pn7160.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace pn7160 {
+
+static const char *const TAG = "pn7160.t3t";
+
+static const uint8_t T3T_CMD_CHECK = 0x06;
+static const uint8_t T3T_RSP_CHECK = 0x07;
+static const uint16_t T3T_NDEF_SERVICE_READ = 0x000B;  // NDEF service, read without encryption
+static const uint8_t T3T_BLOCK_SIZE = 16;
+static const uint8_t T3T_IDM_LENGTH = 8;
+// the block list takes two bytes per block up to block 255 and three past it
+static const uint8_t T3T_BLOCK_ELEMENT_SHORT = 0x80;
+static const uint16_t T3T_BLOCK_ELEMENT_SHORT_MAX = 0xFF;
+
+// Check response: LEN, response code, IDm, status flags 1 and 2, number of blocks, then the blocks; the NFCC adds a
+// status byte after them
+static const uint8_t T3T_RSP_CODE = 1;
+static const uint8_t T3T_RSP_IDM = 2;
+static const uint8_t T3T_RSP_STATUS_FLAG_1 = 10;
+static const uint8_t T3T_RSP_STATUS_FLAG_2 = 11;
+static const uint8_t T3T_RSP_BLOCKS = 12;
+static const uint8_t T3T_RSP_DATA = 13;
+// LEN is one byte, so a Check answers with 15 blocks at most, whatever the card's Nbr says; with the NFCC's status
+// byte that still fits one data packet
+static const uint8_t T3T_MAX_BLOCKS_PER_CHECK = (0xFF - T3T_RSP_DATA) / T3T_BLOCK_SIZE;
+// Checks in flight at once: each one is queued in the NFCC while the one before it is on air
+static const uint8_t T3T_CHECKS_PER_STEP = 2;
+
+// attribute information block (block 0): version, Nbr, Nbw, Nmaxb, four unused bytes, WriteF, RW flag, Ln, checksum
+static const uint8_t T3T_ATTR_VERSION = 0;
+static const uint8_t T3T_ATTR_NBR = 1;
+static const uint8_t T3T_ATTR_NMAXB = 3;
+static const uint8_t T3T_ATTR_WRITE_F = 9;
+static const uint8_t T3T_ATTR_LN = 11;
+static const uint8_t T3T_ATTR_CHECKSUM = 14;
+static const uint8_t T3T_MAPPING_VERSION_MAJOR = 1;
+static const uint8_t T3T_WRITE_F_IN_PROGRESS = 0x0F;
+static const uint32_t T3T_MAX_NDEF_LENGTH = 0x8000;  // as for Type 4 tags; a corrupt Ln shouldn't take all the heap
+
+// PMm response time: T = 302 us * ((B + 1) * blocks + A + 1) * 4^E, with A, B and E packed into the MRTI byte
+static const uint16_t T3T_MRTI_BASE_US = 302;
+static const uint16_t T3T_BYTE_US = 38;  // 212 kbit/s on air
+
+/// how long to wait for a Check of `blocks` blocks on a card with this PMm MRTI_check, the frames themselves included
+static uint16_t check_timeout_ms(const uint8_t mrti_check, const uint8_t blocks) {
+  const uint32_t a = mrti_check & 0x07;
+  const uint32_t b = (mrti_check >> 3) & 0x07;
+  const uint32_t e = mrti_check >> 6;
+  const uint32_t card_us = (T3T_MRTI_BASE_US * ((b + 1) * blocks + a + 1)) << (2 * e);
+  // the command is about as long as the response's header, plus up to three bytes per block in its block list
+  const uint32_t air_us = (2 * T3T_RSP_DATA + (3 + T3T_BLOCK_SIZE) * blocks) * T3T_BYTE_US;
+  return NFCC_DEFAULT_TIMEOUT + (card_us + air_us + 999) / 1000;
+}
+
+/// a Check of `blocks` NDEF service blocks from `block` on, LEN first as the NFCC expects it
+static void build_check(const uint8_t *idm, const uint16_t block, const uint8_t blocks, NciFrame &tx) {
+  tx.set_header(nfc::NCI_PKT_MT_DATA, NCI_STATIC_RF_CONN_ID, 0);
+  tx.set_payload({0x00, T3T_CMD_CHECK});
+  tx.append(idm, T3T_IDM_LENGTH);
+  const uint8_t services[] = {0x01, T3T_NDEF_SERVICE_READ & 0xFF, T3T_NDEF_SERVICE_READ >> 8, blocks};  // one service
+  tx.append(services, sizeof(services));
+  for (uint16_t b = block; b < block + blocks; b++) {
+    if (b <= T3T_BLOCK_ELEMENT_SHORT_MAX) {
+      const uint8_t element[] = {T3T_BLOCK_ELEMENT_SHORT, static_cast<uint8_t>(b)};
+      tx.append(element, sizeof(element));
+    } else {
+      const uint8_t element[] = {0x00, static_cast<uint8_t>(b & 0xFF), static_cast<uint8_t>(b >> 8)};
+      tx.append(element, sizeof(element));
+    }
+  }
+  tx.payload()[0] = tx.get_payload_size();
+}
+
+TagOpStatus PN7160::read_t3t_tag_(nfc::NfcTag &tag) {
+  auto &op = this->tag_op_;
+  auto &data = this->tag_data_;
+
+  if (op.length == 0) {
+    uint8_t attr[T3T_BLOCK_SIZE];
+    if (this->check_t3t_blocks_(0, 1, 1, attr) != nfc::STATUS_OK) {
+      ESP_LOGW(TAG, "No NDEF attribute information block");
+      return TagOpStatus::FAILED;
+    }
+    uint16_t sum = 0;
+    for (uint8_t i = 0; i < T3T_ATTR_CHECKSUM; i++) {
+      sum += attr[i];
+    }
+    if (sum != ((attr[T3T_ATTR_CHECKSUM] << 8) | attr[T3T_ATTR_CHECKSUM + 1])) {
+      ESP_LOGW(TAG, "Attribute information block checksum mismatch");
+      return TagOpStatus::FAILED;
+    }
+    if (attr[T3T_ATTR_VERSION] >> 4 != T3T_MAPPING_VERSION_MAJOR) {
+      ESP_LOGW(TAG, "Unsupported mapping version %u.%u", attr[T3T_ATTR_VERSION] >> 4, attr[T3T_ATTR_VERSION] & 0x0F);
+      return TagOpStatus::FAILED;
+    }
+    if (attr[T3T_ATTR_WRITE_F] == T3T_WRITE_F_IN_PROGRESS) {
+      ESP_LOGW(TAG, "NDEF message was left part written");
+      return TagOpStatus::FAILED;
+    }
+    const uint8_t nbr = attr[T3T_ATTR_NBR];
+    const uint16_t nmaxb = (attr[T3T_ATTR_NMAXB] << 8) | attr[T3T_ATTR_NMAXB + 1];
+    const uint32_t message_length = (attr[T3T_ATTR_LN] << 16) | (attr[T3T_ATTR_LN + 1] << 8) | attr[T3T_ATTR_LN + 2];
+    if (nbr == 0) {
+      ESP_LOGW(TAG, "Attribute information block gives no Nbr");
+      return TagOpStatus::FAILED;
+    }
+    if (message_length > static_cast<uint32_t>(nmaxb) * T3T_BLOCK_SIZE || message_length > T3T_MAX_NDEF_LENGTH) {
+      ESP_LOGW(TAG, "NDEF message of %" PRIu32 " bytes runs past the end of the tag", message_length);
+      return TagOpStatus::FAILED;
+    }
+    if (message_length == 0) {
+      return TagOpStatus::DONE;
+    }
+    op.chunk = std::min(nbr, T3T_MAX_BLOCKS_PER_CHECK);
+    op.block = 1;
+    op.index = 0;
+    op.length = message_length;
+    ESP_LOGV(TAG, "NDEF message of %" PRIu32 " bytes, read %u blocks at a time", message_length, op.chunk);
+    // whole blocks; trimmed to the message once they are in
+    data.resize((op.length + T3T_BLOCK_SIZE - 1) / T3T_BLOCK_SIZE * T3T_BLOCK_SIZE);
+    return TagOpStatus::PENDING;
+  }
+
+  const uint16_t remaining = (op.length - op.index + T3T_BLOCK_SIZE - 1) / T3T_BLOCK_SIZE;
+  const uint16_t count = std::min<uint16_t>(remaining, op.chunk * T3T_CHECKS_PER_STEP);
+  if (this->check_t3t_blocks_(op.block, count, op.chunk, data.data() + op.index) != nfc::STATUS_OK) {
+    ESP_LOGE(TAG, "Error reading tag data at block %u", op.block);
+    return TagOpStatus::FAILED;
+  }
+  op.block += count;
+  op.index += count * T3T_BLOCK_SIZE;
+  if (op.index < op.length) {
+    return TagOpStatus::PENDING;
+  }
+
+  data.resize(op.length);
+  tag.set_ndef_message(make_unique<nfc::NdefMessage>(data));
+  return TagOpStatus::DONE;
+}
+
+uint8_t PN7160::check_t3t_blocks_(const uint16_t block, const uint16_t count, const uint8_t per_check,
+                                  uint8_t *data) {
+  const auto &endpoint = this->discovered_endpoint_[this->tag_op_.endpoint];
+  const uint8_t *idm = endpoint.uid;
+  const uint16_t timeout = check_timeout_ms(endpoint.tech.mrti_check, per_check);
+  const size_t checks = (count + per_check - 1) / per_check;
+  NciFrame tx;
+  NciFrame rx;
+
+  build_check(idm, block, std::min<uint16_t>(count, per_check), tx);
+  if (this->send_data_(tx, timeout) != nfc::STATUS_OK) {
+    return nfc::STATUS_FAILED;
+  }
+  for (size_t i = 0; i < checks; i++) {
+    if (i + 1 < checks) {
+      const uint16_t next = (i + 1) * per_check;
+      build_check(idm, block + next, std::min<uint16_t>(count - next, per_check), tx);
+      if (this->send_data_(tx, timeout) != nfc::STATUS_OK) {
+        return nfc::STATUS_FAILED;
+      }
+    }
+    if (this->receive_data_(rx, timeout) != nfc::STATUS_OK) {
+      return nfc::STATUS_FAILED;
+    }
+
+    const uint16_t first = i * per_check;
+    const uint8_t blocks = std::min<uint16_t>(count - first, per_check);
+    const uint8_t *response = rx.payload();
+    const uint8_t size = rx.get_payload_size();
+    if (size <= T3T_RSP_BLOCKS || response[T3T_RSP_CODE] != T3T_RSP_CHECK ||
+        !std::equal(idm, idm + T3T_IDM_LENGTH, response + T3T_RSP_IDM) || response[size - 1] != nfc::STATUS_OK) {
+      ESP_LOGV(TAG, "Bad response to Check at block %u", block + first);
+      return nfc::STATUS_FAILED;
+    }
+    if (response[T3T_RSP_STATUS_FLAG_1] != 0) {
+      ESP_LOGV(TAG, "Check at block %u failed with status flags %02X %02X", block + first,
+               response[T3T_RSP_STATUS_FLAG_1], response[T3T_RSP_STATUS_FLAG_2]);
+      return nfc::STATUS_FAILED;
+    }
+    if (response[T3T_RSP_BLOCKS] != blocks || size < T3T_RSP_DATA + blocks * T3T_BLOCK_SIZE + 1u) {
+      ESP_LOGV(TAG, "Short Check response at block %u", block + first);
+      return nfc::STATUS_FAILED;
+    }
+    std::memcpy(data + first * T3T_BLOCK_SIZE, response + T3T_RSP_DATA, blocks * T3T_BLOCK_SIZE);
+  }
+  return nfc::STATUS_OK;
+}
+
+uint8_t PN7160::check_t3t_presence_() {
+  uint8_t block[T3T_BLOCK_SIZE];
+  return this->check_t3t_blocks_(0, 1, 1, block);
+}
+
+}  // namespace pn7160
+}  // namespace esphome
@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "pn7160.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace pn7160 {
+
+static const char *const TAG = "pn7160.t4t";
+
+static const uint8_t T4T_CLA = 0x00;
+static const uint8_t T4T_INS_SELECT = 0xA4;
+static const uint8_t T4T_INS_READ_BINARY = 0xB0;
+static const uint8_t T4T_SELECT_BY_NAME = 0x04;
+static const uint8_t T4T_SELECT_BY_ID = 0x00;
+static const uint8_t T4T_SELECT_FIRST_NO_FCI = 0x0C;
+static const uint8_t T4T_NDEF_APP_NAME[] = {0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01};
+static const uint16_t T4T_CC_FILE_ID = 0xE103;
+static const uint16_t T4T_SW_OK = 0x9000;
+
+// capability container: CCLEN, mapping version, MLe, MLc, then the NDEF file control TLV -- file ID, maximum size and
+// access conditions. Mapping 3.0's ENDEF TLV is only for files past what READ BINARY's offset can reach.
+static const uint8_t T4T_CC_LENGTH = 15;
+static const uint8_t T4T_CC_MLE = 3;
+static const uint8_t T4T_CC_TLV = 7;
+static const uint8_t T4T_TLV_NDEF_FILE = 0x04;
+static const uint8_t T4T_READ_ACCESS_GRANTED = 0x00;
+static const uint8_t T4T_NLEN_SIZE = 2;
+
+static const uint16_t T4T_SHORT_LE_MAX = 256;  // Le 0x00
+static const uint16_t T4T_MAX_FILE_SIZE = 0x8000;  // READ BINARY offsets are 15 bits
+// the NFCC reassembles chained ISO-DEP frames and hands them over in as many data packets as it takes, so what limits
+// a READ BINARY is the card's MLe; this keeps one from holding up loop() for too long even on a card with a large one
+static const uint16_t T4T_MAX_CHUNK = 512;
+
+// the steps of a read, in tag_op_.block
+static const uint8_t T4T_STEP_SELECT = 0;  // NDEF application and CC file, and read the CC
+static const uint8_t T4T_STEP_NDEF = 1;    // NDEF file, and read its first chunk
+static const uint8_t T4T_STEP_DATA = 2;
+
+static T4tCapdu select_by_name(const uint8_t *name, const uint8_t length) {
+  T4tCapdu capdu{{T4T_CLA, T4T_INS_SELECT, T4T_SELECT_BY_NAME, 0x00, length}, 5};
+  std::memcpy(capdu.data + capdu.length, name, length);
+  capdu.length += length;
+  capdu.data[capdu.length++] = 0x00;  // Le
+  return capdu;
+}
+
+static T4tCapdu select_by_id(const uint16_t file_id) {
+  return {{T4T_CLA, T4T_INS_SELECT, T4T_SELECT_BY_ID, T4T_SELECT_FIRST_NO_FCI, 0x02, static_cast<uint8_t>(file_id >> 8),
+           static_cast<uint8_t>(file_id & 0xFF)},
+          7};
+}
+
+/// READ BINARY of `length` bytes at `offset`; more than 256 takes an extended Le, so only for cards whose MLe says so
+static T4tCapdu read_binary(const uint16_t offset, const uint16_t length) {
+  if (length > T4T_SHORT_LE_MAX) {
+    return {{T4T_CLA, T4T_INS_READ_BINARY, static_cast<uint8_t>(offset >> 8), static_cast<uint8_t>(offset & 0xFF), 0x00,
+             static_cast<uint8_t>(length >> 8), static_cast<uint8_t>(length & 0xFF)},
+            7};
+  }
+  return {{T4T_CLA, T4T_INS_READ_BINARY, static_cast<uint8_t>(offset >> 8), static_cast<uint8_t>(offset & 0xFF),
+           static_cast<uint8_t>(length & 0xFF)},
+          5};
+}
+
+TagOpStatus PN7160::read_t4t_tag_(nfc::NfcTag &tag) {
+  auto &op = this->tag_op_;
+  auto &data = this->tag_data_;
+  const auto &rapdu = this->t4t_rapdu_;
+
+  if (op.block == T4T_STEP_SELECT) {
+    const T4tCapdu capdus[] = {select_by_name(T4T_NDEF_APP_NAME, sizeof(T4T_NDEF_APP_NAME)),
+                               select_by_id(T4T_CC_FILE_ID), read_binary(0, T4T_CC_LENGTH)};
+    if (this->transceive_t4t_apdus_(capdus, 3) != nfc::STATUS_OK) {
+      ESP_LOGW(TAG, "No NDEF application");
+      return TagOpStatus::FAILED;
+    }
+    if (rapdu.size() < T4T_CC_LENGTH) {
+      ESP_LOGW(TAG, "Capability container is too short");
+      return TagOpStatus::FAILED;
+    }
+    const uint16_t mle = (rapdu[T4T_CC_MLE] << 8) | rapdu[T4T_CC_MLE + 1];
+    const uint8_t *tlv = rapdu.data() + T4T_CC_TLV;
+    if (tlv[0] != T4T_TLV_NDEF_FILE) {
+      ESP_LOGW(TAG, "No NDEF file control TLV");
+      return TagOpStatus::FAILED;
+    }
+    const uint16_t file_size = (tlv[4] << 8) | tlv[5];
+    if (tlv[6] != T4T_READ_ACCESS_GRANTED) {
+      ESP_LOGW(TAG, "NDEF file is read protected");
+      return TagOpStatus::FAILED;
+    }
+    if (mle == 0) {
+      ESP_LOGW(TAG, "Capability container gives no MLe");
+      return TagOpStatus::FAILED;
+    }
+    op.file_id = (tlv[2] << 8) | tlv[3];
+    op.file_size = std::min(file_size, T4T_MAX_FILE_SIZE);
+    op.chunk = std::min(mle, T4T_MAX_CHUNK);
+    ESP_LOGV(TAG, "NDEF file %04X of %u bytes, read %u bytes at a time", op.file_id, file_size, op.chunk);
+    op.block = T4T_STEP_NDEF;
+    return TagOpStatus::PENDING;
+  }
+
+  if (op.block == T4T_STEP_NDEF) {
+    // the first chunk brings NLEN along with it; no more than fits one data packet, as most messages are short
+    const uint16_t first = std::min<uint16_t>({op.chunk, op.file_size,
+                                              static_cast<uint16_t>(this->conn_max_payload_[NCI_STATIC_RF_CONN_ID] - 2)});
+    const T4tCapdu capdus[] = {select_by_id(op.file_id), read_binary(0, first)};
+    if (this->transceive_t4t_apdus_(capdus, 2) != nfc::STATUS_OK || rapdu.size() < T4T_NLEN_SIZE) {
+      ESP_LOGE(TAG, "Error reading NDEF file");
+      return TagOpStatus::FAILED;
+    }
+    const uint16_t message_length = (rapdu[0] << 8) | rapdu[1];
+    if (message_length == 0) {
+      return TagOpStatus::DONE;
+    }
+    if (T4T_NLEN_SIZE + message_length > op.file_size) {
+      ESP_LOGW(TAG, "NDEF message runs past the end of its file");
+      return TagOpStatus::FAILED;
+    }
+    op.length = T4T_NLEN_SIZE + message_length;
+    op.index = std::min<uint32_t>(rapdu.size(), op.length);
+    data.assign(rapdu.begin(), rapdu.begin() + op.index);
+    data.resize(op.length);
+    op.block = T4T_STEP_DATA;
+  } else {
+    const uint16_t read_length = std::min<uint32_t>(op.length - op.index, op.chunk);
+    const T4tCapdu capdu = read_binary(op.index, read_length);
+    // a card may send back less than asked for; carry on from wherever it stopped
+    if (this->transceive_t4t_apdus_(&capdu, 1) != nfc::STATUS_OK || rapdu.empty()) {
+      ESP_LOGE(TAG, "Error reading NDEF file at offset %" PRIu32, op.index);
+      return TagOpStatus::FAILED;
+    }
+    const uint16_t received = std::min<size_t>(rapdu.size(), read_length);
+    std::copy(rapdu.begin(), rapdu.begin() + received, data.begin() + op.index);
+    op.index += received;
+  }
+  if (op.index < op.length) {
+    return TagOpStatus::PENDING;
+  }
+
+  data.erase(data.begin(), data.begin() + T4T_NLEN_SIZE);
+  tag.set_ndef_message(make_unique<nfc::NdefMessage>(data));
+  return TagOpStatus::DONE;
+}
+
+uint8_t PN7160::transceive_t4t_apdus_(const T4tCapdu *capdus, const size_t count) {
+  auto &rapdu = this->t4t_rapdu_;
+  rapdu.reserve(T4T_MAX_CHUNK + 2);  // status word included
+  // as with Type 2 READs, each C-APDU is queued in the NFCC while the one before it is on air
+  if (this->send_data_message_(NCI_STATIC_RF_CONN_ID, capdus[0].data, capdus[0].length, NFCC_ISO_DEP_TIMEOUT) !=
+      nfc::STATUS_OK) {
+    return nfc::STATUS_FAILED;
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (i + 1 < count && this->send_data_message_(NCI_STATIC_RF_CONN_ID, capdus[i + 1].data, capdus[i + 1].length,
+                                                  NFCC_ISO_DEP_TIMEOUT) != nfc::STATUS_OK) {
+      return nfc::STATUS_FAILED;
+    }
+    if (this->receive_data_message_(rapdu, NFCC_ISO_DEP_TIMEOUT) != nfc::STATUS_OK) {
+      return nfc::STATUS_FAILED;
+    }
+    const uint16_t sw = rapdu.size() >= 2 ? (rapdu[rapdu.size() - 2] << 8) | rapdu.back() : 0;
+    if (sw != T4T_SW_OK) {
+      ESP_LOGV(TAG, "C-APDU %02X %02X failed with status word %04X", capdus[i].data[1], capdus[i].data[2], sw);
+      return nfc::STATUS_FAILED;
+    }
+    rapdu.resize(rapdu.size() - 2);
+  }
+  return nfc::STATUS_OK;
+}
+
+uint8_t PN7160::check_t4t_presence_() {
+  NciFrame tx(nfc::NCI_PKT_MT_CTRL_COMMAND, nfc::RF_GID, RF_ISO_DEP_NAK_PRESENCE_OID);
+  NciFrame rx;
+  if (this->transceive_(tx, rx) != nfc::STATUS_OK) {
+    return nfc::STATUS_FAILED;
+  }
+  // the response only says the NAK is going out; whether the card acknowledged it comes after, as a notification
+  uint8_t read_retries = 0;
+  if (this->read_frame_retrying_(rx, NFCC_ISO_DEP_TIMEOUT, read_retries) != nfc::STATUS_OK ||
+      !rx.message_type_is(nfc::NCI_PKT_MT_CTRL_NOTIFICATION) || !rx.gid_is(nfc::RF_GID) ||
+      !rx.oid_is(RF_ISO_DEP_NAK_PRESENCE_OID)) {
+    ESP_LOGV(TAG, "No presence check notification");
+    return nfc::STATUS_FAILED;
+  }
+  return rx.get_simple_status_response();
+}
+
+}  // namespace pn7160
+}  // namespace esphome
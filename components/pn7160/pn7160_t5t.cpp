@@ -0,0 +1,487 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+#include <memory>
+
+#include "pn7160.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace pn7160 {
+
+static const char *const TAG = "pn7160.t5t";
+
+// requests go addressed, so another label in the field doesn't answer too, at the high data rate
+static const uint8_t T5T_REQ_FLAGS = 0x22;
+static const uint8_t T5T_CMD_READ_SINGLE_BLOCK = 0x20;
+static const uint8_t T5T_CMD_WRITE_SINGLE_BLOCK = 0x21;
+static const uint8_t T5T_CMD_READ_MULTIPLE_BLOCKS = 0x23;
+static const uint8_t T5T_CMD_GET_SYSTEM_INFO = 0x2B;
+static const uint8_t T5T_UID_LENGTH = 8;
+
+// responses are the flags, then the data or an error code; the NFCC adds a status byte after them
+static const uint8_t T5T_RSP_FLAG_ERROR = 0x01;
+static const uint8_t T5T_RSP_OVERHEAD = 2;
+
+// Get System Information: flags, info flags, UID, then DSFID, AFI and memory size as the info flags say
+static const uint8_t T5T_INFO_FLAGS = 1;
+static const uint8_t T5T_INFO_DATA = 2 + T5T_UID_LENGTH;
+static const uint8_t T5T_INFO_DSFID = 0x01;
+static const uint8_t T5T_INFO_AFI = 0x02;
+static const uint8_t T5T_INFO_MEMORY_SIZE = 0x04;
+static const uint8_t T5T_MAX_BLOCK_SIZE = 32;  // the memory size gives it in five bits
+static const uint16_t T5T_MAX_BLOCKS = 256;    // block numbers are one byte in these commands
+
+// capability container: magic number, version and access, MLEN in 8-byte units, features; an MLEN of zero means the
+// 8-byte form, with the real one in bytes 6 and 7
+static const uint8_t T5T_CC_MAGIC = 0xE1;
+static const uint8_t T5T_CC_MAGIC_EXTENDED = 0xE2;  // the one for tags addressed with two-byte block numbers
+static const uint8_t T5T_CC_VERSION_1_0 = 0x40;     // read and write access granted
+static const uint8_t T5T_CC_MLEN = 2;
+static const uint8_t T5T_CC_FEATURES = 3;
+static const uint8_t T5T_CC_MLEN_EXTENDED = 6;
+static const uint8_t T5T_CC_SHORT_LENGTH = 4;
+static const uint8_t T5T_CC_LONG_LENGTH = 8;
+static const uint8_t T5T_CC_MBREAD = 0x01;
+static const uint16_t T5T_CC_SHORT_MAX_AREA = 0xFF * 8;
+
+static const uint8_t TLV_NULL = 0x00;
+static const uint8_t TLV_NDEF = 0x03;
+static const uint8_t TLV_TERMINATOR = 0xFE;
+static const uint8_t TLV_LENGTH_LONG = 0xFF;  // the next two bytes hold the length
+static const uint8_t T5T_EMPTY_NDEF_TLV[] = {TLV_NDEF, 0x00, TLV_TERMINATOR};
+
+// at 26 kbit/s a step can't do much within the loop budget: a Read Multiple Blocks of about 48 bytes, or three
+// single-block exchanges, or two writes with their programming time
+static const uint8_t T5T_BYTES_PER_READ = 48;
+static const uint8_t T5T_READS_PER_STEP = 3;
+static const uint8_t T5T_WRITES_PER_STEP = 2;
+static const uint8_t T5T_COMPARE_BLOCKS = 4;  // read back in one go before writing
+
+// about 302 us a byte either way, CRC and framing included
+static const uint16_t T5T_BYTE_US = 302;
+
+/// how long to wait for a request of `request` bytes answered with `response` bytes
+static uint16_t t5t_timeout_ms(const uint16_t request, const uint16_t response) {
+  return NFCC_DEFAULT_TIMEOUT + ((request + response + 4) * T5T_BYTE_US + 999) / 1000;
+}
+
+/// true if `rx` is a response without the error flag, the NFCC's status byte after it OK
+static bool t5t_response_ok(const NciFrame &rx) {
+  const uint8_t size = rx.get_payload_size();
+  if (size < T5T_RSP_OVERHEAD || rx.payload()[size - 1] != nfc::STATUS_OK) {
+    return false;
+  }
+  if (rx.payload()[0] & T5T_RSP_FLAG_ERROR) {
+    ESP_LOGV(TAG, "Request failed with error code %02X", size > T5T_RSP_OVERHEAD ? rx.payload()[1] : 0);
+    return false;
+  }
+  return true;
+}
+
+void PN7160::build_t5t_request_(NciFrame &tx, const uint8_t command) {
+  const auto &endpoint = this->discovered_endpoint_[this->tag_op_.endpoint];
+  tx.set_header(nfc::NCI_PKT_MT_DATA, NCI_STATIC_RF_CONN_ID, 0);
+  tx.set_payload({T5T_REQ_FLAGS, command});
+  // least significant byte first on air
+  for (uint8_t i = endpoint.uid_length; i > 0; i--) {
+    tx.append(endpoint.uid[i - 1]);
+  }
+}
+
+uint8_t PN7160::identify_t5t_(TagIdentity &identity) {
+  NciFrame rx;
+  NciFrame tx;
+  uint8_t cc[T5T_CC_LONG_LENGTH] = {};
+  uint16_t blocks = 0;
+  // DSFID, AFI, memory size and IC reference follow the UID at most
+  const uint16_t info_timeout = t5t_timeout_ms(T5T_INFO_DATA, T5T_INFO_DATA + 5);
+  const uint16_t read_timeout = t5t_timeout_ms(T5T_INFO_DATA + 1, 1 + T5T_MAX_BLOCK_SIZE);
+
+  // block 0 is queued in the NFCC while Get System Information is on air
+  this->build_t5t_request_(tx, T5T_CMD_GET_SYSTEM_INFO);
+  if (this->send_data_(tx, info_timeout) != nfc::STATUS_OK) {
+    return nfc::STATUS_FAILED;
+  }
+  this->build_t5t_request_(tx, T5T_CMD_READ_SINGLE_BLOCK);
+  tx.append(0);
+  if (this->send_data_(tx, read_timeout) != nfc::STATUS_OK ||
+      this->receive_data_(rx, info_timeout) != nfc::STATUS_OK) {
+    return nfc::STATUS_FAILED;
+  }
+  // it's optional; without it, the block size comes from the read and the memory size from the capability container
+  if (t5t_response_ok(rx)) {
+    const uint8_t info_flags = rx.payload()[T5T_INFO_FLAGS];
+    const uint8_t memory_size_at = T5T_INFO_DATA + ((info_flags & T5T_INFO_DSFID) ? 1 : 0) +
+                                   ((info_flags & T5T_INFO_AFI) ? 1 : 0);
+    if ((info_flags & T5T_INFO_MEMORY_SIZE) && rx.get_payload_size() >= memory_size_at + 2 + 1) {
+      blocks = rx.payload()[memory_size_at] + 1;
+    }
+  }
+  if (this->receive_data_(rx, read_timeout) != nfc::STATUS_OK || !t5t_response_ok(rx) ||
+      rx.get_payload_size() < T5T_RSP_OVERHEAD + T5T_CC_SHORT_LENGTH) {
+    ESP_LOGV(TAG, "Can't read block 0");
+    return nfc::STATUS_FAILED;
+  }
+  identity.block_size = std::min<uint8_t>(rx.get_payload_size() - T5T_RSP_OVERHEAD, T5T_MAX_BLOCK_SIZE);
+  std::memcpy(cc, rx.payload() + 1, std::min<uint8_t>(identity.block_size, T5T_CC_LONG_LENGTH));
+
+  identity.chip = TagChip::UNKNOWN;
+  identity.ndef_formatted = cc[0] == T5T_CC_MAGIC || cc[0] == T5T_CC_MAGIC_EXTENDED;
+  identity.cc_length = identity.ndef_formatted && cc[T5T_CC_MLEN] == 0 ? T5T_CC_LONG_LENGTH : T5T_CC_SHORT_LENGTH;
+  if (identity.cc_length > identity.block_size) {
+    this->build_t5t_request_(tx, T5T_CMD_READ_SINGLE_BLOCK);
+    tx.append(1);
+    if (this->transceive_(tx, rx, read_timeout) != nfc::STATUS_OK || !t5t_response_ok(rx) ||
+        rx.get_payload_size() < T5T_RSP_OVERHEAD + identity.block_size) {
+      ESP_LOGV(TAG, "Can't read the rest of the capability container");
+      return nfc::STATUS_FAILED;
+    }
+    std::memcpy(cc + identity.block_size, rx.payload() + 1, T5T_CC_LONG_LENGTH - identity.block_size);
+  }
+
+  // the data area as far as one-byte block numbers reach, whatever the tag's size
+  uint32_t capacity;
+  if (identity.ndef_formatted) {
+    capacity = identity.cc_length == T5T_CC_LONG_LENGTH
+                   ? ((cc[T5T_CC_MLEN_EXTENDED] << 8) | cc[T5T_CC_MLEN_EXTENDED + 1]) * 8U
+                   : cc[T5T_CC_MLEN] * 8U;
+  } else {
+    capacity = blocks * identity.block_size > identity.cc_length ? blocks * identity.block_size - identity.cc_length
+                                                                   : 0;
+    capacity = std::min<uint32_t>(capacity, T5T_CC_SHORT_MAX_AREA);  // all a new short capability container can say
+  }
+  identity.capacity = std::min<uint32_t>(capacity, T5T_MAX_BLOCKS * identity.block_size - identity.cc_length);
+  // a tag formatted here gets no MBREAD bit, not knowing whether it has the command
+  identity.fast_read = identity.ndef_formatted && (cc[T5T_CC_FEATURES] & T5T_CC_MBREAD);
+  return nfc::STATUS_OK;
+}
+
+TagOpStatus PN7160::read_t5t_tag_(nfc::NfcTag &tag) {
+  auto &op = this->tag_op_;
+  auto &data = this->tag_data_;
+  const uint8_t block_size = op.identity.block_size;
+  const uint8_t step_blocks = op.fast_read ? std::max(T5T_BYTES_PER_READ / block_size, 1) : T5T_READS_PER_STEP;
+
+  if (op.length == 0) {
+    if (!op.identity.ndef_formatted) {
+      ESP_LOGW(TAG, "Not NDEF formatted");
+      return TagOpStatus::FAILED;
+    }
+    // from the block the data area starts in, as far as one step reads
+    const uint8_t first = op.identity.cc_length / block_size;
+    const uint16_t area_blocks = (op.identity.cc_length + op.identity.capacity + block_size - 1) / block_size;
+    uint8_t count = std::min<uint16_t>(step_blocks, area_blocks - first);
+    if (count == 0) {
+      ESP_LOGW(TAG, "Capability container gives no data area");
+      return TagOpStatus::FAILED;
+    }
+    data.resize(count * block_size);
+    if (this->read_t5t_blocks_(first, count, data.data()) != nfc::STATUS_OK) {
+      ESP_LOGE(TAG, "Error reading tag data");
+      return TagOpStatus::FAILED;
+    }
+    data.resize(count * block_size);
+
+    // past any NULL and other TLVs to the NDEF one
+    size_t i = op.identity.cc_length - first * block_size;
+    uint16_t message_length = 0;
+    while (true) {
+      if (i + 1 >= data.size() || data[i] == TLV_TERMINATOR) {
+        ESP_LOGW(TAG, "Couldn't find NDEF message");
+        return TagOpStatus::FAILED;
+      }
+      if (data[i] == TLV_NULL) {
+        i++;
+        continue;
+      }
+      uint8_t header = 2;
+      uint16_t length = data[i + 1];
+      if (length == TLV_LENGTH_LONG) {
+        if (i + 3 >= data.size()) {
+          ESP_LOGW(TAG, "Couldn't find NDEF message");
+          return TagOpStatus::FAILED;
+        }
+        header = 4;
+        length = (data[i + 2] << 8) | data[i + 3];
+      }
+      if (data[i] == TLV_NDEF) {
+        op.message_start = i + header;
+        message_length = length;
+        break;
+      }
+      i += header + length;
+    }
+    ESP_LOGVV(TAG, "NDEF message length: %u, start: %u", message_length, op.message_start);
+
+    if (message_length == 0) {
+      return TagOpStatus::DONE;
+    }
+    if (first * block_size + op.message_start + message_length > op.identity.cc_length + op.identity.capacity) {
+      ESP_LOGW(TAG, "NDEF message runs past the end of the data area");
+      return TagOpStatus::FAILED;
+    }
+    op.index = data.size();
+    op.length = op.message_start + message_length;
+    op.block = first + count;
+    // whole blocks; trimmed to the message once they are in
+    data.resize(std::max<size_t>(data.size(), (op.length + block_size - 1) / block_size * block_size));
+  } else {
+    uint8_t count = std::min<uint32_t>((op.length - op.index + block_size - 1) / block_size, step_blocks);
+    if (this->read_t5t_blocks_(op.block, count, data.data() + op.index) != nfc::STATUS_OK) {
+      ESP_LOGE(TAG, "Error reading tag data at block %u", op.block);
+      return TagOpStatus::FAILED;
+    }
+    op.index += count * block_size;
+    op.block += count;
+  }
+  if (op.index < op.length) {
+    return TagOpStatus::PENDING;
+  }
+
+  data.resize(op.length);
+  data.erase(data.begin(), data.begin() + op.message_start);
+  tag.set_ndef_message(make_unique<nfc::NdefMessage>(data));
+  return TagOpStatus::DONE;
+}
+
+uint8_t PN7160::read_t5t_blocks_(const uint8_t block, uint8_t &count, uint8_t *data) {
+  const uint8_t block_size = this->tag_op_.identity.block_size;
+  NciFrame rx;
+  NciFrame tx;
+
+  if (this->tag_op_.fast_read) {
+    this->build_t5t_request_(tx, T5T_CMD_READ_MULTIPLE_BLOCKS);
+    tx.append(block);
+    tx.append(count - 1);
+    if (this->transceive_(tx, rx, t5t_timeout_ms(tx.get_payload_size(), 1 + count * block_size)) == nfc::STATUS_OK &&
+        t5t_response_ok(rx) && rx.get_payload_size() >= T5T_RSP_OVERHEAD + count * block_size) {
+      std::memcpy(data, rx.payload() + 1, count * block_size);
+      return nfc::STATUS_OK;
+    }
+    // some tags say they have it in the capability container and then don't, or take fewer blocks than this at once
+    ESP_LOGW(TAG, "Read Multiple Blocks failed at block %u; reading a block at a time", block);
+    this->tag_op_.fast_read = false;
+    count = std::min(count, T5T_READS_PER_STEP);  // the caller reads the rest on its next steps
+  }
+
+  // each Read Single Block is sent while the one before it is on air
+  const uint16_t timeout = t5t_timeout_ms(T5T_INFO_DATA + 1, 1 + block_size);
+  this->build_t5t_request_(tx, T5T_CMD_READ_SINGLE_BLOCK);
+  tx.append(block);
+  const uint8_t block_at = tx.get_payload_size() - 1;
+  if (this->send_data_(tx, timeout) != nfc::STATUS_OK) {
+    return nfc::STATUS_FAILED;
+  }
+  for (uint8_t i = 0; i < count; i++) {
+    if (i + 1 < count) {
+      tx.payload()[block_at] = block + i + 1;
+      if (this->send_data_(tx, timeout) != nfc::STATUS_OK) {
+        return nfc::STATUS_FAILED;
+      }
+    }
+    if (this->receive_data_(rx, timeout) != nfc::STATUS_OK || !t5t_response_ok(rx) ||
+        rx.get_payload_size() < T5T_RSP_OVERHEAD + block_size) {
+      ESP_LOGV(TAG, "Can't read block %u", block + i);
+      return nfc::STATUS_FAILED;
+    }
+    std::memcpy(data + i * block_size, rx.payload() + 1, block_size);
+  }
+  return nfc::STATUS_OK;
+}
+
+uint8_t PN7160::write_t5t_blocks_(const uint8_t block, const uint8_t *write_data, const uint8_t count) {
+  const uint8_t block_size = this->tag_op_.identity.block_size;
+  NciFrame rx;
+  NciFrame tx;
+
+  // as with reads, the next write is queued in the NFCC before the previous one's response is collected
+  for (uint8_t i = 0; i <= count; i++) {
+    if (i < count) {
+      this->build_t5t_request_(tx, T5T_CMD_WRITE_SINGLE_BLOCK);
+      tx.append(block + i);
+      tx.append(write_data + i * block_size, block_size);
+      if (this->send_data_(tx, NFCC_TAG_WRITE_TIMEOUT) != nfc::STATUS_OK) {
+        ESP_LOGE(TAG, "Error writing block %u", block + i);
+        return nfc::STATUS_FAILED;
+      }
+    }
+    if (i > 0 && (this->receive_data_(rx, NFCC_TAG_WRITE_TIMEOUT) != nfc::STATUS_OK || !t5t_response_ok(rx))) {
+      ESP_LOGE(TAG, "Error writing block %u", block + i - 1);
+      return nfc::STATUS_FAILED;
+    }
+  }
+  return nfc::STATUS_OK;
+}
+
+uint8_t PN7160::check_t5t_presence_() {
+  NciFrame rx;
+  NciFrame tx;
+  this->build_t5t_request_(tx, T5T_CMD_READ_SINGLE_BLOCK);
+  tx.append(static_cast<uint8_t>(0));
+  if (this->transceive_(tx, rx, t5t_timeout_ms(T5T_INFO_DATA + 1, 1 + this->tag_op_.identity.block_size)) !=
+      nfc::STATUS_OK) {
+    return nfc::STATUS_FAILED;
+  }
+  // an error response is the label answering too
+  const uint8_t size = rx.get_payload_size();
+  return size >= T5T_RSP_OVERHEAD && rx.payload()[size - 1] == nfc::STATUS_OK ? nfc::STATUS_OK : nfc::STATUS_FAILED;
+}
+
+uint8_t PN7160::prepare_t5t_image_() {
+  auto &op = this->tag_op_;
+  auto &image = this->tag_data_;
+  const uint8_t block_size = op.identity.block_size;
+  // capability container bytes in the block the data area starts in; they go back as they are
+  const uint8_t shared = op.identity.cc_length % block_size;
+
+  op.block = op.identity.cc_length / block_size;
+  if (shared != 0) {
+    uint8_t first[T5T_MAX_BLOCK_SIZE];
+    uint8_t count = 1;
+    if (this->read_t5t_blocks_(op.block, count, first) != nfc::STATUS_OK) {
+      ESP_LOGE(TAG, "Error reading block %u", op.block);
+      return nfc::STATUS_FAILED;
+    }
+    image.insert(image.begin(), first, first + shared);
+  }
+  image.resize((image.size() + block_size - 1) / block_size * block_size, 0x00);
+  op.index = 0;
+  op.length = image.size();
+  return nfc::STATUS_OK;
+}
+
+TagOpStatus PN7160::write_t5t_image_() {
+  auto &op = this->tag_op_;
+  const uint8_t block_size = op.identity.block_size;
+
+  bool read_back = false;
+  if (op.compared == 0) {
+    uint8_t count = std::min<uint32_t>((op.length - op.index) / block_size, T5T_COMPARE_BLOCKS);
+    if (op.differential) {
+      uint8_t current[T5T_COMPARE_BLOCKS * T5T_MAX_BLOCK_SIZE];
+      if (this->read_t5t_blocks_(op.block, count, current) != nfc::STATUS_OK) {
+        ESP_LOGE(TAG, "Error reading block %u", op.block);
+        return TagOpStatus::FAILED;
+      }
+      read_back = true;
+      op.dirty = 0;
+      for (uint8_t i = 0; i < count; i++) {
+        if (std::memcmp(current + i * block_size, this->tag_data_.data() + op.index + i * block_size, block_size) !=
+            0) {
+          op.dirty |= 1 << i;
+        }
+      }
+    } else {
+      op.dirty = (1 << count) - 1;
+    }
+    op.compared = count;
+  }
+
+  // blocks that already hold their data are passed over without a step of their own
+  while (op.compared > 0 && !(op.dirty & 1)) {
+    op.index += block_size;
+    op.block++;
+    op.compared--;
+    op.dirty >>= 1;
+    op.skipped++;
+  }
+  // then the run of them that don't, unless this step read back
+  uint8_t blocks = 0;
+  while (!read_back && blocks < op.compared && blocks < T5T_WRITES_PER_STEP && (op.dirty >> blocks) & 1) {
+    blocks++;
+  }
+  if (blocks > 0) {
+    if (this->write_t5t_blocks_(op.block, this->tag_data_.data() + op.index, blocks) != nfc::STATUS_OK) {
+      return TagOpStatus::FAILED;
+    }
+    op.index += blocks * block_size;
+    op.block += blocks;
+    op.compared -= blocks;
+    op.dirty >>= blocks;
+  }
+  if (op.index < op.length) {
+    return TagOpStatus::PENDING;
+  }
+  if (op.differential) {
+    ESP_LOGD(TAG, "  %u of %" PRIu32 " blocks already up to date", op.skipped, op.length / block_size);
+  }
+  return TagOpStatus::DONE;
+}
+
+TagOpStatus PN7160::write_t5t_tag_(const std::shared_ptr<nfc::NdefMessage> &message) {
+  auto &op = this->tag_op_;
+
+  if (op.length == 0) {
+    this->encode_ndef_tlv_(message);
+    const uint32_t capacity = op.identity.capacity;
+    const uint32_t buffer_length = this->tag_data_.size();
+    if (buffer_length > capacity) {
+      ESP_LOGE(TAG, "Message length exceeds tag capacity %" PRIu32 " > %" PRIu32, buffer_length, capacity);
+      return TagOpStatus::FAILED;
+    }
+    return this->prepare_t5t_image_() == nfc::STATUS_OK ? TagOpStatus::PENDING : TagOpStatus::FAILED;
+  }
+  return this->write_t5t_image_();
+}
+
+TagOpStatus PN7160::clean_t5t_() {
+  auto &op = this->tag_op_;
+
+  if (op.length == 0) {
+    if (op.identity.capacity == 0) {
+      ESP_LOGE(TAG, "Tag memory size unknown");
+      return TagOpStatus::FAILED;
+    }
+    // the whole data area, but only the blocks that aren't blank already are written
+    this->tag_data_.assign(op.identity.capacity, 0x00);
+    op.differential = true;
+    return this->prepare_t5t_image_() == nfc::STATUS_OK ? TagOpStatus::PENDING : TagOpStatus::FAILED;
+  }
+  return this->write_t5t_image_();
+}
+
+TagOpStatus PN7160::format_t5t_() {
+  auto &op = this->tag_op_;
+
+  if (op.length == 0) {
+    if (op.task == EP_WRITE && op.identity.ndef_formatted) {
+      // formatting for a write would only empty the data area; leave it, and write only the blocks that change
+      ESP_LOGD(TAG, "Already NDEF formatted; writing only blocks that differ");
+      op.differential = true;
+      return TagOpStatus::DONE;
+    }
+    if (op.identity.capacity == 0) {
+      ESP_LOGE(TAG, "Tag memory size unknown");
+      return TagOpStatus::FAILED;
+    }
+    // an empty NDEF message, after the capability container that is there or a new one
+    this->tag_data_.assign(T5T_EMPTY_NDEF_TLV, T5T_EMPTY_NDEF_TLV + sizeof(T5T_EMPTY_NDEF_TLV));
+    if (op.identity.ndef_formatted) {
+      return this->prepare_t5t_image_() == nfc::STATUS_OK ? TagOpStatus::PENDING : TagOpStatus::FAILED;
+    }
+    const uint8_t cc[T5T_CC_SHORT_LENGTH] = {T5T_CC_MAGIC, T5T_CC_VERSION_1_0,
+                                             static_cast<uint8_t>(op.identity.capacity / 8), 0x00};
+    this->tag_data_.insert(this->tag_data_.begin(), cc, cc + sizeof(cc));
+    this->tag_data_.resize((this->tag_data_.size() + op.identity.block_size - 1) / op.identity.block_size *
+                               op.identity.block_size,
+                           0x00);
+    op.block = 0;
+    op.index = 0;
+    op.length = this->tag_data_.size();
+    return TagOpStatus::PENDING;
+  }
+
+  const TagOpStatus status = this->write_t5t_image_();
+  if (status == TagOpStatus::DONE && !op.identity.ndef_formatted) {
+    // the cached identity still says otherwise, and the write that may follow goes by this one
+    op.identity.ndef_formatted = true;
+    op.identity.capacity = op.identity.capacity / 8 * 8;
+    op.identity.cc_length = T5T_CC_SHORT_LENGTH;
+    this->remember_identity_(op.identity);
+  }
+  return status;
+}
+
+}  // namespace pn7160
+}  // namespace esphome
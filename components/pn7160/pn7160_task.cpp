@@ -0,0 +1,66 @@
+#include "pn7160.h"
+
+#ifdef USE_PN7160_TASK
+
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace pn7160 {
+
+static const char *const TAG = "pn7160.task";
+
+// the state machine's timers (tag TTL, presence checks, health check, stuck EP states) need a pass at least this often
+// with no IRQ
+static const uint32_t TASK_IDLE_WAKE_MS = 10;
+
+void PN7160::start_task_() {
+  if (xTaskCreatePinnedToCore(PN7160::task_main_, "pn7160", this->task_stack_size_, this, this->task_priority_,
+                              &this->task_handle_, this->task_core_) != pdPASS) {
+    ESP_LOGE(TAG, "Unable to start the NFC task");
+    this->mark_failed();
+  }
+}
+
+void PN7160::task_main_(void *arg) {
+  auto *pn7160 = static_cast<PN7160 *>(arg);
+  while (true) {
+    bool mid_operation;
+    {
+      LockGuard guard(pn7160->nci_lock_);
+      pn7160->nci_loop_();
+      mid_operation = pn7160->tag_op_.active;
+    }
+    if (mid_operation) {
+      // the loop budget ran out mid-operation; give the main loop a tick to take the lock, then carry on
+      vTaskDelay(1);
+    } else {
+      pn7160->task_wait_();
+    }
+  }
+}
+
+void PN7160::task_wait_() {
+  const TaskHandle_t self = xTaskGetCurrentTaskHandle();
+  this->irq_waiting_task_ = self;
+  // registered first, so an edge between here and the take still leaves a notification behind
+  if (!this->irq_asserted_()) {
+    // a polled IRQ pin gives no notification, so its level is looked at again after a tick
+    ulTaskNotifyTake(pdTRUE, this->irq_interrupt_ ? pdMS_TO_TICKS(TASK_IDLE_WAKE_MS) : 1);
+  }
+  if (this->irq_waiting_task_ == self) {
+    this->irq_waiting_task_ = nullptr;
+  }
+}
+
+void PN7160::dispatch_events_() {
+  NfcEvent event;
+  while (this->events_.pop(event)) {
+    this->fire_event_(event.type, event.tag);
+    event.tag.reset();
+  }
+}
+
+}  // namespace pn7160
+}  // namespace esphome
+
+#endif  // USE_PN7160_TASK
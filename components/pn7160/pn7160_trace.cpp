@@ -0,0 +1,78 @@
+#include "pn7160_trace.h"
+
+#ifdef USE_PN7160_TRACE
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+namespace esphome {
+namespace pn7160 {
+
+bool NciTrace::init(const size_t capacity) {
+  this->buffer_.reset(new (std::nothrow) uint8_t[capacity]);
+  this->capacity_ = this->buffer_ ? capacity : 0;
+  this->clear();
+  return this->capacity_ != 0;
+}
+
+void NciTrace::clear() {
+  this->head_ = 0;
+  this->tail_ = 0;
+  this->used_ = 0;
+  this->records_ = 0;
+  this->dropped_ = 0;
+}
+
+void NciTrace::record(const Direction direction, const uint32_t timestamp_us, const uint8_t *frame,
+                      const size_t length) {
+  const size_t needed = RECORD_HEADER_SIZE + length;
+  if (needed > this->capacity_ || (this->stop_when_full_ && this->capacity_ - this->used_ < needed)) {
+    this->dropped_++;
+    return;
+  }
+  // make room by retiring the oldest records
+  while (this->capacity_ - this->used_ < needed) {
+    const size_t oldest = RECORD_HEADER_SIZE + (this->at_(5) | (this->at_(6) << 8));
+    this->tail_ = (this->tail_ + oldest) % this->capacity_;
+    this->used_ -= oldest;
+    this->records_--;
+    this->dropped_++;
+  }
+
+  const uint8_t header[RECORD_HEADER_SIZE] = {
+      direction,
+      static_cast<uint8_t>(timestamp_us),
+      static_cast<uint8_t>(timestamp_us >> 8),
+      static_cast<uint8_t>(timestamp_us >> 16),
+      static_cast<uint8_t>(timestamp_us >> 24),
+      static_cast<uint8_t>(length),
+      static_cast<uint8_t>(length >> 8),
+  };
+  this->put_(header, sizeof(header));
+  if (length) {
+    this->put_(frame, length);
+  }
+  this->records_++;
+}
+
+void NciTrace::put_(const uint8_t *bytes, const size_t length) {
+  // at most two copies: up to the end of the buffer, then from its start
+  const size_t first = std::min(length, this->capacity_ - this->head_);
+  std::memcpy(this->buffer_.get() + this->head_, bytes, first);
+  std::memcpy(this->buffer_.get(), bytes + first, length - first);
+  this->head_ = (this->head_ + length) % this->capacity_;
+  this->used_ += length;
+}
+
+void NciTrace::copy_to(std::vector<uint8_t> &out) const {
+  out.reserve(out.size() + this->used_);
+  for (size_t i = 0; i < this->used_; i++) {
+    out.push_back(this->at_(i));
+  }
+}
+
+}  // namespace pn7160
+}  // namespace esphome
+
+#endif  // USE_PN7160_TRACE
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "esphome/core/defines.h"
+
+#ifdef USE_PN7160_TRACE
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace esphome {
+namespace pn7160 {
+
+/// Ring buffer of raw NCI frames as they cross the bus, oldest overwritten first. Each record is a direction byte, a
+/// little-endian 32-bit microsecond timestamp, a little-endian 16-bit length and the frame itself; dumped as hex by
+/// PN7160::dump_trace(), decoded on the host by scripts/pn7160_trace_decode.py and replayed by pn7160_sim.
+class NciTrace {
+ public:
+  enum Direction : uint8_t {
+    TRACE_TX = 0x00,  // host to NFCC
+    TRACE_RX = 0x01,  // NFCC to host
+    TRACE_IRQ = 0x02,  // NFCC raised IRQ; no frame
+  };
+  static const uint8_t RECORD_HEADER_SIZE = 7;
+
+  /// allocates the buffer; false if there isn't `capacity` bytes to spare
+  bool init(size_t capacity);
+  /// keep the oldest records and drop new ones once full, so a recording made from boot stays replayable
+  void set_stop_when_full(bool stop_when_full) { this->stop_when_full_ = stop_when_full; }
+  void record(Direction direction, uint32_t timestamp_us, const uint8_t *frame, size_t length);
+  void clear();
+  /// appends the buffered records to `out`, oldest first
+  void copy_to(std::vector<uint8_t> &out) const;
+
+  size_t capacity() const { return this->capacity_; }
+  size_t size() const { return this->used_; }
+  uint32_t records() const { return this->records_; }
+  /// records overwritten (or too big to ever fit) since the last clear()
+  uint32_t dropped() const { return this->dropped_; }
+
+ protected:
+  void put_(const uint8_t *bytes, size_t length);
+  uint8_t at_(size_t offset) const { return this->buffer_[(this->tail_ + offset) % this->capacity_]; }
+
+  std::unique_ptr<uint8_t[]> buffer_;
+  size_t capacity_{0};
+  size_t head_{0};  // next byte written
+  size_t tail_{0};  // oldest record
+  size_t used_{0};
+  uint32_t records_{0};
+  uint32_t dropped_{0};
+  bool stop_when_full_{false};
+};
+
+}  // namespace pn7160
+}  // namespace esphome
+
+#endif  // USE_PN7160_TRACE
@@ -0,0 +1,73 @@
+"""PN7160 statistics sensor platform for ESPHome."""
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.components import sensor
+from esphome.const import (
+    CONF_ID,
+    ENTITY_CATEGORY_DIAGNOSTIC,
+    STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
+    UNIT_MILLISECOND,
+)
+
+from . import pn7160_ns, PN7160, CONF_PN7160_ID
+
+DEPENDENCIES = ["pn7160"]
+
+CONF_IRQ_TIMEOUTS = "irq_timeouts"
+CONF_MISREADS_AVOIDED = "misreads_avoided"
+CONF_READ_RETRIES = "read_retries"
+CONF_TRANSCEIVE_LATENCY = "transceive_latency"
+
+PN7160StatsSensor = pn7160_ns.class_(
+    "PN7160StatsSensor", cg.PollingComponent, cg.Parented.template(PN7160)
+)
+
+CONFIG_SCHEMA = cv.Schema(
+    {
+        cv.GenerateID(): cv.declare_id(PN7160StatsSensor),
+        cv.GenerateID(CONF_PN7160_ID): cv.use_id(PN7160),
+        cv.Optional(CONF_TRANSCEIVE_LATENCY): sensor.sensor_schema(
+            unit_of_measurement=UNIT_MILLISECOND,
+            icon="mdi:timer-outline",
+            accuracy_decimals=1,
+            state_class=STATE_CLASS_MEASUREMENT,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
+        cv.Optional(CONF_READ_RETRIES): sensor.sensor_schema(
+            icon="mdi:repeat",
+            accuracy_decimals=0,
+            state_class=STATE_CLASS_TOTAL_INCREASING,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
+        cv.Optional(CONF_IRQ_TIMEOUTS): sensor.sensor_schema(
+            icon="mdi:timer-alert-outline",
+            accuracy_decimals=0,
+            state_class=STATE_CLASS_TOTAL_INCREASING,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
+        cv.Optional(CONF_MISREADS_AVOIDED): sensor.sensor_schema(
+            icon="mdi:tag-check-outline",
+            accuracy_decimals=0,
+            state_class=STATE_CLASS_TOTAL_INCREASING,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
+    }
+).extend(cv.polling_component_schema("60s"))
+
+
+async def to_code(config):
+    cg.add_define("USE_PN7160_STATS")
+    var = cg.new_Pvariable(config[CONF_ID])
+    await cg.register_component(var, config)
+    await cg.register_parented(var, config[CONF_PN7160_ID])
+
+    for key, setter in (
+        (CONF_TRANSCEIVE_LATENCY, var.set_transceive_latency_sensor),
+        (CONF_READ_RETRIES, var.set_read_retries_sensor),
+        (CONF_IRQ_TIMEOUTS, var.set_irq_timeouts_sensor),
+        (CONF_MISREADS_AVOIDED, var.set_misreads_avoided_sensor),
+    ):
+        if sensor_config := config.get(key):
+            sens = await sensor.new_sensor(sensor_config)
+            cg.add(setter(sens))
@@ -7,21 +7,19 @@ namespace pn7160_i2c {
 
 static const char *const TAG = "pn7160_i2c";
 
-uint8_t PN7160I2C::read_nfcc(nfc::NciMessage &rx, const uint16_t timeout) {
+uint8_t PN7160I2C::read_nfcc(pn7160::NciFrame &rx, const uint16_t timeout) {
   if (this->wait_for_irq_(timeout) != nfc::STATUS_OK) {
     ESP_LOGW(TAG, "read_nfcc_() timeout waiting for IRQ");
     return nfc::STATUS_FAILED;
   }
 
-  rx.get_message().resize(nfc::NCI_PKT_HEADER_SIZE);
-  if (!this->read_bytes_raw(rx.get_message().data(), nfc::NCI_PKT_HEADER_SIZE)) {
+  if (!this->read_bytes_raw(rx.data(), nfc::NCI_PKT_HEADER_SIZE)) {
     return nfc::STATUS_FAILED;
   }
 
   uint8_t length = rx.get_payload_size();
   if (length > 0) {
-    rx.get_message().resize(length + nfc::NCI_PKT_HEADER_SIZE);
-    if (!this->read_bytes_raw(rx.get_message().data() + nfc::NCI_PKT_HEADER_SIZE, length)) {
+    if (!this->read_bytes_raw(rx.payload(), length)) {
       return nfc::STATUS_FAILED;
     }
   }
@@ -33,8 +31,8 @@ uint8_t PN7160I2C::read_nfcc(nfc::NciMessage &rx, const uint16_t timeout) {
   return nfc::STATUS_OK;
 }
 
-uint8_t PN7160I2C::write_nfcc(nfc::NciMessage &tx) {
-  if (this->write(tx.encode().data(), tx.encode().size()) == i2c::ERROR_OK) {
+uint8_t PN7160I2C::write_nfcc(pn7160::NciFrame &tx) {
+  if (this->write(tx.data(), tx.size()) == i2c::ERROR_OK) {
     return nfc::STATUS_OK;
   }
   return nfc::STATUS_FAILED;
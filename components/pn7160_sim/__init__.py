@@ -0,0 +1,167 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome.const import CONF_FREQUENCY, CONF_ID, CONF_TYPE, CONF_UID
+from esphome.core import CORE, HexInt
+
+from .. import pn7160
+
+AUTO_LOAD = ["pn7160"]
+
+CONF_BENCHMARK = "benchmark"
+CONF_BUS = "bus"
+CONF_BUSES = "buses"
+CONF_EXIT_WHEN_DONE = "exit_when_done"
+CONF_LOOP_INTERVAL = "loop_interval"
+CONF_NDEF_FILL = "ndef_fill"
+CONF_NDEF_URI = "ndef_uri"
+CONF_POLL_PERIOD = "poll_period"
+CONF_PRESENT = "present"
+CONF_REPLAY = "replay"
+CONF_RF_JITTER = "rf_jitter"
+CONF_SCENARIOS = "scenarios"
+CONF_SEED = "seed"
+CONF_TAGS = "tags"
+CONF_TAPS = "taps"
+
+pn7160_sim_ns = cg.esphome_ns.namespace("pn7160_sim")
+PN7160Sim = pn7160_sim_ns.class_("PN7160Sim", pn7160.PN7160)
+
+SimBus = pn7160_sim_ns.enum("SimBus")
+SIM_BUSES = {
+    "i2c": SimBus.SIM_BUS_I2C,
+    "spi": SimBus.SIM_BUS_SPI,
+}
+
+SimTagType = pn7160_sim_ns.enum("SimTagType")
+SIM_TAG_TYPES = {
+    "mifare_classic_1k": SimTagType.SIM_TAG_MIFARE_CLASSIC_1K,
+    "mifare_classic_4k": SimTagType.SIM_TAG_MIFARE_CLASSIC_4K,
+    "mifare_ultralight": SimTagType.SIM_TAG_MIFARE_ULTRALIGHT,
+    "ntag213": SimTagType.SIM_TAG_NTAG213,
+    "ntag215": SimTagType.SIM_TAG_NTAG215,
+    "ntag216": SimTagType.SIM_TAG_NTAG216,
+    "t3t": SimTagType.SIM_TAG_T3T,
+    "t4t": SimTagType.SIM_TAG_T4T,
+    "t5t": SimTagType.SIM_TAG_T5T,
+}
+
+
+def validate_uid(value):
+    """Accept 'xx-xx-xx-xx' or 'xx:xx:xx:xx' and return the bytes."""
+    parts = cv.string(value).replace(":", "-").split("-")
+    try:
+        uid = [HexInt(int(part, 16)) for part in parts if len(part) == 2]
+    except ValueError as e:
+        raise cv.Invalid(f"UID '{value}' is not valid hexadecimal") from e
+    if len(uid) != len(parts) or len(uid) not in (4, 7, 8, 10):
+        raise cv.Invalid("UID must be 4, 7, 8 or 10 bytes of two hex digits each")
+    return uid
+
+
+def validate_tag(value):
+    """Type 3 tags go by an 8-byte IDm and Type 5 ones by an 8-byte UID, the NFC-A ones by a 4, 7 or 10-byte UID."""
+    if (value[CONF_TYPE] in ("t3t", "t5t")) != (len(value[CONF_UID]) == 8):
+        raise cv.Invalid("UID must be 8 bytes for t3t and t5t tags and 4, 7 or 10 bytes for the others")
+    return value
+
+
+TAG_SCHEMA = cv.All(
+    cv.Schema(
+        {
+            cv.Required(CONF_TYPE): cv.enum(SIM_TAG_TYPES, lower=True),
+            cv.Required(CONF_UID): validate_uid,
+            cv.Optional(CONF_NDEF_URI, default=""): cv.string,
+            cv.Optional(CONF_PRESENT, default=True): cv.boolean,
+            cv.Optional(CONF_NDEF_FILL, default=False): cv.boolean,
+        }
+    ),
+    validate_tag,
+)
+
+BUS_FREQUENCY_SCHEMA = cv.All(cv.frequency, cv.int_range(min=10000))
+
+BENCHMARK_BUS_SCHEMA = cv.Schema(
+    {
+        cv.Required(CONF_BUS): cv.enum(SIM_BUSES, lower=True),
+        cv.Required(CONF_FREQUENCY): BUS_FREQUENCY_SCHEMA,
+    }
+)
+
+BENCHMARK_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_TAPS, default=100): cv.int_range(min=1, max=65535),
+        cv.Optional(CONF_BUSES, default=[]): cv.ensure_list(BENCHMARK_BUS_SCHEMA),
+    }
+)
+
+
+def validate_exit_when_done(value):
+    """Ending the program is only a way to hand a status to CI on the host platform."""
+    value = cv.boolean(value)
+    if value and not CORE.is_host:
+        raise cv.Invalid("exit_when_done is only available on the host platform")
+    return value
+
+
+SCENARIOS_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_EXIT_WHEN_DONE, default=False): validate_exit_when_done,
+    }
+)
+
+CONFIG_SCHEMA = pn7160.PN7160_BASE_SCHEMA.extend(
+    {
+        cv.GenerateID(): cv.declare_id(PN7160Sim),
+        cv.Optional(CONF_BUS, default="i2c"): cv.enum(SIM_BUSES, lower=True),
+        cv.Optional(CONF_FREQUENCY, default="400kHz"): BUS_FREQUENCY_SCHEMA,
+        cv.Optional(
+            CONF_LOOP_INTERVAL, default="16ms"
+        ): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_POLL_PERIOD, default="50ms"): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_RF_JITTER, default="0%"): cv.percentage,
+        cv.Optional(CONF_SEED, default=1): cv.uint32_t,
+        cv.Optional(CONF_TAGS, default=[]): cv.ensure_list(TAG_SCHEMA),
+        cv.Optional(CONF_BENCHMARK): BENCHMARK_SCHEMA,
+        # read, hold, write, clean and replay every tag once and log the outcomes for scripts/pn7160_scenario_check.py
+        cv.Optional(CONF_SCENARIOS): SCENARIOS_SCHEMA,
+        # raw NCI trace records, as written by scripts/pn7160_trace_decode.py --raw
+        cv.Optional(CONF_REPLAY): cv.file_,
+    }
+)
+
+
+async def to_code(config):
+    var = cg.new_Pvariable(config[CONF_ID])
+    await pn7160.setup_pn7160(var, config)
+
+    cg.add(var.set_bus(config[CONF_BUS]))
+    cg.add(var.set_bus_frequency(int(config[CONF_FREQUENCY])))
+    cg.add(var.set_loop_interval(config[CONF_LOOP_INTERVAL]))
+    cg.add(var.set_poll_period(config[CONF_POLL_PERIOD]))
+    cg.add(var.set_rf_jitter(config[CONF_RF_JITTER]))
+    cg.add(var.set_seed(config[CONF_SEED]))
+
+    for tag in config[CONF_TAGS]:
+        cg.add(
+            var.add_tag(
+                tag[CONF_TYPE],
+                tag[CONF_UID],
+                tag[CONF_NDEF_URI],
+                tag[CONF_PRESENT],
+                tag[CONF_NDEF_FILL],
+            )
+        )
+
+    if replay_path := config.get(CONF_REPLAY):
+        with open(CORE.relative_config_path(replay_path), "rb") as f:
+            trace = f.read()
+        cg.add(var.set_replay([HexInt(byte) for byte in trace]))
+
+    if benchmark_config := config.get(CONF_BENCHMARK):
+        cg.add(var.set_benchmark_taps(benchmark_config[CONF_TAPS]))
+        for bus in benchmark_config[CONF_BUSES]:
+            cg.add(var.add_benchmark_bus(bus[CONF_BUS], int(bus[CONF_FREQUENCY])))
+
+    if (scenarios_config := config.get(CONF_SCENARIOS)) is not None:
+        cg.add(var.set_scenarios(True))
+        cg.add(var.set_scenarios_exit(scenarios_config[CONF_EXIT_WHEN_DONE]))
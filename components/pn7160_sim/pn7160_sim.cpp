@@ -0,0 +1,683 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstdlib>
+#include <new>
+
+#include "pn7160_sim.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace pn7160_sim {
+
+static const char *const TAG = "pn7160_sim";
+
+// virtual time the NFCC takes to do things; ballpark figures for a PN7160, not measurements
+static const uint32_t NFCC_TURNAROUND_US = 250;    // control command to its response
+static const uint32_t NFCC_RESET_US = 3000;        // CORE_RESET_RSP to CORE_RESET_NTF
+static const uint32_t NFCC_NOTIFICATION_US = 100;  // a response to a notification that follows it
+static const uint32_t RF_ACTIVATION_US = 5000;     // anticollision and select
+static const uint32_t RF_ISODEP_ACTIVATION_US = 3000;  // RATS/ATS, on top of RF_ACTIVATION_US
+static const uint32_t RF_ISODEP_NAK_US = 400;          // an R(NAK) and the card's R(ACK)
+static const uint32_t BUS_TRANSACTION_OVERHEAD_US = 30;  // start/stop or chip select, plus host driver overhead
+static const uint32_t HIGH_FREQUENCY_LOOP_US = 1000;      // between loop() calls when nothing sleeps
+
+static uint8_t tag_protocol(const SimTagType type) {
+  switch (type) {
+    case SIM_TAG_MIFARE_CLASSIC_1K:
+    case SIM_TAG_MIFARE_CLASSIC_4K:
+      return nfc::PROT_MIFARE;
+    case SIM_TAG_T3T:
+      return nfc::PROT_T3T;
+    case SIM_TAG_T4T:
+      return nfc::PROT_ISODEP;
+    case SIM_TAG_T5T:
+      return nfc::PROT_T5T;
+    default:
+      return nfc::PROT_T2T;
+  }
+}
+
+static uint8_t tag_technology(const SimTagType type) {
+  switch (type) {
+    case SIM_TAG_T3T:
+      return nfc::MODE_POLL | nfc::TECH_PASSIVE_NFCF;
+    case SIM_TAG_T5T:
+      return nfc::MODE_POLL | nfc::TECH_PASSIVE_15693;
+    default:
+      return nfc::MODE_POLL | nfc::TECH_PASSIVE_NFCA;
+  }
+}
+
+/// NCI bit rate code: 106 kbit/s for NFC-A, 212 for NFC-F, 26 for NFC-V
+static uint8_t tag_bit_rate(const SimTagType type) {
+  switch (type) {
+    case SIM_TAG_T3T:
+      return 0x01;
+    case SIM_TAG_T5T:
+      return 0x20;
+    default:
+      return 0x00;
+  }
+}
+
+const char *sim_tag_type_name(const SimTagType type) {
+  switch (type) {
+    case SIM_TAG_MIFARE_CLASSIC_1K:
+      return "mifare_classic_1k";
+    case SIM_TAG_MIFARE_CLASSIC_4K:
+      return "mifare_classic_4k";
+    case SIM_TAG_MIFARE_ULTRALIGHT:
+      return "mifare_ultralight";
+    case SIM_TAG_NTAG213:
+      return "ntag213";
+    case SIM_TAG_NTAG215:
+      return "ntag215";
+    case SIM_TAG_NTAG216:
+      return "ntag216";
+    case SIM_TAG_T3T:
+      return "t3t";
+    case SIM_TAG_T4T:
+      return "t4t";
+    case SIM_TAG_T5T:
+      return "t5t";
+    default:
+      return "unknown";
+  }
+}
+
+#ifdef USE_HOST
+static thread_local uint32_t heap_allocations = 0;
+static thread_local uint32_t heap_pauses = 0;
+
+uint32_t sim_heap_allocations() { return heap_allocations; }
+SimHeapPause::SimHeapPause() { heap_pauses++; }
+SimHeapPause::~SimHeapPause() { heap_pauses--; }
+#endif
+
+void PN7160Sim::loop() {
+  if (this->benchmark_taps_) {
+    this->run_benchmark_();
+    this->benchmark_taps_ = 0;
+  }
+  if (this->scenarios_) {
+    this->run_scenarios_();
+    this->scenarios_ = false;
+  }
+  this->clock_us_ += this->loop_gap_us_();
+  PN7160::loop();
+}
+
+uint32_t PN7160Sim::loop_gap_us_() const {
+  // the application doesn't sleep between loop() calls while a component asks for a high-frequency loop; the other
+  // components' loop()s still take some time
+  return HighFrequencyLoopRequester::is_high_frequency() ? HIGH_FREQUENCY_LOOP_US : this->loop_interval_ * 1000;
+}
+
+void PN7160Sim::dump_config() {
+  PN7160::dump_config();
+  ESP_LOGCONFIG(TAG,
+                "  Simulated NFCC:\n"
+                "    Bus: %s at %" PRIu32 " Hz\n"
+                "    Loop interval: %" PRIu32 " ms\n"
+                "    Poll period: %" PRIu32 " ms\n"
+                "    Virtual clock: %" PRIu32 " ms\n"
+                "    Frames: %" PRIu32 " written, %" PRIu32 " read\n"
+                "    Activations: %" PRIu32 "\n"
+                "    Data packets sent without a credit: %" PRIu32,
+                this->bus_ == SIM_BUS_SPI ? "SPI" : "I2C", this->bus_frequency_, this->loop_interval_,
+                this->poll_period_, this->millis_(), this->frames_written_, this->frames_read_, this->activations_,
+                this->credit_violations_);
+  if (this->replaying_) {
+    ESP_LOGCONFIG(TAG, "    Replay: %zu of %zu bytes played, %" PRIu32 " divergences", this->replay_cursor_,
+                  this->replay_trace_.size(), this->replay_divergences_);
+  }
+  for (size_t i = 0; i < this->tags_.size(); i++) {
+    char uid_buf[nfc::FORMAT_UID_BUFFER_SIZE];
+    ESP_LOGCONFIG(TAG, "    Tag %zu: type %u, UID %s, %zu bytes, %zu of NDEF%s", i, this->tags_[i].type,
+                  nfc::format_uid_to(uid_buf, this->tags_[i].uid), this->tags_[i].memory.size(),
+                  this->tags_[i].ndef_length, this->tags_[i].present ? ", present" : "");
+  }
+}
+
+size_t PN7160Sim::add_tag(SimTagType type, const std::vector<uint8_t> &uid, const std::string &ndef_uri,
+                          bool present, bool ndef_fill) {
+  std::vector<uint8_t> ndef;
+  std::string uri = ndef_uri;
+  if (ndef_fill && uri.empty()) {
+    uri = "https://example.com/";
+  }
+  if (!uri.empty()) {
+    const size_t capacity = ndef_capacity_(type);
+    // record headers grow at 256 bytes of payload, so it can take a second pass to land exactly on the capacity
+    for (uint8_t pass = 0; pass < 3; pass++) {
+      nfc::NdefMessage message;
+      message.add_uri_record(uri);
+      ndef = message.encode();
+      if (!ndef_fill || ndef.size() == capacity) {
+        break;
+      }
+      if (ndef.size() < capacity) {
+        uri.append(capacity - ndef.size(), 'x');
+      } else {
+        uri.resize(uri.size() - std::min(uri.size(), ndef.size() - capacity));
+      }
+    }
+  }
+
+  SimTag tag{type, uid, {}, present, ndef.size()};
+  switch (type) {
+    case SIM_TAG_MIFARE_CLASSIC_1K:
+    case SIM_TAG_MIFARE_CLASSIC_4K:
+      build_mifare_classic_image_(tag, ndef);
+      break;
+
+    case SIM_TAG_T3T:
+      build_t3t_image_(tag, ndef);
+      break;
+
+    case SIM_TAG_T4T:
+      build_t4t_image_(tag, ndef);
+      break;
+
+    case SIM_TAG_T5T:
+      build_t5t_image_(tag, ndef);
+      break;
+
+    default:
+      build_t2t_image_(tag, ndef);
+      break;
+  }
+  this->tags_.push_back(std::move(tag));
+  return this->tags_.size() - 1;
+}
+
+void PN7160Sim::place_tag(size_t index) {
+  if (index < this->tags_.size() && !this->tags_[index].present) {
+    this->tags_[index].present = true;
+    // the NFCC notices it on its next poll
+    if (this->rf_state_ == SimRfState::DISCOVERY) {
+      this->discovery_started_us_ = this->clock_us_;
+    }
+  }
+}
+
+void PN7160Sim::remove_tag(size_t index) {
+  if (index < this->tags_.size()) {
+    this->tags_[index].present = false;
+  }
+}
+
+uint32_t PN7160Sim::bus_time_us_(size_t length) const {
+  // I2C adds an address byte and an ACK bit per byte; SPI adds the TDD byte
+  const uint32_t bits = this->bus_ == SIM_BUS_SPI ? (length + 1) * 8 : (length + 1) * 9;
+  return BUS_TRANSACTION_OVERHEAD_US + static_cast<uint32_t>(bits * 1000000ULL / this->bus_frequency_);
+}
+
+uint32_t PN7160Sim::jitter_(const uint32_t rf_time_us) {
+  if (this->rf_jitter_ <= 0) {
+    return rf_time_us;
+  }
+  // xorshift32: cheap, and the same seed gives the same run everywhere
+  this->rng_state_ ^= this->rng_state_ << 13;
+  this->rng_state_ ^= this->rng_state_ >> 17;
+  this->rng_state_ ^= this->rng_state_ << 5;
+  const float unit = (this->rng_state_ >> 8) / 16777216.0f;
+  return rf_time_us + static_cast<uint32_t>(rf_time_us * this->rf_jitter_ * unit);
+}
+
+uint8_t PN7160Sim::read_nfcc(pn7160::NciFrame &rx, const uint16_t timeout) {
+  if (this->wait_for_irq_(timeout, true) != nfc::STATUS_OK) {
+    ESP_LOGW(TAG, "read_nfcc() timed out waiting for IRQ");
+    return nfc::STATUS_FAILED;
+  }
+
+  rx = this->rx_queue_.front().frame;
+  this->rx_queue_.pop_front();
+  if (rx.message_type_is(nfc::NCI_PKT_MT_CTRL_NOTIFICATION) && rx.gid_is(nfc::RF_GID) &&
+      rx.oid_is(nfc::RF_INTF_ACTIVATED_OID)) {
+    this->last_activation_us_ = this->clock_us_;
+    this->host_credits_ = rx.get_message_byte(nfc::RF_INTF_ACTIVATED_NTF_INIT_CRED);
+  } else if (rx.message_type_is(nfc::NCI_PKT_MT_CTRL_NOTIFICATION) && rx.gid_is(nfc::NCI_CORE_GID) &&
+             rx.oid_is(nfc::NCI_CORE_CONN_CREDITS_OID)) {
+    this->host_credits_ += rx.get_message_byte(nfc::NCI_PKT_PAYLOAD_OFFSET + 2);
+  }
+  this->clock_us_ += this->bus_time_us_(rx.size());
+  this->frames_read_++;
+  return nfc::STATUS_OK;
+}
+
+uint8_t PN7160Sim::write_nfcc(pn7160::NciFrame &tx) {
+#ifdef USE_HOST
+  SimHeapPause pause;  // queuing the NFCC's answers
+#endif
+  const uint64_t written_us = this->clock_us_;
+  this->clock_us_ += this->bus_time_us_(tx.size());
+  this->frames_written_++;
+
+  if (this->replaying_) {
+    this->replay_write_(tx, written_us);
+    return nfc::STATUS_OK;
+  }
+
+  if (tx.message_type_is(nfc::NCI_PKT_MT_DATA)) {
+    if (!this->host_credits_) {
+      // a real NFCC has nowhere to put it; handled anyway so the run carries on
+      ESP_LOGW(TAG, "Data packet sent with no credit");
+      this->credit_violations_++;
+    } else {
+      this->host_credits_--;
+    }
+    this->handle_data_(tx);
+  } else if (tx.message_type_is(nfc::NCI_PKT_MT_CTRL_COMMAND)) {
+    this->handle_command_(tx);
+  } else {
+    char buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
+    ESP_LOGW(TAG, "Host sent a frame an NFCC never receives: %s", pn7160::format_frame_to(buf, tx));
+  }
+  return nfc::STATUS_OK;
+}
+
+uint8_t PN7160Sim::wait_for_irq_(const uint16_t timeout, const bool pin_state) {
+#ifdef USE_HOST
+  SimHeapPause pause;  // discovery notifications queued while the driver waits
+#endif
+  if (!pin_state) {
+    return nfc::STATUS_OK;  // the virtual line drops as soon as the frame is read out
+  }
+
+  const uint64_t deadline = this->clock_us_ + timeout * 1000ULL;
+  this->update_discovery_();
+  if (this->rx_queue_.empty() && this->rf_state_ == SimRfState::DISCOVERY) {
+    // skip ahead to the next poll if it lands inside the timeout
+    const uint64_t next_poll = this->discovery_started_us_ + this->poll_period_ * 1000ULL;
+    if (next_poll <= deadline) {
+      this->clock_us_ = std::max(this->clock_us_, next_poll);
+      this->update_discovery_();
+    }
+  }
+
+  if (!this->rx_queue_.empty() && this->rx_queue_.front().ready_us <= deadline) {
+    this->clock_us_ = std::max(this->clock_us_, this->rx_queue_.front().ready_us);
+#ifdef USE_PN7160_TRACE
+    this->trace_.record(pn7160::NciTrace::TRACE_IRQ, this->micros_(), nullptr, 0);
+#endif
+    return nfc::STATUS_OK;
+  }
+
+  this->clock_us_ = deadline;
+#ifdef USE_PN7160_STATS
+  this->stats_.record_irq_timeout();
+#endif
+  return nfc::STATUS_FAILED;
+}
+
+bool PN7160Sim::irq_asserted_() {
+#ifdef USE_HOST
+  SimHeapPause pause;
+#endif
+  this->update_discovery_();
+  return !this->rx_queue_.empty() && this->rx_queue_.front().ready_us <= this->clock_us_;
+}
+
+void PN7160Sim::queue_frame_(const pn7160::NciFrame &frame, const uint32_t latency_us) {
+  uint64_t ready_us = this->clock_us_;
+  if (!this->rx_queue_.empty()) {
+    ready_us = std::max(ready_us, this->rx_queue_.back().ready_us);
+  }
+  this->rx_queue_.push_back(PendingFrame{ready_us + latency_us, frame});
+}
+
+void PN7160Sim::queue_control_(const uint8_t message_type, const uint8_t gid, const uint8_t oid,
+                               std::initializer_list<uint8_t> payload, const uint32_t latency_us) {
+  this->queue_frame_(pn7160::NciFrame(message_type, gid, oid, payload), latency_us);
+}
+
+void PN7160Sim::queue_data_message_(const uint8_t *payload, const size_t length, const uint32_t latency_us) {
+  size_t offset = 0;
+  uint32_t latency = latency_us;
+  do {
+    const size_t segment = std::min<size_t>(length - offset, pn7160::NCI_MAX_PAYLOAD_SIZE);
+    pn7160::NciFrame frame;
+    frame.set_message(nfc::NCI_PKT_MT_DATA, pn7160::NCI_STATIC_RF_CONN_ID, 0, payload + offset, segment);
+    offset += segment;
+    frame.set_pbf(offset < length);
+    this->queue_frame_(frame, latency);
+    latency = 0;  // the rest follow as fast as the host reads them
+  } while (offset < length);
+}
+
+void PN7160Sim::handle_command_(const pn7160::NciFrame &tx) {
+  const uint8_t gid = tx.get_gid();
+  const uint8_t oid = tx.get_oid();
+  const uint8_t rsp = nfc::NCI_PKT_MT_CTRL_RESPONSE;
+  const uint8_t ntf = nfc::NCI_PKT_MT_CTRL_NOTIFICATION;
+
+  if (gid == nfc::NCI_CORE_GID && oid == nfc::NCI_CORE_RESET_OID) {
+    this->rx_queue_.clear();
+    this->rf_state_ = SimRfState::IDLE;
+    this->queue_control_(rsp, gid, oid, {nfc::STATUS_OK}, NFCC_TURNAROUND_US);
+    // reset trigger, configuration status, NCI version, manufacturer ID and four bytes of manufacturer info
+    this->queue_control_(ntf, gid, oid, {0x02, tx.get_message_byte(nfc::NCI_PKT_PAYLOAD_OFFSET), 0x20, 0x04, 0x04,
+                                         0x50, 0x10, 0x05, 0x00},
+                         NFCC_RESET_US);
+    return;
+  }
+
+  if (gid == nfc::NCI_CORE_GID && oid == nfc::NCI_CORE_INIT_OID) {
+    // laid out the way init_core_() reads it: status, features, interfaces, limits, then manufacturer info with the
+    // hardware, ROM and firmware versions
+    this->queue_control_(rsp, gid, oid,
+                         {nfc::STATUS_OK, 0x1E, 0x03, 0x00, 0x00,                                       // features
+                          4, nfc::INTF_FRAME, nfc::INTF_ISODEP, nfc::INTF_NFCDEP, nfc::INTF_TAGCMD,  // interfaces
+                          0x01, 0x00, 0x02,                                                             // conns, routing
+                          pn7160::NCI_MAX_PAYLOAD_SIZE, 0x00, 0x04,  // max control payload, max large param
+                          0x04,                                      // manufacturer ID
+                          0x00, 0x12, 0x30, 0x12, 0x35},             // manufacturer info
+                         NFCC_TURNAROUND_US);
+    return;
+  }
+
+  if (gid == nfc::RF_GID) {
+    switch (oid) {
+      case nfc::RF_DISCOVER_OID:
+        if (this->rf_state_ != SimRfState::IDLE) {
+          this->queue_control_(rsp, gid, oid, {nfc::STATUS_REJECTED}, NFCC_TURNAROUND_US);
+          return;
+        }
+        this->queue_control_(rsp, gid, oid, {nfc::STATUS_OK}, NFCC_TURNAROUND_US);
+        this->rf_state_ = SimRfState::DISCOVERY;
+        this->discovery_started_us_ = this->clock_us_;
+        return;
+
+      case nfc::RF_DISCOVER_SELECT_OID: {
+        const size_t index = tx.get_message_byte(nfc::NCI_PKT_PAYLOAD_OFFSET) - 1;
+        if (this->rf_state_ != SimRfState::W4_HOST_SELECT || index >= this->tags_.size() ||
+            !this->tags_[index].present) {
+          this->queue_control_(rsp, gid, oid, {nfc::STATUS_REJECTED}, NFCC_TURNAROUND_US);
+          return;
+        }
+        this->queue_control_(rsp, gid, oid, {nfc::STATUS_OK}, NFCC_TURNAROUND_US);
+        this->activate_tag_(index);
+        return;
+      }
+
+      case nfc::RF_DEACTIVATE_OID:
+        this->handle_deactivate_(tx.get_message_byte(nfc::NCI_PKT_PAYLOAD_OFFSET));
+        return;
+
+      case pn7160::RF_ISO_DEP_NAK_PRESENCE_OID: {
+        if (this->rf_state_ != SimRfState::POLL_ACTIVE || this->tags_[this->active_tag_].type != SIM_TAG_T4T) {
+          this->queue_control_(rsp, gid, oid, {nfc::STATUS_REJECTED}, NFCC_TURNAROUND_US);
+          return;
+        }
+        this->queue_control_(rsp, gid, oid, {nfc::STATUS_OK}, NFCC_TURNAROUND_US);
+        // a card that is gone leaves the NFCC waiting out its RF timeout
+        const bool present = this->tags_[this->active_tag_].present;
+        this->queue_control_(ntf, gid, oid, {present ? nfc::STATUS_OK : nfc::STATUS_FAILED},
+                             present ? this->jitter_(RF_ISODEP_NAK_US) : RF_ACTIVATION_US);
+        return;
+      }
+
+      default:
+        break;
+    }
+  }
+
+  // everything else (configuration, discover map, listen mode routing, proprietary) is simply accepted
+  if (oid == nfc::NCI_CORE_SET_CONFIG_OID && gid == nfc::NCI_CORE_GID) {
+    this->queue_control_(rsp, gid, oid, {nfc::STATUS_OK, 0x00}, NFCC_TURNAROUND_US);  // no invalid parameters
+  } else {
+    this->queue_control_(rsp, gid, oid, {nfc::STATUS_OK}, NFCC_TURNAROUND_US);
+  }
+}
+
+void PN7160Sim::handle_deactivate_(const uint8_t type) {
+  const uint8_t rsp = nfc::NCI_PKT_MT_CTRL_RESPONSE;
+  const uint8_t ntf = nfc::NCI_PKT_MT_CTRL_NOTIFICATION;
+
+  switch (this->rf_state_) {
+    case SimRfState::IDLE:
+      this->queue_control_(rsp, nfc::RF_GID, nfc::RF_DEACTIVATE_OID, {nfc::STATUS_REJECTED}, NFCC_TURNAROUND_US);
+      return;
+
+    case SimRfState::DISCOVERY:
+      // nothing is active, so there is no notification to follow
+      this->queue_control_(rsp, nfc::RF_GID, nfc::RF_DEACTIVATE_OID, {nfc::STATUS_OK}, NFCC_TURNAROUND_US);
+      if (type == nfc::DEACTIVATION_TYPE_IDLE) {
+        this->rf_state_ = SimRfState::IDLE;
+      }
+      return;
+
+    default:
+      break;
+  }
+
+  // drop anything still queued for the endpoint being torn down
+  this->rx_queue_.clear();
+  this->queue_control_(rsp, nfc::RF_GID, nfc::RF_DEACTIVATE_OID, {nfc::STATUS_OK}, NFCC_TURNAROUND_US);
+  this->queue_control_(ntf, nfc::RF_GID, nfc::RF_DEACTIVATE_OID, {type, 0x00}, NFCC_NOTIFICATION_US);  // DH request
+
+  switch (type) {
+    case nfc::DEACTIVATION_TYPE_IDLE:
+      this->rf_state_ = SimRfState::IDLE;
+      break;
+
+    case nfc::DEACTIVATION_TYPE_SLEEP:
+    case nfc::DEACTIVATION_TYPE_SLEEP_AF:
+      this->rf_state_ = SimRfState::W4_HOST_SELECT;
+      break;
+
+    default:
+      this->rf_state_ = SimRfState::DISCOVERY;
+      this->discovery_started_us_ = this->clock_us_;
+      break;
+  }
+}
+
+void PN7160Sim::update_discovery_() {
+  if (this->rf_state_ != SimRfState::DISCOVERY ||
+      this->clock_us_ < this->discovery_started_us_ + this->poll_period_ * 1000ULL) {
+    return;
+  }
+
+  size_t present = 0;
+  size_t last_present = 0;
+  for (size_t i = 0; i < this->tags_.size(); i++) {
+    if (this->tags_[i].present) {
+      present++;
+      last_present = i;
+    }
+  }
+  if (!present) {
+    this->discovery_started_us_ = this->clock_us_;  // start the next poll
+    return;
+  }
+
+  if (present == 1) {
+    this->activate_tag_(last_present);
+    return;
+  }
+
+  // more than one tag in the field: report them all and let the host choose
+  for (size_t i = 0; i < this->tags_.size(); i++) {
+    if (!this->tags_[i].present) {
+      continue;
+    }
+    pn7160::NciFrame ntf(nfc::NCI_PKT_MT_CTRL_NOTIFICATION, nfc::RF_GID, nfc::RF_DISCOVER_OID);
+    ntf.append(static_cast<uint8_t>(i + 1));
+    ntf.append(tag_protocol(this->tags_[i].type));
+    ntf.append(tag_technology(this->tags_[i].type));
+    this->append_tech_params_(ntf, i);
+    ntf.append(i == last_present ? nfc::RF_DISCOVER_NTF_NT_LAST : nfc::RF_DISCOVER_NTF_NT_MORE);
+    this->queue_frame_(ntf, RF_ACTIVATION_US);
+  }
+  this->rf_state_ = SimRfState::W4_HOST_SELECT;
+}
+
+void PN7160Sim::activate_tag_(const size_t index) {
+  const SimTag &tag = this->tags_[index];
+  const uint8_t protocol = tag_protocol(tag.type);
+  const bool is_mfc = protocol == nfc::PROT_MIFARE;
+  const bool is_t4t = protocol == nfc::PROT_ISODEP;
+  const uint8_t bit_rate = tag_bit_rate(tag.type);
+
+  pn7160::NciFrame ntf(nfc::NCI_PKT_MT_CTRL_NOTIFICATION, nfc::RF_GID, nfc::RF_INTF_ACTIVATED_OID);
+  ntf.append(static_cast<uint8_t>(index + 1));
+  ntf.append(is_mfc ? nfc::INTF_TAGCMD : (is_t4t ? nfc::INTF_ISODEP : nfc::INTF_FRAME));
+  ntf.append(protocol);
+  ntf.append(tag_technology(tag.type));
+  ntf.append(pn7160::NCI_MAX_PAYLOAD_SIZE);  // max data packet payload
+  ntf.append(0x01);                          // initial credits
+  this->append_tech_params_(ntf, index);
+  ntf.append(tag_technology(tag.type));  // data exchange mode & technology
+  ntf.append(bit_rate);                  // transmit bit rate
+  ntf.append(bit_rate);                  // receive bit rate
+  if (is_t4t) {
+    static const uint8_t ATS[] = {0x05, 0x78, 0x80, 0x70, 0x02};  // FSC 256, TA/TB/TC present
+    ntf.append(sizeof(ATS) + 1);
+    ntf.append(sizeof(ATS));
+    ntf.append(ATS, sizeof(ATS));
+  } else {
+    ntf.append(0x00);  // no activation parameters
+  }
+
+  this->queue_frame_(ntf, this->jitter_(is_t4t ? RF_ACTIVATION_US + RF_ISODEP_ACTIVATION_US : RF_ACTIVATION_US));
+  this->rf_state_ = SimRfState::POLL_ACTIVE;
+  this->active_tag_ = index;
+  this->mfc_authenticated_sector_ = -1;
+  this->mfc_pending_write_block_ = -1;
+  this->t4t_selected_file_ = 0;
+  this->host_message_.clear();
+  this->activations_++;
+}
+
+void PN7160Sim::append_tech_params_(pn7160::NciFrame &frame, const size_t index) {
+  const SimTag &tag = this->tags_[index];
+  if (tag.type == SIM_TAG_T3T) {
+    frame.append(static_cast<uint8_t>(2 + tag.uid.size() + sizeof(T3T_PMM)));  // technology parameters length
+    frame.append(0x01);                                                       // bit rate: 212 kbit/s
+    frame.append(static_cast<uint8_t>(tag.uid.size() + sizeof(T3T_PMM)));    // SENSF_RES: IDm and PMm
+    frame.append(tag.uid.data(), tag.uid.size());
+    frame.append(T3T_PMM, sizeof(T3T_PMM));
+    return;
+  }
+  if (tag.type == SIM_TAG_T5T) {
+    frame.append(static_cast<uint8_t>(2 + tag.uid.size()));  // technology parameters length
+    frame.append(0x00);                                      // RES_FLAG
+    frame.append(0x00);                                      // DSFID
+    for (auto it = tag.uid.rbegin(); it != tag.uid.rend(); ++it) {
+      frame.append(*it);  // least significant byte first
+    }
+    return;
+  }
+  uint8_t sens_res[2] = {0x44, 0x00};  // NTAG/Ultralight
+  uint8_t sel_res = 0x00;
+  switch (tag.type) {
+    case SIM_TAG_MIFARE_CLASSIC_1K:
+      sens_res[0] = 0x04;
+      sel_res = 0x08;
+      break;
+    case SIM_TAG_MIFARE_CLASSIC_4K:
+      sens_res[0] = 0x02;
+      sel_res = 0x18;
+      break;
+    case SIM_TAG_T4T:
+      sens_res[0] = 0x44;
+      sens_res[1] = 0x03;
+      sel_res = 0x20;
+      break;
+    default:
+      break;
+  }
+  // UID size in bits 7-6 (single, double, triple), so a 7-byte Classic EV1 answers 0x44 as the real one does
+  sens_res[0] = (sens_res[0] & 0x3F) | (tag.uid.size() == 4 ? 0x00 : (tag.uid.size() == 7 ? 0x40 : 0x80));
+
+  frame.append(static_cast<uint8_t>(2 + 1 + tag.uid.size() + 1 + 1));  // technology parameters length
+  frame.append(sens_res, sizeof(sens_res));
+  frame.append(static_cast<uint8_t>(tag.uid.size()));
+  frame.append(tag.uid.data(), tag.uid.size());
+  frame.append(0x01);
+  frame.append(sel_res);
+}
+
+void PN7160Sim::handle_data_(const pn7160::NciFrame &tx) {
+  if (this->rf_state_ != SimRfState::POLL_ACTIVE) {
+    ESP_LOGW(TAG, "Data packet with no active endpoint");
+    return;
+  }
+
+  // the NFCC returns the credit as soon as the packet has gone out over RF
+  this->queue_control_(nfc::NCI_PKT_MT_CTRL_NOTIFICATION, nfc::NCI_CORE_GID, nfc::NCI_CORE_CONN_CREDITS_OID,
+                       {0x01, 0x00, 0x01}, NFCC_TURNAROUND_US);
+
+  // a segmented message only goes out over RF once its last segment is in
+  const uint8_t *command = tx.payload();
+  size_t length = tx.get_payload_size();
+  if (tx.get_pbf() || !this->host_message_.empty()) {
+    this->host_message_.insert(this->host_message_.end(), command, command + length);
+    if (tx.get_pbf()) {
+      return;
+    }
+    command = this->host_message_.data();
+    length = this->host_message_.size();
+  }
+
+  SimTag &tag = this->tags_[this->active_tag_];
+  pn7160::NciFrame response(nfc::NCI_PKT_MT_DATA, {});
+  uint32_t rf_time_us = 0;
+  if (tag.present) {
+    switch (tag.type) {
+      case SIM_TAG_MIFARE_CLASSIC_1K:
+      case SIM_TAG_MIFARE_CLASSIC_4K:
+        rf_time_us = this->handle_mifare_classic_(tag, command, length, response);
+        break;
+
+      case SIM_TAG_T3T:
+        rf_time_us = this->handle_t3t_(tag, command, length, response);
+        break;
+
+      case SIM_TAG_T4T:
+        rf_time_us = this->handle_t4t_(tag, command, length, this->t4t_response_);
+        break;
+
+      case SIM_TAG_T5T:
+        rf_time_us = this->handle_t5t_(tag, command, length, response);
+        break;
+
+      default:
+        rf_time_us = this->handle_t2t_(tag, command, length, response);
+        break;
+    }
+  }
+  this->host_message_.clear();
+
+  if (rf_time_us && tag.type == SIM_TAG_T4T) {
+    this->queue_data_message_(this->t4t_response_.data(), this->t4t_response_.size(), this->jitter_(rf_time_us));
+  } else if (rf_time_us) {
+    this->queue_frame_(response, this->jitter_(rf_time_us));
+  } else {
+    // tag gone or silent: the NFCC gives up after its RF timeout
+    this->queue_control_(nfc::NCI_PKT_MT_CTRL_NOTIFICATION, nfc::NCI_CORE_GID, nfc::NCI_CORE_INTERFACE_ERROR_OID,
+                         {nfc::RF_TIMEOUT_ERROR, 0x00}, RF_ACTIVATION_US);
+  }
+}
+
+}  // namespace pn7160_sim
+}  // namespace esphome
+
+#ifdef USE_HOST
+// replaces the global operator new for the whole program; the array and nothrow forms come back here
+void *operator new(size_t size) {
+  if (!esphome::pn7160_sim::heap_pauses) {
+    esphome::pn7160_sim::heap_allocations++;
+  }
+  void *ptr = malloc(size ? size : 1);
+  if (ptr == nullptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { free(ptr); }
+#endif
@@ -0,0 +1,261 @@
+#pragma once
+
+#include "esphome/core/component.h"
+#include "esphome/components/pn7160/pn7160.h"
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace esphome {
+namespace pn7160_sim {
+
+enum SimTagType : uint8_t {
+  SIM_TAG_MIFARE_CLASSIC_1K = 0,
+  SIM_TAG_MIFARE_CLASSIC_4K,
+  SIM_TAG_MIFARE_ULTRALIGHT,
+  SIM_TAG_NTAG213,
+  SIM_TAG_NTAG215,
+  SIM_TAG_NTAG216,
+  SIM_TAG_T4T,
+  SIM_TAG_T3T,
+  SIM_TAG_T5T,
+};
+
+/// the `type` a tag is configured with, as benchmark and scenario reports name it
+const char *sim_tag_type_name(SimTagType type);
+
+#ifdef USE_HOST
+/// heap allocations made on this thread so far, outside a SimHeapPause; the simulator replaces the global operator
+/// new on the host platform to count them
+uint32_t sim_heap_allocations();
+
+/// leaves the simulated NFCC's own allocations out of sim_heap_allocations() while in scope, so what is counted is
+/// the driver's
+class SimHeapPause {
+ public:
+  SimHeapPause();
+  ~SimHeapPause();
+};
+#endif
+
+/// PMm of the virtual Type 3 tags: IC code, then maximum response times; MRTI_check 0x0A allows a Check of n blocks
+/// 302 us * (2n + 3)
+static const uint8_t T3T_PMM[] = {0x01, 0x20, 0x22, 0x04, 0x27, 0x0A, 0x0A, 0x8B};
+
+enum SimBus : uint8_t {
+  SIM_BUS_I2C = 0,
+  SIM_BUS_SPI,
+};
+
+enum class SimRfState : uint8_t {
+  IDLE,
+  DISCOVERY,
+  W4_HOST_SELECT,
+  POLL_ACTIVE,
+};
+
+struct SimTag {
+  SimTagType type;
+  std::vector<uint8_t> uid;
+  std::vector<uint8_t> memory;  // block/page image; for T3T, the NDEF service from its attribute block on; for T4T,
+                                // the NDEF file (length prefix included)
+  bool present;
+  size_t ndef_length;  // bytes of NDEF message stored, for reports
+};
+
+/// notes when the driver dispatches a tag to its listeners; the benchmark registers it last so every on_tag trigger
+/// and listener ahead of it has run
+class SimBenchmarkListener : public nfc::NfcTagListener {
+ public:
+  void tag_on(nfc::NfcTag &tag) override;
+  void tag_off(nfc::NfcTag &tag) override { this->tag_off_seen = true; }
+
+  uint64_t *clock_us{nullptr};
+  uint64_t tag_on_us{0};
+  bool tag_on_seen{false};
+  bool tag_off_seen{false};
+  bool tag_had_ndef{false};
+};
+
+/// counts the tags the driver dispatches during a scenario and keeps the NDEF message of the last one read
+class SimScenarioListener : public nfc::NfcTagListener {
+ public:
+  void tag_on(nfc::NfcTag &tag) override;
+  void tag_off(nfc::NfcTag &tag) override { this->tag_offs++; }
+
+  uint32_t tag_ons{0};
+  uint32_t tag_offs{0};
+  std::vector<uint8_t> ndef;  // encoded, empty if the tag had no message
+};
+
+/// A virtual NFCC behind the read_nfcc()/write_nfcc() interface: answers the NCI commands the driver sends, runs
+/// discovery against a set of virtual tags and serves their memory images. Time is virtual too -- bus transfers, NFCC
+/// turnaround and RF exchanges advance a clock the driver reads through millis_(), so runs are repeatable and do not
+/// depend on the host.
+class PN7160Sim : public pn7160::PN7160 {
+ public:
+  void loop() override;
+  void dump_config() override;
+
+  void set_bus(SimBus bus) { this->bus_ = bus; }
+  void set_bus_frequency(uint32_t frequency) { this->bus_frequency_ = frequency; }
+  void set_loop_interval(uint32_t interval) { this->loop_interval_ = interval; }
+  void set_poll_period(uint32_t period) { this->poll_period_ = period; }
+  /// RF exchanges take up to this fraction longer than nominal, drawn from a seeded generator
+  void set_rf_jitter(float jitter) { this->rf_jitter_ = jitter; }
+  void set_seed(uint32_t seed) { this->rng_state_ = seed ? seed : 1; }
+
+  /// taps per tag and bus; a non-zero count runs the benchmark once, on the first loop()
+  void set_benchmark_taps(uint16_t taps) { this->benchmark_taps_ = taps; }
+  void add_benchmark_bus(SimBus bus, uint32_t frequency) { this->benchmark_buses_.push_back({bus, frequency}); }
+  /// runs the read, steady, write, clean and replay scenarios on every tag once, on the first loop()
+  void set_scenarios(bool scenarios) { this->scenarios_ = scenarios; }
+  /// ends the program once the scenarios have run, with a non-zero status if any failed (host platform only)
+  void set_scenarios_exit(bool exit) { this->scenarios_exit_ = exit; }
+
+  /// adds a tag holding a URI record (NDEF-formatted but empty, or factory-blank for MIFARE Classic, if `ndef_uri` is
+  /// empty); `ndef_fill` pads the URI until the message fills the tag. Returns its index
+  size_t add_tag(SimTagType type, const std::vector<uint8_t> &uid, const std::string &ndef_uri, bool present,
+                 bool ndef_fill = false);
+  void place_tag(size_t index);
+  void remove_tag(size_t index);
+  SimTag &get_tag(size_t index) { return this->tags_[index]; }
+  size_t tag_count() const { return this->tags_.size(); }
+
+  /// plays back a session recorded by the pn7160 NCI trace (raw records, as written by pn7160_trace_decode.py --raw)
+  /// instead of simulating an NFCC; virtual tags are ignored
+  void set_replay(const std::vector<uint8_t> &trace) {
+    this->replay_trace_ = trace;
+    this->replaying_ = true;
+  }
+
+  void advance_clock_us(uint32_t us) { this->clock_us_ += us; }
+  uint64_t get_clock_us() const { return this->clock_us_; }
+
+ protected:
+  uint8_t read_nfcc(pn7160::NciFrame &rx, uint16_t timeout) override;
+  uint8_t write_nfcc(pn7160::NciFrame &tx) override;
+  uint8_t wait_for_irq_(uint16_t timeout, bool pin_state) override;
+  bool irq_asserted_() override;
+  uint32_t millis_() override { return this->clock_us_ / 1000; }
+  uint32_t micros_() override { return this->clock_us_; }
+
+  /// virtual time that passes between two loop() calls
+  uint32_t loop_gap_us_() const;
+  /// bus time for a transaction of `length` bytes at the configured clock
+  uint32_t bus_time_us_(size_t length) const;
+  /// `rf_time_us` stretched by up to rf_jitter_
+  uint32_t jitter_(uint32_t rf_time_us);
+  /// queues a frame for the host, raising IRQ `latency_us` after the last one queued
+  void queue_frame_(const pn7160::NciFrame &frame, uint32_t latency_us);
+  void queue_control_(uint8_t message_type, uint8_t gid, uint8_t oid, std::initializer_list<uint8_t> payload,
+                      uint32_t latency_us);
+  /// queues a data message for the host, segmented with PBF if it is longer than the announced max payload
+  void queue_data_message_(const uint8_t *payload, size_t length, uint32_t latency_us);
+
+  void handle_command_(const pn7160::NciFrame &tx);
+  void handle_data_(const pn7160::NciFrame &tx);
+  void handle_deactivate_(uint8_t type);
+  /// raises discovery/activation notifications once a present tag has been in the field for a poll period
+  void update_discovery_();
+  void activate_tag_(size_t index);
+  /// NFC-A technology parameters (SENS_RES, NFCID1, SEL_RES), NFC-F ones (SENSF_RES) or NFC-V ones (RES_FLAG, DSFID,
+  /// UID) for the tag at `index`
+  void append_tech_params_(pn7160::NciFrame &frame, size_t index);
+
+  // tag memory images and command handlers (pn7160_sim_tags.cpp); handlers build the data message into `response`
+  // and return the RF exchange time, or 0 if the tag does not answer. R-APDUs can outgrow one packet, so the ISO-DEP
+  // handler builds into a vector
+  static void build_mifare_classic_image_(SimTag &tag, const std::vector<uint8_t> &ndef);
+  static void build_t2t_image_(SimTag &tag, const std::vector<uint8_t> &ndef);
+  static void build_t3t_image_(SimTag &tag, const std::vector<uint8_t> &ndef);
+  static void build_t4t_image_(SimTag &tag, const std::vector<uint8_t> &ndef);
+  static void build_t5t_image_(SimTag &tag, const std::vector<uint8_t> &ndef);
+  uint32_t handle_mifare_classic_(SimTag &tag, const uint8_t *command, size_t length, pn7160::NciFrame &response);
+  uint32_t handle_t2t_(SimTag &tag, const uint8_t *command, size_t length, pn7160::NciFrame &response);
+  uint32_t handle_t3t_(SimTag &tag, const uint8_t *command, size_t length, pn7160::NciFrame &response);
+  uint32_t handle_t4t_(SimTag &tag, const uint8_t *command, size_t length, std::vector<uint8_t> &response);
+  uint32_t handle_t5t_(SimTag &tag, const uint8_t *command, size_t length, pn7160::NciFrame &response);
+  /// NDEF bytes that fit on a tag of this type, TLV excluded
+  static size_t ndef_capacity_(SimTagType type);
+
+  // session replay (pn7160_sim_replay.cpp)
+  /// answers `tx`, written at `written_us`, with the frames recorded after it, at their recorded offsets
+  void replay_write_(const pn7160::NciFrame &tx, uint64_t written_us);
+
+  // tap-to-trigger benchmark (pn7160_sim_benchmark.cpp)
+  void run_benchmark_();
+  /// places the tag at `index` and runs the driver until it is dispatched; false if it never was
+  bool benchmark_tap_(size_t index, uint32_t &latency_us, bool &read_ok);
+  /// runs the driver, loop_gap_us_() of virtual time per iteration, until `done` or `timeout_ms` passes
+  bool run_until_(const bool &done, uint32_t timeout_ms);
+  /// one loop() of the driver after loop_gap_us_(), noting the longest one in longest_loop_us_
+  void step_();
+
+  // regression scenarios (pn7160_sim_scenarios.cpp)
+  void run_scenarios_();
+  /// places the tag at `index`, runs the driver until it has dealt with the tag and `hold_ms` longer, then removes it
+  /// and lets it age out; false if the driver never got to it. The driver's heap allocations while it dealt with the
+  /// tag are added to scenario_allocations_, the ones while the tag was held to `held_allocations`
+  bool scenario_tap_(size_t index, uint32_t hold_ms = 0, uint32_t *held_allocations = nullptr);
+  /// logs one scenario's outcome for scripts/pn7160_scenario_check.py; returns `passed`
+  bool report_scenario_(const char *scenario, size_t index, bool passed, uint32_t writes);
+  /// plays the session recorded up to `recorded_us` back through a second, replaying simulator
+  bool run_replay_scenario_(const std::vector<uint8_t> &trace, uint64_t recorded_us, uint32_t expected_tags);
+
+  struct PendingFrame {
+    uint64_t ready_us;
+    pn7160::NciFrame frame;
+  };
+  std::deque<PendingFrame> rx_queue_;
+  std::vector<SimTag> tags_;
+
+  SimBus bus_{SIM_BUS_I2C};
+  uint32_t bus_frequency_{400000};
+  uint32_t loop_interval_{16};
+  uint32_t poll_period_{50};
+  float rf_jitter_{0};
+  uint32_t rng_state_{1};
+
+  uint16_t benchmark_taps_{0};
+  std::vector<std::pair<SimBus, uint32_t>> benchmark_buses_;
+  SimBenchmarkListener benchmark_listener_;
+  uint64_t last_activation_us_{0};  // when the driver picked up the last RF_INTF_ACTIVATED_NTF
+
+  bool scenarios_{false};
+  bool scenarios_exit_{false};
+  SimScenarioListener scenario_listener_;
+  uint32_t scenario_writes_{0};       // on_finished_write calls
+  uint32_t scenario_allocations_{0};  // driver heap allocations in the taps so far; host platform only
+  uint64_t longest_loop_us_{0};
+
+  uint64_t clock_us_{0};
+  uint64_t discovery_started_us_{0};
+  SimRfState rf_state_{SimRfState::IDLE};
+  size_t active_tag_{0};
+
+  // per-activation tag state
+  int16_t mfc_authenticated_sector_{-1};
+  int16_t mfc_pending_write_block_{-1};
+  uint16_t t4t_selected_file_{0};
+  std::vector<uint8_t> host_message_;  // segments of a data message the host has not finished sending
+  std::vector<uint8_t> t4t_response_;
+
+  std::vector<uint8_t> replay_trace_;
+  size_t replay_cursor_{0};  // offset of the next record to match
+  bool replaying_{false};
+  uint32_t replay_divergences_{0};
+
+  // credits the host has been given on the static RF connection, counted as it reads them out
+  uint8_t host_credits_{0};
+  uint32_t credit_violations_{0};  // data packets sent without one
+
+  uint32_t frames_written_{0};
+  uint32_t frames_read_{0};
+  uint32_t activations_{0};
+};
+
+}  // namespace pn7160_sim
+}  // namespace esphome
@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <cinttypes>
+
+#include "pn7160_sim.h"
+#include "esphome/core/application.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace pn7160_sim {
+
+static const char *const TAG = "pn7160_sim.benchmark";
+
+static const uint32_t TAP_TIMEOUT_MS = 2000;  // virtual time a tap may take before it counts as a failure
+
+/// nearest-rank percentile of sorted `samples`
+static uint32_t percentile(const std::vector<uint32_t> &samples, const uint8_t pct) {
+  if (samples.empty()) {
+    return 0;
+  }
+  const size_t rank = (samples.size() * pct + 99) / 100;
+  return samples[std::max<size_t>(rank, 1) - 1];
+}
+
+void SimBenchmarkListener::tag_on(nfc::NfcTag &tag) {
+  this->tag_on_us = *this->clock_us;
+  this->tag_on_seen = true;
+  this->tag_had_ndef = tag.has_ndef_message();
+}
+
+bool PN7160Sim::run_until_(const bool &done, const uint32_t timeout_ms) {
+  const uint64_t deadline = this->clock_us_ + timeout_ms * 1000ULL;
+  while (!done && this->clock_us_ < deadline) {
+    this->step_();
+  }
+  return done;
+}
+
+void PN7160Sim::step_() {
+  this->clock_us_ += this->loop_gap_us_();
+  const uint64_t started_us = this->clock_us_;
+  PN7160::loop();
+  this->longest_loop_us_ = std::max(this->longest_loop_us_, this->clock_us_ - started_us);
+  App.feed_wdt();
+}
+
+bool PN7160Sim::benchmark_tap_(const size_t index, uint32_t &latency_us, bool &read_ok) {
+  this->benchmark_listener_.tag_on_seen = false;
+  this->benchmark_listener_.tag_off_seen = false;
+  this->benchmark_listener_.tag_had_ndef = false;
+
+  this->place_tag(index);
+  const bool dispatched = this->run_until_(this->benchmark_listener_.tag_on_seen, TAP_TIMEOUT_MS);
+  this->remove_tag(index);
+  if (!dispatched) {
+    return false;
+  }
+  latency_us = this->benchmark_listener_.tag_on_us - this->last_activation_us_;
+  read_ok = this->benchmark_listener_.tag_had_ndef == (this->tags_[index].ndef_length > 0);
+
+  // let the driver age the tag out so the next tap is a fresh one
+  return this->run_until_(this->benchmark_listener_.tag_off_seen, TAP_TIMEOUT_MS);
+}
+
+void PN7160Sim::run_benchmark_() {
+  // registered last, so the time it records is after every other trigger and listener has run
+  this->benchmark_listener_.clock_us = &this->clock_us_;
+  this->register_listener(&this->benchmark_listener_);
+
+  const SimBus saved_bus = this->bus_;
+  const uint32_t saved_frequency = this->bus_frequency_;
+  std::vector<bool> saved_present;
+  for (auto &tag : this->tags_) {
+    saved_present.push_back(tag.present);
+    tag.present = false;
+  }
+  if (this->benchmark_buses_.empty()) {
+    this->benchmark_buses_.push_back({this->bus_, this->bus_frequency_});
+  }
+
+  // bring the NFCC up and let anything already in the field age out
+  const bool never = false;
+  this->run_until_(never, this->poll_period_ + this->tag_ttl_ * 2);
+
+  ESP_LOGI(TAG, "Running %u taps per tag on %zu bus configuration(s)", this->benchmark_taps_,
+           this->benchmark_buses_.size());
+  std::vector<uint32_t> samples;
+  samples.reserve(this->benchmark_taps_);
+  for (const auto &bus : this->benchmark_buses_) {
+    this->bus_ = bus.first;
+    this->bus_frequency_ = bus.second;
+    for (size_t i = 0; i < this->tags_.size(); i++) {
+      samples.clear();
+      uint32_t failures = 0;
+      uint32_t read_failures = 0;
+      for (uint16_t tap = 0; tap < this->benchmark_taps_; tap++) {
+        uint32_t latency_us = 0;
+        bool read_ok = false;
+        if (!this->benchmark_tap_(i, latency_us, read_ok)) {
+          failures++;
+          // start the next tap from a clean NFCC rather than whatever state the failure left behind
+          this->run_until_(never, this->tag_ttl_ * 2);
+          continue;
+        }
+        samples.push_back(latency_us);
+        if (!read_ok) {
+          read_failures++;
+        }
+      }
+      std::sort(samples.begin(), samples.end());
+
+      // one JSON object per line, picked out of the log by scripts/pn7160_bench_report.py
+      ESP_LOGI(TAG,
+               "BENCH {\"bus\":\"%s\",\"frequency\":%" PRIu32 ",\"tag\":\"%s\",\"ndef_bytes\":%zu,\"taps\":%u,"
+               "\"failures\":%" PRIu32 ",\"read_failures\":%" PRIu32 ",\"p50_us\":%" PRIu32 ",\"p95_us\":%" PRIu32
+               ",\"p99_us\":%" PRIu32 ",\"min_us\":%" PRIu32 ",\"max_us\":%" PRIu32 "}",
+               this->bus_ == SIM_BUS_SPI ? "spi" : "i2c", this->bus_frequency_, sim_tag_type_name(this->tags_[i].type),
+               this->tags_[i].ndef_length, this->benchmark_taps_, failures, read_failures, percentile(samples, 50),
+               percentile(samples, 95), percentile(samples, 99), samples.empty() ? 0 : samples.front(),
+               samples.empty() ? 0 : samples.back());
+    }
+  }
+
+  this->bus_ = saved_bus;
+  this->bus_frequency_ = saved_frequency;
+  for (size_t i = 0; i < this->tags_.size(); i++) {
+    this->tags_[i].present = saved_present[i];
+  }
+  ESP_LOGI(TAG, "Benchmark complete");
+}
+
+}  // namespace pn7160_sim
+}  // namespace esphome
@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+
+#include "pn7160_sim.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace pn7160_sim {
+
+static const char *const TAG = "pn7160_sim.replay";
+
+// record layout of pn7160::NciTrace: direction, 32-bit timestamp, 16-bit length (both little-endian), frame
+static const uint8_t RECORD_HEADER_SIZE = 7;
+static const uint8_t RECORD_TX = 0x00;
+static const uint8_t RECORD_RX = 0x01;
+static const uint8_t RECORD_IRQ = 0x02;
+
+struct ReplayRecord {
+  uint8_t direction;
+  uint32_t timestamp_us;
+  const uint8_t *frame;
+  size_t length;
+  size_t next;  // offset of the record after this one
+};
+
+static bool parse_record(const std::vector<uint8_t> &trace, const size_t offset, ReplayRecord &record) {
+  if (offset + RECORD_HEADER_SIZE > trace.size()) {
+    return false;
+  }
+  const uint8_t *header = trace.data() + offset;
+  record.direction = header[0];
+  record.timestamp_us = header[1] | (header[2] << 8) | (header[3] << 16) | (static_cast<uint32_t>(header[4]) << 24);
+  record.length = header[5] | (header[6] << 8);
+  record.frame = header + RECORD_HEADER_SIZE;
+  record.next = offset + RECORD_HEADER_SIZE + record.length;
+  return record.next <= trace.size();
+}
+
+void PN7160Sim::replay_write_(const pn7160::NciFrame &tx, const uint64_t written_us) {
+  // find the recorded write this one corresponds to; a write skipped on the way means the driver took another path
+  ReplayRecord record{};
+  size_t offset = this->replay_cursor_;
+  uint32_t skipped_writes = 0;
+  bool found = false;
+  while (!found && parse_record(this->replay_trace_, offset, record)) {
+    if (record.direction == RECORD_TX) {
+      found = record.length == tx.size() && std::memcmp(record.frame, tx.data(), record.length) == 0;
+      skipped_writes += !found;
+    }
+    offset = record.next;
+  }
+  if (!found) {
+    char buf[nfc::FORMAT_BYTES_BUFFER_SIZE];
+    ESP_LOGW(TAG, "Host wrote %s, which the rest of the recording never does", pn7160::format_frame_to(buf, tx));
+    this->replay_divergences_++;
+    return;
+  }
+  if (skipped_writes) {
+    ESP_LOGW(TAG, "Skipped %" PRIu32 " recorded write(s) to resynchronize", skipped_writes);
+    this->replay_divergences_++;
+  }
+
+  // everything up to the next recorded write is the NFCC's answer, due at the same offset from the write as recorded;
+  // an IRQ record, when present, marks when the frame was ready more closely than the read that followed
+  const uint32_t written_at = record.timestamp_us;
+  optional<uint32_t> irq_at;
+  while (parse_record(this->replay_trace_, offset, record) && record.direction != RECORD_TX) {
+    if (record.direction == RECORD_IRQ) {
+      irq_at = record.timestamp_us;
+    } else if (record.direction == RECORD_RX && record.length >= nfc::NCI_PKT_HEADER_SIZE &&
+               record.length <= pn7160::NCI_MAX_FRAME_SIZE) {
+      pn7160::NciFrame frame;
+      std::memcpy(frame.data(), record.frame, record.length);
+      uint64_t ready_us = written_us + static_cast<uint32_t>(irq_at.value_or(record.timestamp_us) - written_at);
+      if (!this->rx_queue_.empty()) {
+        ready_us = std::max(ready_us, this->rx_queue_.back().ready_us);
+      }
+      this->rx_queue_.push_back(PendingFrame{ready_us, frame});
+      irq_at.reset();
+    }
+    offset = record.next;
+  }
+  this->replay_cursor_ = offset;
+
+  if (offset >= this->replay_trace_.size()) {
+    ESP_LOGI(TAG, "End of recording reached, %" PRIu32 " divergence(s)", this->replay_divergences_);
+  }
+}
+
+}  // namespace pn7160_sim
+}  // namespace esphome
@@ -0,0 +1,241 @@
+#include <cinttypes>
+#include <cstdlib>
+#include <memory>
+
+#include "pn7160_sim.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace pn7160_sim {
+
+static const char *const TAG = "pn7160_sim.scenarios";
+
+static const uint32_t TAP_TIMEOUT_MS = 5000;  // virtual time the driver may take over one operation
+static const char *const WRITE_URI = "https://example.com/scenario";
+static const size_t LONG_URI_LENGTH = 300;  // a message past 255 bytes, for the three-byte TLV length form
+static const uint32_t STEADY_HOLD_MS = 2000;  // time a read tag stays in the field in the steady scenario
+
+/// the driver writes, formats and cleans these; Type 3 and 4 tags are only read
+static bool tag_writable(const SimTagType type) { return type != SIM_TAG_T3T && type != SIM_TAG_T4T; }
+
+/// 32-bit FNV-1a
+static uint32_t memory_hash(const std::vector<uint8_t> &memory) {
+  uint32_t hash = 2166136261UL;
+  for (const auto byte : memory) {
+    hash = (hash ^ byte) * 16777619UL;
+  }
+  return hash;
+}
+
+void SimScenarioListener::tag_on(nfc::NfcTag &tag) {
+#ifdef USE_HOST
+  SimHeapPause pause;  // the copy below is the scenario's, not the driver's
+#endif
+  this->tag_ons++;
+  this->ndef.clear();
+  if (tag.has_ndef_message()) {
+    this->ndef = tag.get_ndef_message()->encode();
+  }
+}
+
+bool PN7160Sim::scenario_tap_(const size_t index, const uint32_t hold_ms, uint32_t *held_allocations) {
+  const uint64_t placed_us = this->clock_us_;
+  const uint64_t deadline = placed_us + TAP_TIMEOUT_MS * 1000ULL;
+  this->place_tag(index);
+#ifdef USE_HOST
+  uint32_t allocations = sim_heap_allocations();
+#endif
+  // the operation starts when the driver picks up the activation, and can finish within that same loop()
+  bool handled = false;
+  while (!handled && this->clock_us_ < deadline) {
+    this->step_();
+    handled = this->last_activation_us_ > placed_us && !this->tag_op_.active;
+  }
+#ifdef USE_HOST
+  this->scenario_allocations_ += sim_heap_allocations() - allocations;
+  allocations = sim_heap_allocations();
+#endif
+  if (handled && hold_ms) {
+    const bool never = false;
+    this->run_until_(never, hold_ms);
+#ifdef USE_HOST
+    *held_allocations = sim_heap_allocations() - allocations;
+#endif
+  }
+  this->remove_tag(index);
+
+  // let the driver age the tag out so the next tap is a fresh one
+  const bool never = false;
+  this->run_until_(never, this->poll_period_ + this->tag_ttl_ * 2);
+  return handled;
+}
+
+bool PN7160Sim::report_scenario_(const char *scenario, const size_t index, const bool passed, const uint32_t writes) {
+  // one JSON object per line, picked out of the log by scripts/pn7160_scenario_check.py
+  ESP_LOGI(TAG,
+           "SCENARIO {\"scenario\":\"%s\",\"tag\":\"%s\",\"index\":%zu,\"passed\":%s,\"tag_events\":%" PRIu32
+           ",\"removals\":%" PRIu32 ",\"writes\":%" PRIu32 ",\"ndef_bytes\":%zu,\"memory_fnv\":\"%08" PRIx32
+           "\",\"allocations\":%" PRIu32 ",\"longest_loop_us\":%" PRIu64 "}",
+           scenario, sim_tag_type_name(this->tags_[index].type), index, passed ? "true" : "false",
+           this->scenario_listener_.tag_ons, this->scenario_listener_.tag_offs, writes,
+           this->scenario_listener_.ndef.size(), memory_hash(this->tags_[index].memory), this->scenario_allocations_,
+           this->longest_loop_us_);
+  this->scenario_allocations_ = 0;
+  this->scenario_listener_.tag_ons = 0;
+  this->scenario_listener_.tag_offs = 0;
+  this->scenario_listener_.ndef.clear();
+  this->longest_loop_us_ = 0;
+  return passed;
+}
+
+bool PN7160Sim::run_replay_scenario_(const std::vector<uint8_t> &trace, const uint64_t recorded_us,
+                                     const uint32_t expected_tags) {
+  // a second simulator, set up like this one, plays the recording back to a fresh driver
+  auto replay = make_unique<PN7160Sim>();
+  SimScenarioListener listener;
+  replay->register_listener(&listener);
+  replay->set_bus(this->bus_);
+  replay->set_bus_frequency(this->bus_frequency_);
+  replay->set_loop_interval(this->loop_interval_);
+  replay->set_loop_budget(this->loop_budget_);
+  replay->set_tag_ttl(this->tag_ttl_);
+  replay->set_presence_check_interval(this->presence_check_interval_);
+  replay->set_replay(trace);
+  replay->setup();
+  const bool never = false;
+  replay->run_until_(never, recorded_us / 1000);
+  replay->request_high_frequency_loop_(false);  // the requester is shared with this driver
+
+  const bool passed = listener.tag_ons == expected_tags && replay->replay_divergences_ == 0 &&
+                      replay->replay_cursor_ == trace.size();
+  ESP_LOGI(TAG,
+           "SCENARIO {\"scenario\":\"replay\",\"tag\":\"session\",\"index\":0,\"passed\":%s,\"tag_events\":%" PRIu32
+           ",\"removals\":%" PRIu32 ",\"divergences\":%" PRIu32 ",\"trace_bytes\":%zu,\"played_bytes\":%zu"
+           ",\"longest_loop_us\":%" PRIu64 "}",
+           passed ? "true" : "false", listener.tag_ons, listener.tag_offs, replay->replay_divergences_, trace.size(),
+           replay->replay_cursor_, replay->longest_loop_us_);
+  return passed;
+}
+
+void PN7160Sim::run_scenarios_() {
+  this->register_listener(&this->scenario_listener_);
+  this->add_on_finished_write_callback([this]() { this->scenario_writes_++; });
+
+  std::vector<bool> saved_present;
+  for (auto &tag : this->tags_) {
+    saved_present.push_back(tag.present);
+    tag.present = false;
+  }
+
+  // bring the NFCC up and let anything already in the field age out
+  const bool never = false;
+  this->run_until_(never, this->poll_period_ + this->tag_ttl_ * 2);
+  this->longest_loop_us_ = 0;
+
+  ESP_LOGI(TAG, "Running scenarios on %zu tag(s)", this->tags_.size());
+  uint32_t scenarios = 0;
+  uint32_t failures = 0;
+  auto tally = [&scenarios, &failures](const bool passed) {
+    scenarios++;
+    failures += !passed;
+  };
+
+  // read: every tag as configured, and its memory left as it was
+  this->read_mode();
+  uint32_t tags_read = 0;
+  for (size_t i = 0; i < this->tags_.size(); i++) {
+    const uint32_t hash = memory_hash(this->tags_[i].memory);
+    const bool handled = this->scenario_tap_(i);
+    const auto &seen = this->scenario_listener_;
+    tags_read += seen.tag_ons;
+    tally(this->report_scenario_("read", i,
+                                 handled && seen.tag_ons == 1 && seen.tag_offs == 1 &&
+                                     seen.ndef.size() == this->tags_[i].ndef_length &&
+                                     memory_hash(this->tags_[i].memory) == hash,
+                                 0));
+  }
+#ifdef USE_PN7160_TRACE
+  // the session so far, from the NFCC reset on, is what the replay scenario plays back
+  std::vector<uint8_t> trace;
+  this->trace_.copy_to(trace);
+  const bool trace_complete = this->trace_.dropped() == 0;
+  const uint64_t recorded_us = this->clock_us_;
+#endif
+
+  // steady: a tag left in the field after it was read. Polling for it or checking its presence must not touch the heap
+  for (size_t i = 0; i < this->tags_.size(); i++) {
+    uint32_t held_allocations = 0;
+    const bool handled = this->scenario_tap_(i, STEADY_HOLD_MS, &held_allocations);
+    this->scenario_allocations_ = held_allocations;
+    const auto &seen = this->scenario_listener_;
+    tally(this->report_scenario_("steady", i,
+                                 handled && seen.tag_ons == 1 && seen.tag_offs == 1 && held_allocations == 0, 0));
+  }
+
+  // write, then write a message too long for the one-byte TLV length; each is read back on a second tap. A message
+  // that doesn't fit must leave the one before it in place
+  std::vector<uint8_t> previous[2];
+  for (const bool long_message : {false, true}) {
+    std::string uri = WRITE_URI;
+    if (long_message) {
+      uri.append(LONG_URI_LENGTH - uri.size(), 'x');
+    }
+    std::shared_ptr<nfc::NdefMessage> message = make_unique<nfc::NdefMessage>();
+    message->add_uri_record(uri);
+    previous[long_message] = message->encode();
+    const auto &written = previous[long_message];
+
+    for (size_t i = 0; i < this->tags_.size(); i++) {
+      if (!tag_writable(this->tags_[i].type)) {
+        continue;
+      }
+      this->set_tag_write_message(message);
+      this->write_mode();
+      this->scenario_writes_ = 0;
+      bool handled = this->scenario_tap_(i);
+      this->read_mode();
+      handled = this->scenario_tap_(i) && handled;
+      const auto &seen = this->scenario_listener_;
+      const bool fits = written.size() <= ndef_capacity_(this->tags_[i].type);
+      tally(this->report_scenario_(long_message ? "write_long" : "write", i,
+                                   handled && this->scenario_writes_ == 1 && seen.tag_ons == 1 &&
+                                       seen.ndef == (fits ? written : previous[false]),
+                                   this->scenario_writes_));
+    }
+  }
+
+  // clean, then read back nothing
+  for (size_t i = 0; i < this->tags_.size(); i++) {
+    if (!tag_writable(this->tags_[i].type)) {
+      continue;
+    }
+    this->clean_mode();
+    bool handled = this->scenario_tap_(i);
+    this->read_mode();
+    handled = this->scenario_tap_(i) && handled;
+    const auto &seen = this->scenario_listener_;
+    tally(this->report_scenario_("clean", i, handled && seen.tag_ons == 1 && seen.ndef.empty(), 0));
+  }
+
+#ifdef USE_PN7160_TRACE
+  if (trace_complete) {
+    tally(this->run_replay_scenario_(trace, recorded_us, tags_read));
+  } else {
+    ESP_LOGW(TAG, "The NCI trace overflowed during the read scenario; raise its buffer_size to replay it");
+    tally(false);
+  }
+#endif
+
+  for (size_t i = 0; i < this->tags_.size(); i++) {
+    this->tags_[i].present = saved_present[i];
+  }
+  ESP_LOGI(TAG, "Scenarios complete: %" PRIu32 " of %" PRIu32 " passed", scenarios - failures, scenarios);
+#ifdef USE_HOST
+  if (this->scenarios_exit_) {
+    exit(failures ? EXIT_FAILURE : EXIT_SUCCESS);
+  }
+#endif
+}
+
+}  // namespace pn7160_sim
+}  // namespace esphome
@@ -0,0 +1,678 @@
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+#include "pn7160_sim.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace pn7160_sim {
+
+static const char *const TAG = "pn7160_sim.tags";
+
+// NFC-A at 106 kbit/s: ~85 us per byte on air (8 data bits plus parity), plus frame delay time and SOF/EOF per
+// exchange; writes add the tag's EEPROM programming time
+static const uint32_t RF_BYTE_US = 85;
+static const uint32_t RF_EXCHANGE_US = 250;
+static const uint32_t EEPROM_WRITE_US = 4000;
+
+static const uint8_t MFC_NAK = 0x04;
+static const uint8_t MFC_AUTH_FAILED = 0x03;
+
+static const uint8_t NTAG_CMD_GET_VERSION = 0x60;
+static const uint8_t NTAG_CMD_FAST_READ = 0x3A;
+static const uint8_t T2T_NAK = 0x00;
+
+// NFC-F at 212 kbit/s: ~38 us per byte, plus preamble, sync and CRC per frame; the card's own time comes from its PMm
+static const uint32_t RF_F_BYTE_US = 38;
+static const uint32_t RF_F_FRAME_US = 300;
+static const uint8_t T3T_CMD_CHECK = 0x06;
+static const uint8_t T3T_RSP_CHECK = 0x07;
+static const uint8_t T3T_BLOCK_SIZE = 16;
+static const uint8_t T3T_NBR = 12;          // blocks per Check
+static const uint8_t T3T_NBW = 8;           // blocks per Update
+static const uint16_t T3T_NDEF_BLOCKS = 63;  // after the attribute information block
+static const uint8_t T3T_STATUS_ERROR = 0xFF;
+static const uint8_t T3T_STATUS_BLOCK_COUNT = 0xA2;
+static const uint8_t T3T_STATUS_BLOCK_NUMBER = 0xA8;
+static const uint8_t T3T_STATUS_SERVICE = 0xA6;
+
+static const uint16_t T4T_FILE_NONE = 0x0000;
+static const uint16_t T4T_FILE_APP = 0x0001;  // NDEF application selected, no file yet
+static const uint16_t T4T_FILE_CC = 0xE103;
+static const uint16_t T4T_FILE_NDEF = 0xE104;
+static const uint16_t T4T_NDEF_FILE_SIZE = 2048;
+static const uint16_t T4T_MAX_LE = 0xFF;  // the 257-byte R-APDU to a full read goes back in two segments
+
+// NFC-V at 26 kbit/s: ~302 us per byte either way, plus SOF/EOF and the label's response delay per exchange. The
+// labels are ICODE SLIX2-like: 80 blocks of 4 bytes, block 0 the capability container
+static const uint32_t RF_V_BYTE_US = 302;
+static const uint32_t RF_V_EXCHANGE_US = 600;
+static const uint8_t T5T_FLAG_ADDRESS = 0x20;
+static const uint8_t T5T_FLAG_ERROR = 0x01;
+static const uint8_t T5T_CMD_READ_SINGLE_BLOCK = 0x20;
+static const uint8_t T5T_CMD_WRITE_SINGLE_BLOCK = 0x21;
+static const uint8_t T5T_CMD_READ_MULTIPLE_BLOCKS = 0x23;
+static const uint8_t T5T_CMD_GET_SYSTEM_INFO = 0x2B;
+static const uint8_t T5T_ERROR_NOT_SUPPORTED = 0x01;
+static const uint8_t T5T_ERROR_BLOCK = 0x10;  // block not available
+static const uint8_t T5T_BLOCK_SIZE = 4;
+static const uint16_t T5T_BLOCKS = 80;
+static const uint16_t T5T_DATA_AREA = (T5T_BLOCKS - 1) * T5T_BLOCK_SIZE / 8 * 8;  // what the CC can say of the rest
+static const uint8_t T5T_MAX_READ_BLOCKS = 32;  // per Read Multiple Blocks
+static const uint8_t T5T_IC_REFERENCE = 0x01;
+
+static uint32_t rf_time_us(size_t command_length, size_t response_length) {
+  return RF_EXCHANGE_US + (command_length + response_length) * RF_BYTE_US;
+}
+
+/// NDEF message wrapped in its TLV, with the terminator; an empty message gives an empty NDEF TLV
+static std::vector<uint8_t> ndef_tlv(const std::vector<uint8_t> &ndef) {
+  std::vector<uint8_t> tlv{0x03};
+  if (ndef.size() < 0xFF) {
+    tlv.push_back(ndef.size());
+  } else {
+    tlv.push_back(0xFF);
+    tlv.push_back(ndef.size() >> 8);
+    tlv.push_back(ndef.size() & 0xFF);
+  }
+  tlv.insert(tlv.end(), ndef.begin(), ndef.end());
+  tlv.push_back(0xFE);
+  return tlv;
+}
+
+static uint8_t mfc_sector_of(uint16_t block) {
+  const uint16_t first_high_block = nfc::MIFARE_CLASSIC_BLOCKS_PER_SECT_LOW * nfc::MIFARE_CLASSIC_16BLOCK_SECT_START;
+  if (block >= first_high_block) {
+    return (block - first_high_block) / nfc::MIFARE_CLASSIC_BLOCKS_PER_SECT_HIGH +
+           nfc::MIFARE_CLASSIC_16BLOCK_SECT_START;
+  }
+  return block / nfc::MIFARE_CLASSIC_BLOCKS_PER_SECT_LOW;
+}
+
+static uint16_t mfc_trailer_of(uint8_t sector) {
+  if (sector >= nfc::MIFARE_CLASSIC_16BLOCK_SECT_START) {
+    return nfc::MIFARE_CLASSIC_BLOCKS_PER_SECT_LOW * nfc::MIFARE_CLASSIC_16BLOCK_SECT_START +
+           (sector - nfc::MIFARE_CLASSIC_16BLOCK_SECT_START + 1) * nfc::MIFARE_CLASSIC_BLOCKS_PER_SECT_HIGH - 1;
+  }
+  return (sector + 1) * nfc::MIFARE_CLASSIC_BLOCKS_PER_SECT_LOW - 1;
+}
+
+size_t PN7160Sim::ndef_capacity_(const SimTagType type) {
+  size_t tlv_bytes;
+  switch (type) {
+    case SIM_TAG_MIFARE_CLASSIC_1K:
+      tlv_bytes = 15 * 3 * nfc::MIFARE_CLASSIC_BLOCK_SIZE;  // sectors 1-15, trailers excluded
+      break;
+    case SIM_TAG_MIFARE_CLASSIC_4K:
+      // sectors 1-31 but 16 (MAD2), then 32-39 of 16 blocks
+      tlv_bytes = (30 * 3 + 8 * 15) * nfc::MIFARE_CLASSIC_BLOCK_SIZE;
+      break;
+    case SIM_TAG_MIFARE_ULTRALIGHT:
+      tlv_bytes = 48;
+      break;
+    case SIM_TAG_NTAG213:
+      tlv_bytes = 144;
+      break;
+    case SIM_TAG_NTAG215:
+      tlv_bytes = 496;
+      break;
+    case SIM_TAG_NTAG216:
+      tlv_bytes = 872;
+      break;
+    case SIM_TAG_T3T:
+      return T3T_NDEF_BLOCKS * T3T_BLOCK_SIZE;  // the attribute block holds the length
+    case SIM_TAG_T5T:
+      tlv_bytes = T5T_DATA_AREA;
+      break;
+    default:
+      return T4T_NDEF_FILE_SIZE - 2;  // the file starts with the two-byte NLEN
+  }
+  // NDEF TLV: type, one or three length bytes, and the terminator TLV
+  return tlv_bytes - 3 < 0xFF ? tlv_bytes - 3 : tlv_bytes - 5;
+}
+
+void PN7160Sim::build_mifare_classic_image_(SimTag &tag, const std::vector<uint8_t> &ndef) {
+  static const uint8_t BLANK_ACCESS[] = {0xFF, 0x07, 0x80, 0x69};
+  static const uint8_t MAD_ACCESS[] = {0x78, 0x77, 0x88};
+  static const uint8_t MAD_GPB_V1 = 0xC1;
+  static const uint8_t MAD_GPB_V2 = 0xC2;  // 4K: a MAD2 in sector 16 covers sectors 17-39
+  static const uint8_t MAD2_SECTOR = 16;
+  static const uint8_t NDEF_ACCESS[] = {0x7F, 0x07, 0x88, 0x40};
+  static const uint8_t MAD_BLOCK_1[] = {0x14, 0x01, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1,
+                                        0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1};
+  static const uint8_t MAD_BLOCK_2[] = {0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1,
+                                        0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1};
+  static const uint8_t MAD2_BLOCK_64[] = {0x9E, 0x00, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1,
+                                          0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1, 0x03, 0xE1};
+
+  const bool is_4k = tag.type == SIM_TAG_MIFARE_CLASSIC_4K;
+  const uint16_t blocks = is_4k ? 256 : 64;
+  const uint8_t sectors = mfc_sector_of(blocks - 1) + 1;
+  const bool formatted = !ndef.empty();
+  tag.memory.assign(blocks * nfc::MIFARE_CLASSIC_BLOCK_SIZE, 0x00);
+
+  // manufacturer block: a 4-byte UID with its BCC or, on an EV1, a 7-byte UID; then SAK and ATQA
+  uint8_t *block_0 = tag.memory.data();
+  size_t at = 7;
+  if (tag.uid.size() != 7) {
+    tag.uid.resize(4);
+    block_0[4] = tag.uid[0] ^ tag.uid[1] ^ tag.uid[2] ^ tag.uid[3];
+    at = 5;
+  }
+  std::memcpy(block_0, tag.uid.data(), tag.uid.size());
+  block_0[at] = is_4k ? 0x18 : 0x08;
+  block_0[at + 1] = is_4k ? 0x02 : 0x04;
+
+  for (uint8_t sector = 0; sector < sectors; sector++) {
+    uint8_t *trailer = tag.memory.data() + mfc_trailer_of(sector) * nfc::MIFARE_CLASSIC_BLOCK_SIZE;
+    if (!formatted) {
+      std::memcpy(trailer, nfc::DEFAULT_KEY, 6);
+      std::memcpy(trailer + 6, BLANK_ACCESS, 4);
+    } else if (sector == 0 || (is_4k && sector == MAD2_SECTOR)) {
+      std::memcpy(trailer, nfc::MAD_KEY, 6);
+      std::memcpy(trailer + 6, MAD_ACCESS, 3);
+      trailer[9] = is_4k ? MAD_GPB_V2 : MAD_GPB_V1;
+    } else {
+      std::memcpy(trailer, nfc::NDEF_KEY, 6);
+      std::memcpy(trailer + 6, NDEF_ACCESS, 4);
+    }
+    std::memcpy(trailer + 10, nfc::DEFAULT_KEY, 6);
+  }
+  if (!formatted) {
+    return;
+  }
+
+  std::memcpy(tag.memory.data() + 1 * nfc::MIFARE_CLASSIC_BLOCK_SIZE, MAD_BLOCK_1, sizeof(MAD_BLOCK_1));
+  std::memcpy(tag.memory.data() + 2 * nfc::MIFARE_CLASSIC_BLOCK_SIZE, MAD_BLOCK_2, sizeof(MAD_BLOCK_2));
+  const uint16_t mad2_block = MAD2_SECTOR * nfc::MIFARE_CLASSIC_BLOCKS_PER_SECT_LOW;
+  if (is_4k) {
+    std::memcpy(tag.memory.data() + mad2_block * nfc::MIFARE_CLASSIC_BLOCK_SIZE, MAD2_BLOCK_64, sizeof(MAD2_BLOCK_64));
+    for (uint16_t block = mad2_block + 1; block < mad2_block + 3; block++) {
+      std::memcpy(tag.memory.data() + block * nfc::MIFARE_CLASSIC_BLOCK_SIZE, MAD_BLOCK_2, sizeof(MAD_BLOCK_2));
+    }
+  }
+
+  // the TLV runs from block 4 through the data blocks, stepping over sector trailers and the MAD2 sector
+  const auto tlv = ndef_tlv(ndef);
+  size_t written = 0;
+  for (uint16_t block = 4; block < blocks && written < tlv.size(); block++) {
+    if (nfc::mifare_classic_is_trailer_block(block) || (is_4k && mfc_sector_of(block) == MAD2_SECTOR)) {
+      continue;
+    }
+    const size_t chunk = std::min<size_t>(nfc::MIFARE_CLASSIC_BLOCK_SIZE, tlv.size() - written);
+    std::memcpy(tag.memory.data() + block * nfc::MIFARE_CLASSIC_BLOCK_SIZE, tlv.data() + written, chunk);
+    written += chunk;
+  }
+  if (written < tlv.size()) {
+    ESP_LOGW(TAG, "NDEF message does not fit on the tag; truncated");
+  }
+}
+
+void PN7160Sim::build_t2t_image_(SimTag &tag, const std::vector<uint8_t> &ndef) {
+  uint16_t pages = 16;
+  uint8_t cc_size = 0x06;
+  switch (tag.type) {
+    case SIM_TAG_NTAG213:
+      pages = 45;
+      cc_size = 0x12;
+      break;
+    case SIM_TAG_NTAG215:
+      pages = 135;
+      cc_size = 0x3E;
+      break;
+    case SIM_TAG_NTAG216:
+      pages = 231;
+      cc_size = 0x6D;
+      break;
+    default:
+      break;
+  }
+  tag.memory.assign(pages * nfc::MIFARE_ULTRALIGHT_PAGE_SIZE, 0x00);
+
+  // pages 0-2: UID with its two check bytes, then the static lock bytes; page 3: capability container. The UID on
+  // air is whatever was configured, so a tag that answers with a 4-byte random ID can be tried too
+  std::vector<uint8_t> uid = tag.uid;
+  uid.resize(7);
+  const uint8_t header[] = {uid[0], uid[1], uid[2], static_cast<uint8_t>(0x88 ^ uid[0] ^ uid[1] ^ uid[2]),
+                            uid[3], uid[4], uid[5], uid[6],
+                            static_cast<uint8_t>(uid[3] ^ uid[4] ^ uid[5] ^ uid[6]), 0x48, 0x00, 0x00,
+                            0xE1, 0x10, cc_size, 0x00};
+  std::memcpy(tag.memory.data(), header, sizeof(header));
+
+  if (tag.type != SIM_TAG_MIFARE_ULTRALIGHT) {
+    // NTAG21x configuration pages follow the dynamic lock bytes: CFG0 (AUTH0 = 0xFF, no password), CFG1, PWD, PACK
+    uint8_t *config = tag.memory.data() + (pages - 4) * nfc::MIFARE_ULTRALIGHT_PAGE_SIZE;
+    config[3] = 0xFF;
+    std::memset(config + 8, 0xFF, 4);
+  }
+
+  const auto tlv = ndef_tlv(ndef);
+  const size_t user_bytes = cc_size * 8;
+  if (tlv.size() > user_bytes) {
+    ESP_LOGW(TAG, "NDEF message does not fit on the tag; truncated");
+  }
+  std::memcpy(tag.memory.data() + nfc::MIFARE_ULTRALIGHT_DATA_START_PAGE * nfc::MIFARE_ULTRALIGHT_PAGE_SIZE,
+              tlv.data(), std::min(tlv.size(), user_bytes));
+}
+
+void PN7160Sim::build_t3t_image_(SimTag &tag, const std::vector<uint8_t> &ndef) {
+  tag.memory.assign((1 + T3T_NDEF_BLOCKS) * T3T_BLOCK_SIZE, 0x00);
+  tag.uid.resize(8);
+  const size_t length = std::min<size_t>(ndef.size(), T3T_NDEF_BLOCKS * T3T_BLOCK_SIZE);
+  std::memcpy(tag.memory.data() + T3T_BLOCK_SIZE, ndef.data(), length);
+
+  // attribute information block: mapping 1.0, Nbr, Nbw, Nmaxb, WriteF off, read/write, Ln, then the checksum
+  const uint8_t attr[] = {0x10, T3T_NBR, T3T_NBW, T3T_NDEF_BLOCKS >> 8, T3T_NDEF_BLOCKS & 0xFF, 0x00, 0x00, 0x00,
+                          0x00, 0x00, 0x01, static_cast<uint8_t>(length >> 16), static_cast<uint8_t>(length >> 8),
+                          static_cast<uint8_t>(length & 0xFF)};
+  uint16_t sum = 0;
+  for (const uint8_t byte : attr) {
+    sum += byte;
+  }
+  std::memcpy(tag.memory.data(), attr, sizeof(attr));
+  tag.memory[14] = sum >> 8;
+  tag.memory[15] = sum & 0xFF;
+}
+
+void PN7160Sim::build_t4t_image_(SimTag &tag, const std::vector<uint8_t> &ndef) {
+  tag.memory.assign(T4T_NDEF_FILE_SIZE, 0x00);
+  const size_t length = std::min<size_t>(ndef.size(), T4T_NDEF_FILE_SIZE - 2);
+  tag.memory[0] = length >> 8;
+  tag.memory[1] = length & 0xFF;
+  std::memcpy(tag.memory.data() + 2, ndef.data(), length);
+}
+
+void PN7160Sim::build_t5t_image_(SimTag &tag, const std::vector<uint8_t> &ndef) {
+  tag.memory.assign(T5T_BLOCKS * T5T_BLOCK_SIZE, 0x00);
+  tag.uid.resize(8);
+  // capability container: NDEF magic, mapping 1.0 read/write, data area in 8-byte units, Read Multiple Blocks
+  const uint8_t cc[] = {0xE1, 0x40, T5T_DATA_AREA / 8, 0x01};
+  std::memcpy(tag.memory.data(), cc, sizeof(cc));
+  const auto tlv = ndef_tlv(ndef);
+  const size_t user_bytes = T5T_DATA_AREA;
+  if (tlv.size() > user_bytes) {
+    ESP_LOGW(TAG, "NDEF message does not fit on the tag; truncated");
+  }
+  std::memcpy(tag.memory.data() + sizeof(cc), tlv.data(), std::min(tlv.size(), user_bytes));
+}
+
+uint32_t PN7160Sim::handle_mifare_classic_(SimTag &tag, const uint8_t *command, const size_t length,
+                                           pn7160::NciFrame &response) {
+  const uint16_t blocks = tag.memory.size() / nfc::MIFARE_CLASSIC_BLOCK_SIZE;
+  if (length < 2) {
+    return 0;
+  }
+
+  if (command[0] == pn7160::MFC_AUTHENTICATE_OID) {
+    const uint8_t sector = command[1];
+    const uint8_t param = length > 2 ? command[2] : 0;
+    response.set_payload({pn7160::MFC_AUTHENTICATE_OID, MFC_AUTH_FAILED});
+    this->mfc_authenticated_sector_ = -1;
+    if (sector <= mfc_sector_of(blocks - 1) && (param & pn7160::MFC_AUTHENTICATE_PARAM_EMBED_KEY) && length >= 9) {
+      const uint8_t *trailer = tag.memory.data() + mfc_trailer_of(sector) * nfc::MIFARE_CLASSIC_BLOCK_SIZE;
+      const uint8_t *key = (param & pn7160::MFC_AUTHENTICATE_PARAM_KS_B) ? trailer + 10 : trailer;
+      if (std::memcmp(key, command + 3, 6) == 0) {
+        this->mfc_authenticated_sector_ = sector;
+        response.payload()[1] = nfc::STATUS_OK;
+      }
+    }
+    // three-pass authentication: request, nonce exchange, answer
+    return 3 * RF_EXCHANGE_US + 28 * RF_BYTE_US;
+  }
+
+  if (command[0] != pn7160::XCHG_DATA_OID) {
+    return 0;
+  }
+
+  // second half of a write: the block data
+  if (this->mfc_pending_write_block_ >= 0) {
+    const uint16_t block = this->mfc_pending_write_block_;
+    this->mfc_pending_write_block_ = -1;
+    if (length != 1 + nfc::MIFARE_CLASSIC_BLOCK_SIZE) {
+      response.set_payload({pn7160::XCHG_DATA_OID, MFC_NAK, nfc::STATUS_OK});
+      return rf_time_us(length - 1, 1);
+    }
+    std::memcpy(tag.memory.data() + block * nfc::MIFARE_CLASSIC_BLOCK_SIZE, command + 1,
+                nfc::MIFARE_CLASSIC_BLOCK_SIZE);
+    response.set_payload({pn7160::XCHG_DATA_OID, nfc::MIFARE_CMD_ACK, nfc::STATUS_OK});
+    return rf_time_us(length - 1 + 2, 1) + EEPROM_WRITE_US;
+  }
+
+  const uint8_t opcode = command[1];
+  const uint16_t block = length > 2 ? command[2] : 0;
+  const bool block_ok = block < blocks && mfc_sector_of(block) == this->mfc_authenticated_sector_;
+
+  switch (opcode) {
+    case nfc::MIFARE_CMD_READ: {
+      if (!block_ok) {
+        response.set_payload({pn7160::XCHG_DATA_OID, MFC_NAK, nfc::STATUS_OK});
+        return rf_time_us(4, 1);
+      }
+      response.set_payload({pn7160::XCHG_DATA_OID});
+      response.append(tag.memory.data() + block * nfc::MIFARE_CLASSIC_BLOCK_SIZE, nfc::MIFARE_CLASSIC_BLOCK_SIZE);
+      if (nfc::mifare_classic_is_trailer_block(block)) {
+        std::memset(response.payload() + 1, 0x00, 6);  // key A never reads back
+      }
+      response.append(nfc::STATUS_OK);
+      return rf_time_us(4, nfc::MIFARE_CLASSIC_BLOCK_SIZE + 2);
+    }
+
+    case nfc::MIFARE_CMD_WRITE:
+      if (!block_ok || block == 0) {
+        response.set_payload({pn7160::XCHG_DATA_OID, MFC_NAK, nfc::STATUS_OK});
+      } else {
+        this->mfc_pending_write_block_ = block;
+        response.set_payload({pn7160::XCHG_DATA_OID, nfc::MIFARE_CMD_ACK, nfc::STATUS_OK});
+      }
+      return rf_time_us(4, 1);
+
+    case nfc::MIFARE_CMD_HALT:
+      this->mfc_authenticated_sector_ = -1;
+      response.set_payload({pn7160::XCHG_DATA_OID, nfc::STATUS_OK});
+      return rf_time_us(4, 0);
+
+    default:
+      response.set_payload({pn7160::XCHG_DATA_OID, MFC_NAK, nfc::STATUS_OK});
+      return rf_time_us(length - 1, 1);
+  }
+}
+
+uint32_t PN7160Sim::handle_t2t_(SimTag &tag, const uint8_t *command, const size_t length,
+                                pn7160::NciFrame &response) {
+  const uint16_t pages = tag.memory.size() / nfc::MIFARE_ULTRALIGHT_PAGE_SIZE;
+  const bool is_ntag = tag.type != SIM_TAG_MIFARE_ULTRALIGHT;
+  if (length < 1) {
+    return 0;
+  }
+
+  switch (command[0]) {
+    case nfc::MIFARE_CMD_READ: {
+      if (length < 2 || command[1] >= pages) {
+        response.set_payload({T2T_NAK, nfc::STATUS_OK});
+        return rf_time_us(4, 1);
+      }
+      // four pages, rolling over to page 0 past the end of memory
+      response.set_payload({});
+      for (uint8_t i = 0; i < 4; i++) {
+        const uint16_t page = (command[1] + i) % pages;
+        response.append(tag.memory.data() + page * nfc::MIFARE_ULTRALIGHT_PAGE_SIZE, nfc::MIFARE_ULTRALIGHT_PAGE_SIZE);
+      }
+      response.append(nfc::STATUS_OK);
+      return rf_time_us(4, 18);
+    }
+
+    case nfc::MIFARE_CMD_WRITE_ULTRALIGHT: {
+      const uint8_t page = length > 1 ? command[1] : 0;
+      if (length < 6 || page < 2 || page >= pages) {
+        response.set_payload({T2T_NAK, nfc::STATUS_OK});
+        return rf_time_us(length, 1);
+      }
+      uint8_t *target = tag.memory.data() + page * nfc::MIFARE_ULTRALIGHT_PAGE_SIZE;
+      if (page <= 3) {
+        // lock bytes and the capability container are one-time programmable: bits can only be set
+        for (uint8_t i = 0; i < nfc::MIFARE_ULTRALIGHT_PAGE_SIZE; i++) {
+          if (page == 3 || i >= 2) {
+            target[i] |= command[2 + i];
+          }
+        }
+      } else {
+        std::memcpy(target, command + 2, nfc::MIFARE_ULTRALIGHT_PAGE_SIZE);
+      }
+      response.set_payload({nfc::MIFARE_CMD_ACK, nfc::STATUS_OK});
+      return rf_time_us(8, 1) + EEPROM_WRITE_US;
+    }
+
+    case NTAG_CMD_GET_VERSION: {
+      if (!is_ntag) {
+        return 0;  // MIFARE Ultralight (EV0) does not answer
+      }
+      const uint8_t storage_size = tag.type == SIM_TAG_NTAG213 ? 0x0F : (tag.type == SIM_TAG_NTAG215 ? 0x11 : 0x13);
+      response.set_payload({0x00, 0x04, 0x04, 0x02, 0x01, 0x00, storage_size, 0x03, nfc::STATUS_OK});
+      return rf_time_us(3, 10);
+    }
+
+    case NTAG_CMD_FAST_READ: {
+      if (!is_ntag) {
+        return 0;
+      }
+      const uint8_t start = length > 1 ? command[1] : 0;
+      const uint8_t end = length > 2 ? command[2] : 0;
+      const size_t bytes = (end - start + 1) * nfc::MIFARE_ULTRALIGHT_PAGE_SIZE;
+      if (length < 3 || end < start || end >= pages || bytes + 1 > pn7160::NCI_MAX_PAYLOAD_SIZE) {
+        response.set_payload({T2T_NAK, nfc::STATUS_OK});
+        return rf_time_us(5, 1);
+      }
+      response.set_payload(tag.memory.data() + start * nfc::MIFARE_ULTRALIGHT_PAGE_SIZE, bytes);
+      response.append(nfc::STATUS_OK);
+      return rf_time_us(5, bytes + 2);
+    }
+
+    default:
+      return 0;
+  }
+}
+
+uint32_t PN7160Sim::handle_t3t_(SimTag &tag, const uint8_t *command, const size_t length,
+                                pn7160::NciFrame &response) {
+  static const uint8_t ID_AT = 2;
+  static const uint8_t ID_LENGTH = 8;
+  const uint16_t blocks = tag.memory.size() / T3T_BLOCK_SIZE;
+  // LEN, command code and IDm; a card only answers to its own IDm
+  if (length < ID_AT + ID_LENGTH || command[0] != length ||
+      !std::equal(tag.uid.begin(), tag.uid.end(), command + ID_AT)) {
+    return 0;
+  }
+  if (command[1] != T3T_CMD_CHECK) {
+    return 0;  // the sim's cards are read only
+  }
+
+  response.set_payload({0x00, T3T_RSP_CHECK});
+  response.append(tag.uid.data(), tag.uid.size());
+  // one service, the NDEF one (read only or read/write), then the block list
+  size_t at = ID_AT + ID_LENGTH;
+  uint8_t status = 0x00;
+  const uint16_t service = length > at + 2 ? command[at + 1] | (command[at + 2] << 8) : 0;
+  if (length <= at + 3 || command[at] != 1 || (service != 0x000B && service != 0x0009)) {
+    status = T3T_STATUS_SERVICE;
+  }
+  const uint8_t count = status ? 0 : command[at + 3];
+  if (!status && (count == 0 || count > T3T_NBR)) {
+    status = T3T_STATUS_BLOCK_COUNT;
+  }
+  std::vector<uint8_t> data;
+  at += 4;
+  for (uint8_t i = 0; i < count && !status; i++) {
+    uint16_t block = 0xFFFF;
+    if (at + 1 < length && (command[at] & 0x80)) {
+      block = command[at + 1];
+      at += 2;
+    } else if (at + 2 < length) {
+      block = command[at + 1] | (command[at + 2] << 8);
+      at += 3;
+    }
+    if (block >= blocks) {
+      status = T3T_STATUS_BLOCK_NUMBER;
+    } else {
+      data.insert(data.end(), tag.memory.begin() + block * T3T_BLOCK_SIZE,
+                  tag.memory.begin() + (block + 1) * T3T_BLOCK_SIZE);
+    }
+  }
+
+  if (status) {
+    response.append(T3T_STATUS_ERROR);
+    response.append(status);
+  } else {
+    response.append(0x00);
+    response.append(0x00);
+    response.append(count);
+    response.append(data.data(), data.size());
+  }
+  response.payload()[0] = response.get_payload_size();
+  response.append(nfc::STATUS_OK);
+
+  // the card takes as long as its PMm allows: MRTI_check 0x0A is 302 us * (2n + 3)
+  const uint32_t card_us = 302 * (2 * count + 3);
+  return 2 * RF_F_FRAME_US + (length + response.get_payload_size()) * RF_F_BYTE_US + card_us;
+}
+
+uint32_t PN7160Sim::handle_t4t_(SimTag &tag, const uint8_t *command, const size_t length,
+                                std::vector<uint8_t> &response) {
+  static const uint8_t NDEF_APP_NAME[] = {0xD2, 0x76, 0x00, 0x00, 0x85, 0x01, 0x01};
+  static const uint8_t SW_OK[] = {0x90, 0x00};
+  static const uint8_t SW_NOT_FOUND[] = {0x6A, 0x82};
+  static const uint8_t SW_WRONG_OFFSET[] = {0x6B, 0x00};
+  static const uint8_t SW_WRONG_LENGTH[] = {0x67, 0x00};
+  static const uint8_t SW_UNSUPPORTED[] = {0x6D, 0x00};
+  const uint8_t cc_file[] = {0x00, 0x0F, 0x20, T4T_MAX_LE >> 8, T4T_MAX_LE & 0xFF, 0x00, 0xFF, 0x04, 0x06, 0xE1, 0x04,
+                             T4T_NDEF_FILE_SIZE >> 8, T4T_NDEF_FILE_SIZE & 0xFF, 0x00, 0x00};
+
+  response.clear();
+  const uint32_t command_time = RF_EXCHANGE_US + (length + 3) * RF_BYTE_US;  // PCB and CRC around the C-APDU
+  if (length < 4) {
+    response.insert(response.end(), std::begin(SW_WRONG_LENGTH), std::end(SW_WRONG_LENGTH));
+    return command_time + 5 * RF_BYTE_US;
+  }
+
+  const uint8_t ins = command[1];
+  const uint16_t p1p2 = (command[2] << 8) | command[3];
+
+  if (ins == 0xA4) {  // SELECT
+    const uint8_t lc = length > 4 ? command[4] : 0;
+    const uint8_t *data = command + 5;
+    if (length < 5u + lc) {
+      response.insert(response.end(), std::begin(SW_WRONG_LENGTH), std::end(SW_WRONG_LENGTH));
+    } else if (command[2] == 0x04 && lc == sizeof(NDEF_APP_NAME) &&
+               std::memcmp(data, NDEF_APP_NAME, sizeof(NDEF_APP_NAME)) == 0) {
+      this->t4t_selected_file_ = T4T_FILE_APP;
+      response.insert(response.end(), std::begin(SW_OK), std::end(SW_OK));
+    } else if (command[2] == 0x00 && lc == 2 && this->t4t_selected_file_ != T4T_FILE_NONE &&
+               (((data[0] << 8) | data[1]) == T4T_FILE_CC || ((data[0] << 8) | data[1]) == T4T_FILE_NDEF)) {
+      this->t4t_selected_file_ = (data[0] << 8) | data[1];
+      response.insert(response.end(), std::begin(SW_OK), std::end(SW_OK));
+    } else {
+      response.insert(response.end(), std::begin(SW_NOT_FOUND), std::end(SW_NOT_FOUND));
+    }
+    return command_time + 5 * RF_BYTE_US;
+  }
+
+  const uint8_t *file = nullptr;
+  size_t file_size = 0;
+  if (this->t4t_selected_file_ == T4T_FILE_CC) {
+    file = cc_file;
+    file_size = sizeof(cc_file);
+  } else if (this->t4t_selected_file_ == T4T_FILE_NDEF) {
+    file = tag.memory.data();
+    file_size = tag.memory.size();
+  }
+
+  if (ins == 0xB0) {  // READ BINARY
+    if (file == nullptr) {
+      response.insert(response.end(), std::begin(SW_NOT_FOUND), std::end(SW_NOT_FOUND));
+    } else if (p1p2 >= file_size) {
+      response.insert(response.end(), std::begin(SW_WRONG_OFFSET), std::end(SW_WRONG_OFFSET));
+    } else {
+      size_t le;
+      if (length == 7 && command[4] == 0x00) {
+        le = (command[5] << 8) | command[6];  // extended
+        le = le ? le : 65536;
+      } else {
+        le = length > 4 ? command[4] : 0;
+        le = le ? le : 256;
+      }
+      le = std::min<size_t>(le, T4T_MAX_LE);
+      le = std::min<size_t>(le, file_size - p1p2);
+      response.insert(response.end(), file + p1p2, file + p1p2 + le);
+      response.insert(response.end(), std::begin(SW_OK), std::end(SW_OK));
+    }
+    return command_time + (response.size() + 3) * RF_BYTE_US;
+  }
+
+  if (ins == 0xD6) {  // UPDATE BINARY
+    const uint8_t lc = length > 4 ? command[4] : 0;
+    if (this->t4t_selected_file_ != T4T_FILE_NDEF) {
+      response.insert(response.end(), std::begin(SW_NOT_FOUND), std::end(SW_NOT_FOUND));
+    } else if (length < 5u + lc || p1p2 + lc > file_size) {
+      response.insert(response.end(), std::begin(SW_WRONG_LENGTH), std::end(SW_WRONG_LENGTH));
+    } else {
+      std::memcpy(tag.memory.data() + p1p2, command + 5, lc);
+      response.insert(response.end(), std::begin(SW_OK), std::end(SW_OK));
+      return command_time + 5 * RF_BYTE_US + EEPROM_WRITE_US;
+    }
+    return command_time + 5 * RF_BYTE_US;
+  }
+
+  response.insert(response.end(), std::begin(SW_UNSUPPORTED), std::end(SW_UNSUPPORTED));
+  return command_time + 5 * RF_BYTE_US;
+}
+
+uint32_t PN7160Sim::handle_t5t_(SimTag &tag, const uint8_t *command, const size_t length,
+                                pn7160::NciFrame &response) {
+  const uint16_t blocks = tag.memory.size() / T5T_BLOCK_SIZE;
+  // flags, command code, then the UID if addressed: a label only answers to its own, least significant byte first
+  size_t at = 2;
+  if (length < at) {
+    return 0;
+  }
+  if (command[0] & T5T_FLAG_ADDRESS) {
+    if (length < at + tag.uid.size() || !std::equal(tag.uid.rbegin(), tag.uid.rend(), command + at)) {
+      return 0;
+    }
+    at += tag.uid.size();
+  }
+  const uint32_t command_time = RF_V_EXCHANGE_US + (length + 2) * RF_V_BYTE_US;  // CRC after the request
+
+  switch (command[1]) {
+    case T5T_CMD_GET_SYSTEM_INFO:
+      // DSFID, AFI, memory size and IC reference
+      response.set_payload({0x00, 0x0F});
+      for (auto it = tag.uid.rbegin(); it != tag.uid.rend(); ++it) {
+        response.append(*it);
+      }
+      response.append(0x00);
+      response.append(0x00);
+      response.append(blocks - 1);
+      response.append(T5T_BLOCK_SIZE - 1);
+      response.append(T5T_IC_REFERENCE);
+      break;
+
+    case T5T_CMD_READ_SINGLE_BLOCK:
+      if (length <= at || command[at] >= blocks) {
+        response.set_payload({T5T_FLAG_ERROR, T5T_ERROR_BLOCK});
+        break;
+      }
+      response.set_payload({0x00});
+      response.append(tag.memory.data() + command[at] * T5T_BLOCK_SIZE, T5T_BLOCK_SIZE);
+      break;
+
+    case T5T_CMD_READ_MULTIPLE_BLOCKS: {
+      const uint16_t count = length > at + 1 ? command[at + 1] + 1 : 0;
+      if (count == 0 || count > T5T_MAX_READ_BLOCKS || command[at] + count > blocks) {
+        response.set_payload({T5T_FLAG_ERROR, T5T_ERROR_BLOCK});
+        break;
+      }
+      response.set_payload({0x00});
+      response.append(tag.memory.data() + command[at] * T5T_BLOCK_SIZE, count * T5T_BLOCK_SIZE);
+      break;
+    }
+
+    case T5T_CMD_WRITE_SINGLE_BLOCK:
+      if (length < at + 1 + T5T_BLOCK_SIZE || command[at] >= blocks) {
+        response.set_payload({T5T_FLAG_ERROR, T5T_ERROR_BLOCK});
+        break;
+      }
+      std::memcpy(tag.memory.data() + command[at] * T5T_BLOCK_SIZE, command + at + 1, T5T_BLOCK_SIZE);
+      response.set_payload({0x00, nfc::STATUS_OK});
+      return command_time + 3 * RF_V_BYTE_US + EEPROM_WRITE_US;
+
+    default:
+      response.set_payload({T5T_FLAG_ERROR, T5T_ERROR_NOT_SUPPORTED});
+      break;
+  }
+  response.append(nfc::STATUS_OK);
+  // the response's flags and data, then its CRC
+  return command_time + (response.get_payload_size() - 1 + 2) * RF_V_BYTE_US;
+}
+
+}  // namespace pn7160_sim
+}  // namespace esphome
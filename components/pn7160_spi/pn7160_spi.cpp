@@ -12,21 +12,19 @@ void PN7160Spi::setup() {
   PN7160::setup();
 }
 
-uint8_t PN7160Spi::read_nfcc(nfc::NciMessage &rx, const uint16_t timeout) {
+uint8_t PN7160Spi::read_nfcc(pn7160::NciFrame &rx, const uint16_t timeout) {
   if (this->wait_for_irq_(timeout) != nfc::STATUS_OK) {
     ESP_LOGW(TAG, "read_nfcc_() timeout waiting for IRQ");
     return nfc::STATUS_FAILED;
   }
 
-  rx.get_message().resize(nfc::NCI_PKT_HEADER_SIZE);
   this->enable();
   this->write_byte(TDD_SPI_READ);  // send "transfer direction detector"
-  this->read_array(rx.get_message().data(), nfc::NCI_PKT_HEADER_SIZE);
+  this->read_array(rx.data(), nfc::NCI_PKT_HEADER_SIZE);
 
   uint8_t length = rx.get_payload_size();
   if (length > 0) {
-    rx.get_message().resize(length + nfc::NCI_PKT_HEADER_SIZE);
-    this->read_array(rx.get_message().data() + nfc::NCI_PKT_HEADER_SIZE, length);
+    this->read_array(rx.payload(), length);
   }
   this->disable();
   // semaphore to ensure transaction is complete before returning
@@ -37,10 +35,10 @@ uint8_t PN7160Spi::read_nfcc(nfc::NciMessage &rx, const uint16_t timeout) {
   return nfc::STATUS_OK;
 }
 
-uint8_t PN7160Spi::write_nfcc(nfc::NciMessage &tx) {
+uint8_t PN7160Spi::write_nfcc(pn7160::NciFrame &tx) {
   this->enable();
-  this->write_byte(TDD_SPI_WRITE);  // send "transfer direction detector"
-  this->write_array(tx.encode().data(), tx.encode().size());
+  // "transfer direction detector" goes out in the same transfer as the frame
+  this->write_array(tx.data_with_prefix(TDD_SPI_WRITE), tx.size() + 1);
   this->disable();
   return nfc::STATUS_OK;
 }
@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+"""Collect the BENCH lines pn7160_sim logs into a JSON report.
+
+Reads a log on stdin (or from the file given) and writes a JSON array with one
+object per bus/tag case. With --baseline, compares p95 latencies against an
+earlier report and exits non-zero if any case got slower than --tolerance.
+"""
+
+import argparse
+import json
+import re
+import sys
+
+BENCH_LINE = re.compile(r"BENCH (\{.*\})")
+
+
+def case_key(case):
+    return (case["bus"], case["frequency"], case["tag"], case["ndef_bytes"])
+
+
+def parse(lines):
+    cases = []
+    for line in lines:
+        if match := BENCH_LINE.search(line):
+            cases.append(json.loads(match.group(1)))
+    return cases
+
+
+def compare(cases, baseline, tolerance):
+    previous = {case_key(case): case for case in baseline}
+    regressions = 0
+    for case in cases:
+        old = previous.get(case_key(case))
+        if old is None or old["p95_us"] == 0:
+            continue
+        change = case["p95_us"] / old["p95_us"] - 1
+        if change > tolerance:
+            regressions += 1
+            print(
+                f"{case['bus']} {case['frequency']} Hz {case['tag']} ({case['ndef_bytes']} bytes): "
+                f"p95 {old['p95_us']} -> {case['p95_us']} us (+{change:.1%})",
+                file=sys.stderr,
+            )
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("log", nargs="?", type=argparse.FileType("r"), default=sys.stdin)
+    parser.add_argument("-o", "--output", type=argparse.FileType("w"), default=sys.stdout)
+    parser.add_argument("--baseline", type=argparse.FileType("r"), help="earlier report to compare against")
+    parser.add_argument("--tolerance", type=float, default=0.05, help="allowed p95 increase (default 0.05)")
+    args = parser.parse_args()
+
+    cases = parse(args.log)
+    if not cases:
+        print("no BENCH lines found", file=sys.stderr)
+        return 1
+    json.dump(cases, args.output, indent=2)
+    args.output.write("\n")
+
+    if args.baseline and compare(cases, json.load(args.baseline), args.tolerance):
+        return 1
+    for case in cases:
+        if case["failures"] or case["read_failures"]:
+            print(f"{case['tag']} on {case['bus']}: {case['failures']} failed taps, "
+                  f"{case['read_failures']} bad reads", file=sys.stderr)
+            return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
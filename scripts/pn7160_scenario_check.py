@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+"""Check the SCENARIO lines pn7160_sim logs against the expected outcomes.
+
+Reads a log on stdin (or from the file given). Every scenario must have
+passed its own checks. With --expected, each one must also match the
+recorded tag events, removals, writes, NDEF bytes and memory hash exactly,
+and its longest loop() may not exceed the recorded one by more than
+--tolerance. -o writes the outcomes as a new expected file.
+"""
+
+import argparse
+import json
+import re
+import sys
+
+SCENARIO_LINE = re.compile(r"SCENARIO (\{.*\})")
+COMPLETE_LINE = re.compile(r"Scenarios complete")
+TIMING_KEY = "longest_loop_us"
+
+
+def scenario_key(scenario):
+    return (scenario["scenario"], scenario["index"], scenario["tag"])
+
+
+def describe(scenario):
+    return f"{scenario['scenario']} on {scenario['tag']} (tag {scenario['index']})"
+
+
+def parse(lines):
+    scenarios = []
+    complete = False
+    for line in lines:
+        if match := SCENARIO_LINE.search(line):
+            scenarios.append(json.loads(match.group(1)))
+        elif COMPLETE_LINE.search(line):
+            complete = True
+            break
+    return scenarios, complete
+
+
+def compare(scenarios, expected, tolerance):
+    problems = 0
+    found = {scenario_key(scenario): scenario for scenario in scenarios}
+    for old in expected:
+        new = found.get(scenario_key(old))
+        if new is None:
+            print(f"{describe(old)}: missing", file=sys.stderr)
+            problems += 1
+            continue
+        for key, value in old.items():
+            if key == TIMING_KEY:
+                if new[key] > value * (1 + tolerance):
+                    print(f"{describe(old)}: longest loop {value} -> {new[key]} us", file=sys.stderr)
+                    problems += 1
+            elif new.get(key) != value:
+                print(f"{describe(old)}: {key} {value} -> {new.get(key)}", file=sys.stderr)
+                problems += 1
+    return problems
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("log", nargs="?", type=argparse.FileType("r"), default=sys.stdin)
+    parser.add_argument("-o", "--output", type=argparse.FileType("w"), help="write the outcomes here")
+    parser.add_argument("--expected", type=argparse.FileType("r"), help="outcomes to compare against")
+    parser.add_argument("--tolerance", type=float, default=0.10, help="allowed longest loop increase (default 0.10)")
+    args = parser.parse_args()
+
+    scenarios, complete = parse(args.log)
+    if not complete:
+        print("the scenarios did not run to completion", file=sys.stderr)
+        return 1
+    if args.output:
+        json.dump(scenarios, args.output, indent=2)
+        args.output.write("\n")
+
+    problems = 0
+    for scenario in scenarios:
+        if not scenario["passed"]:
+            print(f"{describe(scenario)}: failed", file=sys.stderr)
+            problems += 1
+    if args.expected:
+        problems += compare(scenarios, json.load(args.expected), args.tolerance)
+    print(f"{len(scenarios)} scenarios, {problems} problem(s)")
+    return 1 if problems else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
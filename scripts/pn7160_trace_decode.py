@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+"""Decode an NCI trace dumped by the pn7160 `pn7160.dump_trace` action.
+
+Reads a device log on stdin (or from the file given), picks out the last
+TRACE block and prints one line per frame: time, direction, message type,
+opcode and payload. With --raw, writes the binary records to a file instead;
+pn7160_sim's `replay` option plays such a file back against the driver.
+"""
+
+import argparse
+import re
+import sys
+
+TRACE_LINE = re.compile(r"TRACE ([0-9a-fA-F]+|END)\s*$")
+RECORD_HEADER_SIZE = 7
+
+MESSAGE_TYPES = {0: "DATA", 1: "CMD", 2: "RSP", 3: "NTF"}
+OPCODES = {
+    (0x0, 0x00): "CORE_RESET",
+    (0x0, 0x01): "CORE_INIT",
+    (0x0, 0x02): "CORE_SET_CONFIG",
+    (0x0, 0x03): "CORE_GET_CONFIG",
+    (0x0, 0x04): "CORE_CONN_CREATE",
+    (0x0, 0x05): "CORE_CONN_CLOSE",
+    (0x0, 0x06): "CORE_CONN_CREDITS",
+    (0x0, 0x07): "CORE_GENERIC_ERROR",
+    (0x0, 0x08): "CORE_INTERFACE_ERROR",
+    (0x1, 0x00): "RF_DISCOVER_MAP",
+    (0x1, 0x01): "RF_SET_LISTEN_MODE_ROUTING",
+    (0x1, 0x02): "RF_GET_LISTEN_MODE_ROUTING",
+    (0x1, 0x03): "RF_DISCOVER",
+    (0x1, 0x04): "RF_DISCOVER_SELECT",
+    (0x1, 0x05): "RF_INTF_ACTIVATED",
+    (0x1, 0x06): "RF_DEACTIVATE",
+    (0x1, 0x07): "RF_FIELD_INFO",
+    (0x1, 0x08): "RF_T3T_POLLING",
+    (0x1, 0x09): "RF_NFCEE_ACTION",
+    (0x1, 0x0A): "RF_NFCEE_DISCOVERY_REQ",
+    (0x1, 0x0B): "RF_PARAMETER_UPDATE",
+    (0x2, 0x00): "NFCEE_DISCOVER",
+    (0x2, 0x01): "NFCEE_MODE_SET",
+    (0xF, 0x02): "PROP_CORE_SET_POWER_MODE",
+    (0xF, 0x10): "PROP_XCHG_DATA",
+    (0xF, 0x32): "PROP_MF_SECTORSEL",
+    (0xF, 0x40): "PROP_MFC_AUTHENTICATE",
+}
+
+
+def extract(lines):
+    """Return the bytes of the last complete TRACE block in the log."""
+    blocks, current = [], None
+    for line in lines:
+        match = TRACE_LINE.search(line)
+        if not match:
+            continue
+        if match.group(1) == "END":
+            if current is not None:
+                blocks.append(current)
+            current = None
+        else:
+            current = (current or bytearray()) + bytes.fromhex(match.group(1))
+    return blocks[-1] if blocks else None
+
+
+def records(trace):
+    offset = 0
+    while offset + RECORD_HEADER_SIZE <= len(trace):
+        direction = trace[offset]
+        timestamp = int.from_bytes(trace[offset + 1 : offset + 5], "little")
+        length = int.from_bytes(trace[offset + 5 : offset + 7], "little")
+        frame = trace[offset + RECORD_HEADER_SIZE : offset + RECORD_HEADER_SIZE + length]
+        if len(frame) != length:
+            raise ValueError(f"record at offset {offset} is truncated")
+        yield direction, timestamp, bytes(frame)
+        offset += RECORD_HEADER_SIZE + length
+
+
+def describe(frame):
+    if len(frame) < 3:
+        return "(short frame) " + frame.hex(" ")
+    mt = frame[0] >> 5
+    segment = "+" if frame[0] & 0x10 else ""
+    payload = frame[3:].hex(" ")
+    if mt == 0:
+        return f"DATA conn {frame[0] & 0x0F}{segment} [{frame[2]}] {payload}"
+    gid, oid = frame[0] & 0x0F, frame[1] & 0x3F
+    name = OPCODES.get((gid, oid), f"GID {gid:X} OID {oid:02X}")
+    return f"{MESSAGE_TYPES.get(mt, f'MT{mt}')} {name}{segment} [{frame[2]}] {payload}"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("log", nargs="?", type=argparse.FileType("r"), default=sys.stdin)
+    parser.add_argument("--raw", type=argparse.FileType("wb"), help="write the binary records here instead")
+    args = parser.parse_args()
+
+    trace = extract(args.log)
+    if trace is None:
+        print("no complete TRACE block found", file=sys.stderr)
+        return 1
+    if args.raw:
+        args.raw.write(trace)
+        return 0
+
+    start = previous = None
+    for direction, timestamp, frame in records(trace):
+        if start is None:
+            start = previous = timestamp
+        # 32-bit microsecond counters wrap after about 71 minutes
+        elapsed = (timestamp - start) & 0xFFFFFFFF
+        delta = (timestamp - previous) & 0xFFFFFFFF
+        previous = timestamp
+        if direction == 2:
+            print(f"{elapsed / 1000:10.3f} ms (+{delta:6d} us) !! IRQ")
+            continue
+        arrow = "->" if direction == 0 else "<-"
+        print(f"{elapsed / 1000:10.3f} ms (+{delta:6d} us) {arrow} {describe(frame)}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())